@@ -0,0 +1,256 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp" // Main config file
+
+#ifdef USE_OPEN_THREADS
+#include <OpenThreads/Thread>
+#include <OpenThreads/ScopedLock>
+#elif USE_BOOST
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#endif
+
+#include "DecodePool.hpp"
+#include "EpiAtomic.hpp"
+
+using namespace epi::node;
+using namespace epi::util;
+
+namespace epi {
+namespace node {
+
+/**
+ * Worker thread of a DecodePool
+ */
+class DecodePoolWorker
+    #ifdef USE_OPEN_THREADS
+    : public OpenThreads::Thread
+    #endif
+{
+public:
+    /**
+     * The thread will start with creation of the object.
+     */
+    DecodePoolWorker(DecodePool *pool, unsigned lane):
+            mPool(pool), mLane(lane)
+    {
+        #ifdef USE_OPEN_THREADS
+        start();
+        #elif USE_BOOST
+        m_thread = boost::shared_ptr<boost::thread>(
+            new boost::thread(boost::bind(&DecodePoolWorker::run, this))
+        );
+        #endif
+    }
+
+    /**
+     * Wait for the thread
+     */
+    ~DecodePoolWorker() {
+        #ifdef USE_OPEN_THREADS
+        if (this->isRunning()) {
+            this->join();
+        }
+        #elif USE_BOOST
+        m_thread->join();
+        #endif
+    }
+
+    void run() {
+        #ifdef CWDEBUG
+        epi::debug::setThreadDebugMargin();
+        #endif
+        mPool->run(mLane);
+    }
+
+private:
+    DecodePool *mPool;
+    unsigned mLane;
+    #ifdef USE_BOOST
+    boost::shared_ptr<boost::thread> m_thread;
+    #endif
+};
+
+} // node
+} // epi
+
+DecodePool::DecodePool(int threads): mLanes(), mWorkers(), mNextLane(0)
+{
+    if (threads < 1) {
+        threads = 1;
+    }
+    for (int i = 0; i < STREAMS; i++) {
+        Stream *stream = new Stream();
+        stream->next = 0;
+        stream->delivered = 0;
+        mStreams[i] = stream;
+    }
+    for (int i = 0; i < threads; i++) {
+        Lane *lane = new Lane();
+        lane->stop = false;
+        mLanes.push_back(lane);
+    }
+    for (int i = 0; i < threads; i++) {
+        mWorkers.push_back(new DecodePoolWorker(this, i));
+    }
+}
+
+DecodePool::~DecodePool() {
+    Dout(dc::connect, "["<<this<<"]"<< "DecodePool::~DecodePool()");
+    for (unsigned i = 0; i < mLanes.size(); i++) {
+        Lane *lane = mLanes[i];
+        lane->mutex.lock();
+        lane->stop = true;
+        #ifdef USE_OPEN_THREADS
+        lane->condition.signal();
+        #elif USE_BOOST
+        lane->condition.notify_one();
+        #endif
+        lane->mutex.unlock();
+    }
+    for (unsigned i = 0; i < mWorkers.size(); i++) {
+        delete mWorkers[i];
+    }
+    for (unsigned i = 0; i < mLanes.size(); i++) {
+        delete mLanes[i];
+    }
+    for (int i = 0; i < STREAMS; i++) {
+        delete mStreams[i];
+    }
+}
+
+unsigned DecodePool::key(void *origin, ErlangMessage *msg) {
+    if (msg->instanceOf(ERL_MSG_REG_SEND)) {
+        return ((RegSendMessage *) msg)->getSenderPid()->hash();
+    }
+    // Drop the bits of the alignment
+    std::size_t address = (std::size_t) origin;
+    return (unsigned) (address >> 4) ^ (unsigned) (address >> 12);
+}
+
+void DecodePool::submit(EpiReceiver *receiver, void *origin,
+                        ErlangMessage *msg, long volatile *inFlight,
+                        LatencyHistogram *decodeTime)
+{
+    Job job;
+    job.receiver = receiver;
+    job.origin = origin;
+    job.msg = msg;
+    job.inFlight = inFlight;
+    job.decodeTime = decodeTime;
+    job.stream = mStreams[key(origin, msg) % STREAMS];
+    {
+        #ifdef USE_OPEN_THREADS
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(job.stream->mutex);
+        #elif USE_BOOST
+        boost::mutex::scoped_lock lock(job.stream->mutex);
+        #endif
+        job.sequence = job.stream->next++;
+    }
+
+    unsigned long turn = (unsigned long) atomicFetchAdd(&mNextLane, 1);
+    Lane *lane = mLanes[turn % mLanes.size()];
+    lane->mutex.lock();
+    lane->jobs.push_back(job);
+    if (lane->jobs.size() == 1) {
+        #ifdef USE_OPEN_THREADS
+        lane->condition.signal();
+        #elif USE_BOOST
+        lane->condition.notify_one();
+        #endif
+    }
+    lane->mutex.unlock();
+}
+
+void DecodePool::run(unsigned index) {
+    Dout(dc::connect, "["<<this<<"]"<< "DecodePool::run(" << index << "): Thread started");
+    Lane *lane = mLanes[index];
+    while (true) {
+        Job job;
+        {
+            #ifdef USE_OPEN_THREADS
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(lane->mutex);
+            #elif USE_BOOST
+            boost::mutex::scoped_lock lock(lane->mutex);
+            #endif
+            while (lane->jobs.empty() && !lane->stop) {
+                #ifdef USE_OPEN_THREADS
+                lane->condition.wait(&lane->mutex);
+                #elif USE_BOOST
+                lane->condition.wait(lock);
+                #endif
+            }
+            // Jobs submitted before the stop are still done
+            if (lane->jobs.empty()) {
+                break;
+            }
+            job = lane->jobs.front();
+            lane->jobs.pop_front();
+        }
+
+        // As in the constructor of the message, a decoding error is
+        // left to be found by the recipient
+        long long start = LatencyHistogram::now();
+        try {
+            job.msg->getMsg();
+        } catch (EpiDecodeException &) {
+        }
+        long long elapsed = LatencyHistogram::now() - start;
+        if (job.decodeTime) {
+            job.decodeTime->record(elapsed);
+        }
+        if (Trace::enabled(TRACE_CODEC)) {
+            TraceMessage(TRACE_DECODE, job.msg, elapsed, 0);
+        }
+        deliver(job);
+    }
+    Dout(dc::connect, "["<<this<<"]"<< "DecodePool::run(" << index << "): Thread exit");
+}
+
+void DecodePool::deliver(Job &job) {
+    Stream *stream = job.stream;
+    // Delivered under the lock of the stream, to keep the order
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(stream->mutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(stream->mutex);
+    #endif
+    if (job.sequence != stream->delivered) {
+        stream->decoded[job.sequence] = job;
+        return;
+    }
+    job.receiver->deliver(job.origin, job.msg);
+    atomicFetchAdd(job.inFlight, -1);
+    stream->delivered++;
+
+    std::map<unsigned long long, Job>::iterator next = stream->decoded.begin();
+    while (next != stream->decoded.end() && next->first == stream->delivered) {
+        next->second.receiver->deliver(next->second.origin, next->second.msg);
+        atomicFetchAdd(next->second.inFlight, -1);
+        stream->delivered++;
+        stream->decoded.erase(next++);
+    }
+}
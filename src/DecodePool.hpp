@@ -0,0 +1,176 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#ifndef __DECODEPOOL_HPP
+#define __DECODEPOOL_HPP
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#ifdef USE_OPEN_THREADS
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+#elif USE_BOOST
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+#endif
+
+#include "EpiMessage.hpp"
+#include "EpiReceiver.hpp"
+#include "LatencyHistogram.hpp"
+
+namespace epi {
+namespace node {
+
+class DecodePoolWorker;
+
+/**
+ * Pool of threads that decode the terms of incoming messages, so the
+ * thread reading a connection only has to split the messages.
+ *
+ * Each worker has its own queue (lane), and messages are given to the
+ * lanes in turn, so even the messages of a single sender are decoded in
+ * parallel. They are put back in order before they are delivered: the
+ * messages of a stream are delivered in the order they were submitted.
+ * The stream of a REG_SEND message is its sender pid, so the messages
+ * from a sender to a recipient keep their order, like in Erlang. A SEND
+ * message does not carry the pid of the sender, its stream is the
+ * origin of the message.
+ *
+ * The connections using the pool must be closed before it is
+ * destroyed.
+ */
+class DecodePool {
+    friend class DecodePoolWorker;
+public:
+    /**
+     * Create the pool and start the workers
+     * @param threads number of worker threads
+     */
+    DecodePool(int threads);
+
+    /**
+     * Decode the messages already submitted, then stop and wait for the
+     * workers
+     */
+    ~DecodePool();
+
+    /**
+     * Decode the term of a message in a worker and deliver it to the
+     * receiver.
+     * @param receiver receiver for the message
+     * @param origin origin of the message, given to the receiver
+     * @param msg message. Ownership is transfered to the receiver
+     * @param inFlight counter decremented once the message is delivered.
+     *  The caller must increment it before the call.
+     * @param decodeTime histogram for the time to decode it, can be 0
+     */
+    void submit(EpiReceiver *receiver, void *origin,
+                ErlangMessage *msg, long volatile *inFlight,
+                epi::util::LatencyHistogram *decodeTime = 0);
+
+    /**
+     * Get the number of worker threads
+     */
+    inline int threads() const {
+        return mLanes.size();
+    }
+
+private:
+    enum {
+        STREAMS = 256
+    };
+
+    struct Stream;
+
+    struct Job {
+        EpiReceiver *receiver;
+        void *origin;
+        ErlangMessage *msg;
+        long volatile *inFlight;
+        epi::util::LatencyHistogram *decodeTime;
+        Stream *stream;
+        unsigned long long sequence;
+    };
+
+    struct Lane {
+        #ifdef USE_OPEN_THREADS
+        OpenThreads::Mutex mutex;
+        OpenThreads::Condition condition;
+        #elif USE_BOOST
+        boost::mutex mutex;
+        boost::condition condition;
+        #endif
+        std::deque<Job> jobs;
+        bool stop;
+    };
+
+    // Messages that are delivered in order. Streams can be shared by
+    // several senders, that only adds ordering
+    struct Stream {
+        #ifdef USE_OPEN_THREADS
+        OpenThreads::Mutex mutex;
+        #elif USE_BOOST
+        boost::mutex mutex;
+        #endif
+        // Sequence of the next message submitted
+        unsigned long long next;
+        // Sequence of the next message to deliver
+        unsigned long long delivered;
+        // Decoded messages waiting for the previous ones
+        std::map<unsigned long long, Job> decoded;
+    };
+
+    /*
+     * Get the ordering key of a message: a hash of its sender, or of
+     * its origin if the message does not carry the sender
+     */
+    static unsigned key(void *origin, ErlangMessage *msg);
+
+    /*
+     * Deliver the decoded job, and the jobs of its stream that were
+     * waiting for it
+     */
+    void deliver(Job &job);
+
+    /*
+     * Main loop of a worker
+     */
+    void run(unsigned lane);
+
+    std::vector<Lane *> mLanes;
+    std::vector<DecodePoolWorker *> mWorkers;
+    Stream *mStreams[STREAMS];
+    // Lane of the next message
+    long volatile mNextLane;
+
+    DecodePool(const DecodePool &);
+    DecodePool &operator=(const DecodePool &);
+};
+
+} // namespace node
+} // namespace epi
+
+#endif // __DECODEPOOL_HPP
@@ -28,6 +28,9 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 using namespace epi::ei;
 
+/** Buffers bigger than this are freed on reset */
+static const int MAX_KEPT_BUFFER_SIZE = 64*1024;
+
 
 EIBuffer::EIBuffer(const bool with_version): mWithVersion(with_version) {
     if (with_version) {
@@ -48,12 +51,15 @@ EIBuffer::~EIBuffer() {
 }
 
 void EIBuffer::do_reset() {
-    ei_x_free(&mBuffer);
-    if (mWithVersion) {
-        ei_x_new_with_version(&mBuffer);
-    } else {
+    // Keep the allocated memory to reuse the buffer
+    if (mBuffer.buffsz > MAX_KEPT_BUFFER_SIZE) {
+        ei_x_free(&mBuffer);
         ei_x_new(&mBuffer);
     }
+    mBuffer.index = 0;
+    if (mWithVersion) {
+        ei_x_encode_version(&mBuffer);
+    }
 }
 
 void EIBuffer::do_resetIndex() {
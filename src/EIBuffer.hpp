@@ -31,6 +31,10 @@ namespace ei {
 
 class EIConnection;
 class EIMessageAcceptor;
+class EIUringConnection;
+class EIUringMessageAcceptor;
+class ReplayConnection;
+class ReplayAcceptor;
 
 /**
  * Implementation of Buffer using EI library
@@ -39,6 +43,10 @@ class EIMessageAcceptor;
 class EIBuffer {
     friend class EIConnection;
     friend class EIMessageAcceptor;
+    friend class EIUringConnection;
+    friend class EIUringMessageAcceptor;
+    friend class ReplayConnection;
+    friend class ReplayAcceptor;
 public:
 
     virtual ~EIBuffer();
@@ -28,6 +28,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "EIOutputBuffer.hpp"
 #include "EIInputBuffer.hpp"
 #include "EpiUtil.hpp"
+#include "EpiProbes.hpp"
+#include "FrameCapture.hpp"
 
 #ifdef USE_BOOST
 #include <boost/bind.hpp>
@@ -162,6 +164,8 @@ void EIMessageAcceptor::run() {
             break;
         }
 
+        // The frame is read, time it until the receiver has it
+        long long start = LatencyHistogram::now();
         if (receive_res == ERL_ERROR) {
             //Dout(dc::connect, "["<<this<<"]"<<
             //        "EIMessageAcceptor: sending connection error");
@@ -185,10 +189,17 @@ void EIMessageAcceptor::run() {
                 msgResult = new ErrorMessage(new EpiAuthException(oss.str()));
             }
 
+            if (FrameCapture::enabled()) {
+                FrameCapture::record(mConnection->getPeer()->getNodeName(),
+                                     &msg, buffer->getInternalBuffer(),
+                                     *buffer->getInternalIndex());
+            }
+
             try {
             //    Dout(dc::connect, "["<<this<<"]"<<
             //            "EIMessageAcceptor: sending connection message");
-                msgResult = epi::util::ToMessage(&msg, buffer.get());
+                // The term is decoded by the connection on delivery
+                msgResult = epi::util::ToMessage(&msg, buffer.get(), false);
             } catch (EpiConnectionException &e) {
             //    Dout(dc::connect, "["<<this<<"]"<<
             //            "EIMessageAcceptor: sending connection error (unknown message)");
@@ -196,11 +207,34 @@ void EIMessageAcceptor::run() {
             }
         }
 
+        unsigned size = *buffer->getInternalBufferSize();
+
         // All ok, the buffer is referenced by the message and we can (and have to)
         // release the auto_ptr to it.
         buffer.release();
 
+        // The connection can be gone after delivering an error, and
+        // the message after delivering it
+        bool error = msgResult->instanceOf(ERL_MSG_ERROR);
+        bool trace = !error && Trace::enabled(TRACE_MESSAGE_IN);
+        unsigned long long from = 0;
+        unsigned long long to = 0;
+        unsigned type = msgResult->messageType();
+        if (trace) {
+            MessagePids(msgResult, &from, &to);
+        }
+        if (!error) {
+            mConnection->countIn(size);
+        }
         mConnection->deliver(this, msgResult);
+        if (!error) {
+            long long elapsed = LatencyHistogram::now() - start;
+            mConnection->getLatencyStats().stage(LATENCY_RECEIVE)
+                    .record(elapsed);
+            if (trace) {
+                Trace::record(TRACE_FRAME_IN, elapsed, size, from, to, type);
+            }
+        }
     }
     Dout(dc::connect, "["<<this<<"]"<< "EIMessageAcceptor:: Thread exit");
     #ifdef USE_BOOST
@@ -241,14 +275,22 @@ void EIConnection::sendBuf( ErlPid * from, ErlPid * to, OutputBuffer * _buffer )
 
     // std::auto_ptr<erlang_pid> _from = ErlPid2EI(from);
     std::auto_ptr<erlang_pid> _to(ErlPid2EI(to));
+    long long start = LatencyHistogram::now();
     int ei_res = ei_send_encoded(mSocket->getSystemSocket(), _to.get(),
                                  (char *) buffer->getInternalBuffer(),
                                  *(buffer->getInternalIndex()));
+    long long elapsed = LatencyHistogram::now() - start;
+    mLatencyStats.stage(LATENCY_SEND).record(elapsed);
+    if (Trace::enabled(TRACE_MESSAGE_OUT)) {
+        Trace::record(TRACE_FRAME_OUT, elapsed, *(buffer->getInternalIndex()),
+                      from->key(), to->key(), ERL_MSG_SEND);
+    }
 
     // FIXME: throw more expecific exceptions
     if (ei_res < 0) {
         throw EpiEIException("Error sending data", erl_errno);
     }
+    countOut(*(buffer->getInternalIndex()));
 
     Dout_finish(_continue, " sent.");
 
@@ -266,15 +308,23 @@ void EIConnection::sendBuf( ErlPid * from, const std::string &to,
 
     std::auto_ptr<erlang_pid> _from(ErlPid2EI(from));
 
+    long long start = LatencyHistogram::now();
     int ei_res = ei_send_reg_encoded(mSocket->getSystemSocket(), _from.get(),
                                      (char *) to.c_str(),
                                      (char *) buffer->getInternalBuffer(),
                                      *(buffer->getInternalIndex()));
+    long long elapsed = LatencyHistogram::now() - start;
+    mLatencyStats.stage(LATENCY_SEND).record(elapsed);
+    if (Trace::enabled(TRACE_MESSAGE_OUT)) {
+        Trace::record(TRACE_FRAME_OUT, elapsed, *(buffer->getInternalIndex()),
+                      from->key(), 0, ERL_MSG_REG_SEND);
+    }
 
     // FIXME: throw more expecific exceptions
     if (ei_res < 0) {
         throw EpiEIException("Error sending data", erl_errno);
     }
+    countOut(*(buffer->getInternalIndex()));
 
     Dout_finish(_continue, " sent.");
 
@@ -311,6 +361,10 @@ void EIConnection::close()
 {
     this->stop();
     _socketMutex.lock();
+    if (mSocket) {
+        EPI_PROBE2(connection__close, mSocket->getSystemSocket(),
+                   mPeer->getNodeName().c_str());
+    }
     delete mSocket;
     mSocket = 0;
     _socketMutex.unlock();
@@ -71,6 +71,10 @@ public:
      */
     virtual OutputBuffer* newOutputBuffer();
 
+    inline OutputBufferType outputBufferType() const {
+        return EI_OUTPUT_BUFFER;
+    }
+
     /**
      * Send a buffer to a pid.
      * @param from From pid
@@ -26,6 +26,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include "ErlTypes.hpp"
 #include "EIInputBuffer.hpp"
+#include "EpiProbes.hpp"
 
 using namespace epi::node;
 using namespace epi::error;
@@ -51,9 +52,14 @@ EIInputBuffer::EIInputBuffer(ei_x_buff &buffer, const bool with_version):
 
 ErlTerm* EIInputBuffer::readTerm() throw(EpiDecodeException)
 {
-    Dout_continue(dc::buffer, _continue, " failed.",
-                  "["<<this<<"]" << "EIInputBuffer::readTerm(): ");
+    EPI_PROBE2(decode__start, this, mDecodeIndex);
+    ErlTerm* term = this->decodeTerm();
+    EPI_PROBE3(decode__end, this, mDecodeIndex, term ? term->termType() : 0);
+    return term;
+}
 
+ErlTerm* EIInputBuffer::decodeTerm() throw(EpiDecodeException)
+{
     // Check if is there are more elements to decode
     if (*this->getDecodeIndex() == *this->getInternalBufferSize()) {
         return 0;
@@ -73,7 +79,6 @@ ErlTerm* EIInputBuffer::readTerm() throw(EpiDecodeException)
     switch (type) {
     case ERL_ATOM_EXT:
         if (1==1) { // Fake context
-            Dout_continued(  "decoding an Atom: ");
             char atom[MAXATOMLEN];
             ei_res = ei_decode_atom(this->getInternalBuffer(),
                                     this->getDecodeIndex(), atom);
@@ -89,7 +94,6 @@ ErlTerm* EIInputBuffer::readTerm() throw(EpiDecodeException)
         break;
     case ERL_PID_EXT:
         if (1==1) {
-            Dout_continued("decoding a Pid: ");
             erlang_pid pid;
             ei_res = ei_decode_pid(this->getInternalBuffer(),
                                        this->getDecodeIndex(), &pid);
@@ -108,7 +112,6 @@ ErlTerm* EIInputBuffer::readTerm() throw(EpiDecodeException)
     case ERL_LARGE_TUPLE_EXT:
     case ERL_SMALL_TUPLE_EXT:
         if (1==1) {
-            Dout_continued( "decoding a Tuple: ");
             int arity;
 
             ei_res = ei_decode_tuple_header(this->getInternalBuffer(),
@@ -119,7 +122,7 @@ ErlTerm* EIInputBuffer::readTerm() throw(EpiDecodeException)
             try {
                 ErlTermPtr<ErlTuple> new_tuple(new ErlTuple(arity));
                 for (int i=0; i < arity; i++) {
-                    new_tuple->initElement(this->readTerm());
+                    new_tuple->initElement(this->decodeTerm());
                 }
                 returnTerm = new_tuple.drop();
             } catch(EpiDecodeException &e) {
@@ -132,7 +135,6 @@ ErlTerm* EIInputBuffer::readTerm() throw(EpiDecodeException)
 
     case ERL_STRING_EXT:
         if (1==1) {
-            Dout_continued( "decoding a String: ");
             char* string_data = new char[size+1];
             ei_res = ei_decode_string(this->getInternalBuffer(),
                                       this->getDecodeIndex(), string_data);
@@ -148,7 +150,6 @@ ErlTerm* EIInputBuffer::readTerm() throw(EpiDecodeException)
 
     case ERL_LIST_EXT:
         if (1==1) {
-            Dout_continued( "decoding a List: ");
             int arity;
 
             ei_res = ei_decode_list_header(this->getInternalBuffer(),
@@ -167,9 +168,9 @@ ErlTerm* EIInputBuffer::readTerm() throw(EpiDecodeException)
                     for (int i=0; i <= arity; i++) {
                     // If the decoding is success, add it (check if is the tail)
                         if (i!=arity)
-                            new_list->addElement(this->readTerm());
+                            new_list->addElement(this->decodeTerm());
                         else
-                            new_list->close(this->readTerm());
+                            new_list->close(this->decodeTerm());
                     }
                 } catch (EpiDecodeException &e) {
                     throw e;
@@ -184,7 +185,6 @@ ErlTerm* EIInputBuffer::readTerm() throw(EpiDecodeException)
 
     case ERL_NIL_EXT:
         if (1==1) {
-            Dout_continued( "decoding a Empty list: ");
             int arity;
             ei_res = ei_decode_list_header(this->getInternalBuffer(),
                                        this->getDecodeIndex(), &arity);
@@ -201,7 +201,6 @@ ErlTerm* EIInputBuffer::readTerm() throw(EpiDecodeException)
     case ERL_SMALL_INTEGER_EXT:
     case ERL_INTEGER_EXT:
         if (1==1) {
-            Dout_continued( "decoding a Long: ");
             long long vlong;
             ei_res = ei_decode_longlong(this->getInternalBuffer(),
                                         this->getDecodeIndex(), &vlong);
@@ -216,7 +215,6 @@ ErlTerm* EIInputBuffer::readTerm() throw(EpiDecodeException)
     case NEW_FLOAT_EXT:
     case ERL_FLOAT_EXT:
         if (1==1) {
-            Dout_continued( "decoding a Double: ");
             double vdouble;
             ei_res = ei_decode_double(this->getInternalBuffer(),
                                           this->getDecodeIndex(), &vdouble);
@@ -231,8 +229,6 @@ ErlTerm* EIInputBuffer::readTerm() throw(EpiDecodeException)
 
     case ERL_BINARY_EXT:
         if (1==1) {
-            Dout_continued( "decoding a Binary: ");
-
             char *data = new char[size];
             // EI lib needs a long as parameter of ei_decode_binary but returns
             // a int in ei_get_type
@@ -250,7 +246,6 @@ ErlTerm* EIInputBuffer::readTerm() throw(EpiDecodeException)
 
     case ERL_NEW_REFERENCE_EXT:
         if (1==1) {
-            Dout_continued( "decoding a Reference: ");
             erlang_ref ref;
             ei_res = ei_decode_ref(this->getInternalBuffer(),
                                        this->getDecodeIndex(), &ref);
@@ -268,7 +263,6 @@ ErlTerm* EIInputBuffer::readTerm() throw(EpiDecodeException)
 
     case ERL_PORT_EXT:
         if (1==1) {
-            Dout_continued( "decoding a Port: ");
             erlang_port port;
             ei_res = ei_decode_port(this->getInternalBuffer(),
                                         this->getDecodeIndex(), &port);
@@ -288,12 +282,10 @@ ErlTerm* EIInputBuffer::readTerm() throw(EpiDecodeException)
         std::ostringstream oss;
         oss << "Unknown message content type " << type;
 
-        Dout_continued( "Unknown message content type " << type);
         throw EpiEIDecodeException(oss.str());
         break;
     }
 
-    Dout_finish(_continue, returnTerm->toString() << ".");
     return returnTerm;
 
 }
@@ -50,8 +50,12 @@ public:
 
     virtual ErlTerm* readTerm() throw(EpiDecodeException);
 
+    size_t memoryFootprint(std::set<const ErlTerm*> &visited) const {
+        return mBuffer.buffsz;
+    }
+
     void reset()        { do_reset(); }
-    void resetIndex()   { do_resetIndex(); }
+    void resetIndex()   { do_resetIndex(); mDecodeIndex = mBuffer.index; }
 
 protected:
     EIInputBuffer(ei_x_buff &buffer, const bool with_version);
@@ -59,6 +63,13 @@ protected:
     int mDecodeIndex;
 
     int *getDecodeIndex();
+
+private:
+    /**
+     * Decode the next term, recursing into compound terms.
+     * readTerm wraps this with the decode probes.
+     */
+    ErlTerm* decodeTerm() throw(EpiDecodeException);
 };
 
 }
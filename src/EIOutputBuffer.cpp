@@ -28,6 +28,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "EIInputBuffer.hpp"
 #include "ErlTypes.hpp"
 #include "EpiUtil.hpp"
+#include "EpiProbes.hpp"
 
 using namespace epi::node;
 using namespace epi::type;
@@ -46,11 +47,27 @@ EIOutputBuffer::~EIOutputBuffer()
 
 void EIOutputBuffer::writeTerm(ErlTerm *t, const VariableBinding *binding)
         throw(EpiInvalidTerm, EpiEncodeException, EpiVariableUnbound)
+{
+    EPI_PROBE2(encode__start, this, mBuffer.index);
+    this->encodeTerm(t, binding);
+    EPI_PROBE2(encode__end, this, mBuffer.index);
+}
+
+void EIOutputBuffer::encodeTerm(ErlTerm *t, const VariableBinding *binding)
+        throw(EpiInvalidTerm, EpiEncodeException, EpiVariableUnbound)
 {
     if (t) {
-        Dout_continue(dc::connect, _continue, " failed.",
-                      "InputBuffer::WriteTerm(" << t->toString() << "):");
         int ei_res;
+        if (t->isFrozen()) {
+            // The cached encoding is the same this switch would make
+            const std::string *encoding = t->frozenEncoding();
+            ei_res = ei_x_append_buf(this->getBuffer(), encoding->data(),
+                                     (int) encoding->size());
+            if (ei_res < 0) {
+                throw EpiEIEncodeException("EI frozen term encoding failed", ei_res);
+            }
+            return;
+        }
         switch(t->termType()) {
         case ERL_ATOM:
             ei_res = ei_x_encode_atom(this->getBuffer(),
@@ -151,7 +168,7 @@ void EIOutputBuffer::writeTerm(ErlTerm *t, const VariableBinding *binding)
                 }
 
                 for (unsigned int i = 0; i < tuple->arity(); i++) {
-                    this->writeTerm(tuple->elementAt(i), binding);
+                    this->encodeTerm(tuple->elementAt(i), binding);
                 }
             }
             break;
@@ -171,9 +188,9 @@ void EIOutputBuffer::writeTerm(ErlTerm *t, const VariableBinding *binding)
 
                 // Encode all elements and last tail
                 for(unsigned int i=0; i<list->arity(); ++i) {
-                    this->writeTerm(list->elementAt(i), binding);
+                    this->encodeTerm(list->elementAt(i), binding);
                 }
-                this->writeTerm(list->tail(list->arity()-1), binding);
+                this->encodeTerm(list->tail(list->arity()-1), binding);
 
             }
             break;
@@ -185,7 +202,7 @@ void EIOutputBuffer::writeTerm(ErlTerm *t, const VariableBinding *binding)
                 }
                 ErlTerm* term = binding? binding->search(variable->getName()): 0;
                 if (term) {
-                    this->writeTerm(term, binding);
+                    this->encodeTerm(term, binding);
                 } else {
                     throw EpiVariableUnbound(variable->getName());
                 }
@@ -193,7 +210,6 @@ void EIOutputBuffer::writeTerm(ErlTerm *t, const VariableBinding *binding)
 
             break;
         }
-        Dout_finish(_continue, " encoded.");
     } else {
         throw EpiInvalidTerm("trying to encode a null pointer");
     }
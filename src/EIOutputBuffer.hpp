@@ -68,6 +68,15 @@ public:
      */
     InputBuffer *getInputBuffer();
 
+private:
+    /**
+     * Encode a term, recursing into compound terms, or copying the
+     * encoding of frozen terms.
+     * writeTerm wraps this with the encode probes.
+     */
+    void encodeTerm(ErlTerm *t, const VariableBinding *binding)
+            throw(EpiInvalidTerm, EpiEncodeException, EpiVariableUnbound);
+
 };
 
 } // ei
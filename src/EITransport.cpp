@@ -30,6 +30,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "EITransport.hpp"
 #include "EIConnection.hpp"
 #include "EpiUtil.hpp"
+#include "EpiProbes.hpp"
 
 using namespace epi::node;
 using namespace epi::error;
@@ -70,11 +71,23 @@ ErlangTransport *
         hostname = subnodename.substr(pos+1, subnodename.size());
     }
 
-    return new epi::ei::EITransport(alivename+"@"+hostname, alivename,
-                                    hostname, aCookie, port);
+    return newTransport(alivename+"@"+hostname, alivename,
+                        hostname, aCookie, port);
 
 }
 
+ErlangTransport *
+        EITransportFactory::newTransport(const std::string aNodeName,
+                                         const std::string aAliveName,
+                                         const std::string aHostName,
+                                         const std::string aCookie,
+                                         const int aPort)
+        throw (EpiException)
+{
+    return new epi::ei::EITransport(aNodeName, aAliveName,
+                                    aHostName, aCookie, aPort);
+}
+
 
 EITransport::EITransport( const std::string aNodeName,
                 const std::string aAliveName,
@@ -155,6 +168,13 @@ Connection * EITransport::connect( const std::string node,
     return connection;
 }
 
+Connection * EITransport::connect( const std::string node, long timeout )
+        throw( EpiConnectionException )
+{
+    // Use default cookie
+    return do_connect(ec, node, timeout);
+}
+
 Connection * EITransport::accept( long timeout )
         throw( EpiConnectionException )
 {
@@ -176,13 +196,17 @@ Connection * EITransport::accept( const std::string cookie, long timeout )
 /*
  * Perform connection using this ei_cnode
  */
-Connection* EITransport::do_connect(const ei_cnode *other_ec, const std::string node)
+Connection* EITransport::do_connect(const ei_cnode *other_ec,
+                                    const std::string node,
+                                    long timeout)
         throw(EpiConnectionException)
 {
     Dout_continue(dc::connect, _continue, " failed.",
                   "EITransport::do_connect(" << node << "): ");
 
-    int newSock = ei_connect((ei_cnode *) other_ec, (char *) node.c_str());
+    // ei_connect_tmo uses no timeout if it is 0
+    int newSock = ei_connect_tmo((ei_cnode *) other_ec, (char *) node.c_str(),
+                                 (unsigned) timeout);
 
     if (newSock<0) {
         switch (erl_errno) {
@@ -196,6 +220,10 @@ Connection* EITransport::do_connect(const ei_cnode *other_ec, const std::string
                 Dout_finish(_continue, " Failed: Network error.");
                 throw EpiNetworkException("Can not connect: network error", erl_errno);
                 break;
+            case ETIMEDOUT:
+                Dout_finish(_continue, " Failed: Timeout.");
+                throw EpiNetworkException("Can not connect: timeout", erl_errno);
+                break;
             case ECONNREFUSED:
                 Dout_finish(_continue, " Failed: Connection refused.");
                 throw EpiNetworkException("Can not connect: no body in other side", erl_errno);
@@ -209,9 +237,10 @@ Connection* EITransport::do_connect(const ei_cnode *other_ec, const std::string
 
 
     // Create the connection
-    Connection *connection = new EIConnection(new PeerNode(node),
-                                            other_ec->ei_connect_cookie,
-                                            new Socket(newSock));
+    Connection *connection = newConnection(new PeerNode(node),
+                                           other_ec->ei_connect_cookie,
+                                           new Socket(newSock));
+    EPI_PROBE2(connection__connect, newSock, node.c_str());
 
     Dout_finish(_continue, "Socket " << newSock << " connected [" << connection << "]");
 
@@ -249,9 +278,10 @@ Connection* EITransport::do_accept(ei_cnode *other_ec, long timeout)
     }
 
     // Create the connection
-    Connection *connection = new EIConnection(new PeerNode(erlConnect.nodename),
-                                            other_ec->ei_connect_cookie,
-                                            new Socket(newSock));
+    Connection *connection = newConnection(new PeerNode(erlConnect.nodename),
+                                           other_ec->ei_connect_cookie,
+                                           new Socket(newSock));
+    EPI_PROBE2(connection__accept, newSock, erlConnect.nodename);
 
     Dout_finish(_continue, "accepted for " << erlConnect.nodename);
 
@@ -309,6 +339,13 @@ void EITransport::setListening()
     }
 }
 
+Connection* EITransport::newConnection(PeerNode *peer,
+                                       const std::string cookie,
+                                       Socket *socket)
+{
+    return new EIConnection(peer, cookie, socket);
+}
+
 std::string EITransport::getNodeName() {
     return mNodeName;
 }
@@ -83,6 +83,16 @@ public:
             createErlangTransport(std::string nodename, std::string aCookie)
             throw (EpiException);
     inline virtual ~EITransportFactory() {}
+protected:
+    /**
+     * Create the transport once the node name is parsed
+     */
+    virtual ErlangTransport *newTransport(const std::string aNodeName,
+                                          const std::string aAliveName,
+                                          const std::string aHostName,
+                                          const std::string aCookie,
+                                          const int aPort)
+            throw (EpiException);
 };
 
 
@@ -120,6 +130,9 @@ public:
     virtual Connection* connect(const std::string node, const std::string cookie)
             throw(EpiConnectionException);
 
+    virtual Connection* connect(const std::string node, long timeout)
+            throw(EpiConnectionException);
+
     virtual Connection* accept(long timeout = 0)
             throw(EpiConnectionException);
 
@@ -174,11 +187,20 @@ protected:
 
     Socket mSocket;
 
-    Connection* do_connect(const ei_cnode *other_ec, const std::string node)
+    Connection* do_connect(const ei_cnode *other_ec, const std::string node,
+                           long timeout = 0)
             throw(EpiConnectionException);
     Connection* do_accept(ei_cnode *other_ec, long timeout = 0)
             throw(EpiConnectionException);
 
+    /**
+     * Create the connection for a socket connected by EI.
+     * Subclasses can override it to use other connection type.
+     */
+    virtual Connection* newConnection(PeerNode *peer,
+                                      const std::string cookie,
+                                      Socket *socket);
+
 
 };
 
@@ -0,0 +1,707 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp"
+
+#ifdef USE_IO_URING
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <vector>
+
+#include "EIUringConnection.hpp"
+#include "EIOutputBuffer.hpp"
+#include "EIInputBuffer.hpp"
+#include "EpiUtil.hpp"
+#include "FrameCapture.hpp"
+
+#ifdef USE_BOOST
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/shared_ptr.hpp>
+#elif USE_OPEN_THREADS
+#include "OpenThreads/Thread"
+#endif
+
+using namespace epi::type;
+using namespace epi::error;
+using namespace epi::node;
+using namespace epi::util;
+using namespace epi::ei;
+
+/** Size of the registered receive buffer */
+static const unsigned RECV_BUFFER_SIZE = 64*1024;
+/** Size of the send ring */
+static const unsigned SEND_RING_ENTRIES = 256;
+/** Pass through byte in distribution packets */
+static const char PASS_THROUGH = 'p';
+/** userData of the receive operations and their cancelation */
+static const unsigned long long RECV_OPERATION = 1;
+static const unsigned long long CANCEL_OPERATION = 2;
+
+static inline unsigned get32be(const char *s) {
+    const unsigned char *p = (const unsigned char *) s;
+    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline void put32be(char *s, unsigned n) {
+    s[0] = (n >> 24) & 0xff;
+    s[1] = (n >> 16) & 0xff;
+    s[2] = (n >> 8) & 0xff;
+    s[3] = n & 0xff;
+}
+
+/*
+ * Blocking send of all the data. Used when a linked send is
+ * canceled or sent partially.
+ * @return 0 or -errno
+ */
+static int sendAll(int fd, const char *data, unsigned len) {
+    while (len > 0) {
+        int res = ::send(fd, data, len, MSG_NOSIGNAL);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        data += res;
+        len -= res;
+    }
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+
+namespace epi {
+namespace ei {
+
+/**
+ * This class will read all incoming packets from the socket using
+ * io_uring, delivering them to the receiver of the connection
+ */
+class EIUringMessageAcceptor
+    #ifdef USE_OPEN_THREADS
+    : public OpenThreads::Thread
+    #endif
+{
+public:
+    /**
+     * The acceptor thread will start with creation of
+     * the object.
+     */
+    EIUringMessageAcceptor(EIUringConnection *connection);
+
+    ~EIUringMessageAcceptor();
+
+    /**
+     * This method will stop and destroy the acceptor
+     */
+    void stop();
+
+    void run();
+
+private:
+    /*
+     * Wait for the completion of the receive operation, checking each
+     * 500 ms if the thread must exit. If so, the operation is canceled,
+     * and its completion is still waited for, so its buffer can be
+     * freed after this returns.
+     * @return the result of the operation, or 0 if thread must exit
+     */
+    int waitCompletion();
+
+    /*
+     * Read a packet bigger than the registered buffer.
+     * @return false if there is an error or thread must exit
+     */
+    bool readBigPacket(unsigned length, unsigned available);
+
+    /*
+     * Decode a distribution packet and deliver it
+     */
+    void processPacket(const char *packet, unsigned length);
+
+    /*
+     * Deliver an error
+     */
+    void deliverError(int err);
+
+    EIUringConnection *mConnection;
+    bool mThreadExit;
+    IOUring mRing;
+    char *mBuffer;
+    unsigned mFilled;
+    #ifdef USE_BOOST
+    boost::shared_ptr<boost::thread> m_thread;
+    #endif
+};
+
+}// ei
+}// epi
+
+EIUringMessageAcceptor::EIUringMessageAcceptor(EIUringConnection *connection):
+        mConnection(connection), mThreadExit(false),
+        mBuffer(new char[RECV_BUFFER_SIZE]), mFilled(0)
+{
+    #ifdef USE_OPEN_THREADS
+    start();
+    #elif USE_BOOST
+    m_thread = boost::shared_ptr<boost::thread>(
+        new boost::thread(boost::bind(&EIUringMessageAcceptor::run, this))
+    );
+    #endif
+}
+
+EIUringMessageAcceptor::~EIUringMessageAcceptor()
+{
+    this->stop();
+    delete [] mBuffer;
+}
+
+void EIUringMessageAcceptor::stop() {
+    mThreadExit = true;
+    #ifdef USE_OPEN_THREADS
+    if (this->isRunning()) {
+        Dout(dc::connect, "["<<this<<"]"<< "EIUringMessageAcceptor::stop(): joining thread");
+        this->join();
+    }
+    #elif USE_BOOST
+    if (m_thread.get()) {
+        Dout(dc::connect, "["<<this<<"]"<< "EIUringMessageAcceptor::stop(): joining thread");
+        m_thread->join();
+        m_thread.reset();
+    }
+    #endif
+}
+
+int EIUringMessageAcceptor::waitCompletion() {
+    unsigned long long userData;
+    int result;
+    bool canceled = false;
+    while (true) {
+        if (mThreadExit && !canceled) {
+            mRing.prepareCancel(RECV_OPERATION, CANCEL_OPERATION);
+            canceled = true;
+        }
+        int ret = mRing.submitAndWait(1, 500);
+        if (ret < 0 && ret != -ETIME) {
+            // The kernel stops using the buffer once the ring is closed
+            mRing.close();
+            return ret;
+        }
+        while (mRing.peekCompletion(&userData, &result)) {
+            if (userData == RECV_OPERATION) {
+                return mThreadExit ? 0 : result;
+            }
+        }
+    }
+}
+
+void EIUringMessageAcceptor::deliverError(int err) {
+    if (!mThreadExit) {
+        mConnection->deliver(mConnection, new ErrorMessage(
+                new EpiEIException("Error in receive", err)));
+    }
+}
+
+bool EIUringMessageAcceptor::readBigPacket(unsigned length, unsigned available) {
+    char *packet = new char[length];
+    memcpy(packet, mBuffer+4, available);
+    while (available < length) {
+        mRing.prepareRecv(mConnection->mSocket->getSystemSocket(),
+                          packet + available, length - available,
+                          RECV_OPERATION);
+        int res = waitCompletion();
+        if (res <= 0) {
+            delete [] packet;
+            deliverError(res < 0 ? -res : EIO);
+            return false;
+        }
+        available += res;
+    }
+    processPacket(packet, length);
+    delete [] packet;
+    return true;
+}
+
+void EIUringMessageAcceptor::run() {
+    #ifdef CWDEBUG
+    epi::debug::setThreadDebugMargin();
+    #endif
+
+    Dout(dc::connect, "["<<this<<"]"<< "EIUringMessageAcceptor::run(): Thread started (" << gettid() << ")");
+
+    struct iovec iov;
+    iov.iov_base = mBuffer;
+    iov.iov_len = RECV_BUFFER_SIZE;
+    if (!mRing.create(4) || !mRing.registerBuffers(&iov, 1)) {
+        deliverError(errno);
+        mRing.close();
+        return;
+    }
+
+    int fd = mConnection->mSocket->getSystemSocket();
+    while(!mThreadExit) {
+        mRing.prepareReadFixed(fd, mBuffer + mFilled,
+                               RECV_BUFFER_SIZE - mFilled, 0, RECV_OPERATION);
+        int res = waitCompletion();
+        if (mThreadExit) {
+            break;
+        }
+        if (res <= 0) {
+            // Connection closed or error
+            deliverError(res < 0 ? -res : EIO);
+            break;
+        }
+        mFilled += res;
+
+        // Process all the complete packets in the buffer
+        unsigned offset = 0;
+        while (mFilled - offset >= 4) {
+            unsigned length = get32be(mBuffer + offset);
+            if (length == 0) {
+                // Tick
+                mConnection->sendTick();
+                offset += 4;
+            } else if (length + 4 > RECV_BUFFER_SIZE) {
+                // Packet does not fit in the buffer
+                memmove(mBuffer, mBuffer + offset, mFilled - offset);
+                if (!readBigPacket(length, mFilled - offset - 4)) {
+                    mThreadExit = true;
+                }
+                offset = mFilled;
+            } else if (mFilled - offset - 4 >= length) {
+                processPacket(mBuffer + offset + 4, length);
+                offset += length + 4;
+            } else {
+                break;
+            }
+        }
+        if (offset > 0) {
+            memmove(mBuffer, mBuffer + offset, mFilled - offset);
+            mFilled -= offset;
+        }
+    }
+
+    // No operation is left, but do not let the ring outlive the buffers
+    mRing.close();
+    Dout(dc::connect, "["<<this<<"]"<< "EIUringMessageAcceptor:: Thread exit");
+}
+
+void EIUringMessageAcceptor::processPacket(const char *packet, unsigned length) {
+    if (packet[0] != PASS_THROUGH) {
+        Dout(dc::connect, "["<<this<<"]"<< "EIUringMessageAcceptor: ignoring packet");
+        return;
+    }
+    long long start = LatencyHistogram::now();
+
+    // Decode the control message
+    erlang_msg msg;
+    int index = 1;
+    int version, arity;
+    long msgtype;
+    memset(&msg, 0, sizeof(msg));
+    bool error =
+            ei_decode_version(packet, &index, &version) < 0 ||
+            ei_decode_tuple_header(packet, &index, &arity) < 0 ||
+            ei_decode_long(packet, &index, &msgtype) < 0;
+    if (!error) {
+        switch (msgtype) {
+        case ERL_SEND:
+        case ERL_SEND_TT:
+            error = ei_decode_atom(packet, &index, msg.cookie) < 0 ||
+                    ei_decode_pid(packet, &index, &msg.to) < 0 ||
+                    (msgtype == ERL_SEND_TT &&
+                     ei_skip_term(packet, &index) < 0);
+            msgtype = ERL_SEND;
+            break;
+        case ERL_REG_SEND:
+        case ERL_REG_SEND_TT:
+            error = ei_decode_pid(packet, &index, &msg.from) < 0 ||
+                    ei_decode_atom(packet, &index, msg.cookie) < 0 ||
+                    ei_decode_atom(packet, &index, msg.toname) < 0 ||
+                    (msgtype == ERL_REG_SEND_TT &&
+                     ei_skip_term(packet, &index) < 0);
+            msgtype = ERL_REG_SEND;
+            break;
+        case ERL_LINK:
+        case ERL_UNLINK:
+            error = ei_decode_pid(packet, &index, &msg.from) < 0 ||
+                    ei_decode_pid(packet, &index, &msg.to) < 0;
+            break;
+        case ERL_EXIT:
+        case ERL_EXIT2:
+        case ERL_EXIT_TT:
+        case ERL_EXIT2_TT:
+            // The reason is the last element of the control message
+            error = ei_decode_pid(packet, &index, &msg.from) < 0 ||
+                    ei_decode_pid(packet, &index, &msg.to) < 0 ||
+                    ((msgtype == ERL_EXIT_TT || msgtype == ERL_EXIT2_TT) &&
+                     ei_skip_term(packet, &index) < 0);
+            msgtype = (msgtype == ERL_EXIT || msgtype == ERL_EXIT_TT) ?
+                    ERL_EXIT : ERL_EXIT2;
+            break;
+        default:
+            break;
+        }
+    }
+    msg.msgtype = msgtype;
+
+    EpiMessage *msgResult;
+    if (error || (unsigned) index > length) {
+        msgResult = new ErrorMessage(new EpiUnknownMessageException(
+                "Error decoding control message"));
+    } else {
+        // Copy the message (or exit reason) after the version
+        EIInputBuffer *buffer = new EIInputBuffer();
+        if ((unsigned) index < length && (unsigned char) packet[index] == 131) {
+            index++;
+        }
+        ei_x_append_buf(buffer->getBuffer(), packet + index, length - index);
+        if (FrameCapture::enabled()) {
+            FrameCapture::record(mConnection->getPeer()->getNodeName(), &msg,
+                                 buffer->getInternalBuffer(),
+                                 *buffer->getInternalIndex());
+        }
+        try {
+            msgResult = epi::util::ToMessage(&msg, buffer, false);
+        } catch (EpiConnectionException &e) {
+            msgResult = new ErrorMessage(new EpiConnectionException(e));
+        }
+    }
+    // The connection can be gone after delivering an error, and
+    // the message after delivering it
+    bool failed = msgResult->instanceOf(ERL_MSG_ERROR);
+    bool trace = !failed && Trace::enabled(TRACE_MESSAGE_IN);
+    unsigned long long from = 0;
+    unsigned long long to = 0;
+    unsigned type = msgResult->messageType();
+    if (trace) {
+        MessagePids(msgResult, &from, &to);
+    }
+    if (!failed) {
+        mConnection->countIn(length);
+    }
+    mConnection->deliver(mConnection, msgResult);
+    if (!failed) {
+        long long elapsed = LatencyHistogram::now() - start;
+        mConnection->getLatencyStats().stage(LATENCY_RECEIVE).record(elapsed);
+        if (trace) {
+            Trace::record(TRACE_FRAME_IN, elapsed, length, from, to, type);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+
+EIUringConnection::EIUringConnection(PeerNode *peer,
+                                     std::string cookie,
+                                     Socket *aSocket):
+        EIConnection(peer, cookie, aSocket),
+        mUringAcceptor(0), mSendRing(), mSendRingValid(false),
+        mSendQueue(), mFlushing(false)
+{
+    mSendRingValid = mSendRing.create(SEND_RING_ENTRIES);
+}
+
+EIUringConnection::~EIUringConnection() {
+    Dout(dc::connect, "["<<this<<"]"<< "EIUringConnection::~EIUringConnection()");
+    this->close();
+}
+
+void EIUringConnection::sendBuf( ErlPid * from, ErlPid * to, OutputBuffer * _buffer )
+        throw( EpiConnectionException)
+{
+    Dout(dc::connect, "["<<this<<"]"<< "EIUringConnection::sendBuf(from=" <<
+            from->toString() << ", to=" << to->toString() << ", buffer)");
+    EIOutputBuffer *buffer = (EIOutputBuffer *) _buffer;
+    std::auto_ptr<erlang_pid> _to(ErlPid2EI(to));
+
+    // {SEND, '', ToPid}, the cookie is not sent, like ei does
+    SendFrame frame;
+    int index = 5;
+    ei_encode_version(frame.header, &index);
+    ei_encode_tuple_header(frame.header, &index, 3);
+    ei_encode_long(frame.header, &index, ERL_SEND);
+    ei_encode_atom(frame.header, &index, "");
+    ei_encode_pid(frame.header, &index, _to.get());
+
+    frame.headerLength = index;
+    frame.payload = buffer->getInternalBuffer();
+    frame.payloadLength = *(buffer->getInternalIndex());
+    put32be(frame.header, frame.headerLength + frame.payloadLength - 4);
+    frame.header[4] = PASS_THROUGH;
+    long long start = LatencyHistogram::now();
+    sendFrame(&frame);
+    countOut(frame.payloadLength);
+    long long elapsed = LatencyHistogram::now() - start;
+    mLatencyStats.stage(LATENCY_SEND).record(elapsed);
+    if (Trace::enabled(TRACE_MESSAGE_OUT)) {
+        Trace::record(TRACE_FRAME_OUT, elapsed, frame.payloadLength,
+                      from->key(), to->key(), ERL_MSG_SEND);
+    }
+}
+
+void EIUringConnection::sendBuf( ErlPid * from, const std::string &to,
+                                 OutputBuffer * _buffer )
+        throw( EpiConnectionException)
+{
+    Dout(dc::connect, "["<<this<<"]"<< "EIUringConnection::sendBuf(from=" <<
+            from->toString() << ", to=" << to << ", buffer)");
+    EIOutputBuffer *buffer = (EIOutputBuffer *) _buffer;
+    std::auto_ptr<erlang_pid> _from(ErlPid2EI(from));
+
+    // {REG_SEND, FromPid, '', ToName}
+    SendFrame frame;
+    int index = 5;
+    ei_encode_version(frame.header, &index);
+    ei_encode_tuple_header(frame.header, &index, 4);
+    ei_encode_long(frame.header, &index, ERL_REG_SEND);
+    ei_encode_pid(frame.header, &index, _from.get());
+    ei_encode_atom(frame.header, &index, "");
+    ei_encode_atom(frame.header, &index, to.c_str());
+
+    frame.headerLength = index;
+    frame.payload = buffer->getInternalBuffer();
+    frame.payloadLength = *(buffer->getInternalIndex());
+    put32be(frame.header, frame.headerLength + frame.payloadLength - 4);
+    frame.header[4] = PASS_THROUGH;
+    long long start = LatencyHistogram::now();
+    sendFrame(&frame);
+    countOut(frame.payloadLength);
+    long long elapsed = LatencyHistogram::now() - start;
+    mLatencyStats.stage(LATENCY_SEND).record(elapsed);
+    if (Trace::enabled(TRACE_MESSAGE_OUT)) {
+        Trace::record(TRACE_FRAME_OUT, elapsed, frame.payloadLength,
+                      from->key(), 0, ERL_MSG_REG_SEND);
+    }
+}
+
+void EIUringConnection::sendBuf( ErlPid* from,
+                                 const std::string &node,
+                                 const std::string &to,
+                                 OutputBuffer* buffer )
+        throw (EpiConnectionException)
+{
+    // the connection is connected to one peer, just send all to it
+    sendBuf(from, to, buffer);
+}
+
+void EIUringConnection::sendTick() {
+    SendFrame frame;
+    put32be(frame.header, 0);
+    frame.headerLength = 4;
+    frame.payload = 0;
+    frame.payloadLength = 0;
+    try {
+        sendFrame(&frame);
+    } catch (EpiConnectionException &e) {
+        // The acceptor will get the error
+    }
+}
+
+void EIUringConnection::sendFrame(SendFrame *frame)
+        throw (EpiConnectionException)
+{
+    frame->result = 0;
+    frame->done = false;
+
+    _sendMutex.lock();
+    mSendQueue.push_back(frame);
+    while (!frame->done) {
+        if (!mFlushing) {
+            // Send all the queued frames, ours included
+            mFlushing = true;
+            std::list<SendFrame *> batch;
+            batch.swap(mSendQueue);
+            _sendMutex.unlock();
+            flushFrames(batch);
+            _sendMutex.lock();
+            mFlushing = false;
+            #ifdef USE_OPEN_THREADS
+            _sendCondition.broadcast();
+            #elif USE_BOOST
+            _sendCondition.notify_all();
+            #endif
+        } else {
+            #ifdef USE_OPEN_THREADS
+            _sendCondition.wait(&_sendMutex);
+            #elif USE_BOOST
+            _sendCondition.wait(_sendMutex);
+            #endif
+        }
+    }
+    _sendMutex.unlock();
+
+    if (frame->result < 0) {
+        throw EpiEIException("Error sending data", -frame->result);
+    }
+}
+
+void EIUringConnection::flushFrames(std::list<SendFrame *> &batch) {
+    // Each frame is sent as header and payload
+    std::vector<SendOp> ops;
+    for (std::list<SendFrame *>::const_iterator p = batch.begin();
+         p != batch.end(); ++p)
+    {
+        SendOp op;
+        op.frame = *p;
+        op.data = (*p)->header;
+        op.length = (*p)->headerLength;
+        op.result = -ECANCELED;
+        ops.push_back(op);
+        if ((*p)->payloadLength > 0) {
+            op.data = (*p)->payload;
+            op.length = (*p)->payloadLength;
+            ops.push_back(op);
+        }
+    }
+
+    int fd = mSocket ? mSocket->getSystemSocket() : -1;
+    unsigned first = 0;
+    while (first < ops.size()) {
+        if (mSendRingValid) {
+            // The ops before the returned one are sent
+            first = submitOps(fd, ops, first);
+            if (first == ops.size()) {
+                break;
+            }
+        }
+        // Finish this op (a short send, or one the ring could not do)
+        // before the next ones are submitted, so the stream keeps the
+        // order of the ops
+        SendOp &op = ops[first];
+        if (op.result >= 0 || op.result == -ECANCELED) {
+            unsigned sent = op.result > 0 ? op.result : 0;
+            op.result = fd < 0 ? -EBADF :
+                    sendAll(fd, op.data + sent, op.length - sent);
+            if (op.result == 0) {
+                op.result = op.length;
+            }
+        }
+        if (op.result < 0) {
+            // The stream is broken: fail this frame and the next ones
+            for (unsigned i = first; i < ops.size(); i++) {
+                if (ops[i].frame->result == 0) {
+                    ops[i].frame->result = op.result;
+                }
+            }
+            break;
+        }
+        first++;
+    }
+
+    for (std::list<SendFrame *>::const_iterator p = batch.begin();
+         p != batch.end(); ++p)
+    {
+        (*p)->done = true;
+    }
+}
+
+unsigned EIUringConnection::submitOps(int fd, std::vector<SendOp> &ops,
+                                      unsigned first)
+{
+    while (first < ops.size()) {
+        // Submit as many linked sends as fit in the ring
+        unsigned count = 0;
+        unsigned space = mSendRing.spaceLeft();
+        while (first + count < ops.size() && count < space) {
+            const SendOp &op = ops[first + count];
+            bool link = first + count + 1 < ops.size() && count + 1 < space;
+            mSendRing.prepareSend(fd, op.data, op.length, first + count, link);
+            count++;
+        }
+
+        // Reap the completions of all the submitted ops, so none of
+        // them is still in the kernel when this returns
+        unsigned long long userData;
+        int result;
+        unsigned done = 0;
+        bool failed = mSendRing.submitAndWait(count) < 0;
+        unsigned submitted = count - mSendRing.unsubmitted();
+        while (done < submitted) {
+            if (mSendRing.peekCompletion(&userData, &result)) {
+                ops[userData].result = result;
+                done++;
+            } else {
+                int ret = failed ? mSendRing.wait(submitted - done) :
+                        mSendRing.submitAndWait(submitted - done);
+                if (ret < 0) {
+                    // The ops in flight are unknown: the stream is lost
+                    mSendRing.close();
+                    mSendRingValid = false;
+                    for (unsigned i = first; i < ops.size(); i++) {
+                        ops[i].result = ret;
+                    }
+                    return first;
+                }
+                submitted = count - mSendRing.unsubmitted();
+            }
+        }
+        if (failed || submitted < count) {
+            // The ops not taken by the kernel are never started once the
+            // ring is closed, they are sent by hand
+            mSendRing.close();
+            mSendRingValid = false;
+        }
+
+        // Stop at the first op not fully sent: the next ones in the
+        // link were canceled
+        for (unsigned i = first; i < first + count; i++) {
+            if (ops[i].result != (int) ops[i].length) {
+                return i;
+            }
+        }
+        first += count;
+        if (!mSendRingValid) {
+            break;
+        }
+    }
+    return first;
+}
+
+void EIUringConnection::start() {
+    if (mUringAcceptor == 0) {
+        mUringAcceptor = new EIUringMessageAcceptor(this);
+    }
+}
+
+void EIUringConnection::stop() {
+    if (mUringAcceptor) {
+        mUringAcceptor->stop();
+        delete mUringAcceptor;
+        mUringAcceptor = 0;
+    }
+}
+
+void EIUringConnection::close()
+{
+    this->stop();
+    EIConnection::close();
+}
+
+#endif // USE_IO_URING
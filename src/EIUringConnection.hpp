@@ -0,0 +1,174 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#ifndef _EIURINGCONNECTION_H
+#define _EIURINGCONNECTION_H
+
+#ifdef USE_IO_URING
+
+#include <list>
+#include <vector>
+
+#ifdef USE_OPEN_THREADS
+#include "OpenThreads/Mutex"
+#include "OpenThreads/Condition"
+#elif USE_BOOST
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+#endif
+
+#include "IOUring.hpp"
+#include "EIConnection.hpp"
+
+namespace epi {
+namespace ei {
+
+using namespace epi::type;
+using namespace epi::error;
+using namespace epi::node;
+
+class EIUringMessageAcceptor;
+
+/**
+ * EIConnection that uses io_uring for the data transfer once the
+ * connection is set up by the EI library.
+ *
+ * Incoming packets are read with IORING_OP_READ_FIXED in a registered
+ * buffer, and several packets are decoded from each read. Outgoing
+ * messages of concurrent senders are grouped and submitted in one
+ * system call, the header and the payload of each message as linked
+ * sends (the payload is not copied).
+ *
+ * Terms are still encoded and decoded by EI, only the socket
+ * I/O is replaced.
+ */
+class EIUringConnection: public EIConnection
+{
+    friend class EIUringMessageAcceptor;
+public:
+    /**
+     * Create a new connection. The connection is stoped by default, and
+     * no receiver is defined.
+     * @param peer Peer information
+     * @param cookie Cookie for this connection
+     * @param aSocket Socket for this connection, already connected
+     *  by EI
+     */
+    EIUringConnection(PeerNode *peer, std::string cookie, Socket *aSocket);
+
+    virtual ~EIUringConnection();
+
+    virtual void sendBuf( epi::type::ErlPid* from,
+                          epi::type::ErlPid* to,
+                          epi::node::OutputBuffer* buffer )
+            throw (EpiConnectionException);
+
+    virtual void sendBuf( epi::type::ErlPid* from,
+                          const std::string &to,
+                          epi::node::OutputBuffer* buffer )
+            throw (EpiConnectionException);
+
+    virtual void sendBuf( ErlPid* from,
+                          const std::string &node,
+                          const std::string &to,
+                          OutputBuffer* buffer )
+            throw (EpiConnectionException);
+
+    virtual void start();
+    virtual void stop();
+    virtual void close();
+
+protected:
+
+    /**
+     * A distribution packet waiting to be sent
+     */
+    struct SendFrame {
+        char header[2048];
+        unsigned headerLength;
+        const char *payload;
+        unsigned payloadLength;
+        int result;
+        bool done;
+    };
+
+    /**
+     * One send operation of a frame (header or payload)
+     */
+    struct SendOp {
+        SendFrame *frame;
+        const char *data;
+        unsigned length;
+        int result;
+    };
+
+    /**
+     * Queue the frame and wait until it is sent. The first waiting
+     * thread sends all the queued frames.
+     * @throws EpiEIException if the frame could not be sent
+     */
+    void sendFrame(SendFrame *frame)
+            throw (EpiConnectionException);
+
+    /**
+     * Send a batch of frames, setting the result of each one.
+     */
+    void flushFrames(std::list<SendFrame *> &batch);
+
+    /**
+     * Send ops from first with the ring, until one is not fully sent.
+     * All the submitted ops are completed when it returns. If the ring
+     * fails it is closed, and not used again.
+     * @return the index of the first op not sent, ops.size() if all
+     *  of them were sent
+     */
+    unsigned submitOps(int fd, std::vector<SendOp> &ops, unsigned first);
+
+    /**
+     * Answer a tick from the peer
+     */
+    void sendTick();
+
+    EIUringMessageAcceptor *mUringAcceptor;
+
+    IOUring mSendRing;
+    bool mSendRingValid;
+    std::list<SendFrame *> mSendQueue;
+    bool mFlushing;
+
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::Mutex _sendMutex;
+    OpenThreads::Condition _sendCondition;
+    #elif USE_BOOST
+    boost::mutex _sendMutex;
+    boost::condition _sendCondition;
+    #endif
+};
+
+} // ei
+} // epi
+
+#endif // USE_IO_URING
+
+#endif
@@ -0,0 +1,79 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp"
+
+#ifdef USE_IO_URING
+
+#include "EIUringTransport.hpp"
+#include "EIUringConnection.hpp"
+#include "IOUring.hpp"
+
+using namespace epi::node;
+using namespace epi::error;
+using namespace epi::ei;
+
+ErlangTransport *
+        EIUringTransportFactory::newTransport(const std::string aNodeName,
+                                              const std::string aAliveName,
+                                              const std::string aHostName,
+                                              const std::string aCookie,
+                                              const int aPort)
+        throw (EpiException)
+{
+    return new EIUringTransport(aNodeName, aAliveName,
+                                aHostName, aCookie, aPort);
+}
+
+EIUringTransport::EIUringTransport( const std::string aNodeName,
+                                    const std::string aAliveName,
+                                    const std::string aHostName,
+                                    const std::string aCookie,
+                                    const int aPort)
+        throw( EpiBadArgument, EpiConnectionException ):
+        EITransport(aNodeName, aAliveName, aHostName, aCookie, aPort)
+{
+    // Check that the kernel supports the features we need
+    IOUring probe;
+    mUringEnabled = probe.create(1);
+    Dout(dc::connect, "EIUringTransport: io_uring " <<
+            (mUringEnabled ? "enabled" : "not available"));
+}
+
+EIUringTransport::~EIUringTransport()
+{
+}
+
+Connection* EIUringTransport::newConnection(PeerNode *peer,
+                                            const std::string cookie,
+                                            Socket *socket)
+{
+    if (mUringEnabled) {
+        return new EIUringConnection(peer, cookie, socket);
+    } else {
+        return EITransport::newConnection(peer, cookie, socket);
+    }
+}
+
+#endif // USE_IO_URING
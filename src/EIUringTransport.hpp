@@ -0,0 +1,95 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#ifndef _EIURINGTRANSPORT_HPP
+#define _EIURINGTRANSPORT_HPP
+
+#ifdef USE_IO_URING
+
+#include "EITransport.hpp"
+
+namespace epi {
+namespace ei {
+
+/**
+ * Factory for EIUringTransport. Registered as the "eiuring" protocol,
+ * so a node is created with a name like "eiuring:alive@host"
+ */
+class EIUringTransportFactory:  public EITransportFactory {
+public:
+    inline virtual ~EIUringTransportFactory() {}
+protected:
+    virtual ErlangTransport *newTransport(const std::string aNodeName,
+                                          const std::string aAliveName,
+                                          const std::string aHostName,
+                                          const std::string aCookie,
+                                          const int aPort)
+            throw (EpiException);
+};
+
+/**
+ * EITransport that creates EIUringConnection connections.
+ * The handshake (connect, accept and epmd) is done by the EI library,
+ * the connections use io_uring to transfer the data.
+ * If io_uring is not available in the running kernel, the
+ * transport creates plain EIConnection connections.
+ */
+class EIUringTransport: public EITransport {
+public:
+
+    /**
+     * Create a new transport
+     * @see EITransport
+     */
+    EIUringTransport(const std::string aNodeName,
+                     const std::string aAliveName,
+                     const std::string aHostName,
+                     const std::string aCookie,
+                     const int aPort = 0
+                    )
+            throw (EpiBadArgument, EpiConnectionException);
+
+    virtual ~EIUringTransport();
+
+    /**
+     * Check if io_uring is used by the connections
+     */
+    inline bool isUringEnabled() const {
+        return mUringEnabled;
+    }
+
+protected:
+    virtual Connection* newConnection(PeerNode *peer,
+                                      const std::string cookie,
+                                      Socket *socket);
+
+    bool mUringEnabled;
+};
+
+} // ei
+} // epi
+
+#endif // USE_IO_URING
+
+#endif
@@ -0,0 +1,124 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+/**
+ * Atomic operations on words and pointers, used by the lock-free
+ * structures of the library.
+ */
+
+#ifndef _EPIATOMIC_HPP
+#define _EPIATOMIC_HPP
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/**
+ * Storage class for variables with a copy per thread. Only for plain
+ * data initialized to zero.
+ */
+#ifdef _MSC_VER
+#define EPI_THREAD_LOCAL __declspec(thread)
+#else
+#define EPI_THREAD_LOCAL __thread
+#endif
+
+namespace epi {
+namespace util {
+
+/**
+ * Read a value shared with other threads. Writes done by the thread
+ * that stored it with atomicStore() are visible after this read.
+ */
+template<class T>
+inline T atomicLoad(T volatile const *ptr) {
+    #if defined(__ATOMIC_ACQUIRE)
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+    #elif defined(__GNUC__)
+    T value = *ptr;
+    __sync_synchronize();
+    return value;
+    #else
+    // volatile reads have acquire semantics in MSVC
+    return *ptr;
+    #endif
+}
+
+/**
+ * Write a value shared with other threads. All the previous writes
+ * are visible to the threads that read it with atomicLoad().
+ */
+template<class T>
+inline void atomicStore(T volatile *ptr, T value) {
+    #if defined(__ATOMIC_RELEASE)
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+    #elif defined(__GNUC__)
+    __sync_synchronize();
+    *ptr = value;
+    #else
+    // volatile writes have release semantics in MSVC
+    *ptr = value;
+    #endif
+}
+
+/**
+ * Set *ptr to newValue if it is oldValue. On Windows only pointers
+ * and longs are supported.
+ * @return true if the value was changed
+ */
+template<class T>
+inline bool atomicCompareAndSwap(T volatile *ptr, T oldValue, T newValue) {
+    #ifdef __GNUC__
+    return __sync_bool_compare_and_swap(ptr, oldValue, newValue);
+    #else
+    return InterlockedCompareExchangePointer(
+            (PVOID volatile *) ptr, (PVOID) newValue, (PVOID) oldValue) ==
+            (PVOID) oldValue;
+    #endif
+}
+
+inline bool atomicCompareAndSwap(long volatile *ptr, long oldValue, long newValue) {
+    #ifdef __GNUC__
+    return __sync_bool_compare_and_swap(ptr, oldValue, newValue);
+    #else
+    return InterlockedCompareExchange(ptr, newValue, oldValue) == oldValue;
+    #endif
+}
+
+/**
+ * Add a value to an integer
+ * @return the value before the addition
+ */
+inline long atomicFetchAdd(long volatile *ptr, long value) {
+    #ifdef __GNUC__
+    return __sync_fetch_and_add(ptr, value);
+    #else
+    return InterlockedExchangeAdd(ptr, value);
+    #endif
+}
+
+} // util
+} // epi
+
+#endif // _EPIATOMIC_HPP
@@ -25,6 +25,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "Config.hpp"
 
 #include <set>
+#include <memory>
+#include <algorithm>
 
 #ifdef USE_OPEN_THREADS
 #include <OpenThreads/ScopedLock>
@@ -35,10 +37,98 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include "EpiAutoNode.hpp"
 #include "PlainBuffer.hpp"
+#include "EpiAtomic.hpp"
+#include "StatsServer.hpp"
 
 using namespace epi::node;
 using namespace epi::type;
 using namespace epi::error;
+using namespace epi::util;
+
+/** Default time to wait for a new connection (ms) */
+static const long DEFAULT_CONNECT_TIMEOUT = 10000;
+
+namespace epi {
+namespace node {
+
+/*
+ * A message waiting for a connection. The buffer is a copy of
+ * the PlainBuffer given to sendBuf.
+ */
+struct AutoNode::PendingSend {
+    ErlTermPtr<ErlPid> from;
+    ErlTermPtr<ErlPid> to;
+    std::string toName;
+    std::auto_ptr<OutputBuffer> buffer;
+
+    PendingSend(ErlPid *aFrom, ErlPid *aTo, const std::string &aToName,
+                OutputBuffer *aBuffer):
+            from(aFrom), to(aTo), toName(aToName), buffer(aBuffer) {}
+};
+
+/**
+ * Thread that sets up the connection to a node for an AutoNode
+ */
+class AutoNodeConnector
+    #ifdef USE_OPEN_THREADS
+    : public OpenThreads::Thread
+    #endif
+{
+public:
+    /**
+     * The thread will start with creation of the object.
+     */
+    AutoNodeConnector(AutoNode *node, const std::string peer):
+            mNode(node), mPeer(peer), mDone(false)
+    {
+        #ifdef USE_OPEN_THREADS
+        start();
+        #elif USE_BOOST
+        m_thread = boost::shared_ptr<boost::thread>(
+            new boost::thread(boost::bind(&AutoNodeConnector::run, this))
+        );
+        #endif
+    }
+
+    /**
+     * Wait for the thread
+     */
+    ~AutoNodeConnector() {
+        #ifdef USE_OPEN_THREADS
+        if (this->isRunning()) {
+            this->join();
+        }
+        #elif USE_BOOST
+        m_thread->join();
+        #endif
+    }
+
+    void run() {
+        #ifdef CWDEBUG
+        epi::debug::setThreadDebugMargin();
+        #endif
+        mNode->doConnect(mPeer);
+        mDone = true;
+    }
+
+    /**
+     * Check if the connection attempt has finished
+     */
+    inline bool isDone() const {
+        return mDone;
+    }
+
+private:
+    AutoNode *mNode;
+    std::string mPeer;
+    volatile bool mDone;
+    #ifdef USE_BOOST
+    boost::shared_ptr<boost::thread> m_thread;
+    #endif
+};
+
+} // node
+} // epi
 
 /**
  * erase elements in a map by value
@@ -62,16 +152,57 @@ int eraseByValue(M &aMap, T &value) {
     return keys.size();
 }
 
+/*
+ * Get the term of a buffer sent to a local mailbox. If the buffer has
+ * only one term without variables, the term is shared by the sender
+ * and the receiver, without copying the buffer.
+ * @return the term, or 0 if the buffer must be copied
+ */
+static ErlTerm *localTerm(OutputBuffer *buffer) {
+    PlainBuffer *plainbuffer = (PlainBuffer *) buffer;
+    if (plainbuffer->size() != 1) {
+        return 0;
+    }
+    plainbuffer->resetIndex();
+    ErlTerm *term = plainbuffer->readTerm();
+    plainbuffer->resetIndex();
+    return term->hasVariables()? 0: term;
+}
+
+static SendMessage *newSendMessage(ErlPid *to, OutputBuffer *buffer) {
+    ErlTerm *term = localTerm(buffer);
+    if (term) {
+        return new SendMessage(to, term);
+    } else {
+        return new SendMessage(to, buffer->getInputBuffer());
+    }
+}
+
+static RegSendMessage *newRegSendMessage(ErlPid *from, const std::string &to,
+                                         OutputBuffer *buffer)
+{
+    ErlTerm *term = localTerm(buffer);
+    if (term) {
+        return new RegSendMessage(from, to, term);
+    } else {
+        return new RegSendMessage(from, to, buffer->getInputBuffer());
+    }
+}
+
 AutoNode::AutoNode( const std::string aNodeName )
     throw( EpiBadArgument, EpiConnectionException):
         LocalNode(aNodeName), mThreadExit(false),
+        mConnectTimeout(DEFAULT_CONNECT_TIMEOUT),
         #ifdef USE_BOOST
         m_threadRunning(0),
         #endif
         _connectionsMutex(), _mailboxesMutex(),
         _regmailboxesMutex(), _socketMutex(),
-        mMailBoxes(), mConnections(), mRegMailBoxes(),
-        mFlushConnections()
+        mMailBoxes(), mMailBoxTable(getCreation()), mUnindexedMailBoxes(0),
+        mConnections(), mReceivingConnections(), mRegMailBoxes(),
+        mFlushConnections(), mPendingSends(), mConnectors(),
+        mTimerService(), mDecodePool(), mRetiredStats(), mMailBoxStats(),
+        mStatsServer(0)
 {
 }
 
@@ -79,13 +210,17 @@ AutoNode::AutoNode( const std::string aNodeName,
                     const std::string aCookie)
         throw( EpiBadArgument, EpiConnectionException):
         LocalNode(aNodeName, aCookie), mThreadExit(false),
+        mConnectTimeout(DEFAULT_CONNECT_TIMEOUT),
         #ifdef USE_BOOST
         m_threadRunning(0),
         #endif
         _connectionsMutex(), _mailboxesMutex(),
         _regmailboxesMutex(), _socketMutex(),
-        mMailBoxes(), mConnections(), mRegMailBoxes(),
-        mFlushConnections()
+        mMailBoxes(), mMailBoxTable(getCreation()), mUnindexedMailBoxes(0),
+        mConnections(), mReceivingConnections(), mRegMailBoxes(),
+        mFlushConnections(), mPendingSends(), mConnectors(),
+        mTimerService(), mDecodePool(), mRetiredStats(), mMailBoxStats(),
+        mStatsServer(0)
 {
 }
 
@@ -94,17 +229,26 @@ AutoNode::AutoNode( const std::string aNodeName,
                     ErlangTransport *transport)
         throw( EpiBadArgument, EpiConnectionException):
         LocalNode(aNodeName, aCookie, transport), mThreadExit(false),
+        mConnectTimeout(DEFAULT_CONNECT_TIMEOUT),
         #ifdef USE_BOOST
         m_threadRunning(0),
         #endif
         _connectionsMutex(), _mailboxesMutex(), 
         _regmailboxesMutex(), _socketMutex(),
-        mMailBoxes(), mConnections(), mRegMailBoxes(),
-        mFlushConnections()
+        mMailBoxes(), mMailBoxTable(getCreation()), mUnindexedMailBoxes(0),
+        mConnections(), mReceivingConnections(), mRegMailBoxes(),
+        mFlushConnections(), mPendingSends(), mConnectors(),
+        mTimerService(), mDecodePool(), mRetiredStats(), mMailBoxStats(),
+        mStatsServer(0)
 {
 }
 
 AutoNode::~AutoNode() {
+    // Connectors use the connections lock, wait for them first
+    destroyConnectors();
+    // The server may be answering a request that takes the locks
+    stopStatsServer();
+
 #ifdef USE_OPEN_THREADS
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock1(_regmailboxesMutex);
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock2(_connectionsMutex);
@@ -133,14 +277,33 @@ AutoNode::~AutoNode() {
 }
 
 MailBox *AutoNode::createMailBox() {
-    MailBox* mailbox = newMailBox();
+    // The pid comes from a free slot of the table
+    unsigned number, serial;
+    bool reserved;
+    {
+        #ifdef USE_OPEN_THREADS
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mailboxesMutex);
+        #elif USE_BOOST
+        boost::mutex::scoped_lock lock(_mailboxesMutex);
+        #endif
+        reserved = mMailBoxTable.reserve(number, serial);
+    }
+    MailBox* mailbox = reserved?
+            new MailBox(new ErlPid(getNodeName(), number, serial, getCreation())):
+            newMailBox();
     mailbox->setSender(this);
+    mailbox->setTimerService(&mTimerService);
+    mailbox->setLatencyStats(&mMailBoxStats);
     addMailBox(mailbox);
     return mailbox;
 }
 
 void AutoNode::deattachMailBox(MailBox *mailbox) {
+    // The timers send with the node
+    mailbox->cancelTimers();
     mailbox->setSender(0);
+    mailbox->setTimerService(0);
+    mailbox->setLatencyStats(0);
     removeMailBox(mailbox);
 }
 
@@ -150,7 +313,7 @@ void AutoNode::registerMailBox(const std::string name, MailBox *mailbox) {
     #elif USE_BOOST
     boost::mutex::scoped_lock lock(_regmailboxesMutex);
     #endif
-    mRegMailBoxes[name] = mailbox;
+    mRegMailBoxes.insert(name, mailbox);
 }
 
 void AutoNode::unRegisterMailBox(const std::string name) {
@@ -159,7 +322,7 @@ void AutoNode::unRegisterMailBox(const std::string name) {
     #elif USE_BOOST
     boost::mutex::scoped_lock lock(_regmailboxesMutex);
     #endif
-    mRegMailBoxes.erase(name);
+    mRegMailBoxes.remove(name);
 }
 
 void AutoNode::unRegisterMailBox(MailBox* mailbox) {
@@ -168,8 +331,7 @@ void AutoNode::unRegisterMailBox(MailBox* mailbox) {
     #elif USE_BOOST
     boost::mutex::scoped_lock lock(_regmailboxesMutex);
     #endif
-    eraseByValue<registered_mailbox_map, std::string,
-    MailBox*, std::less<std::string> >(mRegMailBoxes, mailbox);
+    mRegMailBoxes.remove(mailbox);
 }
 
 
@@ -292,12 +454,135 @@ bool AutoNode::ping(const std::string remoteNode, long timeout) {
 		
 }
 
+void AutoNode::setConnectTimeout(long timeout) {
+    mConnectTimeout = timeout;
+}
+
+long AutoNode::getConnectTimeout() const {
+    return mConnectTimeout;
+}
+
+void AutoNode::setDecodeThreads(int threads) {
+    if (threads > 0 && mDecodePool.get() == 0) {
+        mDecodePool.reset(new DecodePool(threads));
+    }
+}
+
+void AutoNode::getLatencyStats(LatencyStats &stats) {
+    stats.add(mRetiredStats);
+    stats.add(mMailBoxStats);
+    {
+        #ifdef USE_OPEN_THREADS
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_connectionsMutex);
+        #elif USE_BOOST
+        boost::mutex::scoped_lock lock(_connectionsMutex);
+        #endif
+        for (connection_map::const_iterator p = mConnections.begin();
+             p != mConnections.end(); ++p)
+        {
+            stats.add(p->second->getLatencyStats());
+        }
+    }
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mailboxesMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(_mailboxesMutex);
+    #endif
+    for (mailbox_map::const_iterator p = mMailBoxes.begin();
+         p != mMailBoxes.end(); ++p)
+    {
+        if (p->second->hasOwnLatencyStats()) {
+            stats.add(*p->second->getLatencyStats());
+        }
+    }
+}
+
+bool AutoNode::getLatencyStats(const std::string &node, LatencyStats &stats) {
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_connectionsMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(_connectionsMutex);
+    #endif
+    connection_map::const_iterator it = mConnections.find(node);
+    if (it == mConnections.end()) {
+        return false;
+    }
+    stats.add(it->second->getLatencyStats());
+    return true;
+}
+
+void AutoNode::getMailBoxMemory(std::vector<MailBoxMemory> &stats) {
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mailboxesMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(_mailboxesMutex);
+    #endif
+    for (mailbox_map::const_iterator p = mMailBoxes.begin();
+         p != mMailBoxes.end(); ++p)
+    {
+        MailBoxMemory memory;
+        memory.pid = p->first.get();
+        memory.messages = p->second->queuedMessages();
+        memory.bytes = p->second->queuedBytes();
+        stats.push_back(memory);
+    }
+}
+
+void AutoNode::getConnectionStats(std::vector<ConnectionStats> &stats) {
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_connectionsMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(_connectionsMutex);
+    #endif
+    for (connection_map::const_iterator p = mConnections.begin();
+         p != mConnections.end(); ++p)
+    {
+        ConnectionStats connection;
+        connection.node = p->first;
+        connection.messagesIn = p->second->messagesIn();
+        connection.bytesIn = p->second->bytesIn();
+        connection.messagesOut = p->second->messagesOut();
+        connection.bytesOut = p->second->bytesOut();
+        stats.push_back(connection);
+    }
+}
+
+void AutoNode::attachConnection(Connection *connection) {
+    addConnection(connection);
+    connection->start();
+}
+
+void AutoNode::startStatsServer(const std::string &name) {
+    if (mStatsServer != 0) {
+        return;
+    }
+    MailBox *mailbox = createMailBox();
+    registerMailBox(name, mailbox);
+    mStatsServer = new StatsServer(this, mailbox, name);
+    mStatsServer->start();
+}
+
+void AutoNode::stopStatsServer() {
+    if (mStatsServer == 0) {
+        return;
+    }
+    std::auto_ptr<StatsServer> server(mStatsServer);
+    mStatsServer = 0;
+    MailBox *mailbox = server->getMailBox();
+    server->stop();
+    unRegisterMailBox(mailbox);
+    deattachMailBox(mailbox);
+    // Waits for a request being served
+    delete mailbox;
+}
+
 void AutoNode::deliver( void *origin, EpiMessage* msg ) {
     Dout(dc::connect, "AutoNode::deliver(msg)");
     switch(msg->messageType()) {
         case ERL_MSG_ERROR:
             // FIXME: Implement a system to notify connection failure
             removeConnection((Connection *) origin);
+            delete msg;
             break;
         case ERL_MSG_SEND:
             if (1==1) { // hardcoded scope :)
@@ -341,8 +626,10 @@ void AutoNode::deliver( void *origin, EpiMessage* msg ) {
         case ERL_MSG_LINK:
         case ERL_MSG_EXIT:
         // TODO: Add code for control messages
+            delete msg;
             break;
         default:
+            delete msg;
             break;
     }
 
@@ -354,23 +641,13 @@ void AutoNode::sendBuf( epi::type::ErlPid* from,
         throw (epi::error::EpiConnectionException)
 {
 
-    if (isSameHost(to->node(), this->getNodeName(), this->getHostName())) {
-        SendMessage *message = new SendMessage(to, buffer->getInputBuffer());
+    // Pid node names are full names, so isSameHost() is an equality
+    // that can be checked on the interned names
+    if (to->nodeIndex() == getNodeIndex()) {
+        SendMessage *message = newSendMessage(to, buffer);
         deliver(this, message);
     } else {
-        Connection *connection = attempConnection(to->node());
-
-        // Encode data to output buffer for this connection
-        PlainBuffer *plainbuffer = (PlainBuffer *) buffer;
-        OutputBuffer *outbuffer = connection->newOutputBuffer();
-        ErlTerm *t;
-        do {
-            t = plainbuffer->readTerm();
-            if (t) {
-                outbuffer->writeTerm(t);
-            }
-        } while (t != 0);
-        connection->sendBuf(from, to, outbuffer);
+        sendRemote(from, to, "", to->node(), buffer);
     }
 }
 
@@ -379,7 +656,7 @@ void AutoNode::sendBuf( epi::type::ErlPid* from,
                         epi::node::OutputBuffer* buffer )
         throw (epi::error::EpiConnectionException)
 {
-    RegSendMessage *message = new RegSendMessage(from, to, buffer->getInputBuffer());
+    RegSendMessage *message = newRegSendMessage(from, to, buffer);
     deliver(this, message);
 }
 
@@ -390,14 +667,69 @@ void AutoNode::sendBuf( epi::type::ErlPid* from,
         throw (epi::error::EpiConnectionException)
 {
     if (isSameHost(node, this->getNodeName(), this->getHostName())) {
-        RegSendMessage *message = new RegSendMessage(from, to, buffer->getInputBuffer());
+        RegSendMessage *message = newRegSendMessage(from, to, buffer);
         deliver(this, message);
     } else {
-        Connection *connection = attempConnection(node);
+        sendRemote(from, 0, to, node, buffer);
+    }
+}
+
+void AutoNode::sendRemote(ErlPid *from, ErlPid *to,
+                          const std::string &toName,
+                          const std::string &node,
+                          OutputBuffer *buffer)
+        throw (EpiConnectionException)
+{
+    Connection *connection = 0;
+    {
+        #ifdef USE_OPEN_THREADS
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_connectionsMutex);
+        #elif USE_BOOST
+        boost::mutex::scoped_lock lock(_connectionsMutex);
+        #endif
+        // While the queue of the node is being sent, messages go after
+        // it, even if a connection from the node was accepted meanwhile
+        bool connecting = mPendingSends.count(node) > 0;
+        if (!connecting && mConnections.count(node)) {
+            connection = mConnections[node];
+        } else {
+            // Queue the message. If there was not a queue for this node,
+            // start the connector.
+            mPendingSends[node].push_back(
+                    new PendingSend(from, to, toName,
+                                    new PlainBuffer(*(PlainBuffer *) buffer)));
+            if (!connecting) {
+                Dout(dc::connect, "["<<this<<"]"<< "AutoNode::sendRemote(): connecting to " << node);
+                // Delete the finished connectors
+                for (connector_list::iterator p = mConnectors.begin();
+                     p != mConnectors.end(); )
+                {
+                    if ((*p)->isDone()) {
+                        delete *p;
+                        p = mConnectors.erase(p);
+                    } else {
+                        ++p;
+                    }
+                }
+                mConnectors.push_back(new AutoNodeConnector(this, node));
+            }
+        }
+    }
+
+    if (connection) {
+        sendToConnection(connection, from, to, toName, buffer);
+    }
+}
 
-        // Encode data to output buffer for this connection
-        PlainBuffer *plainbuffer = (PlainBuffer *) buffer;
-        OutputBuffer *outbuffer = connection->newOutputBuffer();
+OutputBuffer *AutoNode::encodeForConnection(Connection *connection,
+                                            OutputBuffer *buffer)
+        throw (EpiConnectionException)
+{
+    PlainBuffer *plainbuffer = (PlainBuffer *) buffer;
+    plainbuffer->resetIndex();
+    OutputBuffer *outbuffer = connection->acquireOutputBuffer();
+    long long start = LatencyHistogram::now();
+    try {
         ErlTerm *t;
         do {
             t = plainbuffer->readTerm();
@@ -405,13 +737,201 @@ void AutoNode::sendBuf( epi::type::ErlPid* from,
                 outbuffer->writeTerm(t);
             }
         } while (t != 0);
+    } catch (...) {
+        connection->releaseOutputBuffer(outbuffer);
+        throw;
+    }
+    long long elapsed = LatencyHistogram::now() - start;
+    connection->getLatencyStats().stage(LATENCY_ENCODE).record(elapsed);
+    if (Trace::enabled(TRACE_CODEC)) {
+        Trace::record(TRACE_ENCODE, elapsed, 0, 0, 0);
+    }
+    return outbuffer;
+}
+
+void AutoNode::sendToConnection(Connection *connection, ErlPid *from,
+                                ErlPid *to, const std::string &toName,
+                                OutputBuffer *buffer)
+        throw (EpiConnectionException)
+{
+    // Encode data to output buffer for this connection
+    OutputBuffer *outbuffer = encodeForConnection(connection, buffer);
+
+    try {
+        if (to) {
+            connection->sendBuf(from, to, outbuffer);
+        } else {
+            connection->sendBuf(from, toName, outbuffer);
+        }
+    } catch (EpiConnectionException &) {
+        connection->releaseOutputBuffer(outbuffer);
+        throw;
+    }
+    connection->releaseOutputBuffer(outbuffer);
+}
+
+void AutoNode::doConnect(const std::string node) {
+    Connection *connection = 0;
+    std::string error = "Connection to " + node + " lost";
+    try {
+        connection = this->connect(node, mConnectTimeout);
+        connection->setReceiver(this);
+        connection->setDecodePool(mDecodePool.get());
+    } catch (EpiConnectionException &e) {
+        Dout(dc::connect, "["<<this<<"]"<< "AutoNode::doConnect(" << node <<
+                "): EpiConnectionException: \"" << e.getMessage() <<"\"");
+        error = e.getMessage();
+    }
+
+    // Publish the connection before starting it, so the messages the
+    // peer sends at once find it. If a connection from the node was
+    // accepted meanwhile, later messages must follow the queued ones,
+    // so ours replaces it and the accepted one is kept to receive.
+    if (connection) {
+        {
+            #ifdef USE_OPEN_THREADS
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_connectionsMutex);
+            #elif USE_BOOST
+            boost::mutex::scoped_lock lock(_connectionsMutex);
+            #endif
+            if (mConnections.count(node)) {
+                mReceivingConnections.push_back(mConnections[node]);
+            }
+            mConnections[node] = connection;
+        }
+        connection->start();
+    }
+
+    // Send the queued messages. Messages sent meanwhile are queued
+    // while the queue exists, to keep the message order. If the connect
+    // failed, but the node connected to us meanwhile, the queue is sent
+    // with that connection. Messages that can not be sent are reported
+    // to their senders.
+    pending_send_list sends;
+    bool finished = false;
+    while (!finished) {
+        Connection *target = 0;
+        {
+            #ifdef USE_OPEN_THREADS
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_connectionsMutex);
+            #elif USE_BOOST
+            boost::mutex::scoped_lock lock(_connectionsMutex);
+            #endif
+            if (mConnections.count(node)) {
+                target = mConnections[node];
+            }
+            pending_send_list &queue = mPendingSends[node];
+            sends.swap(queue);
+            if (sends.empty() || target == 0) {
+                mPendingSends.erase(node);
+                finished = true;
+            }
+        }
 
-        connection->sendBuf(from, to, outbuffer);
+        std::set<MailBox *> failed;
+        for (pending_send_list::const_iterator p = sends.begin();
+             p != sends.end(); ++p)
+        {
+            bool sent = false;
+            if (target) {
+                try {
+                    sendToConnection(target, (*p)->from.get(),
+                                     (*p)->to.get(), (*p)->toName,
+                                     (*p)->buffer.get());
+                    sent = true;
+                } catch (EpiException &e) {
+                    Dout(dc::connect, "["<<this<<"]"<< "AutoNode::doConnect(" << node <<
+                            "): EpiException: \"" << e.getMessage() <<"\"");
+                }
+            }
+            if (!sent && (*p)->from.get()) {
+                MailBox *sender = getMailBox((*p)->from.get());
+                if (sender && failed.insert(sender).second) {
+                    sender->deliver(this, new ErrorMessage(
+                            new EpiConnectionException(error)));
+                }
+            }
+            delete *p;
+        }
+        sends.clear();
+    }
+}
+
+void AutoNode::multicastBuf( epi::type::ErlPid* from,
+                             const std::vector<epi::type::ErlPid*> &to,
+                             epi::node::OutputBuffer* buffer )
+        throw (epi::error::EpiConnectionException)
+{
+    // Indexed by interned node name
+    typedef std::map<unsigned, std::vector<ErlPid*> > node_pids_map;
+
+    // Deliver to local mailboxes, grouping the others by node
+    node_pids_map remotePids;
+    for (std::vector<ErlPid*>::const_iterator p = to.begin(); p != to.end(); ++p) {
+        if ((*p)->nodeIndex() == getNodeIndex()) {
+            deliver(this, newSendMessage(*p, buffer));
+        } else {
+            remotePids[(*p)->nodeIndex()].push_back(*p);
+        }
+    }
+
+    // Send to each node, encoding the term once for each kind of
+    // buffer. The first error is thrown once all the nodes are done.
+    Connection *encodedConnections[OUTPUT_BUFFER_TYPES] = { 0 };
+    OutputBuffer *encoded[OUTPUT_BUFFER_TYPES] = { 0 };
+    std::auto_ptr<EpiConnectionException> error;
+    for (node_pids_map::const_iterator n = remotePids.begin();
+         n != remotePids.end(); ++n)
+    {
+        const std::string &node = NodeNames::name((*n).first);
+        const std::vector<ErlPid*> &pids = (*n).second;
+        try {
+            // Like sendRemote, go after the queued messages of the node
+            Connection *connection = 0;
+            {
+                #ifdef USE_OPEN_THREADS
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_connectionsMutex);
+                #elif USE_BOOST
+                boost::mutex::scoped_lock lock(_connectionsMutex);
+                #endif
+                if (mPendingSends.count(node) == 0 && mConnections.count(node)) {
+                    connection = mConnections[node];
+                }
+            }
+            if (connection == 0) {
+                // Queue the messages until the queue is sent
+                for (std::vector<ErlPid*>::const_iterator p = pids.begin();
+                     p != pids.end(); ++p)
+                {
+                    sendRemote(from, *p, "", node, buffer);
+                }
+                continue;
+            }
+            OutputBufferType type = connection->outputBufferType();
+            if (encoded[type] == 0) {
+                encoded[type] = encodeForConnection(connection, buffer);
+                encodedConnections[type] = connection;
+            }
+            connection->multicastBuf(from, pids, encoded[type]);
+        } catch (EpiConnectionException &e) {
+            if (error.get() == 0) {
+                error.reset(new EpiConnectionException(e));
+            }
+        }
+    }
+
+    for (int i = 0; i < OUTPUT_BUFFER_TYPES; i++) {
+        if (encoded[i]) {
+            encodedConnections[i]->releaseOutputBuffer(encoded[i]);
+        }
+    }
+    if (error.get()) {
+        throw EpiConnectionException(*error);
     }
 }
 
 OutputBuffer* AutoNode::newOutputBuffer() {
-    return new PlainBuffer();
+    return new PlainBuffer(true);
 }
 
 
@@ -424,43 +944,68 @@ void AutoNode::addMailBox(MailBox *mailbox) {
     #elif USE_BOOST
     boost::mutex::scoped_lock lock(_mailboxesMutex);
     #endif
-    mMailBoxes[mailbox->self()] = mailbox;
+    ErlPid *pid = mailbox->self();
+    mailbox_map::iterator it = mMailBoxes.find(pid);
+    if (it != mMailBoxes.end()) {
+        if (it->second == mailbox) {
+            return;
+        }
+        unindexMailBox(it->first.get(), it->second);
+        it->second = mailbox;
+    } else {
+        mMailBoxes[pid] = mailbox;
+    }
+    if (pid->nodeIndex() != getNodeIndex() || !mMailBoxTable.insert(pid, mailbox)) {
+        atomicFetchAdd(&mUnindexedMailBoxes, 1);
+    }
+}
+
+void AutoNode::unindexMailBox(ErlPid *pid, MailBox *mailbox) {
+    if (mMailBoxTable.find(pid) == mailbox) {
+        mMailBoxTable.remove(pid, mailbox);
+    } else {
+        atomicFetchAdd(&mUnindexedMailBoxes, -1);
+    }
 }
 
 MailBox *AutoNode::getMailBox(ErlPid *pid) {
+    MailBox *mailbox = mMailBoxTable.find(pid);
+    if (mailbox != 0 || atomicLoad(&mUnindexedMailBoxes) == 0) {
+        return mailbox;
+    }
+
+    // Mailboxes with pids not created by this node
     #ifdef USE_OPEN_THREADS
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mailboxesMutex);
     #elif USE_BOOST
     boost::mutex::scoped_lock lock(_mailboxesMutex);
     #endif
-    if (mMailBoxes.count(pid)) {
-        return mMailBoxes[pid];
-    } else {
-        return 0;
-    }
+    mailbox_map::const_iterator it = mMailBoxes.find(pid);
+    return it != mMailBoxes.end()? it->second: 0;
 }
 
 MailBox *AutoNode::getMailBox(std::string name) {
-    #ifdef USE_OPEN_THREADS
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_regmailboxesMutex);
-    #elif USE_BOOST
-    boost::mutex::scoped_lock lock(_regmailboxesMutex);
-    #endif
-    if (mRegMailBoxes.count(name)) {
-        return mRegMailBoxes[name];
-    } else {
-        return 0;
-    }
+    return mRegMailBoxes.find(name);
 }
 
 void AutoNode::removeMailBox(MailBox *mailbox) {
     // I don't use ScopedLock to prevent interlock
     _mailboxesMutex.lock();
-    eraseByValue<mailbox_map, ErlTermPtr<ErlPid>, MailBox*, ErlPidPtrCompare>(mMailBoxes, mailbox);
+    mailbox_map::iterator it = mMailBoxes.find(mailbox->self());
+    if (it != mMailBoxes.end() && it->second == mailbox) {
+        unindexMailBox(it->first.get(), mailbox);
+        mMailBoxes.erase(it);
+        if (mailbox->hasOwnLatencyStats()) {
+            mRetiredStats.add(*mailbox->getLatencyStats());
+        }
+    } else if (eraseByValue<mailbox_map, ErlTermPtr<ErlPid>, MailBox*, ErlPidPtrCompare>(mMailBoxes, mailbox) > 0 &&
+               mailbox->hasOwnLatencyStats())
+    {
+        mRetiredStats.add(*mailbox->getLatencyStats());
+    }
     _mailboxesMutex.unlock();
     _regmailboxesMutex.lock();
-    eraseByValue<registered_mailbox_map, std::string,
-    MailBox*, std::less<std::string> >(mRegMailBoxes, mailbox);
+    mRegMailBoxes.remove(mailbox);
     _regmailboxesMutex.unlock();
 }
 
@@ -483,8 +1028,15 @@ void AutoNode::addConnection(Connection* connection) {
     #elif USE_BOOST
     boost::mutex::scoped_lock lock(_connectionsMutex);
     #endif
-    mConnections[connection->getPeer()->getNodeName()] = connection;
+    std::string node = connection->getPeer()->getNodeName();
+    if (mConnections.count(node)) {
+        // Messages were sent with the other one, this one only receives
+        mReceivingConnections.push_back(connection);
+    } else {
+        mConnections[node] = connection;
+    }
     connection->setReceiver(this);
+    connection->setDecodePool(mDecodePool.get());
     // Flush the connections that must be deleted
     flushConnections();
 }
@@ -497,6 +1049,13 @@ void AutoNode::removeConnection(Connection* connection) {
     #endif
     int count =
             eraseByValue<connection_map, std::string, Connection*, std::less<std::string> >(mConnections, connection);
+    connection_list::iterator p = std::find(mReceivingConnections.begin(),
+                                            mReceivingConnections.end(),
+                                            connection);
+    if (p != mReceivingConnections.end()) {
+        mReceivingConnections.erase(p);
+        count++;
+    }
     // If count>0 => the connection belongs to this node and will be deleted
     if (count > 0) {
         mFlushConnections.push_back(connection);
@@ -504,26 +1063,27 @@ void AutoNode::removeConnection(Connection* connection) {
 }
 
 void AutoNode::flushConnections() {
-    for (connection_list::const_iterator p = mFlushConnections.begin(), end=mFlushConnections.end(); p != end; ++p)
+    for (connection_list::const_iterator p = mFlushConnections.begin(), end=mFlushConnections.end(); p != end; ++p) {
+        mRetiredStats.add((*p)->getLatencyStats());
         delete *p;
+    }
     mFlushConnections.clear();
 }
 
-Connection *AutoNode::attempConnection(std::string name)
-        throw (EpiConnectionException)
-{
-    Connection *connection = getConnection(name);
-    if (connection == 0) {
-        connection = this->connect(name);
-        addConnection(connection);
-        connection->start();
-    }
-    return connection;
+void AutoNode::destroyConnectors() {
+    connector_list connectors;
+    _connectionsMutex.lock();
+    connectors.swap(mConnectors);
+    _connectionsMutex.unlock();
+    for (connector_list::const_iterator p = connectors.begin(), end=connectors.end(); p != end; ++p)
+        delete *p;
 }
 
 void AutoNode::destroyConnections() {
     for (connection_map::const_iterator p = mConnections.begin(), end=mConnections.end(); p != end; ++p)
         delete (*p).second;
+    for (connection_list::const_iterator p = mReceivingConnections.begin(), end=mReceivingConnections.end(); p != end; ++p)
+        delete *p;
 }
 
 void AutoNode::destroyMailBoxes() {
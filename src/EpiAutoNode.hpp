@@ -44,6 +44,11 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "EpiLocalNode.hpp"
 #include "EpiConnection.hpp"
 #include "EpiMailBox.hpp"
+#include "MailBoxTable.hpp"
+#include "RegisteredNameTable.hpp"
+#include "TimerService.hpp"
+#include "DecodePool.hpp"
+#include "LatencyHistogram.hpp"
 
 namespace epi {
 namespace node {
@@ -51,6 +56,32 @@ namespace node {
 using namespace epi::type;
 using namespace epi::error;
 
+class AutoNodeConnector;
+class StatsServer;
+
+/**
+ * Messages queued in a mailbox, see AutoNode::getMailBoxMemory()
+ */
+struct MailBoxMemory {
+    ErlTermPtr<ErlPid> pid;
+    /** Number of queued messages */
+    int messages;
+    /** Bytes of the queued messages, see MailBox::queuedBytes() */
+    long bytes;
+};
+
+/**
+ * Traffic of a connection, see AutoNode::getConnectionStats()
+ */
+struct ConnectionStats {
+    /** Name of the peer node */
+    std::string node;
+    long messagesIn;
+    long bytesIn;
+    long messagesOut;
+    long bytesOut;
+};
+
 /**
  * Represents a local auto managed node. This class is used when you do not
  * wish to manage connections yourself - outgoing connections are
@@ -65,6 +96,12 @@ using namespace epi::error;
  * to that node. Any messages received will be delivered to the
  * appropriate mailboxes.
  *
+ * Connections are set up in background: the messages sent to a node
+ * while its connection is being set up are queued, and sent in order
+ * once it is ready. Only one connection attempt is made at the same
+ * time for each node. If the connection can not be set up (see
+ * setConnectTimeout()) the queued messages are discarded.
+ *
  * Mailboxes can be named using registerMailBox(). Messages
  * can be sent to named mailboxes and named Erlang processes without
  * knowing the {@link OtpErlangPid pid} that identifies the mailbox.
@@ -90,6 +127,8 @@ class AutoNode: public LocalNode, public EpiReceiver,
                 , public OpenThreads::Thread
                 #endif
 {
+    friend class AutoNodeConnector;
+
     /*
      * Necessary to allow do hashmap on ErlPidPtr :-P
      */
@@ -108,10 +147,17 @@ class AutoNode: public LocalNode, public EpiReceiver,
 
 
     typedef std::map<ErlTermPtr<ErlPid>, MailBox *, ErlPidPtrCompare> mailbox_map;
-    typedef std::map<std::string, MailBox *> registered_mailbox_map;
     typedef std::map<std::string, Connection *> connection_map;
     typedef std::list<Connection *> connection_list;
 
+    /*
+     * A message waiting for a connection
+     */
+    struct PendingSend;
+    typedef std::list<PendingSend *> pending_send_list;
+    typedef std::map<std::string, pending_send_list> pending_send_map;
+    typedef std::list<AutoNodeConnector *> connector_list;
+
 public:
     /**
      * Create a new node, using default cookie an any port
@@ -167,6 +213,14 @@ public:
      */
     void deattachMailBox(MailBox *mailbox);
 
+    /**
+     * Get the TimerService of this node. It is used for the
+     * timeouts of asyncReceive in the mailboxes of the node.
+     */
+    inline TimerService *getTimerService() {
+        return &mTimerService;
+    }
+
 
     /**
      * Register an MailBox with given name. MailBox must be associated
@@ -232,6 +286,81 @@ public:
 	**/
 	bool ping(const std::string remoteNode, long timeout);
 
+    /**
+     * Set the time to wait for a new connection to a node, in
+     * milliseconds. 0 to wait forever. Default is 10 seconds.
+     */
+    void setConnectTimeout(long timeout);
+
+    /**
+     * Get the time to wait for a new connection to a node.
+     */
+    long getConnectTimeout() const;
+
+    /**
+     * Decode the incoming messages in a pool of threads instead of the
+     * threads of the connections. Messages to the same recipient keep
+     * their order. It applies to the connections made after the call,
+     * and can only be set once, before the node is used.
+     * @param threads number of decoding threads. 0 (the default) to
+     *  decode in the connection threads
+     */
+    void setDecodeThreads(int threads);
+
+    /**
+     * Add the latencies of this node to the given stats: those of
+     * its connections and mailboxes, and those of the connections
+     * and mailboxes already removed. The mailboxes record in
+     * histograms shared by the node, unless they use their own, see
+     * MailBox::useOwnLatencyStats().
+     */
+    void getLatencyStats(epi::util::LatencyStats &stats);
+
+    /**
+     * Add the latencies of the connection with a node to the given
+     * stats.
+     * @return false if there is no connection with the node
+     */
+    bool getLatencyStats(const std::string &node,
+                         epi::util::LatencyStats &stats);
+
+    /**
+     * Add the queued messages of each mailbox of this node to the
+     * given list. The bytes are counted while
+     * MailBox::setByteAccounting() is on. The memory of the terms of
+     * all the nodes is counted by epi::type::TermStats.
+     */
+    void getMailBoxMemory(std::vector<MailBoxMemory> &stats);
+
+    /**
+     * Add the traffic of each connection of this node to the given
+     * list.
+     */
+    void getConnectionStats(std::vector<ConnectionStats> &stats);
+
+    /**
+     * Start serving the statistics of this node from a registered
+     * mailbox, so they can be queried from Erlang. See StatsServer
+     * for the requests and replies. Requests are served from the
+     * threads that deliver them, no thread is created.
+     * Does nothing if the server is already started.
+     * @param name name to register the mailbox with
+     */
+    void startStatsServer(const std::string &name = "epi_stats");
+
+    /**
+     * Stop serving the statistics and delete the mailbox of the
+     * server. Does nothing if it was not started.
+     */
+    void stopStatsServer();
+
+    /**
+     * Add a connection made without the transport of this node, like
+     * an epi::ei::ReplayConnection, and start it. It is used and
+     * deleted as the accepted connections.
+     */
+    void attachConnection(Connection *connection);
+
     /**
      * Deliver incoming message
      * This method will analize the message content, delivering it to the
@@ -242,7 +371,9 @@ public:
     /**
      * Create a new OutputBuffer to be used with this sender.
      * The output buffer used by AutoNode is a plain buffer that
-     * simply stores the term.
+     * simply stores the term. Terms are substituted only if they
+     * are delivered to a local mailbox, a remote send encodes them
+     * directly for the connection.
      */
     virtual OutputBuffer* newOutputBuffer();
 
@@ -271,6 +402,18 @@ public:
                   epi::node::OutputBuffer* buffer )
             throw (epi::error::EpiConnectionException);
 
+    /**
+     * Send a buffer to several pids. Local mailboxes get the same
+     * terms. For the remote nodes the terms are encoded only once: all
+     * the connections of the node come from the same transport and
+     * use the same encoding, so the encoded buffer is sent to every
+     * pid in every connection.
+     */
+    void multicastBuf( epi::type::ErlPid* from,
+                       const std::vector<epi::type::ErlPid*> &to,
+                       epi::node::OutputBuffer* buffer )
+            throw (epi::error::EpiConnectionException);
+
     /**
      * Receive an event from an observed object. If the sender is
      * a mailbox and event is EVENT_DESTROY, mailbox will be deleted
@@ -332,16 +475,42 @@ protected:
     void flushConnections();
 
     /**
-     * Get the connection for given name. If no connection exists,
-     * try to setup a connection, adding it to the map
+     * Send a buffer to a remote node, to a pid or to a registered name.
+     * If there is no connection for the node, the message is queued
+     * and a connector thread is started to set up the connection,
+     * if there is not one already.
      */
-    Connection *attempConnection(std::string name)
+    void sendRemote(ErlPid *from, ErlPid *to, const std::string &toName,
+                    const std::string &node, OutputBuffer *buffer)
             throw (EpiConnectionException);
 
+    /**
+     * Encode the terms of the plain buffer in a buffer from the pool
+     * of the connection. The caller must return it to the pool.
+     */
+    OutputBuffer *encodeForConnection(Connection *connection,
+                                      OutputBuffer *buffer)
+            throw (EpiConnectionException);
+
+    /**
+     * Encode the plain buffer for the connection and send it
+     */
+    void sendToConnection(Connection *connection, ErlPid *from,
+                          ErlPid *to, const std::string &toName,
+                          OutputBuffer *buffer)
+            throw (EpiConnectionException);
+
+    /**
+     * Set up the connection to a node and send the queued
+     * messages. Called by the connector thread.
+     */
+    void doConnect(const std::string node);
+
 
 private:
 
     bool mThreadExit;
+    long mConnectTimeout;
 
     #ifdef USE_OPEN_THREADS
     OpenThreads::Mutex _connectionsMutex;
@@ -361,15 +530,44 @@ private:
     #endif
     
     mailbox_map mMailBoxes;
+    // Lock-free index of mMailBoxes by pid, updated with _mailboxesMutex
+    MailBoxTable mMailBoxTable;
+    // Mailboxes in mMailBoxes that are not in mMailBoxTable
+    long volatile mUnindexedMailBoxes;
     connection_map mConnections;
-    registered_mailbox_map mRegMailBoxes;
+    // Connections accepted from a node while other connection to it
+    // was in use. They are not used to send.
+    connection_list mReceivingConnections;
+    // Lock-free table of names, updated with _regmailboxesMutex
+    RegisteredNameTable mRegMailBoxes;
     connection_list mFlushConnections;
+    pending_send_map mPendingSends;
+    connector_list mConnectors;
+    TimerService mTimerService;
+    std::auto_ptr<DecodePool> mDecodePool;
+    // Latencies of the connections and mailboxes removed
+    epi::util::LatencyStats mRetiredStats;
+    // Latencies of the mailboxes without their own histograms
+    epi::util::LatencyStats mMailBoxStats;
+    // Statistics server, 0 if not started
+    StatsServer *mStatsServer;
 
     /*
      * Close and delete all connections. To be used in destructor
      */
     void destroyConnections();
 
+    /*
+     * Wait for the connector threads. To be used in destructor
+     */
+    void destroyConnectors();
+
+    /*
+     * Remove a mailbox of mMailBoxes from mMailBoxTable.
+     * To be called with _mailboxesMutex locked
+     */
+    void unindexMailBox(ErlPid *pid, MailBox *mailbox);
+
     /*
      * Close and delete all mailboxes. To be used in destructor
      */
@@ -26,22 +26,73 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include <sstream>
 
+#ifdef USE_OPEN_THREADS
+#include <OpenThreads/Thread>
+#include <OpenThreads/ScopedLock>
+#elif USE_BOOST
+#include <boost/thread/thread.hpp>
+#endif
+
 #include "EpiError.hpp"
 #include "EpiNode.hpp"
 #include "EpiConnection.hpp"
 #include "EpiBuffer.hpp"
 #include "EpiUtil.hpp"
+#include "EpiAtomic.hpp"
 
 using namespace epi::error;
 using namespace epi::node;
 using namespace epi::util;
 
+/** Max number of buffers kept in the pool of a connection */
+static const unsigned MAX_POOLED_BUFFERS = 8;
+
 Connection::Connection( PeerNode * peer, std::string cookie ):
-        mPeer(peer), mCookie(cookie)
+        mPeer(peer), mCookie(cookie),
+        mDecodePool(0), mInFlight(0), mMessagesIn(0), mBytesIn(0),
+        mMessagesOut(0), mBytesOut(0), mBufferPool()
 {}
 
 Connection::~ Connection( )
 {
+    waitDecoded();
+    for (std::vector<OutputBuffer *>::const_iterator p = mBufferPool.begin();
+         p != mBufferPool.end(); ++p)
+    {
+        delete *p;
+    }
+}
+
+OutputBuffer* Connection::acquireOutputBuffer() {
+    {
+        #ifdef USE_OPEN_THREADS
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_poolMutex);
+        #elif USE_BOOST
+        boost::mutex::scoped_lock lock(_poolMutex);
+        #endif
+        if (!mBufferPool.empty()) {
+            OutputBuffer *buffer = mBufferPool.back();
+            mBufferPool.pop_back();
+            return buffer;
+        }
+    }
+    return newOutputBuffer();
+}
+
+void Connection::releaseOutputBuffer(OutputBuffer *buffer) {
+    buffer->reset();
+    {
+        #ifdef USE_OPEN_THREADS
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_poolMutex);
+        #elif USE_BOOST
+        boost::mutex::scoped_lock lock(_poolMutex);
+        #endif
+        if (mBufferPool.size() < MAX_POOLED_BUFFERS) {
+            mBufferPool.push_back(buffer);
+            return;
+        }
+    }
+    delete buffer;
 }
 
 std::string Connection::getCookie() const {
@@ -56,9 +107,46 @@ void Connection::setReceiver(EpiReceiver *receiver) {
     mReceiver = receiver;
 }
 
+void Connection::setDecodePool(DecodePool *pool) {
+    mDecodePool = pool;
+}
+
 void Connection::deliver( void *origin, EpiMessage * msg ) {
+    if (msg->instanceOf(ERL_MSG_ERLANG)) {
+        if (mDecodePool != 0) {
+            atomicFetchAdd(&mInFlight, 1);
+            mDecodePool->submit(mReceiver, origin, (ErlangMessage *) msg,
+                                &mInFlight,
+                                &mLatencyStats.stage(LATENCY_DECODE));
+            return;
+        }
+        // Decode it in this thread. Errors are found by the recipient
+        long long start = LatencyHistogram::now();
+        try {
+            ((ErlangMessage *) msg)->getMsg();
+        } catch (EpiDecodeException &) {
+        }
+        long long elapsed = LatencyHistogram::now() - start;
+        mLatencyStats.stage(LATENCY_DECODE).record(elapsed);
+        if (Trace::enabled(TRACE_CODEC)) {
+            TraceMessage(TRACE_DECODE, msg, elapsed, 0);
+        }
+    }
+    // Keep the order with the messages being decoded, an error must
+    // not overtake them
+    waitDecoded();
     // Forward it to receiver
     mReceiver->deliver(origin, msg);
 }
 
+void Connection::waitDecoded() {
+    while (atomicLoad(&mInFlight) > 0) {
+        #ifdef USE_OPEN_THREADS
+        OpenThreads::Thread::YieldCurrentThread();
+        #elif USE_BOOST
+        boost::thread::yield();
+        #endif
+    }
+}
+
 
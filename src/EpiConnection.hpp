@@ -25,15 +25,38 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #ifndef _EPICONNECTION_H
 #define _EPICONNECTION_H
 
+#include <vector>
+
+#ifdef USE_OPEN_THREADS
+#include "OpenThreads/Mutex"
+#elif USE_BOOST
+#include <boost/thread/mutex.hpp>
+#endif
+
 #include "EpiNode.hpp"
 #include "EpiMessage.hpp"
 #include "EpiObserver.hpp"
 #include "EpiReceiver.hpp"
 #include "EpiSender.hpp"
+#include "DecodePool.hpp"
+#include "EpiAtomic.hpp"
+#include "LatencyHistogram.hpp"
 
 namespace epi {
 namespace node {
 
+/**
+ * Kinds of the OutputBuffers of the connections. A buffer can be sent
+ * by any connection whose buffers are of the same kind.
+ */
+enum OutputBufferType {
+    /** PlainBuffer, the terms are not encoded */
+    PLAIN_OUTPUT_BUFFER,
+    /** EIOutputBuffer, the terms are encoded by ei */
+    EI_OUTPUT_BUFFER,
+    OUTPUT_BUFFER_TYPES
+};
+
 /**
  * This class represents a connection with an erlang node
  */
@@ -60,6 +83,24 @@ public:
      */
     virtual OutputBuffer* newOutputBuffer() = 0;
 
+    /**
+     * Get the kind of the buffers created by newOutputBuffer()
+     */
+    virtual OutputBufferType outputBufferType() const = 0;
+
+    /**
+     * Get an OutputBuffer from the pool of this connection, or
+     * a new one if the pool is empty. The buffer must be returned
+     * with releaseOutputBuffer().
+     */
+    OutputBuffer* acquireOutputBuffer();
+
+    /**
+     * Reset the buffer and return it to the pool of this connection.
+     * The buffer is deleted if the pool is full.
+     */
+    void releaseOutputBuffer(OutputBuffer *buffer);
+
     /**
      * Send a buffer to a pid.
      * @param from From pid
@@ -134,17 +175,100 @@ public:
      */
     void setReceiver(EpiReceiver *receiver);
 
+    /**
+     * Set a pool to decode the incoming messages. The thread of the
+     * connection will only read them. It must be set before start(),
+     * and the pool must outlive the connection. Without a pool the
+     * messages are decoded by deliver().
+     * @param pool pool to use, 0 to decode in the connection thread
+     */
+    void setDecodePool(DecodePool *pool);
+
+    /**
+     * Get the pool decoding the incoming messages, if any
+     */
+    inline DecodePool *getDecodePool() const {
+        return mDecodePool;
+    }
+
     /**
      * Deliver a message to this connection. The connection will
-     * foward it to the receiver
+     * foward it to the receiver. With a decode pool, erlang messages
+     * are delivered by the pool, and other messages are delivered
+     * once the pool has delivered the previous ones.
      */
     void deliver( void *origin, epi::node::EpiMessage* msg );
 
+    /**
+     * Get the latencies of this connection: reading, decoding, encoding
+     * and sending its messages
+     */
+    inline epi::util::LatencyStats &getLatencyStats() {
+        return mLatencyStats;
+    }
+
+    /**
+     * Count a message read from the peer, with its size on the wire.
+     * Called by the transports.
+     */
+    inline void countIn(unsigned bytes) {
+        epi::util::atomicFetchAdd(&mMessagesIn, 1);
+        epi::util::atomicFetchAdd(&mBytesIn, (long) bytes);
+    }
+
+    /**
+     * Count a message sent to the peer, with its size on the wire.
+     * Called by the transports.
+     */
+    inline void countOut(unsigned bytes) {
+        epi::util::atomicFetchAdd(&mMessagesOut, 1);
+        epi::util::atomicFetchAdd(&mBytesOut, (long) bytes);
+    }
+
+    /** Get the number of messages read from the peer */
+    inline long messagesIn() const {
+        return epi::util::atomicLoad(&mMessagesIn);
+    }
+
+    /** Get the bytes of the messages read from the peer */
+    inline long bytesIn() const {
+        return epi::util::atomicLoad(&mBytesIn);
+    }
+
+    /** Get the number of messages sent to the peer */
+    inline long messagesOut() const {
+        return epi::util::atomicLoad(&mMessagesOut);
+    }
+
+    /** Get the bytes of the messages sent to the peer */
+    inline long bytesOut() const {
+        return epi::util::atomicLoad(&mBytesOut);
+    }
 
 protected:
     EpiReceiver *mReceiver;
     std::auto_ptr<PeerNode> mPeer;
     std::string mCookie;
+    epi::util::LatencyStats mLatencyStats;
+
+private:
+    /*
+     * Wait until the messages given to the decode pool are delivered
+     */
+    void waitDecoded();
+
+    DecodePool *mDecodePool;
+    long volatile mInFlight;
+    long volatile mMessagesIn;
+    long volatile mBytesIn;
+    long volatile mMessagesOut;
+    long volatile mBytesOut;
+    std::vector<OutputBuffer *> mBufferPool;
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::Mutex _poolMutex;
+    #elif USE_BOOST
+    boost::mutex _poolMutex;
+    #endif
 
 };
 
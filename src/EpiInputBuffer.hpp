@@ -25,6 +25,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #ifndef _EPIINPUTBUFFER_H
 #define _EPIINPUTBUFFER_H
 
+#include <set>
+
 #include "EpiBuffer.hpp"
 
 
@@ -48,6 +50,15 @@ public:
      * to decode
      */
     virtual ErlTerm* readTerm() throw(EpiDecodeException) = 0;
+
+    /**
+     * Get the memory held by this buffer. The terms in visited are
+     * not counted, see ErlTerm::memoryFootprint().
+     * Default: 0
+     */
+    virtual size_t memoryFootprint(std::set<const ErlTerm*> &visited) const {
+        return 0;
+    }
 };
 
 } // node
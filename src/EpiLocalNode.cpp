@@ -29,6 +29,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "EpiMailBox.hpp"
 #include "EpiConnection.hpp"
 #include "EpiUtil.hpp"
+#include "EpiAtomic.hpp"
 
 #include "ErlangTransportManager.hpp"
 
@@ -37,12 +38,27 @@ using namespace epi::error;
 using namespace epi::type;
 using namespace epi::util;
 
+/** Refs reserved by a thread at once */
+static const unsigned long long REF_BATCH_SIZE = 1024;
+
+/*
+ * Refs reserved by the current thread for the node with the
+ * given instance number
+ */
+struct RefRange {
+    long node;
+    unsigned long long next;
+    unsigned long long end;
+};
+
+static EPI_THREAD_LOCAL RefRange tRefRange;
 
 //////////////////////////////////////////////////////////////////////////
 // LocalNode
 LocalNode::LocalNode(const std::string aNodeName)
         throw (EpiBadArgument, EpiConnectionException, EpiException):
-        mCreation(smCreationCounter++)
+        mInstance(atomicFetchAdd(&smCreationCounter, 1)),
+        mCreation((short) mInstance)
 {
     Dout_continue(dc::connect, _continue, " failed.",
                   "new LocalNode(name="<< aNodeName <<
@@ -54,7 +70,8 @@ LocalNode::LocalNode(const std::string aNodeName)
 
 LocalNode::LocalNode(const std::string aNodeName, const std::string aCookie)
         throw (EpiBadArgument, EpiConnectionException, EpiException):
-        mCreation(smCreationCounter++)
+        mInstance(atomicFetchAdd(&smCreationCounter, 1)),
+        mCreation((short) mInstance)
 {
     Dout_continue(dc::connect, _continue, " failed.",
             "new LocalNode(name="<< aNodeName <<
@@ -68,7 +85,8 @@ LocalNode::LocalNode(const std::string aNodeName,
                      const std::string aCookie,
                      ErlangTransport *transport)
         throw (EpiBadArgument, EpiConnectionException):
-        mCreation(smCreationCounter++)
+        mInstance(atomicFetchAdd(&smCreationCounter, 1)),
+        mCreation((short) mInstance)
 {
     Dout_continue(dc::connect, _continue, " failed.",
                   "new LocalNode(name="<< aNodeName <<
@@ -92,10 +110,7 @@ void LocalNode::init(const std::string aNodeId,
     // Init the counters
     mPidCount = 1;
     mPortCount = 1;
-    mSerial = 0;
-    mRefId[0] = 1;
-    mRefId[1] = 0;
-    mRefId[2] = 0;
+    mRefBatch = 0;
 
     mCookie = aCookie;
 
@@ -111,51 +126,38 @@ void LocalNode::init(const std::string aNodeId,
 
 
 ErlPid* LocalNode::createPid() {
-    ErlPid *p = new ErlPid(mNodeName, mPidCount, mSerial, mCreation);
-
-    mPidCount++;
-    if (mPidCount > 0x7fff) {
-        mPidCount = 0;
-
-        mSerial++;
-        if (mSerial > 0x1fff) { /* 13 bits */
-            mSerial = 0;
-        }
-    }
-
-    return p;
+    // pid number (15 bits) and serial (13 bits). The highest serial
+    // bit is left for the pids of the mailbox table of AutoNode
+    unsigned long count = (unsigned long) atomicFetchAdd(&mPidCount, 1);
+    return new ErlPid(mNodeName, count & 0x7fff, (count >> 15) & 0xfff,
+                      mCreation);
 }
 
 ErlPort* LocalNode::createPort() {
-    ErlPort *newPort =
-            new ErlPort(getNodeName(),mPortCount,getCreation());
-
-    mPortCount++;
-
-    if (mPortCount > 0xfffffff) { /* 28 bits */
-        mPortCount = 0;
-    }
-
-    return newPort;
-
+    unsigned long count = (unsigned long) atomicFetchAdd(&mPortCount, 1);
+    return new ErlPort(mNodeName, count & 0xfffffff /* 28 bits */,
+                       mCreation);
 }
 
 ErlRef* LocalNode::createRef() {
-    ErlRef *newRef =
-            new ErlRef(getNodeName(), mRefId, getCreation());
-
-    // increment ref ids (3 ints: 18 + 32 + 32 bits)
-    mRefId[0]++;
-    if (mRefId[0] > 0x3ffff) {
-        mRefId[0] = 0;
-
-        mRefId[1]++;
-        if (mRefId[1] == 0) {
-            mRefId[2]++;
+    RefRange &range = tRefRange;
+    if (range.node != mInstance || range.next == range.end) {
+        unsigned long batch = (unsigned long) atomicFetchAdd(&mRefBatch, 1);
+        range.node = mInstance;
+        range.next = batch * REF_BATCH_SIZE;
+        range.end = range.next + REF_BATCH_SIZE;
+        if (range.next == 0) {
+            range.next = 1;
         }
     }
 
-    return newRef;
+    // ref ids (3 ints: 18 + 32 + 32 bits)
+    unsigned long long id = range.next++;
+    unsigned int ids[3];
+    ids[0] = (unsigned int) (id & 0x3ffff);
+    ids[1] = (unsigned int) (id >> 18);
+    ids[2] = (unsigned int) (id >> 50);
+    return new ErlRef(mNodeName, ids, mCreation);
 }
 
 Connection* LocalNode::connect(const std::string node)
@@ -170,6 +172,12 @@ Connection* LocalNode::connect(const std::string node, const std::string cookie)
     return mTransport->connect(node, cookie);
 }
 
+Connection* LocalNode::connect(const std::string node, long timeout)
+        throw(EpiConnectionException)
+{
+    return mTransport->connect(node, timeout);
+}
+
 Connection* LocalNode::accept(long timeout)
         throw(EpiConnectionException)
 {
@@ -208,4 +216,4 @@ MailBox *LocalNode::createMailBox(Connection *connection) {
 
 
 // node creation counter
-short LocalNode::smCreationCounter = 0;
+long volatile LocalNode::smCreationCounter = 0;
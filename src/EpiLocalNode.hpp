@@ -77,17 +77,18 @@ public:
     ~LocalNode();
 
     /**
-     * Create  a new unique pid
+     * Create  a new unique pid. Can be called from any thread.
      */
     ErlPid* createPid();
 
     /**
-     * Create  a new unique port
+     * Create  a new unique port. Can be called from any thread.
      */
     ErlPort* createPort();
 
     /**
-     * Create  a new unique ref
+     * Create  a new unique ref. Can be called from any thread, each
+     * thread takes the ref ids from its own range.
      */
     ErlRef* createRef();
 
@@ -120,6 +121,17 @@ public:
     Connection* connect(const std::string node, const std::string cookie)
             throw(EpiConnectionException);
 
+    /**
+     * Set up a connection to an Erlang node, using the default cookie
+     * and giving up after the given time.
+     * @param node node name to connect
+     * @param timeout timeout in milliseconds. 0 to infinite
+     * @returns A new connection. The connection has no receiver defined
+     * and is not started.
+     */
+    Connection* connect(const std::string node, long timeout)
+            throw(EpiConnectionException);
+
     /**
      * Accept a connection from a client process.
      * This method sets the socket to listen incoming connections.
@@ -175,13 +187,16 @@ protected:
             throw (EpiException);
 
 
+    // Unique number of this node in the process
+    long mInstance;
     short mCreation;
-    static short smCreationCounter;
+    static long volatile smCreationCounter;
 
-    unsigned int mPidCount;
-    unsigned int mPortCount;
-    unsigned int mSerial;
-    unsigned int mRefId[3];
+    // Updated atomically. The pid number and serial are taken from
+    // mPidCount, the ref ids are reserved in batches from mRefBatch.
+    long volatile mPidCount;
+    long volatile mPortCount;
+    long volatile mRefBatch;
 
     ErlangTransport* mTransport;
 };
@@ -24,13 +24,30 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include "Config.hpp" // Main config file
 
+#ifdef USE_OPEN_THREADS
+#include <OpenThreads/Thread>
+#include <OpenThreads/ScopedLock>
+#elif USE_BOOST
+#include <boost/thread/thread.hpp>
+#endif
+
 #include "EpiMailBox.hpp"
 #include "EpiBuffer.hpp"
 #include "PatternMatchingGuard.hpp"
+#include "MailBoxExecutor.hpp"
+#include "EpiAtomic.hpp"
+#include "EpiProbes.hpp"
 #include "ErlTypes.hpp"
+#include "EpiUtil.hpp"
 
 using namespace epi::node;
 using namespace epi::type;
+using namespace epi::util;
+
+// Constant atoms of the rpc requests, shared by all of them. They are
+// frozen, so their encoding is copied into the request
+static ErlTermPtr<ErlTerm> RPC_CALL(FreezeTerm(new ErlAtom("call")));
+static ErlTermPtr<ErlTerm> RPC_USER(FreezeTerm(new ErlAtom("user")));
 
 bool MailBoxGuard::check(void* ptr) {
     EpiMessage *msg = (EpiMessage *) ptr;
@@ -66,9 +83,146 @@ bool MailBoxGuard::check(void* ptr) {
 
 }
 
+namespace epi {
+namespace node {
+
+/*
+ * A receive waiting for a message in MailBox::mPending. The guard and
+ * the callback are owned when the mailbox creates them.
+ */
+struct MailBox::PendingReceive: public TimerTask {
+    MailBox *mailbox;
+    MailBoxGuard *guard;
+    ReceiveCallback *callback;
+    // Callback given to asyncReceive or asyncRPC, to cancel
+    const void *owner;
+    // Service with the timeout, if any
+    TimerService *timers;
+    std::auto_ptr<MailBoxGuard> ownedGuard;
+    std::auto_ptr<ReceiveCallback> ownedCallback;
+
+    PendingReceive(MailBox *aMailBox, MailBoxGuard *aGuard,
+                   ReceiveCallback *aCallback, const void *aOwner):
+            mailbox(aMailBox), guard(aGuard), callback(aCallback),
+            owner(aOwner), timers(0) {}
+
+    /**
+     * Call the callback with the message, or with 0 on timeout
+     */
+    void complete(EpiMessage *msg) {
+        std::auto_ptr<EpiMessage> message(msg);
+        try {
+            if (msg == 0) {
+                callback->received(0);
+            } else if (msg->instanceOf(ERL_MSG_ERROR)) {
+                callback->failed(*((ErrorMessage *) msg)->getException());
+            } else if (msg->instanceOf(ERL_MSG_ERLANG)) {
+                callback->received((ErlangMessage *) message.release());
+            } else {
+                EpiConnectionException error("Unknown messageType");
+                callback->failed(error);
+            }
+        } catch (EpiException &e) {
+            Dout(dc::connect, "["<<mailbox<<"]"<<
+                 "Exception in asyncReceive callback: " << e.getMessage());
+        }
+    }
+
+    void expired() {
+        if (mailbox->removePending(this)) {
+            complete(0);
+            delete this;
+        }
+    }
+};
+
+/*
+ * A term to send when the timer of sendAfter expires
+ */
+struct MailBox::DelayedSend: public TimerTask {
+    MailBox *mailbox;
+    unsigned long id;
+    TimerService *timers;
+    ErlTermPtr<ErlPid> to;
+    ErlTermPtr<ErlTerm> term;
+    // Sending the term, with the _pendingMutex of the mailbox
+    bool running;
+
+    DelayedSend(MailBox *aMailBox, unsigned long aId, TimerService *aTimers,
+                ErlPid *aTo, ErlTerm *aTerm):
+            mailbox(aMailBox), id(aId), timers(aTimers), to(aTo), term(aTerm),
+            running(false) {}
+
+    void expired() {
+        if (!mailbox->startDelayedSend(this)) {
+            // Cancelled, cancelTimer or ~MailBox deletes it
+            return;
+        }
+        try {
+            mailbox->send(to.get(), term.get());
+        } catch (EpiException &e) {
+            Dout(dc::connect, "["<<mailbox<<"]"<<
+                 "Exception in sendAfter: " << e.getMessage());
+        }
+        // The mailbox can be deleted once this is done
+        mailbox->finishDelayedSend(this);
+        delete this;
+    }
+};
+
+/*
+ * Turns the {rex, Response} message into the RPCCallback calls
+ */
+class RPCReceive: public ReceiveCallback {
+public:
+    RPCReceive(RPCCallback *callback): mCallback(callback) {}
+
+    void received(ErlangMessage *msg) {
+        std::auto_ptr<ErlangMessage> message(msg);
+        if (msg == 0) {
+            mCallback->replied(0);
+            return;
+        }
+        ErlTermPtr<ErlTuple> rex;
+        try {
+            rex.reset((ErlTuple *) msg->getMsg());
+        } catch (EpiDecodeException &e) {
+            mCallback->failed(e);
+            return;
+        }
+
+        ErlTermPtr<ErlTerm> badrpc_pattern(
+                new ErlTuple(new ErlAtom("rex"),
+                             new ErlTuple(new ErlAtom("badrpc"),
+                                          new ErlVariable("Reason"))));
+        VariableBinding binding;
+        if (rex->match(badrpc_pattern.get(), &binding)) {
+            EpiBadRPC error(binding.search("Reason"));
+            mCallback->failed(error);
+            return;
+        }
+        mCallback->replied(rex->elementAt(1));
+    }
+
+    void failed(EpiConnectionException &error) {
+        mCallback->failed(error);
+    }
 
+private:
+    RPCCallback *mCallback;
+};
 
-MailBox::MailBox(ErlPid *self): mSelf(self) {
+} // node
+} // epi
+
+long volatile MailBox::sByteAccounting = 0;
+
+MailBox::MailBox(ErlPid *self):
+        mSelf(self), mLatencyStats(0), mOwnLatencyStats(),
+        mExecutor(0), mHandler(0), mScheduled(0),
+        mTimerService(0), mPending(), mPendingCount(0), mDelayedSends(),
+        mNextTimer(0), mDelivering(0), mQueuedBytes(0)
+{
     Dout(dc::connect, "["<< this << "]" << "MailBox::MailBox(" << self->toString() << ")");
 }
 
@@ -76,6 +230,35 @@ MailBox::~MailBox( )
 {
     Dout(dc::connect, "MailBox::~MailBox");
 
+    MailBoxExecutor *executor = atomicLoad(&mExecutor);
+    if (executor) {
+        executor->detach(this);
+    }
+
+    cancelTimers();
+
+    // A receiver can take a message and delete the mailbox while the
+    // thread that put it is still in deliver()
+    while (atomicLoad(&mDelivering) > 0) {
+        #ifdef USE_OPEN_THREADS
+        OpenThreads::Thread::YieldCurrentThread();
+        #elif USE_BOOST
+        boost::thread::yield();
+        #endif
+    }
+
+    // Drop the pending receives
+    _pendingMutex.lock();
+    pending_list pending;
+    pending.swap(mPending);
+    _pendingMutex.unlock();
+    for (pending_list::iterator it = pending.begin(); it != pending.end(); ++it) {
+        if ((*it)->timers) {
+            (*it)->timers->cancel(*it);
+        }
+        delete *it;
+    }
+
     // Delete all pending messages
     mQueue.flush();
 
@@ -97,7 +280,25 @@ void MailBox::deliver( void *origin, epi::node::EpiMessage* msg ) {
         // What about put this at the head of queue???
     case ERL_MSG_SEND:
     case ERL_MSG_REG_SEND:
+        atomicFetchAdd(&mDelivering, 1);
+        EPI_PROBE3(mailbox__deliver, this, mSelf->key(), msg->messageType());
+        if (atomicLoad(&sByteAccounting)) {
+            long bytes = (long) msg->memoryFootprint();
+            msg->setQueuedBytes(bytes);
+            atomicFetchAdd(&mQueuedBytes, bytes);
+        }
+        if (Trace::enabled(TRACE_MAILBOX)) {
+            TraceMessage(TRACE_DELIVER, msg, 0, 0, mSelf->key());
+        }
         mQueue.put(msg);
+        // A full barrier, so asyncReceive or this call sees the message
+        if (atomicFetchAdd(&mPendingCount, 0) > 0) {
+            dispatchPending();
+        }
+        if (MailBoxExecutor *executor = atomicLoad(&mExecutor)) {
+            executor->schedule(this);
+        }
+        atomicFetchAdd(&mDelivering, -1);
         break;
     case ERL_MSG_CONTROL:
     case ERL_MSG_UNLINK:
@@ -109,12 +310,35 @@ void MailBox::deliver( void *origin, epi::node::EpiMessage* msg ) {
     }
 }
 
+void MailBox::setByteAccounting(bool enable) {
+    atomicStore(&sByteAccounting, enable? 1L: 0L);
+}
+
+bool MailBox::byteAccounting() {
+    return atomicLoad(&sByteAccounting) != 0;
+}
+
+EpiMessage *MailBox::taken( EpiMessage *msg ) {
+    if (msg == 0) {
+        return msg;
+    }
+    EPI_PROBE3(mailbox__receive, this, mSelf->key(), msg->messageType());
+    if (msg->queuedBytes() != 0) {
+        atomicFetchAdd(&mQueuedBytes, -msg->queuedBytes());
+        msg->setQueuedBytes(0);
+    }
+    if (Trace::enabled(TRACE_MAILBOX)) {
+        TraceMessage(TRACE_RECEIVE, msg, 0, 0, mSelf->key());
+    }
+    return msg;
+}
+
 ErlTerm* MailBox::receive( )
         throw (EpiDecodeException, EpiConnectionException)
 {
     Dout_continue(dc::connect, _continue, " failed.",
     		"["<< this << "]" << "MailBox::receive()");
-    std::auto_ptr<EpiMessage> msg(mQueue.get());
+    std::auto_ptr<EpiMessage> msg(taken(mQueue.get()));
     if (msg->instanceOf(ERL_MSG_ERROR)) {
         Dout_finish(_continue, " Error");
         throw *(((ErrorMessage *) msg.get())->getException());
@@ -135,7 +359,7 @@ ErlTerm* MailBox::receive( long timeout )
 {
     Dout_continue(dc::connect, _continue, " failed.",  "["<< this << "]" << "MailBox::receive(" << timeout << ")");
     std::auto_ptr<EpiMessage> msg;
-    msg.reset(mQueue.get(timeout));
+    msg.reset(taken(mQueue.get(timeout)));
 	if (msg.get() == 0) {
         return 0;
 	}
@@ -158,7 +382,7 @@ InputBuffer* MailBox::receiveBuf( )
         throw (EpiConnectionException)
 {
     Dout_continue(dc::connect, _continue, " failed.",  "["<< this << "]" << "MailBox::receiveBuf()");
-    std::auto_ptr<EpiMessage> msg(mQueue.get());
+    std::auto_ptr<EpiMessage> msg(taken(mQueue.get()));
 
     if (msg->instanceOf(ERL_MSG_ERROR)) {
         Dout_finish(_continue, " Error");
@@ -177,7 +401,7 @@ InputBuffer* MailBox::receiveBuf( long timeout )
 {
     Dout_continue(dc::connect, _continue, " failed.",  "["<< this << "]" << "MailBox::receiveBuf(" << timeout << ")");
     std::auto_ptr<EpiMessage> msg;
-    msg.reset(mQueue.get(timeout));
+    msg.reset(taken(mQueue.get(timeout)));
 	if (msg.get() == 0) {
         return 0;
 	}
@@ -198,7 +422,7 @@ ErlangMessage* MailBox::receiveMsg( )
 {
     Dout_continue(dc::connect, _continue, " failed.",  "["<< this << "]" << "MailBox::receiveMsg()");
 
-    std::auto_ptr<EpiMessage> msg(mQueue.get());
+    std::auto_ptr<EpiMessage> msg(taken(mQueue.get()));
     if (msg->instanceOf(ERL_MSG_ERROR)) {
         EpiConnectionException exception(*(((ErrorMessage *) msg.get())->getException()));
         Dout_finish(_continue, exception.getMessage());
@@ -218,7 +442,7 @@ ErlangMessage* MailBox::receiveMsg( long timeout )
 {
     Dout_continue(dc::connect, _continue, " failed.",  "["<< this << "]" << "MailBox::receiveMsg(" << timeout << ")");
     std::auto_ptr<EpiMessage> msg;
-    msg.reset(mQueue.get(timeout));
+    msg.reset(taken(mQueue.get(timeout)));
 	if (msg.get() == 0) {
         return 0;
 	}
@@ -241,7 +465,7 @@ ErlTerm* MailBox::receive( ErlTerm *pattern, VariableBinding *binding )
     Dout_continue(dc::connect, _continue, " failed.",  "["<< this << "]" << "MailBox::receive(" << pattern->toString() << ")");
     // Create a PatternMatchingGuard
     PatternMatchingGuard guard(pattern, binding);
-    std::auto_ptr<EpiMessage> msg(mQueue.get(&guard));
+    std::auto_ptr<EpiMessage> msg(taken(mQueue.get(&guard)));
     if (msg->instanceOf(ERL_MSG_ERROR)) {
         Dout_finish(_continue, " Error");
         throw *(((ErrorMessage *) msg.get())->getException());
@@ -268,7 +492,7 @@ ErlTerm* MailBox::receive( ErlTerm *pattern, long timeout, VariableBinding *bind
     // Create a PatternMatchingGuard
     PatternMatchingGuard guard(pattern, binding);
     std::auto_ptr<EpiMessage> msg;
-    msg.reset(mQueue.get(&guard, timeout));
+    msg.reset(taken(mQueue.get(&guard, timeout)));
 	if (msg.get() == 0) {
         return 0;
 	}
@@ -293,7 +517,7 @@ ErlangMessage* MailBox::receive( MailBoxGuard* guard )
 {
     Dout_continue(dc::connect, _continue, " failed.",  "["<< this << "]" << "MailBox::receive(guard=" << guard << ")");
 
-    std::auto_ptr<EpiMessage> msg(mQueue.get(guard));
+    std::auto_ptr<EpiMessage> msg(taken(mQueue.get(guard)));
     if (msg->instanceOf(ERL_MSG_ERROR)) {
         Dout_finish(_continue, " Error");
         throw *(((ErrorMessage *) msg.get())->getException());
@@ -312,7 +536,7 @@ ErlangMessage* MailBox::receive( MailBoxGuard* guard, long timeout )
     Dout_continue(dc::connect, _continue, " failed.",  "["<< this << "]" <<
             "MailBox::receive(guard=" << guard << ", timeout =" << timeout<< ")");
     std::auto_ptr<EpiMessage> msg;
-    msg.reset(mQueue.get(guard, timeout));
+    msg.reset(taken(mQueue.get(guard, timeout)));
 	if (msg.get() == 0) {
         return 0;
 	}
@@ -428,6 +652,16 @@ void MailBox::send( std::string nodename, std::string toName, ErlTerm* term )
     sendBuf(nodename, toName, buffer.get());
 }
 
+void MailBox::multicast( const std::vector<ErlPid*> &toPids, ErlTerm* term )
+        throw(EpiInvalidTerm, EpiEncodeException, EpiConnectionException)
+{
+    Dout(dc::connect, "["<<this<<"]"<< "MailBox::multicast(" <<
+            toPids.size() << " pids, " << term->toString() << ")");
+    std::auto_ptr<OutputBuffer> buffer(mSender->newOutputBuffer());
+    buffer->writeTerm(term);
+    multicastBuf(toPids, buffer.get());
+}
+
 void MailBox::sendBuf( ErlPid* toPid, OutputBuffer* buffer ) const
         throw ( EpiConnectionException )
 {
@@ -470,11 +704,52 @@ void MailBox::sendBuf( const std::string nodename,
     }
 }
 
+void MailBox::multicastBuf( const std::vector<ErlPid*> &toPids,
+                            OutputBuffer* buffer ) const
+        throw(EpiConnectionException )
+{
+    Dout(dc::connect, "["<<this<<"]"<< "MailBox::multicastBuf(" <<
+            toPids.size() << " pids, buffer)");
+
+    if (mSender) {
+        mSender->multicastBuf(self(), toPids, buffer);
+    } else {
+        throw EpiConnectionException("Sender for MailBox not specified");
+    }
+}
+
 
 void MailBox::setSender( EpiSender* sender ) {
     mSender = sender;
 }
 
+void MailBox::setTimerService( TimerService* timerService ) {
+    mTimerService = timerService;
+}
+
+void MailBox::setLatencyStats( LatencyStats *stats ) {
+    if (mOwnLatencyStats.get()) {
+        return;
+    }
+    mLatencyStats = stats;
+    if (stats) {
+        mQueue.setHistograms(&stats->stage(LATENCY_QUEUE_WAIT),
+                             &stats->stage(LATENCY_GUARD));
+    } else {
+        mQueue.setHistograms(0, 0);
+    }
+}
+
+void MailBox::useOwnLatencyStats() {
+    if (mOwnLatencyStats.get()) {
+        return;
+    }
+    mOwnLatencyStats.reset(new LatencyStats());
+    mLatencyStats = mOwnLatencyStats.get();
+    mQueue.setHistograms(&mLatencyStats->stage(LATENCY_QUEUE_WAIT),
+                         &mLatencyStats->stage(LATENCY_GUARD));
+}
+
 
 void MailBox::sendRPC( const std::string nodename,
                        const std::string mod,
@@ -484,11 +759,11 @@ void MailBox::sendRPC( const std::string nodename,
                 EpiEncodeException, EpiConnectionException )
 {
     ErlTerm* inner_terms[] = {
-        new ErlAtom("call"),
+        RPC_CALL.get(),
         new ErlAtom(mod),
         new ErlAtom(fun),
         args,
-        new ErlAtom("user")
+        RPC_USER.get()
     };
     ErlTermPtr<ErlTerm> execTuple =
             new ErlTuple(self(), new ErlTuple(inner_terms, 5));
@@ -521,6 +796,256 @@ ErlTerm* MailBox::RPC(const std::string nodename,
 		return this->receiveRPC(timeout);
 }
 
+void MailBox::asyncReceive( MailBoxGuard* guard, ReceiveCallback *callback,
+                            long timeout )
+        throw (EpiBadArgument)
+{
+    Dout(dc::connect, "["<< this << "]" << "MailBox::asyncReceive(guard=" <<
+         guard << ", timeout=" << timeout << ")");
+    if (timeout >= 0 && mTimerService == 0) {
+        throw EpiBadArgument("No TimerService for the timeout");
+    }
+    PendingReceive *pending = new PendingReceive(this, guard, callback, callback);
+    addPending(pending, timeout);
+}
+
+void MailBox::asyncReceive( ErlTerm *pattern, ReceiveCallback *callback,
+                            long timeout )
+        throw (EpiBadArgument)
+{
+    if (timeout >= 0 && mTimerService == 0) {
+        throw EpiBadArgument("No TimerService for the timeout");
+    }
+    PendingReceive *pending = new PendingReceive(
+            this, new PatternMatchingGuard(pattern), callback, callback);
+    pending->ownedGuard.reset(pending->guard);
+    addPending(pending, timeout);
+}
+
+void MailBox::asyncRPC( const std::string nodename,
+                        const std::string mod,
+                        const std::string fun,
+                        ErlList* args,
+                        RPCCallback *callback,
+                        long timeout )
+        throw ( EpiBadArgument, EpiInvalidTerm,
+                EpiEncodeException, EpiConnectionException )
+{
+    if (timeout >= 0 && mTimerService == 0) {
+        throw EpiBadArgument("No TimerService for the timeout");
+    }
+    this->sendRPC(nodename, mod, fun, args);
+
+    ErlTerm *rex_pattern = new ErlTuple(new ErlAtom("rex"), new ErlVariable());
+    PendingReceive *pending = new PendingReceive(
+            this, new PatternMatchingGuard(rex_pattern),
+            new RPCReceive(callback), callback);
+    pending->ownedGuard.reset(pending->guard);
+    pending->ownedCallback.reset(pending->callback);
+    addPending(pending, timeout);
+}
+
+unsigned long MailBox::sendAfter( ErlPid* toPid, ErlTerm* term, long delay )
+        throw (EpiBadArgument)
+{
+    Dout(dc::connect, "["<< this << "]" << "MailBox::sendAfter(" <<
+         toPid->toString() << ", " << delay << ")");
+    if (mTimerService == 0) {
+        throw EpiBadArgument("No TimerService for sendAfter");
+    }
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_pendingMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(_pendingMutex);
+    #endif
+    unsigned long id = ++mNextTimer;
+    DelayedSend *delayed = new DelayedSend(this, id, mTimerService, toPid, term);
+    mDelayedSends[id] = delayed;
+    mTimerService->add(delayed, TimerService::currentTime() + delay);
+    return id;
+}
+
+bool MailBox::cancelTimer( unsigned long timer ) {
+    DelayedSend *delayed = 0;
+    _pendingMutex.lock();
+    std::map<unsigned long, DelayedSend *>::iterator it = mDelayedSends.find(timer);
+    // A running timer is sending the term, it is too late
+    if (it != mDelayedSends.end() && !it->second->running) {
+        delayed = it->second;
+        mDelayedSends.erase(it);
+    }
+    _pendingMutex.unlock();
+
+    if (delayed == 0) {
+        return false;
+    }
+    // Waits if it is running, it will not send
+    delayed->timers->cancel(delayed);
+    delete delayed;
+    return true;
+}
+
+void MailBox::cancelTimers() {
+    // The running timers are sending with this mailbox, wait for them
+    _pendingMutex.lock();
+    std::list<DelayedSend *> delayed;
+    for (std::map<unsigned long, DelayedSend *>::iterator it = mDelayedSends.begin();
+         it != mDelayedSends.end(); )
+    {
+        if (it->second->running) {
+            ++it;
+        } else {
+            delayed.push_back(it->second);
+            mDelayedSends.erase(it++);
+        }
+    }
+    _pendingMutex.unlock();
+    for (std::list<DelayedSend *>::iterator it = delayed.begin();
+         it != delayed.end(); ++it)
+    {
+        (*it)->timers->cancel(*it);
+        delete *it;
+    }
+    for (bool running = true; running; ) {
+        _pendingMutex.lock();
+        running = false;
+        for (std::map<unsigned long, DelayedSend *>::iterator it = mDelayedSends.begin();
+             it != mDelayedSends.end() && !running; ++it)
+        {
+            running = it->second->running;
+        }
+        _pendingMutex.unlock();
+        if (running) {
+            #ifdef USE_OPEN_THREADS
+            OpenThreads::Thread::YieldCurrentThread();
+            #elif USE_BOOST
+            boost::thread::yield();
+            #endif
+        }
+    }
+}
+
+bool MailBox::startDelayedSend( DelayedSend *delayed ) {
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_pendingMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(_pendingMutex);
+    #endif
+    std::map<unsigned long, DelayedSend *>::iterator it = mDelayedSends.find(delayed->id);
+    if (it == mDelayedSends.end() || it->second != delayed) {
+        return false;
+    }
+    delayed->running = true;
+    return true;
+}
+
+void MailBox::finishDelayedSend( DelayedSend *delayed ) {
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_pendingMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(_pendingMutex);
+    #endif
+    mDelayedSends.erase(delayed->id);
+}
+
+bool MailBox::cancelReceive( ReceiveCallback *callback ) {
+    return cancelPending(callback);
+}
+
+bool MailBox::cancelRPC( RPCCallback *callback ) {
+    return cancelPending(callback);
+}
+
+void MailBox::addPending( PendingReceive *pending, long timeout ) {
+    _pendingMutex.lock();
+    EpiMessage *msg = taken(mQueue.get(pending->guard, (long) 0));
+    if (msg == 0) {
+        if (timeout >= 0) {
+            // Added under the lock, so it is cancelled if served meanwhile
+            pending->timers = mTimerService;
+            mTimerService->add(pending, TimerService::currentTime() + timeout);
+        }
+        mPending.push_back(pending);
+        atomicFetchAdd(&mPendingCount, 1);
+    }
+    _pendingMutex.unlock();
+
+    if (msg != 0) {
+        pending->complete(msg);
+        delete pending;
+    } else {
+        // Messages delivered before the count was incremented
+        dispatchPending();
+    }
+}
+
+bool MailBox::removePending( PendingReceive *pending ) {
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_pendingMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(_pendingMutex);
+    #endif
+    for (pending_list::iterator it = mPending.begin(); it != mPending.end(); ++it) {
+        if (*it == pending) {
+            mPending.erase(it);
+            atomicFetchAdd(&mPendingCount, -1);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MailBox::cancelPending( const void *callback ) {
+    PendingReceive *pending = 0;
+    _pendingMutex.lock();
+    for (pending_list::iterator it = mPending.begin(); it != mPending.end(); ++it) {
+        if ((*it)->owner == callback) {
+            pending = *it;
+            mPending.erase(it);
+            atomicFetchAdd(&mPendingCount, -1);
+            break;
+        }
+    }
+    _pendingMutex.unlock();
+
+    if (pending == 0) {
+        return false;
+    }
+    if (pending->timers) {
+        pending->timers->cancel(pending);
+    }
+    delete pending;
+    return true;
+}
+
+void MailBox::dispatchPending() {
+    std::vector<std::pair<PendingReceive *, EpiMessage *> > served;
+
+    _pendingMutex.lock();
+    pending_list::iterator it = mPending.begin();
+    while (it != mPending.end()) {
+        EpiMessage *msg = taken(mQueue.get((*it)->guard, (long) 0));
+        if (msg != 0) {
+            served.push_back(std::make_pair(*it, msg));
+            it = mPending.erase(it);
+            atomicFetchAdd(&mPendingCount, -1);
+        } else {
+            ++it;
+        }
+    }
+    _pendingMutex.unlock();
+
+    // The callbacks can receive again
+    for (unsigned i = 0; i < served.size(); i++) {
+        PendingReceive *pending = served[i].first;
+        if (pending->timers) {
+            pending->timers->cancel(pending);
+        }
+        pending->complete(served[i].second);
+        delete pending;
+    }
+}
+
 
 void MailBox::exit(ErlAtom* reason)
 {
@@ -25,6 +25,10 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #ifndef __MAILBOX_HPP
 #define __MAILBOX_HPP
 
+#include <list>
+#include <map>
+#include <memory>
+
 #include "ErlTypes.hpp"
 
 #include "GenericQueue.hpp"
@@ -32,11 +36,16 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "EpiSender.hpp"
 #include "EpiObserver.hpp"
 #include "EpiMessage.hpp"
+#include "TimerService.hpp"
+#include "LatencyHistogram.hpp"
 
 namespace epi {
 namespace node {
 
 using namespace epi::type;
+using namespace epi::util;
+
+class MailBoxExecutor;
 
 /**
  * This class allows you to explore the MailBox Queue.
@@ -65,6 +74,47 @@ public:
 
 };
 
+/**
+ * Callback for MailBox::asyncReceive.
+ * The destructor must be virtual.
+ */
+class ReceiveCallback {
+public:
+    /**
+     * A message was received, or the timeout expired
+     * @param msg the message, 0 on timeout. Ownership is transfered
+     */
+    virtual void received(ErlangMessage *msg) = 0;
+
+    /**
+     * A connection error was received instead of a message
+     */
+    virtual void failed(EpiConnectionException &error) = 0;
+
+    virtual inline ~ReceiveCallback() {}
+};
+
+/**
+ * Callback for MailBox::asyncRPC.
+ * The destructor must be virtual.
+ */
+class RPCCallback {
+public:
+    /**
+     * The response arrived, or the timeout expired
+     * @param response the response, 0 on timeout. It is released
+     * after the call, use a ErlTermPtr to keep it.
+     */
+    virtual void replied(ErlTerm *response) = 0;
+
+    /**
+     * The RPC was incorrect (EpiBadRPC) or there was a connection error
+     */
+    virtual void failed(EpiException &error) = 0;
+
+    virtual inline ~RPCCallback() {}
+};
+
 /**
  * Provides a simple mechanism for exchanging messages with Erlang
  * processes or other instances of this class.
@@ -106,6 +156,11 @@ public:
  *
  */
 class MailBox: public EpiReceiver, public EpiObservable {
+    friend class MailBoxExecutor;
+    struct PendingReceive;
+    friend struct PendingReceive;
+    struct DelayedSend;
+    friend struct DelayedSend;
 
 public:
 
@@ -263,6 +318,13 @@ public:
     ErlTerm* receiveRPC( long timeout )
             throw (EpiConnectionException, EpiBadRPC);
 
+    /**
+     * Send a term. With an AutoNode, messages to a node that is not
+     * connected are queued while the connection is set up in background,
+     * so send does not throw if the connection fails. The
+     * EpiConnectionException is thrown instead by the next receive of
+     * this mailbox, once for the messages queued together.
+     */
     void send( epi::type::ErlPid* toPid, ErlTerm* term )
             throw(EpiInvalidTerm, EpiEncodeException, EpiConnectionException);
 
@@ -272,6 +334,17 @@ public:
     void send( std::string nodename, std::string toName, ErlTerm* term )
             throw(EpiInvalidTerm, EpiEncodeException, EpiConnectionException);
 
+    /**
+     * Send a term to several pids, in this or in other nodes.
+     * The term is encoded only once, and the encoded data
+     * is shared by all the destinations.
+     * @param toPids destination pids
+     * @param term term to send
+     * @throws EpiConnectionException if send fails
+     */
+    void multicast( const std::vector<ErlPid*> &toPids, ErlTerm* term )
+            throw(EpiInvalidTerm, EpiEncodeException, EpiConnectionException);
+
 	/**
      * Send data to a pid
 	 * @param aPid remote process pid
@@ -301,6 +374,16 @@ public:
                   epi::node::OutputBuffer* buffer ) const
             throw(EpiConnectionException);
 
+    /**
+     * Send data to several pids
+     * @param toPids destination pids
+     * @param buffer Buffer to send
+     * @throws EpiConnectionException if send fails
+     */
+    void multicastBuf( const std::vector<ErlPid*> &toPids,
+                       epi::node::OutputBuffer* buffer ) const
+            throw(EpiConnectionException);
+
     /**
 	 * Send an RPC request to a remote Erlang node.
      * @param node remote node where execute the funcion.
@@ -308,7 +391,8 @@ public:
 	 * function to be called.
 	 * @param fun the name of the function to call.
 	 * @param args a list of Erlang terms, to be used as arguments
-	 * to the function.
+	 * to the function. Constant arguments sent often can be frozen
+	 * with FreezeTerm(), to copy their encoding.
      * @throws EpiBadArgument if function, module or nodename are too big
      * @throws EpiInvalidTerm if any of the args is invalid
 	 * @throws EpiEncodeException if encoding fails
@@ -361,6 +445,96 @@ public:
         throw ( EpiBadArgument, EpiInvalidTerm,
                 EpiEncodeException, EpiConnectionException );
 
+    /**
+     * Wait for a message that satisfaces the guard without blocking.
+     * The callback is called once: from this call if the message is
+     * already in the mailbox, from the thread that delivers it, or from
+     * the timer thread when the timeout expires.
+     * Pending receives are served in order, before blocking receives.
+     * @param guard Guard to check. Owership is not transfered
+     * @param callback callback for the message. Owership is not transfered
+     * @param timeout the time, in milliseconds, to wait for a message.
+     * -1 to wait forever
+     * @throws EpiBadArgument if there is a timeout but no TimerService
+     */
+    void asyncReceive( MailBoxGuard* guard, ReceiveCallback *callback,
+                       long timeout = -1 )
+            throw (EpiBadArgument);
+
+    /**
+     * Wait for a message that matches the pattern without blocking.
+     * See asyncReceive(MailBoxGuard*, ReceiveCallback*, long)
+     * @param pattern ErlTerm with pattern to check
+     * @param callback callback for the message. Owership is not transfered
+     * @param timeout the time, in milliseconds, to wait for a message.
+     * -1 to wait forever
+     * @throws EpiBadArgument if there is a timeout but no TimerService
+     */
+    void asyncReceive( ErlTerm *pattern, ReceiveCallback *callback,
+                       long timeout = -1 )
+            throw (EpiBadArgument);
+
+    /**
+     * Send an RPC request to a remote Erlang node and wait for the
+     * response without blocking. The callback is called as in
+     * asyncReceive(MailBoxGuard*, ReceiveCallback*, long)
+     * @param node remote node where execute the funcion.
+     * @param mod the name of the Erlang module containing the
+     * function to be called.
+     * @param fun the name of the function to call.
+     * @param args a list of Erlang terms, to be used as arguments
+     * to the function.
+     * @param callback callback for the response. Owership is not transfered
+     * @param timeout the time, in milliseconds, to wait for the response.
+     * -1 to wait forever
+     **/
+    void asyncRPC( const std::string nodename,
+                   const std::string mod,
+                   const std::string fun,
+                   ErlList* args,
+                   RPCCallback *callback,
+                   long timeout = -1 )
+        throw ( EpiBadArgument, EpiInvalidTerm,
+                EpiEncodeException, EpiConnectionException );
+
+    /**
+     * Cancel a pending asyncReceive.
+     * @return true if it was cancelled. If false, the callback was
+     * called or is being called.
+     */
+    bool cancelReceive( ReceiveCallback *callback );
+
+    /**
+     * Cancel a pending asyncRPC. The response will stay in the mailbox.
+     * @return true if it was cancelled. If false, the callback was
+     * called or is being called.
+     */
+    bool cancelRPC( RPCCallback *callback );
+
+    /**
+     * Send a term to a pid after a delay, like erlang:send_after/3.
+     * The term is sent from the timer thread.
+     * @param toPid destination pid
+     * @param term term to send
+     * @param delay the time, in milliseconds, to wait before sending
+     * @return timer id, to be used with cancelTimer
+     * @throws EpiBadArgument if there is no TimerService
+     */
+    unsigned long sendAfter( ErlPid* toPid, ErlTerm* term, long delay )
+            throw (EpiBadArgument);
+
+    /**
+     * Cancel a timer started by sendAfter.
+     * @return true if it was cancelled before sending the term
+     */
+    bool cancelTimer( unsigned long timer );
+
+    /**
+     * Cancel all the timers started by sendAfter. If a timer is sending
+     * its term, wait for it.
+     */
+    void cancelTimers();
+
 
     /**
      * Send exit message to all linked nodes
@@ -394,6 +568,70 @@ public:
      */
     void setSender( EpiSender* sender );
 
+    /**
+     * Set the TimerService for the timeouts of asyncReceive
+     */
+    void setTimerService( TimerService* timerService );
+
+    /**
+     * Set the histograms where the latencies of this mailbox are
+     * recorded: the time messages wait in the queue until they are
+     * received, and the time of the scans of the selective receives.
+     * AutoNode sets the ones it shares among its mailboxes. It is
+     * ignored if the mailbox has its own histograms.
+     * @param stats the histograms, or 0 to not record the latencies
+     */
+    void setLatencyStats( LatencyStats *stats );
+
+    /**
+     * Record the latencies of this mailbox in histograms of its own,
+     * instead of the shared ones. They take about 2.4 KB once used, so
+     * it is meant for the mailboxes being looked into. Call it before
+     * the mailbox receives messages.
+     */
+    void useOwnLatencyStats();
+
+    /**
+     * Check if the mailbox has its own histograms
+     */
+    inline bool hasOwnLatencyStats() const {
+        return mOwnLatencyStats.get() != 0;
+    }
+
+    /**
+     * Get the histograms where the latencies of this mailbox are
+     * recorded: its own ones, the shared ones or 0
+     */
+    inline LatencyStats *getLatencyStats() {
+        return mLatencyStats;
+    }
+
+    /**
+     * Get the number of messages in the queue of this mailbox
+     */
+    inline int queuedMessages() {
+        return mQueue.count();
+    }
+
+    /**
+     * Get the memory held by the messages in the queue of this
+     * mailbox, see EpiMessage::memoryFootprint(). Only the messages
+     * delivered while the byte accounting is on are counted.
+     */
+    inline long queuedBytes() const {
+        return atomicLoad(&mQueuedBytes);
+    }
+
+    /**
+     * Count or not the bytes of the messages queued in the mailboxes.
+     * It is off by default, as it walks the terms of every message.
+     */
+    static void setByteAccounting(bool enable);
+
+    /**
+     * Check if the bytes of the queued messages are counted
+     */
+    static bool byteAccounting();
 
 
 private:
@@ -401,7 +639,77 @@ private:
 
 	EpiSender *mSender;
 
+    LatencyStats *mLatencyStats;
+    std::auto_ptr<LatencyStats> mOwnLatencyStats;
     GenericQueue<EpiMessage> mQueue;
+
+    // Set while attached to a MailBoxExecutor
+    MailBoxExecutor * volatile mExecutor;
+    MailBoxGuard *mHandler;
+    // 1 while queued or running in the executor
+    long volatile mScheduled;
+
+    typedef std::list<PendingReceive *> pending_list;
+
+    /*
+     * Add a pending receive, with a timeout if >= 0, and serve it
+     * if the message is here
+     */
+    void addPending( PendingReceive *pending, long timeout );
+
+    /*
+     * Remove the pending receive if it was not served.
+     * @return true if it was removed
+     */
+    bool removePending( PendingReceive *pending );
+
+    /*
+     * Remove and delete the pending receive of the callback
+     */
+    bool cancelPending( const void *callback );
+
+    /*
+     * Serve the pending receives that have a message
+     */
+    void dispatchPending();
+
+    /*
+     * Add the message taken from the queue to the trace, if enabled,
+     * and substract its bytes from the queued ones
+     * @return the message
+     */
+    EpiMessage *taken( EpiMessage *msg );
+
+    /*
+     * Mark the timer as running if it was not cancelled.
+     * @return true if it is running, and must be finished with
+     * finishDelayedSend
+     */
+    bool startDelayedSend( DelayedSend *delayed );
+
+    /*
+     * Remove a running timer once its term is sent
+     */
+    void finishDelayedSend( DelayedSend *delayed );
+
+    TimerService *mTimerService;
+    pending_list mPending;
+    // Size of mPending, checked by deliver without locking
+    long volatile mPendingCount;
+    // Timers of sendAfter by id, with _pendingMutex. A running timer
+    // is kept until its term is sent.
+    std::map<unsigned long, DelayedSend *> mDelayedSends;
+    unsigned long mNextTimer;
+    // Threads in deliver() after putting a message
+    long volatile mDelivering;
+    // Bytes of the queued messages, see queuedBytes()
+    long volatile mQueuedBytes;
+    static long volatile sByteAccounting;
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::Mutex _pendingMutex;
+    #elif USE_BOOST
+    boost::mutex _pendingMutex;
+    #endif
 };
 
 } // namespace node
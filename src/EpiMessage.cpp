@@ -37,4 +37,34 @@ using namespace epi::util;
 using namespace epi::error;
 using namespace epi::node;
 
+void epi::node::MessagePids(EpiMessage *msg, unsigned long long *from,
+                            unsigned long long *to)
+{
+    ErlPid *sender = 0;
+    ErlPid *recipient = 0;
+    if (msg->instanceOf(ERL_MSG_SEND)) {
+        recipient = ((SendMessage *) msg)->getRecipientPid();
+    } else if (msg->instanceOf(ERL_MSG_REG_SEND)) {
+        sender = ((RegSendMessage *) msg)->getSenderPid();
+    } else if (msg->instanceOf(ERL_MSG_CONTROL)) {
+        sender = ((ControlMessage *) msg)->getSenderPid();
+        recipient = ((ControlMessage *) msg)->getRecipientPid();
+    }
+    if (sender) {
+        *from = sender->key();
+    }
+    if (recipient) {
+        *to = recipient->key();
+    }
+}
 
+void epi::node::TraceMessage(TraceEventType type, EpiMessage *msg,
+                             long long duration, unsigned size,
+                             unsigned long long to)
+{
+    unsigned long long from = 0;
+    unsigned long long recipient = 0;
+    MessagePids(msg, &from, &recipient);
+    Trace::record(type, duration, size, from, to ? to : recipient,
+                  msg->messageType());
+}
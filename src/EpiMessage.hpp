@@ -29,6 +29,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "EpiBuffer.hpp"
 #include "EpiInputBuffer.hpp"
 #include "EpiOutputBuffer.hpp"
+#include "PlainBuffer.hpp"
+#include "TraceRing.hpp"
 
 namespace epi {
 namespace node {
@@ -56,6 +58,7 @@ class Connection;
  */
 class EpiMessage {
 public:
+    inline EpiMessage(): mQueuedBytes(0) {}
 
     /**
      * Get the type of this message
@@ -67,8 +70,30 @@ public:
      */
     virtual bool instanceOf(EpiMessageType type) = 0;
 
+    /**
+     * Get the memory held by this message. Default: 0
+     */
+    virtual size_t memoryFootprint() {
+        return 0;
+    }
+
+    /**
+     * Get the bytes added to the queued bytes of a mailbox
+     * when this message was queued, to substract them when taken.
+     */
+    inline long queuedBytes() const {
+        return mQueuedBytes;
+    }
+
+    inline void setQueuedBytes(long bytes) {
+        mQueuedBytes = bytes;
+    }
+
     /** Virtual destructor  */
     virtual inline ~EpiMessage() {}
+
+private:
+    long mQueuedBytes;
 };
 
 /**
@@ -112,7 +137,16 @@ private:
  */
 class ErlangMessage: public EpiMessage {
 public:
+    /**
+     * Get the buffer. If the message was created with a term,
+     * a buffer with it is created.
+     */
     inline InputBuffer* getBuffer() {
+        if (mBuffer == 0 && mPayLoad.get() != 0) {
+            PlainBuffer *buffer = new PlainBuffer();
+            buffer->writeTerm(mPayLoad.get());
+            mBuffer = buffer;
+        }
         return mBuffer;
     }
 
@@ -120,7 +154,7 @@ public:
      * Get the buffer and set the internal pointer to 0
      */
     inline InputBuffer* releaseBuffer() {
-        InputBuffer* tmp = mBuffer;
+        InputBuffer* tmp = getBuffer();
         mBuffer = 0;
         return tmp;
     }
@@ -152,6 +186,22 @@ public:
         return mPayLoad.get();
     }
 
+    /**
+     * Get the memory held by the buffer and the decoded term. Terms
+     * held by both are counted once.
+     */
+    size_t memoryFootprint() {
+        ErlTerm::term_set visited;
+        size_t size = 0;
+        if (mBuffer) {
+            size += mBuffer->memoryFootprint(visited);
+        }
+        if (mPayLoad.get()) {
+            size += mPayLoad->memoryFootprint(visited);
+        }
+        return size;
+    }
+
     /**
      * The Buffer WILL BE DELETED on message destruction
      */
@@ -164,14 +214,27 @@ protected:
      * buffer index will be reset after decoding.
      * If there is an error, it will ignore it, but the term
      * will not be decoded. So, the error can be received later.
+     * @param decode false to leave the decoding to the first getMsg()
      */
-    inline ErlangMessage(InputBuffer *buffer): mBuffer(buffer) {
-        try {
-            this->getMsg();
-        } catch (EpiDecodeException &) {
+    inline ErlangMessage(InputBuffer *buffer, bool decode = true):
+            mBuffer(buffer)
+    {
+        if (decode) {
+            try {
+                this->getMsg();
+            } catch (EpiDecodeException &) {
+            }
         }
     }
 
+    /**
+     * Create a message with an already decoded term, without
+     * variables. The term is shared, no buffer is created unless
+     * getBuffer() is called.
+     */
+    inline ErlangMessage(ErlTerm *term): mBuffer(0), mPayLoad(term) {
+    }
+
 private:
     InputBuffer *mBuffer;
     ErlTermPtr<ErlTerm> mPayLoad;
@@ -182,8 +245,11 @@ private:
  */
 class SendMessage: public ErlangMessage {
 public:
-    inline SendMessage(ErlPid* recipient, InputBuffer *buffer):
-        ErlangMessage(buffer), mRecipient(recipient) {}
+    inline SendMessage(ErlPid* recipient, InputBuffer *buffer,
+                       bool decode = true):
+        ErlangMessage(buffer, decode), mRecipient(recipient) {}
+    inline SendMessage(ErlPid* recipient, ErlTerm *term):
+        ErlangMessage(term), mRecipient(recipient) {}
     inline ErlPid *getRecipientPid() {
         return mRecipient.get();
     }
@@ -208,8 +274,13 @@ class RegSendMessage: public ErlangMessage {
 public:
     inline RegSendMessage(ErlPid *sender,
                           std::string recipient,
-                          InputBuffer *buffer):
-        ErlangMessage(buffer), mSender(sender), mRecipient(recipient) {}
+                          InputBuffer *buffer,
+                          bool decode = true):
+        ErlangMessage(buffer, decode), mSender(sender), mRecipient(recipient) {}
+    inline RegSendMessage(ErlPid *sender,
+                          std::string recipient,
+                          ErlTerm *term):
+        ErlangMessage(term), mSender(sender), mRecipient(recipient) {}
     inline ErlPid *getSenderPid() {
         return mSender.get();
     }
@@ -304,6 +375,26 @@ private:
     ErlTermPtr<ErlAtom> mReason;
 };
 
+/**
+ * Get the pids carried by a message, as ErlPid::key(). They are left
+ * unchanged if the message does not carry them.
+ */
+void MessagePids(EpiMessage *msg, unsigned long long *from,
+                 unsigned long long *to);
+
+/**
+ * Add an event for a message to the trace, with the pids it carries.
+ * The caller checks the category with Trace::enabled() first.
+ * @param type type of the event
+ * @param msg the message
+ * @param duration duration of the event in nanoseconds, 0 if not timed
+ * @param size size in bytes, 0 if unknown
+ * @param to ErlPid::key() of the recipient, 0 to take it from the message
+ */
+void TraceMessage(epi::util::TraceEventType type, EpiMessage *msg,
+                  long long duration, unsigned size,
+                  unsigned long long to = 0);
+
 } // namespace node
 } // namespace epi
 #endif
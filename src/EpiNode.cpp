@@ -67,16 +67,26 @@ bool epi::node::isSameHost(const std::string node1,
 
 //////////////////////////////////////////////////////////////////////////
 // AbstractNode
-AbstractNode::AbstractNode()
+AbstractNode::AbstractNode():
+        mNodeIndex(NodeNames::intern(""))
 {
 }
 
 AbstractNode::AbstractNode(const std::string aNodeName,
                            const std::string aCookie)
         throw (EpiBadArgument):
-        mCookie(aCookie)
+        mNodeIndex(NodeNames::intern("")), mCookie(aCookie)
 {
-    initNodeName(aNodeName);
+    try {
+        initNodeName(aNodeName);
+    } catch (EpiBadArgument &) {
+        NodeNames::release(mNodeIndex);
+        throw;
+    }
+}
+
+AbstractNode::~AbstractNode() {
+    NodeNames::release(mNodeIndex);
 }
 
 void AbstractNode::initNodeName(const std::string aNodeName)
@@ -98,6 +108,9 @@ void AbstractNode::initNodeName(const std::string aNodeName)
     if (mNodeName.length() > MAX_NODE_LENGTH) {
         throw EpiBadArgument("Node name too big");
     }
+    unsigned index = NodeNames::intern(mNodeName);
+    NodeNames::release(mNodeIndex);
+    mNodeIndex = index;
 }
 
 // FIXME: get the cookie from ~/.cookie
@@ -61,6 +61,7 @@ public:
     AbstractNode();
     AbstractNode(const std::string aHost, const std::string aCookie)
             throw (EpiBadArgument);
+    ~AbstractNode();
 
     /**
      * Get node name
@@ -69,6 +70,14 @@ public:
         return mNodeName;
     }
 
+    /**
+     * Get the index of the node name in NodeNames, to compare it
+     * with the node of pids
+     */
+    inline unsigned getNodeIndex() const {
+        return mNodeIndex;
+    }
+
     /**
      * Get alive name
     */
@@ -101,6 +110,7 @@ public:
 private:
 protected:
     std::string mNodeName;
+    unsigned mNodeIndex;
     std::string mAliveName;
     std::string mHostName;
     std::string mCookie;
@@ -0,0 +1,64 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+/**
+ * Static tracepoints (USDT) of the library, for SystemTap, bpftrace
+ * or perf. They are compiled in with USE_USDT, and need the
+ * sys/sdt.h header of SystemTap. A probe not attached is a nop
+ * instruction, but its arguments are still computed, so the probes
+ * in the paths of every message only take values at hand.
+ *
+ * The provider is "epi". Probes and arguments:
+ *  - connection__connect(fd, node): a connection to a node set up
+ *  - connection__accept(fd, node): a connection from a node accepted
+ *  - connection__close(fd, node): a connection closed
+ *  - mailbox__deliver(mailbox, pid, type): a message put in a mailbox,
+ *    with the ErlPid::key() of the mailbox and the EpiMessageType
+ *  - mailbox__receive(mailbox, pid, type): a message taken from it
+ *  - decode__start(buffer, index): decoding a term at the index
+ *  - decode__end(buffer, index, type): the term decoded, the index
+ *    after it and its ErlTermType
+ *  - encode__start(buffer, index): encoding a term at the index
+ *  - encode__end(buffer, index): the term encoded
+ *  - queue__guard__scan(queue, scanned, matched): a scan of a queue
+ *    with a guard, the elements checked and 1 if one matched
+ *
+ * For example, with bpftrace:
+ *   bpftrace -e 'usdt:./libepi.so:epi:mailbox__deliver { @[arg1] = count(); }'
+ */
+
+#ifndef __EPIPROBES_HPP
+#define __EPIPROBES_HPP
+
+#ifdef USE_USDT
+#include <sys/sdt.h>
+
+#define EPI_PROBE2(name, a, b) DTRACE_PROBE2(epi, name, a, b)
+#define EPI_PROBE3(name, a, b, c) DTRACE_PROBE3(epi, name, a, b, c)
+#else
+#define EPI_PROBE2(name, a, b)
+#define EPI_PROBE3(name, a, b, c)
+#endif
+
+#endif // __EPIPROBES_HPP
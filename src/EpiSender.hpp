@@ -25,6 +25,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #ifndef __EPISENDER_HPP
 #define __EPISENDER_HPP
 
+#include <vector>
+
 #include "EpiException.hpp"
 #include "ErlTypes.hpp"
 #include "EpiOutputBuffer.hpp"
@@ -87,6 +89,29 @@ public:
                           epi::node::OutputBuffer* buffer )
             throw (epi::error::EpiConnectionException) = 0;
 
+    /**
+     * Send a buffer to several pids. The buffer is encoded once
+     * by the caller and sent to all the pids.
+     * The caller maintains the buffer owership.
+     * The default implementation calls sendBuf for each pid,
+     * senders that modify the buffer in sendBuf must override it.
+     * @param from From pid
+     * @param to Destination pids
+     * @param buffer OutputBuffer to send data
+     * @throw EpiConnectionException if send fails
+     */
+    virtual void multicastBuf( epi::type::ErlPid* from,
+                               const std::vector<epi::type::ErlPid*> &to,
+                               epi::node::OutputBuffer* buffer )
+            throw (epi::error::EpiConnectionException)
+    {
+        for (std::vector<epi::type::ErlPid*>::const_iterator p = to.begin();
+             p != to.end(); ++p)
+        {
+            sendBuf(from, *p, buffer);
+        }
+    }
+
 };
 
 } // namespace node
@@ -27,6 +27,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include <memory>
 
 #include "EpiUtil.hpp"
+#include "EIOutputBuffer.hpp"
 
 using namespace epi::type;
 using namespace epi::node;
@@ -151,7 +152,8 @@ ei_cnode *epi::util::EiCNodeChangeCookie(const ei_cnode *ec,
     return new_ec;
 }
 
-EpiMessage *epi::util::ToMessage(erlang_msg* msg, InputBuffer *buffer)
+EpiMessage *epi::util::ToMessage(erlang_msg* msg, InputBuffer *buffer,
+                                  bool decode)
     throw (EpiUnknownMessageException)
 {
     EpiMessage *msgResult = 0;
@@ -160,11 +162,13 @@ EpiMessage *epi::util::ToMessage(erlang_msg* msg, InputBuffer *buffer)
 
     switch (msg->msgtype) {
     case ERL_SEND:
-        msgResult = new SendMessage(EI2ErlPid(&msg->to), _buffer.release());
+        msgResult = new SendMessage(EI2ErlPid(&msg->to), _buffer.release(),
+                                    decode);
         break;
     case ERL_REG_SEND:
         msgResult = new RegSendMessage(EI2ErlPid(&msg->from),
-                                       msg->toname, _buffer.release());
+                                       msg->toname, _buffer.release(),
+                                       decode);
         break;
     case ERL_EXIT:
     case ERL_EXIT2:
@@ -200,3 +204,26 @@ EpiMessage *epi::util::ToMessage(erlang_msg* msg, InputBuffer *buffer)
 
     return msgResult;
 }
+
+// Output buffer that gives the encoded data, without version
+class FreezeBuffer: public epi::ei::EIOutputBuffer {
+public:
+    FreezeBuffer(): EIOutputBuffer(false) {}
+    std::string data() {
+        return std::string(getInternalBuffer(), *getInternalIndex());
+    }
+};
+
+ErlTerm *epi::util::FreezeTerm(ErlTerm *term)
+        throw (EpiInvalidTerm, EpiEncodeException, EpiVariableUnbound)
+{
+    if (!term) {
+        throw EpiInvalidTerm("Can't freeze a null term");
+    }
+    if (!term->isFrozen()) {
+        FreezeBuffer buffer;
+        buffer.writeTerm(term);
+        term->freeze(buffer.data());
+    }
+    return term;
+}
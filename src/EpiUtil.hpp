@@ -102,10 +102,24 @@ ei_cnode *EiCNodeChangeCookie(const ei_cnode *ec,
  *
  * @param msg erlang_msg to convert
  * @param buffer OutputBuffer to use. Owership of buffer will be transfered
+ * @param decode false to leave the term of SEND and REG_SEND messages
+ *  undecoded
  */
-EpiMessage *ToMessage(erlang_msg* msg, InputBuffer *buffer)
+EpiMessage *ToMessage(erlang_msg* msg, InputBuffer *buffer,
+                      bool decode = true)
         throw (EpiUnknownMessageException);
 
+/**
+ * Freeze a term with its encoding, so sending it, alone or inside
+ * other terms, copies the encoding instead of encoding it again.
+ * It does nothing if the term is already frozen.
+ * See ErlTerm::freeze()
+ * @param term Term to freeze, without variables
+ * @return the term
+ */
+ErlTerm *FreezeTerm(ErlTerm *term)
+        throw (EpiInvalidTerm, EpiEncodeException, EpiVariableUnbound);
+
 } // namespace error
 } // namespace epi
 
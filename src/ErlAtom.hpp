@@ -96,6 +96,10 @@ private:
 protected:
     std::string mAtom;
 
+    inline size_t dataSize() const {
+        return stringDataSize(mAtom);
+    }
+
 };
 
 
@@ -116,6 +116,11 @@ protected:
     bool mDelete;
     int mSize;
 
+    // The data is counted by the binary that deletes it
+    inline size_t dataSize() const {
+        return mDelete? mSize: 0;
+    }
+
 };
 
 } //namespace type
@@ -107,6 +107,9 @@ ErlConsList* ErlConsList::addElement(ErlTerm* elem)
     }
 
     mElementVector.push_back(elem);
+    if (elem->hasVariables()) {
+        mHasVariables = true;
+    }
 	
 	return this;
 }
@@ -151,6 +154,7 @@ ErlTerm* ErlConsList::tail(unsigned int index) const
             newList->mElementVector.push_back(mElementVector[i]);
         }
         newList->mInitialized = mInitialized;
+        newList->mHasVariables = mHasVariables;
         return newList;
     }
     // else, return a copy of last element.
@@ -269,11 +273,24 @@ ErlVariable* ErlConsList::searchUnbound(const VariableBinding* binding) {
     return 0;
 }
 
+size_t ErlConsList::subtermsFootprint(term_set &visited) const {
+    size_t size = 0;
+    for (unsigned int i=0; i<mElementVector.size(); i++) {
+        size += mElementVector[i]->memoryFootprint(visited);
+    }
+    return size;
+}
+
 ErlTerm* ErlConsList::subst(const VariableBinding* binding)
         throw (EpiInvalidTerm, EpiVariableUnbound)
 {
     Dout_continue(dc::erlang, _continue, " Failed.", 
     		"["<<this<<"]"<< " ErlConsList::subst(): ");
+    // Nothing to substitute
+    if (!hasVariables() && isValid()) {
+	    Dout_finish(_continue, "Returning the same list (no variables)");
+        return this;
+    }
     ErlTermPtr<ErlConsList> newList = new ErlConsList();
     // We check if any contained term changes.
     bool change = false;
@@ -281,7 +298,7 @@ ErlTerm* ErlConsList::subst(const VariableBinding* binding)
     for (int i=0; i<size; i++) {
         ErlTerm *newElem = mElementVector[i]->subst(binding);
         // check if the pointer is different
-        if (newElem == mElementVector[i].get()) {
+        if (newElem != mElementVector[i].get()) {
             change = true;
         }
         if (i!=size-1) {
@@ -186,6 +186,12 @@ protected:
     // Use a vector of shared pointers to ErlTerms
     std::vector< ErlTermPtr<ErlTerm> > mElementVector;
 
+    inline size_t dataSize() const {
+        return mElementVector.capacity() * sizeof(ErlTermPtr<ErlTerm>);
+    }
+
+    size_t subtermsFootprint(term_set &visited) const;
+
     bool internalMatch(VariableBinding* binding, ErlTerm* pattern)
             throw (EpiVariableUnbound);
 
@@ -51,10 +51,10 @@ void ErlPid::init(std::string node, int id, int serial, int creation)
         throw EpiBadArgument("nodename must be non-empty");
     }
 
-    mNode = node;
-    mId = id & 0x3ffff; // 15bits
-    mSerial = serial & 0x1fff ;  // 13 bits
-    mCreation = creation & 0x03; // 2 bits
+    mKey = ((unsigned long long) NodeNames::intern(node) << NODE_SHIFT) |
+           ((unsigned long long) (id & ID_MASK) << ID_SHIFT) |
+           ((serial & SERIAL_MASK) << SERIAL_SHIFT) |
+           (creation & CREATION_MASK);
     mInitialized = true;
 
 }
@@ -69,9 +69,7 @@ bool ErlPid::equals(const ErlTerm &t) const {
 
     ErlPid *_t = (ErlPid *) &t;
 
-    return (mNode == _t->mNode) &&
-           (mId == _t->mId) &&
-           (mSerial == _t->mSerial);
+    return (mKey >> SERIAL_SHIFT) == (_t->mKey >> SERIAL_SHIFT);
 }
 
 std::string ErlPid::toString(const VariableBinding *binding) const {
@@ -79,36 +77,10 @@ std::string ErlPid::toString(const VariableBinding *binding) const {
         return "** INVALID PID **";
 
     std::ostringstream oss;
-    oss << "#Pid<" << mNode << "." << mId << "." << mSerial << ">";
+    oss << "#Pid<" << node() << "." << id() << "." << serial() << ">";
     return oss.str();
 }
 
 bool epi::type::operator<(const ErlPid &t1, const ErlPid &t2) {
-
-	if (t1.node() < t2.node()) {
-		return true;
-	} 
-	if (t1.node() > t2.node()) {
-		return false;
-	}
-	if (t1.id() < t2.id()) {
-		return true;
-	} 
-	if (t1.id() < t2.id()) {
-		return false;
-	} 
-	if (t1.serial() < t2.serial()) {
-		return true;
-	} 
-	if (t1.serial() > t2.serial()) {
-		return false;
-	} 
-	if (t1.creation() < t2.creation()) {
-		return true;
-	} 
-	if (t1.creation() > t2.creation()) {
-		return false;
-	} 
-	return false;
+    return t1.key() < t2.key();
 }
-
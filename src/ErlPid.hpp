@@ -26,6 +26,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #define _ERLPID_HPP
 
 #include "ErlTerm.hpp"
+#include "NodeNames.hpp"
 
 namespace epi {
 namespace type {
@@ -34,6 +35,8 @@ namespace type {
  * Representation of erlang Pids.
  * A pid has 4 parameters, nodeName, id, serial and creation number
  *
+ * The node name is interned and the 4 parameters are packed in an
+ * integer key, so pids are compared and hashed without strings.
  */
 class ErlPid: public ErlTerm {
 public:
@@ -86,8 +89,15 @@ public:
      *
      * @return the node name from the PID.
      **/
-    inline std::string node() const {
-        return mNode;
+    inline const std::string &node() const {
+        return NodeNames::name(nodeIndex());
+    }
+
+    /**
+     * Get the index of the node name in NodeNames.
+     **/
+    inline unsigned nodeIndex() const {
+        return (unsigned) (mKey >> NODE_SHIFT);
     }
 
     /**
@@ -96,7 +106,7 @@ public:
      * @return the id number from the PID.
      **/
     inline int id() const {
-        return mId;
+        return (int) (mKey >> ID_SHIFT) & ID_MASK;
     }
 
     /**
@@ -105,7 +115,7 @@ public:
      * @return the serial number from the PID.
      **/
     inline int serial() const {
-        return mSerial;
+        return (int) (mKey >> SERIAL_SHIFT) & SERIAL_MASK;
     }
 
     /**
@@ -114,7 +124,23 @@ public:
      * @return the creation number from the PID.
      **/
     inline int creation() const {
-        return mCreation;
+        return (int) mKey & CREATION_MASK;
+    }
+
+    /**
+     * Get the packed node index, id, serial and creation. Pids are
+     * equal if their keys differ only in the creation.
+     **/
+    inline unsigned long long key() const {
+        return mKey;
+    }
+
+    /**
+     * Get a hash value for the PID
+     **/
+    inline unsigned hash() const {
+        return (unsigned) (mKey >> SERIAL_SHIFT) ^
+               (unsigned) (mKey >> NODE_SHIFT);
     }
 
     bool equals(const ErlTerm &t) const;
@@ -130,14 +156,25 @@ public:
 
 private:
     ErlPid(const ErlPid &t) {}
-    inline ~ErlPid() { }
+    inline ~ErlPid() {
+        if (mInitialized) {
+            NodeNames::release(nodeIndex());
+        }
+    }
 
 
 protected:
-    std::string mNode;
-    int mId;
-    int mSerial;
-    int mCreation;
+    // Layout of mKey: node index:31 id:18 serial:13 creation:2
+    enum {
+        CREATION_MASK = 0x03,
+        SERIAL_SHIFT = 2,
+        SERIAL_MASK = 0x1fff,
+        ID_SHIFT = 15,
+        ID_MASK = 0x3ffff,
+        NODE_SHIFT = 33
+    };
+
+    unsigned long long mKey;
 
 };
 
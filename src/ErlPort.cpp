@@ -51,9 +51,9 @@ void ErlPort::init(const std::string node, const int id,
         throw EpiBadArgument("nodename must be non-empty");
     }
 
-    mNode = node;
-    mId = id & 0x3ffff;
-    mCreation = creation & 0x03;
+    mKey = ((unsigned long long) NodeNames::intern(node) << NODE_SHIFT) |
+           ((id & ID_MASK) << ID_SHIFT) |
+           (creation & CREATION_MASK);
     mInitialized = true;
 
 }
@@ -67,8 +67,7 @@ bool ErlPort::equals(const ErlTerm &t) const {
 
     ErlPort *_t = (ErlPort *) &t;
 
-    return (mNode == _t->mNode) &&
-            (mId == _t->mId);
+    return (mKey >> ID_SHIFT) == (_t->mKey >> ID_SHIFT);
 }
 
 std::string ErlPort::toString(const VariableBinding *binding) const {
@@ -76,9 +75,9 @@ std::string ErlPort::toString(const VariableBinding *binding) const {
         return "** INVALID PORT **";
 
     std::ostringstream oss;
-    oss << "#Port<" << mNode << "."
-            << mId << "."
-            << mCreation << ">";
+    oss << "#Port<" << node() << "."
+            << id() << "."
+            << creation() << ">";
     return oss.str();
 }
 
@@ -26,13 +26,15 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #define _ERLPORT_HPP
 
 #include "ErlTerm.hpp"
+#include "NodeNames.hpp"
 
 namespace epi {
 namespace type {
 
 /**
  * Representation of erlang Ports.
- * A port has 3 parameters, nodeName, id and creation number
+ * A port has 3 parameters, nodeName, id and creation number.
+ * They are packed in an integer key, with the node name interned.
  */
 class ErlPort: public ErlTerm {
 public:
@@ -82,8 +84,15 @@ public:
      *
      * @return the node name from the PORT.
      **/
-    inline std::string node() const {
-        return mNode;
+    inline const std::string &node() const {
+        return NodeNames::name(nodeIndex());
+    }
+
+    /**
+     * Get the index of the node name in NodeNames.
+     **/
+    inline unsigned nodeIndex() const {
+        return (unsigned) (mKey >> NODE_SHIFT);
     }
 
     /**
@@ -92,7 +101,7 @@ public:
      * @return the id number from the PORT.
      **/
     inline int id() const {
-        return mId;
+        return (int) (mKey >> ID_SHIFT) & ID_MASK;
     }
 
     /**
@@ -101,7 +110,14 @@ public:
      * @return the creation number from the PORT.
      **/
     inline int creation() const {
-        return mCreation;
+        return (int) mKey & CREATION_MASK;
+    }
+
+    /**
+     * Get the packed node index, id and creation.
+     **/
+    inline unsigned long long key() const {
+        return mKey;
     }
 
     bool equals(const ErlTerm &t) const;
@@ -117,13 +133,23 @@ public:
 
 private:
     ErlPort(const ErlPort &t) {}
-    inline ~ErlPort() {}
+    inline ~ErlPort() {
+        if (mInitialized) {
+            NodeNames::release(nodeIndex());
+        }
+    }
 
 
 protected:
-    std::string mNode;
-    int mId;
-    int mCreation;
+    // Layout of mKey: node index:32 id:18 creation:2
+    enum {
+        CREATION_MASK = 0x03,
+        ID_SHIFT = 2,
+        ID_MASK = 0x3ffff,
+        NODE_SHIFT = 20
+    };
+
+    unsigned long long mKey;
 
 };
 
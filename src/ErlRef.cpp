@@ -52,7 +52,7 @@ void ErlRef::init(const std::string node, const unsigned int ids[],
     }
 
 
-    mNode = node;
+    mNodeIndex = NodeNames::intern(node);
     mNewStyle = newStyle;
 
     mIds[0] = ids[0] & 0x3ffff;
@@ -76,7 +76,7 @@ bool ErlRef::equals(const ErlTerm &t) const {
     if (_t->mNewStyle != mNewStyle)
         return false;
 
-    return (mNode == _t->mNode) &&
+    return (mNodeIndex == _t->mNodeIndex) &&
             (mIds[0] == _t->mIds[0]) &&
             (   !mNewStyle ||
                 ((mIds[1] == _t->mIds[1]) &&
@@ -90,13 +90,13 @@ std::string ErlRef::toString(const VariableBinding *binding) const {
 
     std::ostringstream oss;
     if (mNewStyle) {
-        oss << "#Ref<" << mNode << "."
+        oss << "#Ref<" << node() << "."
                 << mIds[0] << "."
                 << mIds[1] << "."
                 << mIds[2] << "."
                 << mCreation << ">";
     } else {
-        oss << "#Ref<" << mNode << "."
+        oss << "#Ref<" << node() << "."
                 << mIds[0] << "."
                 << mCreation << ">";
     }
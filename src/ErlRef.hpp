@@ -26,6 +26,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #define _ERLREF_HPP
 
 #include "ErlTerm.hpp"
+#include "NodeNames.hpp"
 
 namespace epi {
 namespace type {
@@ -66,7 +67,11 @@ public:
         }
     }
 
-    inline ~ErlRef() { }
+    inline ~ErlRef() {
+        if (mInitialized) {
+            NodeNames::release(mNodeIndex);
+        }
+    }
 
     /**
      * Init the Ref.
@@ -91,8 +96,15 @@ public:
      *
      * @return the node name from the REF.
      **/
-    inline std::string node() const {
-        return mNode;
+    inline const std::string &node() const {
+        return NodeNames::name(mNodeIndex);
+    }
+
+    /**
+     * Get the index of the node name in NodeNames.
+     **/
+    inline unsigned nodeIndex() const {
+        return mNodeIndex;
     }
 
     /**
@@ -147,7 +159,7 @@ private:
     ErlRef(const ErlRef &t) {}
 
 protected:
-    std::string mNode;
+    unsigned mNodeIndex;
     unsigned int mIds[3];
     unsigned int mCreation;
     bool mNewStyle;
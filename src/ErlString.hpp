@@ -89,6 +89,10 @@ private:
 protected:
     std::string mString;
 
+    inline size_t dataSize() const {
+        return stringDataSize(mString);
+    }
+
 };
 
 } //namespace type
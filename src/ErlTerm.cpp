@@ -44,6 +44,113 @@ std::string StringOfTermType(const TermType t) {
 }
 */
 
+long volatile TermStats::sAllocs[TermStats::TYPES];
+long volatile TermStats::sFrees[TermStats::TYPES];
+long volatile TermStats::sBytes[TermStats::TYPES];
+
+bool TermStats::available() {
+#ifdef USE_TERM_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+long TermStats::allocs(const TermType type) {
+    return epi::util::atomicLoad(&sAllocs[type]);
+}
+
+long TermStats::frees(const TermType type) {
+    return epi::util::atomicLoad(&sFrees[type]);
+}
+
+long TermStats::liveTerms(const TermType type) {
+    // Read the frees first, so a term freed meanwhile is not
+    // counted as freed but not allocated
+    long frees = epi::util::atomicLoad(&sFrees[type]);
+    return epi::util::atomicLoad(&sAllocs[type]) - frees;
+}
+
+long TermStats::liveBytes(const TermType type) {
+    return epi::util::atomicLoad(&sBytes[type]);
+}
+
+long TermStats::liveTerms() {
+    long count = 0;
+    for (int i = 0; i < TYPES; i++) {
+        count += liveTerms((TermType) i);
+    }
+    return count;
+}
+
+long TermStats::liveBytes() {
+    long bytes = 0;
+    for (int i = 0; i < TYPES; i++) {
+        bytes += liveBytes((TermType) i);
+    }
+    return bytes;
+}
+
+const char *TermStats::typeName(const TermType type) {
+    static const char *names[TYPES] = {
+        "atom", "long", "int", "double", "string", "ref", "port", "pid",
+        "binary", "tuple", "list", "empty_list", "cons_list", "variable"
+    };
+    if (type < 0 || type >= TYPES) {
+        return "unknown";
+    }
+    return names[type];
+}
+
+void TermStats::allocated(const TermType type, const size_t size) {
+    epi::util::atomicFetchAdd(&sAllocs[type], 1);
+    epi::util::atomicFetchAdd(&sBytes[type], (long) size);
+}
+
+void TermStats::freed(const TermType type, const size_t size) {
+    epi::util::atomicFetchAdd(&sFrees[type], 1);
+    epi::util::atomicFetchAdd(&sBytes[type], - (long) size);
+}
+
+size_t ErlTerm::memoryFootprint() const {
+    term_set visited;
+    return memoryFootprint(visited);
+}
+
+size_t ErlTerm::memoryFootprint(term_set &visited) const {
+    // A term referenced once can only be reached once, so only
+    // the shared terms are remembered
+    if (mRefCount > 1 && !visited.insert(this).second) {
+        return 0;
+    }
+    size_t size = objectSize() + dataSize() + subtermsFootprint(visited);
+    if (mEncoding) {
+        size += sizeof(std::string) + stringDataSize(*mEncoding);
+    }
+    return size;
+}
+
+void ErlTerm::freeze(const std::string &encoding) throw (EpiInvalidTerm) {
+    if (!isValid()) {
+        throw EpiInvalidTerm("Can't freeze an invalid term");
+    }
+    if (hasVariables()) {
+        throw EpiInvalidTerm("Can't freeze a term with variables");
+    }
+    if (!mEncoding) {
+        mEncoding = new std::string(encoding);
+    }
+}
+
+size_t ErlTerm::stringDataSize(const std::string &s) {
+    // Short strings can be kept in the string object
+    const char *data = s.data();
+    if (data >= (const char *) &s && data < (const char *) (&s + 1)) {
+        return 0;
+    }
+    return s.capacity() + 1;
+}
+
 // By default, return himself
 ErlTerm* ErlTerm::subst(const VariableBinding* binding)
         throw (EpiInvalidTerm, EpiVariableUnbound)
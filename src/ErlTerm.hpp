@@ -27,9 +27,11 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include <string>
 #include <vector>
+#include <set>
 #include <memory> 
 
 #include "EpiError.hpp" 
+#include "EpiAtomic.hpp"
 #include "ErlTermImpl.hpp"
 
 #ifdef _WIN32
@@ -75,6 +77,53 @@ enum TermType {
     ERL_VARIABLE
 };
 
+/**
+ * Allocation counters of the terms, by TermType, to look for leaks.
+ * They are kept when the library is built with USE_TERM_STATS
+ * (scons term_stats=1, make TERM_STATS=1), otherwise they stay at 0.
+ * The bytes are those of the term objects, not the data they own;
+ * see ErlTerm::memoryFootprint() for that.
+ */
+class TermStats {
+public:
+    static const int TYPES = ERL_VARIABLE + 1;
+
+    /** Check if the counters are kept */
+    static bool available();
+
+    /** Number of terms of a type created */
+    static long allocs(const TermType type);
+
+    /** Number of terms of a type deleted */
+    static long frees(const TermType type);
+
+    /** Number of terms of a type alive */
+    static long liveTerms(const TermType type);
+
+    /** Bytes of the terms of a type alive */
+    static long liveBytes(const TermType type);
+
+    /** Number of terms alive, of all types */
+    static long liveTerms();
+
+    /** Bytes of the terms alive, of all types */
+    static long liveBytes();
+
+    /** Name of a type, like "tuple" */
+    static const char *typeName(const TermType type);
+
+    /** Count a term created, by the IMPL_TYPE_SUPPORT operator new */
+    static void allocated(const TermType type, const size_t size);
+
+    /** Count a term deleted, by the IMPL_TYPE_SUPPORT operator delete */
+    static void freed(const TermType type, const size_t size);
+
+private:
+    static long volatile sAllocs[TYPES];
+    static long volatile sFrees[TYPES];
+    static long volatile sBytes[TYPES];
+};
+
 /** Maximun sizes */
 static const unsigned int MAX_HOSTNAME_LENGTH = 64;
 static const unsigned int MAX_ALIVE_LENGTH = 63;
@@ -127,8 +176,10 @@ class ErlTerm {
     friend class OutputBuffer;
     friend class InputBuffer;
 
-    typedef int refcnt;
+    typedef long refcnt;
 public:
+    typedef std::set<const ErlTerm*> term_set;
+
     /*
      All subclasses must:
       - define a default constructor (no arguments) that creates
@@ -140,7 +191,8 @@ public:
       - define method ToString
     */
 
-    inline ErlTerm(): mRefCount(0), mInitialized(false) {
+    inline ErlTerm(): mRefCount(0), mDropped(0), mInitialized(false),
+            mHasVariables(false), mEncoding(0) {
         Dout(dc::erlang_memory, "["<<this<<"]" <<"new ErlTerm()");
     }
 
@@ -150,7 +202,13 @@ public:
      */
     inline refcnt addRef() {
         Dout(dc::erlang_memory, "["<<this<<"]" <<"addRef() -> refcnt=" << mRefCount+1);
-        return ++mRefCount;
+        // Take a reference left by drop()
+        for (refcnt dropped = mDropped; dropped > 0; dropped = mDropped) {
+            if (epi::util::atomicCompareAndSwap(&mDropped, dropped, dropped - 1)) {
+                return mRefCount;
+            }
+        }
+        return epi::util::atomicFetchAdd(&mRefCount, 1) + 1;
     }
 
     /**
@@ -159,10 +217,11 @@ public:
      */
     inline refcnt release() {
         Dout(dc::erlang_memory, "["<<this<<"]" <<"release() -> refcnt= " << mRefCount-1);
-        if (--mRefCount <= 0) {
+        refcnt count = epi::util::atomicFetchAdd(&mRefCount, -1) - 1;
+        if (count <= 0) {
             delete this;
         }
-        return mRefCount;
+        return count;
     }
 
     /**
@@ -171,6 +230,45 @@ public:
      */
     virtual bool isValid() const { return mInitialized; }
 
+    /**
+     * Check if this term is or contains an ErlVariable. It is updated
+     * while the term is initialized, so it is cheap to call.
+     */
+    inline bool hasVariables() const { return mHasVariables; }
+
+    /**
+     * Get the memory held by this term: the objects of the term and
+     * its subterms, and the data they own, like the characters of a
+     * string. A subterm shared by several compound terms is counted
+     * once.
+     */
+    size_t memoryFootprint() const;
+
+    /**
+     * Get the memory held by this term, but the terms in visited.
+     * The shared terms counted are added to visited, so it can be
+     * used to count several terms sharing subterms.
+     */
+    size_t memoryFootprint(term_set &visited) const;
+
+    /**
+     * Freeze the term with its encoding in the external term format,
+     * without the version number. The output buffers that encode to
+     * this format copy it instead of walking the term again, also when
+     * the term is inside a bigger one. The encoding is kept until the
+     * term is deleted, freezing it again does nothing.
+     * Use epi::util::FreezeTerm() to get the encoding and freeze it,
+     * and freeze the term before sharing it between threads.
+     * @throws EpiInvalidTerm if the term is not valid or has variables
+     */
+    void freeze(const std::string &encoding) throw (EpiInvalidTerm);
+
+    /** Check if the term is frozen, so its encoding is cached */
+    inline bool isFrozen() const { return mEncoding != 0; }
+
+    /** Get the encoding of a frozen term, 0 if it is not frozen */
+    inline const std::string *frozenEncoding() const { return mEncoding; }
+
     /**
      * Check if the object is an instance of a concrete class. This method
      * is necesary to implement comparation method without rtti.
@@ -242,6 +340,9 @@ public:
      * To be used by ErlTermPtr is you want to return an zero referenced
      * ErlTerm.
      * If reference counter == 0, it is not decreased.
+     * If other references are held, they can be released by other
+     * threads before the term is taken, so the reference is kept and
+     * handed to the next addRef() instead.
      * Use this method with care!!
      * @return value of ref counter
      */
@@ -249,8 +350,11 @@ public:
         Dout(dc::erlang_memory, "["<<this<<"]" << "drop() refcnt=" << mRefCount-1);
         if (mRefCount == 0) {
             return 0;
+        } else if (mRefCount == 1) {
+            return epi::util::atomicFetchAdd(&mRefCount, -1) - 1;
         } else {
-            return --mRefCount;
+            epi::util::atomicFetchAdd(&mDropped, 1);
+            return mRefCount - 1;
         }
     }
 
@@ -285,13 +389,43 @@ public:
 private:
 
 protected:
-    refcnt mRefCount;
+    // Terms are shared between threads by local delivery
+    refcnt volatile mRefCount;
+
+    /** References kept by drop(), taken by the next addRef() */
+    refcnt volatile mDropped;
 
     bool mInitialized;
 
+    /** The term is or contains a variable */
+    bool mHasVariables;
+
+    /** Encoding cached by freeze(), 0 if the term is not frozen */
+    std::string *mEncoding;
+
+    /** Size of the object, defined by IMPL_TYPE_SUPPORT */
+    virtual size_t objectSize() const = 0;
+
+    /** Bytes owned by the term out of the object. Default: 0 */
+    virtual size_t dataSize() const {
+        return 0;
+    }
+
+    /**
+     * Memory held by the subterms of a compound term, but those in
+     * visited. Default: 0
+     */
+    virtual size_t subtermsFootprint(term_set &visited) const {
+        return 0;
+    }
+
+    /** Bytes of the characters of a string out of the object */
+    static size_t stringDataSize(const std::string &s);
+
     /** Protected VIRTUAL!!! destructor. Use release() for destruction */
     inline virtual ~ErlTerm() {
         Dout(dc::erlang_memory, "["<<this<<"]" <<"  \\-delete");
+        delete mEncoding;
     }
     /**
      * Implementation of matching process.
@@ -22,6 +22,27 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 ***** END LICENSE BLOCK *****
 */
 
+/*
+ * Operators new and delete of a term class that count the terms in
+ * TermStats, when built with USE_TERM_STATS. The terms are deleted
+ * through the virtual destructor, so the operator delete used is
+ * the one of the concrete class.
+ */
+#ifdef USE_TERM_STATS
+#define IMPL_TERM_ALLOC(classname, base_type) \
+	static inline void *operator new(size_t size) { \
+		void *p = ::operator new(size); \
+		TermStats::allocated(base_type, size); \
+		return p; \
+	} \
+	static inline void operator delete(void *p, size_t size) { \
+		TermStats::freed(base_type, size); \
+		::operator delete(p); \
+	}
+#else
+#define IMPL_TERM_ALLOC(classname, base_type)
+#endif
+
 /*
  * This macros implements the type checking method for ErlTerms
  */
@@ -32,6 +53,10 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 	inline TermType termType() const {\
          return base_type;\
 	}\
+	inline size_t objectSize() const {\
+		return sizeof(classname);\
+	}\
+	IMPL_TERM_ALLOC(classname, base_type)\
 \
 	static inline classname * cast(ErlTerm* t) throw (EpiBadArgument) {\
 		if (t != 0 && t->instanceOf(base_type)) {\
@@ -48,6 +73,10 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 	inline TermType termType() const {\
 		return base_type;\
 	}\
+	inline size_t objectSize() const {\
+		return sizeof(classname);\
+	}\
+	IMPL_TERM_ALLOC(classname, base_type)\
 	static inline classname * cast(ErlTerm* t) throw (EpiBadArgument) {\
 		if (t != 0 && t->instanceOf(base_type)) {\
 			return (classname *) t;\
@@ -64,6 +93,10 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 	inline TermType termType() const {\
         return base_type;\
 	}\
+	inline size_t objectSize() const {\
+		return sizeof(classname);\
+	}\
+	IMPL_TERM_ALLOC(classname, base_type)\
 	static inline classname * cast(ErlTerm* t) throw (EpiBadArgument) {\
 		if (t != 0 && t->instanceOf(base_type)) {\
 			return (classname *) t;\
@@ -128,13 +128,13 @@ public:
      * counter of given ErlTerm and releasing of old one
      */
     inline ErlTermPtr& operator=(ErlTermPtr &rhs) {
-        reset(rhs.addRef());
+        reset(rhs.get());
         Dout(dc::erlang_memory, "["<<mErlTerm<<"]"<<"  \\-ErlTermPtr assigment");
         return *this;
     }
     template <class U>
     inline ErlTermPtr<T>& operator=(ErlTermPtr<U>& rhs) {
-        reset(rhs.addRef());
+        reset(rhs.get());
         Dout(dc::erlang_memory, "["<<mErlTerm<<"]"<<"  \\-ErlTermPtr assigment");
         return *this;
     }
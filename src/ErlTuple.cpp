@@ -135,6 +135,9 @@ ErlTuple* ErlTuple::initElement(ErlTerm *elem)
     }
 
     mElementVector.push_back(elem);
+    if (elem->hasVariables()) {
+        mHasVariables = true;
+    }
     if (mElementVector.size() == mArity) {
         mInitialized = true;
     }
@@ -246,11 +249,26 @@ ErlVariable* ErlTuple::searchUnbound(const VariableBinding* binding) const {
     return 0;
 }
 
+size_t ErlTuple::subtermsFootprint(term_set &visited) const {
+    size_t size = 0;
+    for (erlterm_vector::const_iterator it=mElementVector.begin(), end=mElementVector.end();
+         it != end; ++it)
+    {
+        size += it->get()->memoryFootprint(visited);
+    }
+    return size;
+}
+
 ErlTerm* ErlTuple::subst(const VariableBinding* binding)
         throw (EpiInvalidTerm, EpiVariableUnbound)
 {
     Dout_continue(dc::erlang, _continue, " Failed.", 
     		"["<<this<<"]"<< " ErlTerm::subst(): ");
+    // Nothing to substitute
+    if (!hasVariables() && isValid()) {
+	    Dout_finish(_continue, "Returning the same tuple (no variables)");
+        return this;
+    }
     ErlTermPtr<ErlTuple> newTuple = new ErlTuple(arity());
     // We check if any contained term changes.
     bool change = false;
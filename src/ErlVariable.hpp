@@ -47,6 +47,7 @@ public:
      */
     inline ErlVariable(): ErlTerm(), mName("_") {
         mInitialized = true;
+        mHasVariables = true;
     }
     /**
      * Create a new variable. If you use "_" as name, it will be an
@@ -54,6 +55,7 @@ public:
      */
     inline ErlVariable( std::string name ): ErlTerm(), mName(name) {
         mInitialized = true;
+        mHasVariables = true;
     }
 
     inline std::string getName( ) {
@@ -79,6 +81,10 @@ private:
 
 protected:
 
+    inline size_t dataSize() const {
+        return stringDataSize(mName);
+    }
+
     bool internalMatch(VariableBinding* binding, ErlTerm* pattern)
             throw (EpiVariableUnbound);
 
@@ -41,6 +41,8 @@ using namespace epi::error;
 class ErlangTransport {
 public:
 
+    virtual ~ErlangTransport() {}
+
     /**
      * Set up a connection to an Erlang node, using the default cookie
      * @param node node name to connect
@@ -60,6 +62,21 @@ public:
     virtual Connection* connect(const std::string node, const std::string cookie)
             throw(EpiConnectionException) = 0;
 
+    /**
+     * Set up a connection to an Erlang node, using the default cookie
+     * and giving up after the given time. Transports that can not
+     * limit the connection time ignore the timeout.
+     * @param node node name to connect
+     * @param timeout timeout in milliseconds. 0 to infinite
+     * @returns A new connection. The connection has no receiver defined
+     * and is not started.
+     */
+    virtual Connection* connect(const std::string node, long timeout)
+            throw(EpiConnectionException)
+    {
+        return connect(node);
+    }
+
     /**
      * Accept a connection from a client process.
      * This method sets the socket to listen incoming connections.
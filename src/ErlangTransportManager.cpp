@@ -24,6 +24,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "Config.hpp"
 
 #include "EITransport.hpp"
+#include "InProcTransport.hpp"
+#include "EIUringTransport.hpp"
 #include "ErlangTransportManager.hpp"
 
 using namespace epi::node;
@@ -34,6 +36,10 @@ ErlangTransportManager *ErlangTransportManager::mErlangTransportManagerInstance
 
 ErlangTransportManager::ErlangTransportManager() {
     mFactoryMap["ei"] = new epi::ei::EITransportFactory();
+    mFactoryMap["inproc"] = new InProcTransportFactory();
+    #ifdef USE_IO_URING
+    mFactoryMap["eiuring"] = new epi::ei::EIUringTransportFactory();
+    #endif
 }
 
 
@@ -0,0 +1,143 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp"
+
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "Fiber.hpp"
+#include "EpiAtomic.hpp"
+
+using namespace epi::util;
+
+// Fiber running in this thread
+static EPI_THREAD_LOCAL Fiber *tCurrent;
+
+#ifdef _WIN32
+
+// This thread converted to a fiber, to switch back to it
+static EPI_THREAD_LOCAL void *tThreadFiber;
+
+Fiber::Fiber(void (*entry)(void *), void *arg, std::size_t stackSize):
+        mEntry(entry), mArg(arg), mDone(false),
+        mFiber(CreateFiber(stackSize, (LPFIBER_START_ROUTINE) &Fiber::start, this)),
+        mCaller(0)
+{
+}
+
+Fiber::~Fiber() {
+    DeleteFiber(mFiber);
+}
+
+void Fiber::resume() {
+    if (tThreadFiber == 0) {
+        tThreadFiber = ConvertThreadToFiber(0);
+    }
+    Fiber *previous = tCurrent;
+    mCaller = previous? previous->mFiber: tThreadFiber;
+    tCurrent = this;
+    SwitchToFiber(mFiber);
+    tCurrent = previous;
+}
+
+void Fiber::yield() {
+    SwitchToFiber(tCurrent->mCaller);
+}
+
+void __stdcall Fiber::start(void *arg) {
+    Fiber *fiber = (Fiber *) arg;
+    fiber->mEntry(fiber->mArg);
+    fiber->mDone = true;
+    SwitchToFiber(fiber->mCaller);
+}
+
+#else
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+Fiber::Fiber(void (*entry)(void *), void *arg, std::size_t stackSize):
+        mEntry(entry), mArg(arg), mDone(false), mStack(0), mMapSize(0)
+{
+    // The stack grows down to a page without access, so an overflow
+    // faults instead of writing over other memory
+    std::size_t page = (std::size_t) sysconf(_SC_PAGESIZE);
+    stackSize = (stackSize + page - 1) / page * page;
+    mMapSize = stackSize + page;
+    void *map = mmap(0, mMapSize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    mStack = (char *) map;
+    if (mprotect(mStack, page, PROT_NONE) != 0) {
+        munmap(mStack, mMapSize);
+        throw std::bad_alloc();
+    }
+
+    getcontext(&mContext);
+    mContext.uc_stack.ss_sp = mStack + page;
+    mContext.uc_stack.ss_size = stackSize;
+    mContext.uc_link = 0;
+    makecontext(&mContext, &Fiber::start, 0);
+}
+
+Fiber::~Fiber() {
+    munmap(mStack, mMapSize);
+}
+
+void Fiber::resume() {
+    Fiber *previous = tCurrent;
+    tCurrent = this;
+    swapcontext(&mCaller, &mContext);
+    tCurrent = previous;
+}
+
+void Fiber::yield() {
+    Fiber *fiber = tCurrent;
+    swapcontext(&fiber->mContext, &fiber->mCaller);
+}
+
+void Fiber::start() {
+    // makecontext only passes int arguments, the fiber is taken
+    // from the thread that resumed it
+    Fiber *fiber = tCurrent;
+    fiber->mEntry(fiber->mArg);
+    fiber->mDone = true;
+    setcontext(&fiber->mCaller);
+}
+
+#endif
+
+Fiber *Fiber::current() {
+    return tCurrent;
+}
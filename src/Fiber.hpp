@@ -0,0 +1,118 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#ifndef __FIBER_HPP
+#define __FIBER_HPP
+
+#include <cstddef>
+
+#ifndef _WIN32
+#include <ucontext.h>
+#endif
+
+namespace epi {
+namespace util {
+
+/**
+ * Execution context with its own stack, switched in user space.
+ * A fiber runs when a thread calls resume(), until the fiber calls
+ * yield() or its function returns. A suspended fiber can be resumed
+ * from any thread.
+ *
+ * Uses ucontext on POSIX systems and Fibers on Windows.
+ */
+class Fiber {
+public:
+    /** Default size of the stack of a fiber */
+    static const std::size_t DEFAULT_STACK_SIZE = 64 * 1024;
+
+    /**
+     * Create a suspended fiber
+     * @param entry function run by the fiber
+     * @param arg argument for the function
+     * @param stackSize size of the stack of the fiber. On POSIX systems
+     * it is rounded up to whole pages, below a page that faults on access.
+     * @throws std::bad_alloc if the stack can not be allocated
+     */
+    Fiber(void (*entry)(void *), void *arg,
+          std::size_t stackSize = DEFAULT_STACK_SIZE);
+
+    /**
+     * Destroy the fiber. It must not be running. If the function
+     * has not finished its stack is not unwound.
+     */
+    ~Fiber();
+
+    /**
+     * Run the fiber in the current thread until it yields or finishes
+     */
+    void resume();
+
+    /**
+     * Check if the function of the fiber has returned
+     */
+    inline bool isDone() const {
+        return mDone;
+    }
+
+    /**
+     * Suspend the current fiber, returning to the thread that resumed it
+     */
+    static void yield();
+
+    /**
+     * Get the fiber running in this thread, or 0
+     */
+    static Fiber *current();
+
+private:
+    #ifdef _WIN32
+    static void __stdcall start(void *fiber);
+    #else
+    static void start();
+    #endif
+
+    void (*mEntry)(void *);
+    void *mArg;
+    bool mDone;
+
+    #ifdef _WIN32
+    void *mFiber;
+    void *mCaller;
+    #else
+    /** Mapped memory, the guard page and the stack */
+    char *mStack;
+    std::size_t mMapSize;
+    ucontext_t mContext;
+    ucontext_t mCaller;
+    #endif
+
+    Fiber(const Fiber &);
+    Fiber &operator=(const Fiber &);
+};
+
+} // util
+} // epi
+
+#endif // __FIBER_HPP
@@ -0,0 +1,268 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+#ifdef USE_OPEN_THREADS
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+#elif USE_BOOST
+#include <boost/thread/mutex.hpp>
+#endif
+
+#include "FrameCapture.hpp"
+#include "LatencyHistogram.hpp"
+
+using namespace epi::util;
+
+static std::ofstream captureFile;
+static long long captureStart = 0;
+static long captureFrames = 0;
+#ifdef USE_OPEN_THREADS
+static OpenThreads::Mutex captureMutex;
+#elif USE_BOOST
+static boost::mutex captureMutex;
+#endif
+
+/*
+ * Start the capture of EPI_CAPTURE at startup
+ */
+static struct CaptureInit {
+    CaptureInit() {
+        const char *env = getenv("EPI_CAPTURE");
+        if (env && *env) {
+            FrameCapture::start(env);
+        }
+    }
+    ~CaptureInit() {
+        FrameCapture::stop();
+    }
+} captureInit;
+
+/*
+ * Encode the control message as the distribution sends it
+ */
+static void encodeControl(const erlang_msg *msg, ei_x_buff *x) {
+    switch (msg->msgtype) {
+    case ERL_SEND:
+        ei_x_encode_tuple_header(x, 3);
+        ei_x_encode_long(x, msg->msgtype);
+        ei_x_encode_atom(x, "");
+        ei_x_encode_pid(x, &msg->to);
+        break;
+    case ERL_REG_SEND:
+        ei_x_encode_tuple_header(x, 4);
+        ei_x_encode_long(x, msg->msgtype);
+        ei_x_encode_pid(x, &msg->from);
+        ei_x_encode_atom(x, "");
+        ei_x_encode_atom(x, msg->toname);
+        break;
+    case ERL_LINK:
+    case ERL_UNLINK:
+    case ERL_EXIT:
+    case ERL_EXIT2:
+        ei_x_encode_tuple_header(x, 3);
+        ei_x_encode_long(x, msg->msgtype);
+        ei_x_encode_pid(x, &msg->from);
+        ei_x_encode_pid(x, &msg->to);
+        break;
+    default:
+        ei_x_encode_tuple_header(x, 1);
+        ei_x_encode_long(x, msg->msgtype);
+        break;
+    }
+}
+
+/*
+ * Decode a control message written by encodeControl()
+ * @return false if it is not valid
+ */
+static bool decodeControl(const char *buffer, unsigned length,
+                          erlang_msg *msg)
+{
+    int index = 0;
+    int version, arity;
+    long msgtype;
+    memset(msg, 0, sizeof(*msg));
+    if (ei_decode_version(buffer, &index, &version) < 0 ||
+        ei_decode_tuple_header(buffer, &index, &arity) < 0 ||
+        ei_decode_long(buffer, &index, &msgtype) < 0)
+    {
+        return false;
+    }
+    bool error;
+    switch (msgtype) {
+    case ERL_SEND:
+        error = arity != 3 ||
+                ei_decode_atom(buffer, &index, msg->cookie) < 0 ||
+                ei_decode_pid(buffer, &index, &msg->to) < 0;
+        break;
+    case ERL_REG_SEND:
+        error = arity != 4 ||
+                ei_decode_pid(buffer, &index, &msg->from) < 0 ||
+                ei_decode_atom(buffer, &index, msg->cookie) < 0 ||
+                ei_decode_atom(buffer, &index, msg->toname) < 0;
+        break;
+    case ERL_LINK:
+    case ERL_UNLINK:
+    case ERL_EXIT:
+    case ERL_EXIT2:
+        error = arity != 3 ||
+                ei_decode_pid(buffer, &index, &msg->from) < 0 ||
+                ei_decode_pid(buffer, &index, &msg->to) < 0;
+        break;
+    default:
+        error = arity != 1;
+        break;
+    }
+    msg->msgtype = msgtype;
+    return !error && (unsigned) index <= length;
+}
+
+long volatile FrameCapture::sEnabled = 0;
+
+bool FrameCapture::start(const std::string &file) {
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(captureMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(captureMutex);
+    #endif
+    atomicStore(&sEnabled, 0L);
+    if (captureFile.is_open()) {
+        captureFile.close();
+    }
+    captureFile.clear();
+    captureFile.open(file.c_str(), std::ios::out | std::ios::binary);
+    if (!captureFile) {
+        return false;
+    }
+    CaptureFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "EPICAPT", 8);
+    header.version = 1;
+    header.frameSize = sizeof(CaptureFrameHeader);
+    captureFile.write((const char *) &header, sizeof(header));
+    captureStart = LatencyHistogram::now();
+    captureFrames = 0;
+    atomicStore(&sEnabled, 1L);
+    return true;
+}
+
+void FrameCapture::stop() {
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(captureMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(captureMutex);
+    #endif
+    atomicStore(&sEnabled, 0L);
+    if (captureFile.is_open()) {
+        captureFile.close();
+    }
+}
+
+void FrameCapture::record(const std::string &peer, const erlang_msg *msg,
+                          const char *payload, unsigned length)
+{
+    long long now = LatencyHistogram::now();
+    ei_x_buff control;
+    ei_x_new_with_version(&control);
+    encodeControl(msg, &control);
+
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(captureMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(captureMutex);
+    #endif
+    // Stopped since the caller checked it
+    if (atomicLoad(&sEnabled)) {
+        CaptureFrameHeader header;
+        header.time = now - captureStart;
+        header.peerLength = peer.size();
+        header.controlLength = control.index;
+        header.payloadLength = length;
+        header.unused = 0;
+        captureFile.write((const char *) &header, sizeof(header));
+        captureFile.write(peer.data(), peer.size());
+        captureFile.write(control.buff, control.index);
+        captureFile.write(payload, length);
+        captureFrames++;
+    }
+    ei_x_free(&control);
+}
+
+long FrameCapture::frames() {
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(captureMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(captureMutex);
+    #endif
+    return captureFrames;
+}
+
+CaptureReader::CaptureReader(): mIn() {
+}
+
+bool CaptureReader::open(const std::string &file) {
+    close();
+    mIn.clear();
+    mIn.open(file.c_str(), std::ios::in | std::ios::binary);
+    CaptureFileHeader header;
+    if (!mIn.read((char *) &header, sizeof(header)) ||
+        memcmp(header.magic, "EPICAPT", 8) != 0 ||
+        header.version != 1 ||
+        header.frameSize != sizeof(CaptureFrameHeader))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool CaptureReader::next(CapturedFrame &frame) {
+    CaptureFrameHeader header;
+    if (!mIn.is_open() || !mIn.read((char *) &header, sizeof(header))) {
+        return false;
+    }
+    std::vector<char> control(header.controlLength);
+    frame.time = header.time;
+    frame.peer.resize(header.peerLength);
+    frame.payload.resize(header.payloadLength);
+    if ((header.peerLength > 0 && !mIn.read(&frame.peer[0], header.peerLength)) ||
+        (header.controlLength > 0 && !mIn.read(&control[0], header.controlLength)) ||
+        (header.payloadLength > 0 && !mIn.read(&frame.payload[0], header.payloadLength)))
+    {
+        return false;
+    }
+    return header.controlLength > 0 &&
+            decodeControl(&control[0], header.controlLength, &frame.msg);
+}
+
+void CaptureReader::close() {
+    if (mIn.is_open()) {
+        mIn.close();
+    }
+}
@@ -0,0 +1,160 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#ifndef __FRAMECAPTURE_HPP
+#define __FRAMECAPTURE_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "ei.h"
+#include "EpiAtomic.hpp"
+
+namespace epi {
+namespace util {
+
+/**
+ * Header of a capture file written by FrameCapture. It is followed by
+ * the frames, each one as a CaptureFrameHeader and then the name of
+ * the peer node, the control message and the payload. Integers are in
+ * the byte order of the machine that wrote the file.
+ */
+struct CaptureFileHeader {
+    /** "EPICAPT" */
+    char magic[8];
+    unsigned version;
+    /** sizeof(CaptureFrameHeader) */
+    unsigned frameSize;
+};
+
+/**
+ * Header of a frame in a capture file
+ */
+struct CaptureFrameHeader {
+    /** Nanoseconds since the capture started */
+    long long time;
+    unsigned peerLength;
+    unsigned controlLength;
+    unsigned payloadLength;
+    unsigned unused;
+};
+
+/**
+ * A frame read from a capture file
+ */
+struct CapturedFrame {
+    /** Nanoseconds since the capture started */
+    long long time;
+    /** Node the frame was read from */
+    std::string peer;
+    /** The control message, as ei_xreceive_msg() gives it */
+    erlang_msg msg;
+    /** The message (or exit reason) with the version magic */
+    std::vector<char> payload;
+};
+
+/**
+ * Capture of the frames read from the distribution connections, to
+ * replay them later with a ReplayConnection.
+ *
+ * Each frame is written with the time it was read, the peer node,
+ * the control message encoded as the distribution sends it
+ * ({2, '', To} for a send, {6, From, '', Name} for a registered send,
+ * {Type, From, To} for links and exits) and the encoded payload.
+ * Ticks and errors are not captured. The frames of all the
+ * connections go to the same file, so the capture has a cost while
+ * it is running; while it is stopped it costs a load and a branch.
+ * A capture to the file in the environment variable EPI_CAPTURE is
+ * started at startup.
+ */
+class FrameCapture {
+public:
+    /**
+     * Check if a capture is running
+     */
+    static inline bool enabled() {
+        return atomicLoad(&sEnabled) != 0;
+    }
+
+    /**
+     * Start capturing to a file, stopping the running capture
+     * @return false if the file could not be written
+     */
+    static bool start(const std::string &file);
+
+    /**
+     * Stop capturing, and close the file
+     */
+    static void stop();
+
+    /**
+     * Write a frame to the capture. The caller checks enabled() first.
+     * @param peer node the frame was read from
+     * @param msg control message
+     * @param payload message with the version magic
+     * @param length bytes of the payload
+     */
+    static void record(const std::string &peer, const erlang_msg *msg,
+                       const char *payload, unsigned length);
+
+    /**
+     * Get the frames written since the capture started
+     */
+    static long frames();
+
+private:
+    static long volatile sEnabled;
+};
+
+/**
+ * Reader of the frames of a capture file
+ */
+class CaptureReader {
+public:
+    CaptureReader();
+
+    /**
+     * Open a capture file
+     * @return false if it can not be read or is not a capture file
+     */
+    bool open(const std::string &file);
+
+    /**
+     * Read the next frame
+     * @return false at the end of the file, or if the frame is
+     *  truncated or its control message can not be decoded
+     */
+    bool next(CapturedFrame &frame);
+
+    void close();
+
+private:
+    std::ifstream mIn;
+};
+
+} // namespace util
+} // namespace epi
+
+#endif // __FRAMECAPTURE_HPP
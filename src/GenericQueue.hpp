@@ -39,6 +39,10 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include <boost/thread/condition.hpp>
 #endif
 
+#include "TimerService.hpp"
+#include "LatencyHistogram.hpp"
+#include "EpiProbes.hpp"
+
 /**
  * Predicate to explore the queue.
  * Implement the method check that analizes the elements of the queue.
@@ -69,9 +73,28 @@ public:
  * @param T class which pointers will be stored
 */
 template <typename T> class GenericQueue {
-    typedef std::list<T*> element_list;
-    typedef typename std::list<T*>::iterator iterator;
+    struct Entry {
+        T* elem;
+        // Time it was put, if the wait is recorded
+        long long queued;
+    };
+    typedef std::list<Entry> element_list;
+    typedef typename std::list<Entry>::iterator iterator;
 public:
+    GenericQueue(): mList(), mWaitHistogram(0), mGuardHistogram(0) {}
+
+    /**
+     * Record the time each element waits in the queue, and the time
+     * of each scan with a guard. Set them before using the queue.
+     * @param wait histogram for the waits, 0 to not record them
+     * @param guard histogram for the scans, 0 to not record them
+     */
+    void setHistograms(epi::util::LatencyHistogram *wait,
+                       epi::util::LatencyHistogram *guard)
+    {
+        mWaitHistogram = wait;
+        mGuardHistogram = guard;
+    }
 
     /**
      * Retrieve an object from the head of the queue, or block until
@@ -124,7 +147,11 @@ public:
 private:
     // attempt to retrieve message from queue head
     T* tryGet();
+    // remove an element from the queue
+    T* take(iterator i);
     element_list mList;
+    epi::util::LatencyHistogram *mWaitHistogram;
+    epi::util::LatencyHistogram *mGuardHistogram;
 
     #ifdef USE_OPEN_THREADS
     OpenThreads::Mutex _queueMutex;
@@ -143,14 +170,23 @@ template <class T>
 T* GenericQueue<T>::tryGet( ) {
     T* elem;
     if (!mList.empty()) {
-        elem = mList.front();
-        mList.pop_front();
+        elem = take(mList.begin());
     } else {
         elem = 0;
     }
     return elem;
 }
 
+template <class T>
+T* GenericQueue<T>::take(iterator i) {
+    T* elem = i->elem;
+    if (mWaitHistogram) {
+        mWaitHistogram->recordSince(i->queued);
+    }
+    mList.erase(i);
+    return elem;
+}
+
 template <class T>
 T* GenericQueue<T>::get( ) {
 	#ifdef USE_OPEN_THREADS
@@ -176,33 +212,23 @@ template <class T>
 {
 	#ifdef USE_OPEN_THREADS
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_queueMutex);
-    long currentTime = currentTimeMillis();
-    long stopTime = currentTime + timeout;
 	#elif USE_BOOST
 	boost::mutex::scoped_lock lock(_queueMutex);
-    boost::system_time currentTime = boost::get_system_time();
-    boost::posix_time::milliseconds const delay(timeout);
-    boost::system_time const stopTime = currentTime + delay;
 	#endif
+    // Monotonic, so changes of the system time don't affect the timeout
+    long long stopTime = epi::util::TimerService::currentTime() + timeout;
     T* elem;
 
     while ((elem = tryGet()) == 0) {
-        #ifdef USE_OPEN_THREADS
-        currentTime = currentTimeMillis();
-		#elif USE_BOOST
-        currentTime = boost::get_system_time();
-		#endif
-        if (stopTime < currentTime) {
+        long long remaining = stopTime - epi::util::TimerService::currentTime();
+        if (remaining <= 0) {
 			return 0;
         }
 		#ifdef USE_OPEN_THREADS
-        if (_queueCondition.wait(&_queueMutex, stopTime-currentTime) != 0) {
-			return 0;
-        }
+        _queueCondition.wait(&_queueMutex, (unsigned long) remaining);
 		#elif USE_BOOST
-        if (_queueCondition.timed_wait(_queueMutex, stopTime) != 0) {
-			return 0;
-        }
+        _queueCondition.timed_wait(_queueMutex,
+                boost::posix_time::milliseconds(remaining));
 		#endif
     }
     return elem;
@@ -218,14 +244,24 @@ T* GenericQueue<T>::get(QueueGuard *guard)
 	#endif
 
 	while (true) {
+        long long start =
+                mGuardHistogram ? epi::util::LatencyHistogram::now() : 0;
+        int scanned = 0;
         // Iterate the list
         for (iterator i = mList.begin(); i != mList.end(); ++i) {
-            T* elem = *i;
-            if (guard->check(elem)) {
-                mList.remove(elem);
-                return elem;
+            scanned++;
+            if (guard->check(i->elem)) {
+                if (mGuardHistogram) {
+                    mGuardHistogram->recordSince(start);
+                }
+                EPI_PROBE3(queue__guard__scan, this, scanned, 1);
+                return take(i);
             }
         }
+        if (mGuardHistogram) {
+            mGuardHistogram->recordSince(start);
+        }
+        EPI_PROBE3(queue__guard__scan, this, scanned, 0);
 
         // No element complaints
         // Give oportunity to other
@@ -245,47 +281,48 @@ T* GenericQueue<T>::get(QueueGuard *guard, long timeout)
 {
 	#ifdef USE_OPEN_THREADS
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_queueMutex);
-	long currentTime = currentTimeMillis();
-    long stopTime = currentTime + timeout;
-
 	#elif USE_BOOST
 	boost::mutex::scoped_lock lock(_queueMutex);
-    boost::system_time currentTime = boost::get_system_time();
-    boost::posix_time::milliseconds const delay(timeout);
-    boost::system_time const stopTime = currentTime + delay;
 	#endif
+    long long stopTime = epi::util::TimerService::currentTime() + timeout;
 
     while (true) {
+        long long start =
+                mGuardHistogram ? epi::util::LatencyHistogram::now() : 0;
+        int scanned = 0;
         // Iterate the list
         for (iterator i = mList.begin(); i != mList.end(); ++i)
         {
-            T* elem = *i;
-            if (guard->check(elem)) {
-                mList.remove(elem);
-                return elem;
+            scanned++;
+            if (guard->check(i->elem)) {
+                if (mGuardHistogram) {
+                    mGuardHistogram->recordSince(start);
+                }
+                EPI_PROBE3(queue__guard__scan, this, scanned, 1);
+                return take(i);
             }
         }
+        if (mGuardHistogram) {
+            mGuardHistogram->recordSince(start);
+        }
+        EPI_PROBE3(queue__guard__scan, this, scanned, 0);
         // No element complaints
         // Give oportunity to other
 		#ifdef USE_OPEN_THREADS
         _queueCondition.signal();
-        currentTime = currentTimeMillis();
 		#elif USE_BOOST
         _queueCondition.notify_one();
-        currentTime = boost::get_system_time();
 		#endif
 
-        if (stopTime < currentTime) {
+        long long remaining = stopTime - epi::util::TimerService::currentTime();
+        if (remaining <= 0) {
 			return 0;
         }
 		#ifdef USE_OPEN_THREADS
-        if (_queueCondition.wait(&_queueMutex, stopTime-currentTime) != 0) {
-			return 0; 
-        }
+        _queueCondition.wait(&_queueMutex, (unsigned long) remaining);
 		#elif USE_BOOST
-        if (_queueCondition.timed_wait(_queueMutex, stopTime) != 0) {
-			return 0; 
-        }
+        _queueCondition.timed_wait(_queueMutex,
+                boost::posix_time::milliseconds(remaining));
 		#endif
     }
 }
@@ -311,7 +348,10 @@ template <class T>
 	boost::mutex::scoped_lock lock(_queueMutex);
 	#endif
 
-    mList.push_back(element);
+    Entry entry;
+    entry.elem = element;
+    entry.queued = mWaitHistogram ? epi::util::LatencyHistogram::now() : 0;
+    mList.push_back(entry);
 	#ifdef USE_OPEN_THREADS
     _queueCondition.signal();
 	#elif USE_BOOST
@@ -326,7 +366,7 @@ template <class T>
     for (iterator i = mList.begin();
          i != mList.end(); i++)
     {
-        delete (*i);
+        delete i->elem;
     }
     mList.clear();
 }
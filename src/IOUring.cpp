@@ -0,0 +1,295 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp"
+
+#ifdef USE_IO_URING
+
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+#include "IOUring.hpp"
+
+IOUring::IOUring(): m_fd(-1), m_entries(0), m_sqTail(0), m_sqSubmitted(0),
+        m_sqRing(MAP_FAILED), m_cqRing(MAP_FAILED),
+        m_sqes((struct io_uring_sqe *) MAP_FAILED),
+        m_sqRingSize(0), m_cqRingSize(0)
+{
+}
+
+IOUring::~IOUring()
+{
+    close();
+}
+
+bool IOUring::create(unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    m_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (m_fd < 0) {
+        m_fd = -1;
+        return false;
+    }
+    // Timeouts in submitAndWait need IORING_ENTER_EXT_ARG (linux 5.11)
+    if (!(params.features & IORING_FEAT_EXT_ARG)) {
+        close();
+        return false;
+    }
+
+    m_entries = params.sq_entries;
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && m_cqRingSize > m_sqRingSize) {
+        m_sqRingSize = m_cqRingSize;
+    }
+
+    m_sqRing = mmap(0, m_sqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED) {
+        close();
+        return false;
+    }
+    if (single) {
+        m_cqRing = m_sqRing;
+    } else {
+        m_cqRing = mmap(0, m_cqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED) {
+            close();
+            return false;
+        }
+    }
+    m_sqes = (struct io_uring_sqe *)
+            mmap(0, params.sq_entries * sizeof(struct io_uring_sqe),
+                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 m_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED) {
+        close();
+        return false;
+    }
+
+    char *sq = (char *) m_sqRing;
+    char *cq = (char *) m_cqRing;
+    m_sqHead = (unsigned *) (sq + params.sq_off.head);
+    m_sqTailPtr = (unsigned *) (sq + params.sq_off.tail);
+    m_sqMask = *(unsigned *) (sq + params.sq_off.ring_mask);
+    m_cqHead = (unsigned *) (cq + params.cq_off.head);
+    m_cqTail = (unsigned *) (cq + params.cq_off.tail);
+    m_cqMask = *(unsigned *) (cq + params.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    // The sqe array is used in order, so the index array is the identity
+    unsigned *array = (unsigned *) (sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) {
+        array[i] = i;
+    }
+    m_sqTail = *m_sqTailPtr;
+    m_sqSubmitted = m_sqTail;
+    return true;
+}
+
+void IOUring::close()
+{
+    if (m_sqes != MAP_FAILED) {
+        munmap(m_sqes, m_entries * sizeof(struct io_uring_sqe));
+        m_sqes = (struct io_uring_sqe *) MAP_FAILED;
+    }
+    if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    m_cqRing = MAP_FAILED;
+    if (m_sqRing != MAP_FAILED) {
+        munmap(m_sqRing, m_sqRingSize);
+        m_sqRing = MAP_FAILED;
+    }
+    if (m_fd != -1) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool IOUring::registerBuffers(const struct iovec *iov, unsigned count)
+{
+    return syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS,
+                   iov, count) == 0;
+}
+
+unsigned IOUring::spaceLeft() const
+{
+    unsigned head = *m_sqHead;
+    __sync_synchronize();
+    return m_entries - (m_sqTail - head);
+}
+
+struct io_uring_sqe *IOUring::getSqe()
+{
+    if (spaceLeft() == 0) {
+        return 0;
+    }
+    struct io_uring_sqe *sqe = &m_sqes[m_sqTail & m_sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sqTail++;
+    return sqe;
+}
+
+bool IOUring::prepareReadFixed(int fd, void *buf, unsigned len,
+                               int bufIndex, unsigned long long userData)
+{
+    struct io_uring_sqe *sqe = getSqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) buf;
+    sqe->len = len;
+    // Sockets are not seekable, read from the current position
+    sqe->off = (unsigned long long) -1;
+    sqe->buf_index = bufIndex;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool IOUring::prepareRecv(int fd, void *buf, unsigned len,
+                          unsigned long long userData)
+{
+    struct io_uring_sqe *sqe = getSqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) buf;
+    sqe->len = len;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool IOUring::prepareSend(int fd, const void *buf, unsigned len,
+                          unsigned long long userData, bool link)
+{
+    struct io_uring_sqe *sqe = getSqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) buf;
+    sqe->len = len;
+    // Without MSG_WAITALL a short send does not break the link, and
+    // the next send would go out before the rest of the data
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    if (link) {
+        sqe->flags = IOSQE_IO_LINK;
+    }
+    sqe->user_data = userData;
+    return true;
+}
+
+bool IOUring::prepareCancel(unsigned long long target,
+                            unsigned long long userData)
+{
+    struct io_uring_sqe *sqe = getSqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = userData;
+    return true;
+}
+
+int IOUring::submitAndWait(unsigned waitCount, long timeout)
+{
+    // Publish the new entries before telling the kernel
+    __sync_synchronize();
+    *m_sqTailPtr = m_sqTail;
+    __sync_synchronize();
+
+    int ret = enter(m_sqTail - m_sqSubmitted, waitCount, timeout);
+    if (ret > 0) {
+        m_sqSubmitted += ret;
+    }
+    return ret;
+}
+
+int IOUring::wait(unsigned waitCount, long timeout)
+{
+    int ret = enter(0, waitCount, timeout);
+    return ret < 0 ? ret : 0;
+}
+
+int IOUring::enter(unsigned toSubmit, unsigned waitCount, long timeout)
+{
+    unsigned flags = waitCount > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    if (timeout >= 0) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000;
+        arg.ts = (unsigned long) &ts;
+    }
+    flags |= IORING_ENTER_EXT_ARG;
+
+    int ret;
+    do {
+        ret = syscall(__NR_io_uring_enter, m_fd, toSubmit, waitCount,
+                      flags, &arg, sizeof(arg));
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        return -errno;
+    }
+    return ret;
+}
+
+bool IOUring::peekCompletion(unsigned long long *userData, int *result)
+{
+    unsigned head = *m_cqHead;
+    __sync_synchronize();
+    if (head == *m_cqTail) {
+        return false;
+    }
+    struct io_uring_cqe *cqe = &m_cqes[head & m_cqMask];
+    *userData = cqe->user_data;
+    *result = cqe->res;
+    __sync_synchronize();
+    *m_cqHead = head + 1;
+    return true;
+}
+
+#endif // USE_IO_URING
@@ -0,0 +1,168 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#ifndef _IOURING_HPP
+#define _IOURING_HPP
+
+#ifdef USE_IO_URING
+
+#include <sys/uio.h>
+
+/**
+ * Minimal wrapper of a Linux io_uring instance, using the raw system
+ * calls (liburing is not needed).
+ *
+ * The submission side and the completion side are not thread safe:
+ * each ring must be used by one thread at a time.
+ *
+ * Like Socket, methods return false (or a negative errno) on failure
+ * and do not throw.
+ */
+class IOUring
+{
+public:
+    IOUring();
+    virtual ~IOUring();
+
+    /**
+     * Create the ring.
+     * @param entries size of the submission queue
+     * @return false if io_uring is not available, or the kernel is too old
+     */
+    bool create(unsigned entries);
+
+    /**
+     * Close the ring. The kernel cancels the operations in flight, and
+     * the queued operations not submitted yet are never started.
+     */
+    void close();
+
+    inline bool is_valid() const { return m_fd != -1; }
+
+    /**
+     * Register fixed buffers, to be used with prepareReadFixed()
+     */
+    bool registerBuffers(const struct iovec *iov, unsigned count);
+
+    /**
+     * Queue a read into the registered buffer bufIndex
+     * @return false if the submission queue is full
+     */
+    bool prepareReadFixed(int fd, void *buf, unsigned len,
+                          int bufIndex, unsigned long long userData);
+
+    /**
+     * Queue a recv into any buffer
+     * @return false if the submission queue is full
+     */
+    bool prepareRecv(int fd, void *buf, unsigned len,
+                     unsigned long long userData);
+
+    /**
+     * Queue a send. The send completes when all the data is sent, or
+     * fails.
+     * @param link if true, next queued operation will not start until
+     *  this one completes, and will be canceled if this one fails or
+     *  sends less data than len.
+     * @return false if the submission queue is full
+     */
+    bool prepareSend(int fd, const void *buf, unsigned len,
+                     unsigned long long userData, bool link);
+
+    /**
+     * Queue the cancelation of the operations submitted with userData
+     * target. The canceled operations complete with -ECANCELED, or
+     * with their result if they could not be canceled.
+     * @return false if the submission queue is full
+     */
+    bool prepareCancel(unsigned long long target, unsigned long long userData);
+
+    /**
+     * Submit the queued operations and wait for completions
+     * @param waitCount number of completions to wait for
+     * @param timeout timeout in ms. Negative to wait forever.
+     * @return number of submitted operations or -errno.
+     *  -ETIME if timeout.
+     */
+    int submitAndWait(unsigned waitCount, long timeout = -1);
+
+    /**
+     * Wait for completions, without submitting the queued operations
+     * @param waitCount number of completions to wait for
+     * @param timeout timeout in ms. Negative to wait forever.
+     * @return 0 or -errno. -ETIME if timeout.
+     */
+    int wait(unsigned waitCount, long timeout = -1);
+
+    /**
+     * Get the next completion, if any
+     * @param userData the userData of the completed operation
+     * @param result result of the operation, as returned by the syscall
+     *  (-errno on failure)
+     * @return false if there are no completions
+     */
+    bool peekCompletion(unsigned long long *userData, int *result);
+
+    /**
+     * Free slots in the submission queue
+     */
+    unsigned spaceLeft() const;
+
+    /**
+     * Queued operations not taken by the kernel yet
+     */
+    inline unsigned unsubmitted() const { return m_sqTail - m_sqSubmitted; }
+
+private:
+    struct io_uring_sqe *getSqe();
+
+    /*
+     * Call io_uring_enter
+     * @return number of submitted operations or -errno
+     */
+    int enter(unsigned toSubmit, unsigned waitCount, long timeout);
+
+    int m_fd;
+    unsigned m_entries;
+    unsigned m_sqTail;
+    unsigned m_sqSubmitted;
+
+    void *m_sqRing;
+    void *m_cqRing;
+    struct io_uring_sqe *m_sqes;
+    unsigned long m_sqRingSize;
+    unsigned long m_cqRingSize;
+
+    volatile unsigned *m_sqHead;
+    volatile unsigned *m_sqTailPtr;
+    unsigned m_sqMask;
+    volatile unsigned *m_cqHead;
+    volatile unsigned *m_cqTail;
+    unsigned m_cqMask;
+    struct io_uring_cqe *m_cqes;
+};
+
+#endif // USE_IO_URING
+
+#endif // _IOURING_HPP
@@ -0,0 +1,410 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp"
+
+#include <map>
+
+#ifdef USE_OPEN_THREADS
+#include <OpenThreads/ScopedLock>
+#include <OpenThreads/Condition>
+#elif USE_BOOST
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+#endif
+
+#include "InProcTransport.hpp"
+#include "PlainBuffer.hpp"
+
+using namespace epi::node;
+using namespace epi::error;
+using namespace epi::type;
+
+namespace epi {
+namespace node {
+
+/**
+ * State shared by the two ends of an in process connection.
+ * It is deleted by the last end destroyed.
+ */
+class InProcLink {
+public:
+    inline InProcLink(): mRefs(2) {
+        mEnds[0] = 0;
+        mEnds[1] = 0;
+    }
+
+    InProcConnection *mEnds[2];
+    int mRefs;
+
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::Mutex _linkMutex;
+    OpenThreads::Condition _linkCondition;
+    #elif USE_BOOST
+    boost::mutex _linkMutex;
+    boost::condition _linkCondition;
+    #endif
+};
+
+} // node
+} // epi
+
+/*
+ * Process wide table of published in process nodes
+ */
+typedef std::map<std::string, InProcTransport *> inproc_transport_map;
+static inproc_transport_map smInProcNodes;
+#ifdef USE_OPEN_THREADS
+static OpenThreads::Mutex _inProcNodesMutex;
+#elif USE_BOOST
+static boost::mutex _inProcNodesMutex;
+#endif
+
+ErlangTransport *
+        InProcTransportFactory::createErlangTransport(std::string nodename, std::string aCookie)
+        throw (EpiException)
+{
+    // There are no ports in process, ignore it if given
+    std::string::size_type pos = nodename.find (":",0);
+    if (pos != std::string::npos) {
+        nodename = nodename.substr(0, pos);
+    }
+
+    pos = nodename.find ("@",0);
+    if (pos == std::string::npos) {
+        nodename = nodename + "@localhost";
+    }
+
+    return new InProcTransport(nodename, aCookie);
+}
+
+InProcTransport::InProcTransport(const std::string aNodeName,
+                                 const std::string aCookie):
+        mNodeName(aNodeName), mCookie(aCookie), mAcceptQueue()
+{
+}
+
+InProcTransport::~InProcTransport()
+{
+    Dout(dc::connect, "["<<this<<"]"<< "InProcTransport::~InProcTransport()");
+    unPublishPort();
+    // Close connections not yet accepted
+    mAcceptQueue.flush();
+}
+
+Connection * InProcTransport::connect( const std::string node )
+        throw( EpiConnectionException )
+{
+    // Use default cookie
+    return connect(node, mCookie);
+}
+
+Connection * InProcTransport::connect( const std::string node,
+                                       const std::string cookie )
+        throw( EpiConnectionException )
+{
+    Dout_continue(dc::connect, _continue, " failed.",
+                  "InProcTransport::connect(" << node << "): ");
+
+    // A node without host is in our host
+    std::string peerName = node;
+    if (node.find ("@",0) == std::string::npos) {
+        peerName = node + mNodeName.substr(mNodeName.find("@",0));
+    }
+
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_inProcNodesMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(_inProcNodesMutex);
+    #endif
+
+    inproc_transport_map::iterator p = smInProcNodes.find(peerName);
+    if (p == smInProcNodes.end()) {
+        Dout_finish(_continue, " Failed: Connection refused.");
+        throw EpiNetworkException("Can not connect: no in process node " + peerName);
+    }
+    InProcTransport *peerTransport = (*p).second;
+    if (peerTransport->mCookie != cookie) {
+        Dout_finish(_continue, " Failed: Cookies differ.");
+        throw EpiAuthException("Cookies differ " + cookie + "!=" + peerTransport->mCookie);
+    }
+
+    // Create both ends and give the remote one to the peer acceptor
+    InProcLink *link = new InProcLink();
+    InProcConnection *local =
+            new InProcConnection(new PeerNode(peerName), cookie, link, 0);
+    InProcConnection *remote =
+            new InProcConnection(new PeerNode(mNodeName), cookie, link, 1);
+    peerTransport->mAcceptQueue.put(remote);
+
+    Dout_finish(_continue, "connected [" << local << "]");
+    return local;
+}
+
+Connection * InProcTransport::accept( long timeout )
+        throw( EpiConnectionException )
+{
+    // Use default cookie
+    return accept(mCookie, timeout);
+}
+
+Connection * InProcTransport::accept( const std::string cookie, long timeout )
+        throw( EpiConnectionException )
+{
+    Connection *connection;
+    if (timeout == 0) {
+        connection = mAcceptQueue.get();
+    } else {
+        connection = mAcceptQueue.get(timeout);
+    }
+
+    if (connection && connection->getCookie() != cookie) {
+        std::string other = connection->getCookie();
+        delete connection;
+        throw EpiAuthException("Cookies differ " + cookie + "!=" + other);
+    }
+    if (connection) {
+        Dout(dc::connect, "InProcTransport::accept(): accepted for " <<
+                connection->getPeer()->getNodeName());
+    }
+    return connection;
+}
+
+void InProcTransport::publishPort()
+        throw (EpiConnectionException)
+{
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_inProcNodesMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(_inProcNodesMutex);
+    #endif
+    inproc_transport_map::iterator p = smInProcNodes.find(mNodeName);
+    if (p != smInProcNodes.end() && (*p).second != this) {
+        throw EpiConnectionException("Node name already in use: " + mNodeName);
+    }
+    smInProcNodes[mNodeName] = this;
+}
+
+void InProcTransport::unPublishPort()
+        throw (EpiConnectionException)
+{
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_inProcNodesMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(_inProcNodesMutex);
+    #endif
+    inproc_transport_map::iterator p = smInProcNodes.find(mNodeName);
+    if (p != smInProcNodes.end() && (*p).second == this) {
+        smInProcNodes.erase(p);
+    }
+}
+
+std::string InProcTransport::getNodeName() {
+    return mNodeName;
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+
+InProcConnection::InProcConnection(PeerNode *peer,
+                                   std::string cookie,
+                                   InProcLink *link,
+                                   int side):
+        Connection(peer, cookie),
+        mLink(link), mSide(side), mStarted(false), mStarting(false),
+        mFlushing(false), mPending(), mBusy(0)
+{
+    mLink->mEnds[mSide] = this;
+}
+
+InProcConnection::~InProcConnection() {
+    Dout(dc::connect, "["<<this<<"]"<< "InProcConnection::~InProcConnection()");
+    this->close();
+
+    mLink->_linkMutex.lock();
+    bool last = --mLink->mRefs == 0;
+    mLink->_linkMutex.unlock();
+    if (last) {
+        delete mLink;
+    }
+}
+
+OutputBuffer* InProcConnection::newOutputBuffer() {
+    return new PlainBuffer();
+}
+
+void InProcConnection::sendBuf( ErlPid * from, ErlPid * to, OutputBuffer * buffer )
+        throw( EpiConnectionException)
+{
+    Dout(dc::connect, "["<<this<<"]"<< "InProcConnection::sendBuf(from=" <<
+            from->toString() << ", to=" << to->toString() << ", buffer)");
+    post(new SendMessage(to, buffer->getInputBuffer(), false));
+    countOut(0);
+}
+
+void InProcConnection::sendBuf( ErlPid * from, const std::string &to,
+                                OutputBuffer * buffer )
+        throw( EpiConnectionException)
+{
+    Dout(dc::connect, "["<<this<<"]"<< "InProcConnection::sendBuf(from=" <<
+            from->toString() << ", to=" << to << ", buffer)");
+    post(new RegSendMessage(from, to, buffer->getInputBuffer(), false));
+    countOut(0);
+}
+
+void InProcConnection::sendBuf( ErlPid* from,
+                                const std::string &node,
+                                const std::string &to,
+                                OutputBuffer* buffer )
+        throw (EpiConnectionException)
+{
+    // the connection is connected to one peer, just send all to it
+    sendBuf(from, to, buffer);
+}
+
+void InProcConnection::post(EpiMessage *msg)
+        throw (EpiConnectionException)
+{
+    mLink->_linkMutex.lock();
+    if (mLink->mEnds[mSide] == 0) {
+        mLink->_linkMutex.unlock();
+        delete msg;
+        throw EpiConnectionException("Connection closed");
+    }
+
+    InProcConnection *peer = mLink->mEnds[1-mSide];
+    if (peer == 0) {
+        mLink->_linkMutex.unlock();
+        delete msg;
+        // Like the EI acceptor on a reset socket, tell the receiver
+        if (mStarted) {
+            deliver(this, new ErrorMessage(
+                    new EpiConnectionException("Connection closed by peer")));
+        }
+        throw EpiConnectionException("Connection closed by peer");
+    }
+
+    peer->countIn(0);
+    if (!peer->mStarted) {
+        peer->mPending.push_back(msg);
+        mLink->_linkMutex.unlock();
+        return;
+    }
+
+    // Deliver outside the lock, the peer waits for us before closing
+    DeliveryGuard delivery(peer);
+    peer->deliver(peer, msg);
+}
+
+InProcConnection::DeliveryGuard::DeliveryGuard(InProcConnection *end):
+        mEnd(end)
+{
+    mEnd->mBusy++;
+    mEnd->mLink->_linkMutex.unlock();
+}
+
+InProcConnection::DeliveryGuard::~DeliveryGuard() {
+    InProcLink *link = mEnd->mLink;
+    link->_linkMutex.lock();
+    mEnd->mBusy--;
+    #ifdef USE_OPEN_THREADS
+    link->_linkCondition.broadcast();
+    #elif USE_BOOST
+    link->_linkCondition.notify_all();
+    #endif
+    link->_linkMutex.unlock();
+}
+
+void InProcConnection::start() {
+    mLink->_linkMutex.lock();
+    if (mStarted || mLink->mEnds[mSide] != this) {
+        mLink->_linkMutex.unlock();
+        return;
+    }
+    mStarting = true;
+    if (mFlushing) {
+        // The thread flushing the messages will start it
+        mLink->_linkMutex.unlock();
+        return;
+    }
+    // Flush the messages received while stopped outside the lock, as
+    // the receivers can send to this link. The messages posted in the
+    // meanwhile are kept after them, until the queue is empty.
+    mFlushing = true;
+    while (mStarting && mLink->mEnds[mSide] == this && !mPending.empty()) {
+        std::list<EpiMessage *> pending;
+        pending.swap(mPending);
+        try {
+            DeliveryGuard delivery(this);
+            while (!pending.empty()) {
+                EpiMessage *msg = pending.front();
+                pending.pop_front();
+                deliver(this, msg);
+            }
+        } catch (...) {
+            // Keep the messages not delivered for the next start
+            mLink->_linkMutex.lock();
+            mPending.splice(mPending.begin(), pending);
+            mStarting = false;
+            mFlushing = false;
+            mLink->_linkMutex.unlock();
+            throw;
+        }
+        mLink->_linkMutex.lock();
+    }
+    mStarted = mStarting && mLink->mEnds[mSide] == this;
+    mStarting = false;
+    mFlushing = false;
+    mLink->_linkMutex.unlock();
+}
+
+void InProcConnection::stop() {
+    mLink->_linkMutex.lock();
+    mStarted = false;
+    mStarting = false;
+    mLink->_linkMutex.unlock();
+}
+
+void InProcConnection::close()
+{
+    mLink->_linkMutex.lock();
+    mLink->mEnds[mSide] = 0;
+    mStarted = false;
+    mStarting = false;
+    // Wait for the threads delivering to this end
+    while (mBusy > 0) {
+        #ifdef USE_OPEN_THREADS
+        mLink->_linkCondition.wait(&mLink->_linkMutex);
+        #elif USE_BOOST
+        mLink->_linkCondition.wait(mLink->_linkMutex);
+        #endif
+    }
+    for (std::list<EpiMessage *>::const_iterator p = mPending.begin(),
+         end = mPending.end(); p != end; ++p)
+    {
+        delete *p;
+    }
+    mPending.clear();
+    mLink->_linkMutex.unlock();
+}
@@ -0,0 +1,221 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#ifndef _INPROCTRANSPORT_HPP
+#define _INPROCTRANSPORT_HPP
+
+#include <string>
+#include <list>
+
+#ifdef USE_OPEN_THREADS
+#include "OpenThreads/Mutex"
+#elif USE_BOOST
+#include <boost/thread/mutex.hpp>
+#endif
+
+#include "EpiConnection.hpp"
+#include "ErlangTransport.hpp"
+#include "ErlangTransportFactory.hpp"
+#include "GenericQueue.hpp"
+
+namespace epi {
+namespace node {
+
+using namespace epi::error;
+using namespace epi::type;
+
+class InProcLink;
+
+/**
+ * Factory for InProcTransport. It is registered in
+ * ErlangTransportManager with the "inproc" protocol, so
+ * "inproc:mynode@myhost" creates an in process node.
+ */
+class InProcTransportFactory:  public ErlangTransportFactory {
+public:
+    virtual ErlangTransport *
+            createErlangTransport(std::string nodename, std::string aCookie)
+            throw (EpiException);
+
+    inline virtual ~InProcTransportFactory() {}
+};
+
+/**
+ * ErlangTransport that connects nodes living in the same process.
+ *
+ * There are no sockets, no epmd and no encoding: the terms written
+ * in a PlainBuffer are delivered as they are to the peer, sharing the
+ * refcounted term trees. It is useful to test and benchmark several
+ * nodes in the same program.
+ *
+ * publishPort() registers the node name in a process wide table, and
+ * connect() looks the peer up in this table. The peer gets the other
+ * end of the connection with accept(), as with any other transport.
+ */
+class InProcTransport: public ErlangTransport {
+public:
+    /**
+     * Create a new in process transport
+     * @param aNodeName node name
+     * @param aCookie cookie to use
+     */
+    InProcTransport(const std::string aNodeName,
+                    const std::string aCookie);
+
+    /**
+     * Unpublish the node and close the connections not yet accepted
+     */
+    virtual ~InProcTransport();
+
+    virtual Connection* connect(const std::string node)
+            throw(EpiConnectionException);
+
+    virtual Connection* connect(const std::string node, const std::string cookie)
+            throw(EpiConnectionException);
+
+    virtual Connection* accept(long timeout = 0)
+            throw(EpiConnectionException);
+
+    virtual Connection* accept(const std::string cookie, long timeout = 0)
+            throw(EpiConnectionException);
+
+    virtual std::string getNodeName();
+
+    /**
+     * Register the node name in the table of in process nodes
+     * @throws EpiConnectionException if other node has the same name
+     */
+    virtual void publishPort() throw (EpiConnectionException);
+
+    /**
+     * Remove the node name from the table of in process nodes
+     */
+    virtual void unPublishPort() throw (EpiConnectionException);
+
+protected:
+    std::string mNodeName;
+    std::string mCookie;
+
+    /** Connections waiting to be accepted */
+    GenericQueue<Connection> mAcceptQueue;
+
+};
+
+/**
+ * One end of a connection between two in process nodes.
+ *
+ * Messages sent to a stopped end are kept until start() is called,
+ * like in a socket buffer. A closed end is detected by the other end
+ * in the next send.
+ */
+class InProcConnection: public Connection
+{
+    friend class InProcTransport;
+public:
+
+    virtual ~InProcConnection();
+
+    /**
+     * Create a new OutputBuffer to be used with this sender.
+     * It is a PlainBuffer, terms are not encoded.
+     */
+    virtual OutputBuffer* newOutputBuffer();
+
+    inline OutputBufferType outputBufferType() const {
+        return PLAIN_OUTPUT_BUFFER;
+    }
+
+    virtual void sendBuf( epi::type::ErlPid* from,
+                          epi::type::ErlPid* to,
+                          epi::node::OutputBuffer* buffer )
+            throw (EpiConnectionException);
+
+    virtual void sendBuf( epi::type::ErlPid* from,
+                          const std::string &to,
+                          epi::node::OutputBuffer* buffer )
+            throw (EpiConnectionException);
+
+    virtual void sendBuf( ErlPid* from,
+                          const std::string &node,
+                          const std::string &to,
+                          OutputBuffer* buffer )
+            throw (EpiConnectionException);
+
+    virtual void start();
+
+    virtual void stop();
+
+    virtual void close();
+
+protected:
+    /**
+     * Create one end of the link. Use InProcTransport::connect()
+     * to create connections.
+     * @param peer Peer information
+     * @param cookie Cookie for this connection
+     * @param link shared state of both ends
+     * @param side index of this end in the link (0 or 1)
+     */
+    InProcConnection(PeerNode *peer, std::string cookie,
+                     InProcLink *link, int side);
+
+    /**
+     * Give the message to the other end of the link.
+     * @throws EpiConnectionException if any end is closed
+     */
+    void post(EpiMessage *msg)
+            throw (EpiConnectionException);
+
+    /**
+     * Marks an end as busy while a thread delivers to it outside the
+     * link lock. It is created with the lock held and releases it; when
+     * destroyed, also if the delivery throws, it tells the threads
+     * waiting in close() and leaves the lock released.
+     */
+    class DeliveryGuard {
+    public:
+        DeliveryGuard(InProcConnection *end);
+        ~DeliveryGuard();
+    private:
+        InProcConnection *mEnd;
+    };
+
+    InProcLink *mLink;
+    int mSide;
+    bool mStarted;
+    /** start() was called, but the pending messages are still delivered */
+    bool mStarting;
+    /** A thread is delivering the pending messages */
+    bool mFlushing;
+    /** Messages received while stopped */
+    std::list<EpiMessage *> mPending;
+    /** Number of threads delivering to this end */
+    int mBusy;
+
+};
+
+} // node
+} // epi
+
+#endif // _INPROCTRANSPORT_HPP
@@ -0,0 +1,251 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "LatencyHistogram.hpp"
+#include "EpiAtomic.hpp"
+
+using namespace epi::util;
+
+/*
+ * Position of the highest bit set, v > 0
+ */
+static inline int highestBit(unsigned long long v) {
+    #ifdef __GNUC__
+    return 63 - __builtin_clzll(v);
+    #else
+    int bit = 0;
+    while (v >>= 1) {
+        bit++;
+    }
+    return bit;
+    #endif
+}
+
+LatencyHistogram::LatencyHistogram(): mBuckets(0) {}
+
+LatencyHistogram::~LatencyHistogram() {
+    delete [] mBuckets;
+}
+
+long long LatencyHistogram::now() {
+    #ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (long long) ((double) counter.QuadPart * 1e9 / frequency.QuadPart);
+    #else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+    #endif
+}
+
+int LatencyHistogram::bucketOf(long long ns) {
+    if (ns < SUB_BUCKETS) {
+        return ns < 0 ? 0 : (int) ns;
+    }
+    int bit = highestBit((unsigned long long) ns);
+    if (bit >= MAX_BITS) {
+        return BUCKETS - 1;
+    }
+    int sub = (int) ((ns >> (bit - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+    return ((bit - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS) + sub;
+}
+
+long long LatencyHistogram::lowerBound(int bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    int bit = (bucket >> SUB_BUCKET_BITS) + SUB_BUCKET_BITS - 1;
+    long long sub = bucket & (SUB_BUCKETS - 1);
+    return (1LL << bit) + (sub << (bit - SUB_BUCKET_BITS));
+}
+
+long long LatencyHistogram::upperBound(int bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    int bit = (bucket >> SUB_BUCKET_BITS) + SUB_BUCKET_BITS - 1;
+    return lowerBound(bucket) + (1LL << (bit - SUB_BUCKET_BITS)) - 1;
+}
+
+long volatile *LatencyHistogram::buckets() {
+    long volatile *buckets = atomicLoad(&mBuckets);
+    if (buckets == 0) {
+        long volatile *fresh = new long[BUCKETS];
+        for (int i = 0; i < BUCKETS; i++) {
+            fresh[i] = 0;
+        }
+        if (atomicCompareAndSwap(&mBuckets, (long volatile *) 0, fresh)) {
+            buckets = fresh;
+        } else {
+            // Other thread won
+            delete [] fresh;
+            buckets = atomicLoad(&mBuckets);
+        }
+    }
+    return buckets;
+}
+
+void LatencyHistogram::record(long long ns) {
+    atomicFetchAdd(&buckets()[bucketOf(ns)], 1);
+}
+
+long LatencyHistogram::count() const {
+    long volatile *buckets = atomicLoad(&mBuckets);
+    long total = 0;
+    if (buckets) {
+        for (int i = 0; i < BUCKETS; i++) {
+            total += atomicLoad(&buckets[i]);
+        }
+    }
+    return total;
+}
+
+long long LatencyHistogram::percentile(double percentile) const {
+    long volatile *buckets = atomicLoad(&mBuckets);
+    if (buckets == 0) {
+        return 0;
+    }
+    long counts[BUCKETS];
+    long total = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        counts[i] = atomicLoad(&buckets[i]);
+        total += counts[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    // Rank of the value, from 1 to total
+    long rank = (long) (percentile / 100.0 * total + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    } else if (rank > total) {
+        rank = total;
+    }
+    long seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return upperBound(i);
+        }
+    }
+    return upperBound(BUCKETS - 1);
+}
+
+long long LatencyHistogram::max() const {
+    long volatile *buckets = atomicLoad(&mBuckets);
+    if (buckets) {
+        for (int i = BUCKETS - 1; i >= 0; i--) {
+            if (atomicLoad(&buckets[i]) > 0) {
+                return upperBound(i);
+            }
+        }
+    }
+    return 0;
+}
+
+double LatencyHistogram::mean() const {
+    long volatile *buckets = atomicLoad(&mBuckets);
+    if (buckets == 0) {
+        return 0;
+    }
+    double sum = 0;
+    long total = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        long n = atomicLoad(&buckets[i]);
+        if (n > 0) {
+            sum += n * ((lowerBound(i) + upperBound(i)) / 2.0);
+            total += n;
+        }
+    }
+    return total ? sum / total : 0;
+}
+
+void LatencyHistogram::add(const LatencyHistogram &other) {
+    long volatile *from = atomicLoad(&other.mBuckets);
+    if (from == 0) {
+        return;
+    }
+    long volatile *to = buckets();
+    for (int i = 0; i < BUCKETS; i++) {
+        long n = atomicLoad(&from[i]);
+        if (n > 0) {
+            atomicFetchAdd(&to[i], n);
+        }
+    }
+}
+
+void LatencyHistogram::reset() {
+    long volatile *buckets = atomicLoad(&mBuckets);
+    if (buckets) {
+        for (int i = 0; i < BUCKETS; i++) {
+            atomicStore(&buckets[i], 0L);
+        }
+    }
+}
+
+LatencyStats::LatencyStats() {}
+
+void LatencyStats::add(const LatencyStats &other) {
+    for (int i = 0; i < LATENCY_STAGES; i++) {
+        mStages[i].add(other.mStages[i]);
+    }
+}
+
+void LatencyStats::reset() {
+    for (int i = 0; i < LATENCY_STAGES; i++) {
+        mStages[i].reset();
+    }
+}
+
+std::string LatencyStats::stageName(LatencyStage stage) {
+    switch (stage) {
+    case LATENCY_RECEIVE:
+        return "receive";
+    case LATENCY_DECODE:
+        return "decode";
+    case LATENCY_QUEUE_WAIT:
+        return "queue_wait";
+    case LATENCY_GUARD:
+        return "guard";
+    case LATENCY_ENCODE:
+        return "encode";
+    case LATENCY_SEND:
+        return "send";
+    default:
+        return "unknown";
+    }
+}
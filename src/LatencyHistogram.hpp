@@ -0,0 +1,200 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#ifndef __LATENCYHISTOGRAM_HPP
+#define __LATENCYHISTOGRAM_HPP
+
+#include <string>
+
+namespace epi {
+namespace util {
+
+/**
+ * Histogram of latencies in nanoseconds, recorded without locks.
+ *
+ * Buckets are log-linear, like a HDR histogram: each power of two is
+ * split in 8 buckets, so a value is known with an error below 12.5%.
+ * Values up to 2^40 ns (about 18 minutes) are kept, longer ones go to
+ * the last bucket.
+ *
+ * The buckets are allocated with the first value, so a histogram
+ * never used costs a pointer. Reading while other threads record
+ * gives a consistent enough view for statistics, but not a snapshot.
+ */
+class LatencyHistogram {
+public:
+    enum {
+        SUB_BUCKET_BITS = 3,
+        SUB_BUCKETS = 1 << SUB_BUCKET_BITS,
+        MAX_BITS = 40,
+        BUCKETS = (MAX_BITS - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS
+    };
+
+    LatencyHistogram();
+
+    ~LatencyHistogram();
+
+    /**
+     * Add a value. It can be called from any thread.
+     * @param ns latency in nanoseconds, negative values count as 0
+     */
+    void record(long long ns);
+
+    /**
+     * Add the time elapsed since a start time.
+     * @param start time as returned by now()
+     */
+    inline void recordSince(long long start) {
+        record(now() - start);
+    }
+
+    /**
+     * Get the number of recorded values
+     */
+    long count() const;
+
+    /**
+     * Get the value below which are the given percentage of the
+     * recorded values. It is the upper bound of its bucket.
+     * @param percentile percentage, from 0 to 100
+     * @return latency in nanoseconds, 0 if there are no values
+     */
+    long long percentile(double percentile) const;
+
+    /**
+     * Get the upper bound of the bucket with the highest value
+     */
+    long long max() const;
+
+    /**
+     * Get the mean of the values, taking the middle of each bucket
+     */
+    double mean() const;
+
+    /**
+     * Add the values of other histogram to this one
+     */
+    void add(const LatencyHistogram &other);
+
+    /**
+     * Remove all the values
+     */
+    void reset();
+
+    /**
+     * Nanoseconds from a monotonic clock
+     */
+    static long long now();
+
+    /**
+     * Get the bucket of a value
+     */
+    static int bucketOf(long long ns);
+
+    /**
+     * Get the lowest value of a bucket
+     */
+    static long long lowerBound(int bucket);
+
+    /**
+     * Get the highest value of a bucket
+     */
+    static long long upperBound(int bucket);
+
+private:
+    /*
+     * Get the buckets, allocating them if needed
+     */
+    long volatile *buckets();
+
+    long volatile * volatile mBuckets;
+
+    LatencyHistogram(const LatencyHistogram &);
+    LatencyHistogram &operator=(const LatencyHistogram &);
+};
+
+/**
+ * Stages timed on the way of a message
+ */
+enum LatencyStage {
+    /** Reading a frame from a connection and handing it over */
+    LATENCY_RECEIVE,
+    /** Decoding the term of an incoming message */
+    LATENCY_DECODE,
+    /** Time a message waits in a mailbox until it is received */
+    LATENCY_QUEUE_WAIT,
+    /** Scanning a mailbox with the guard of a selective receive */
+    LATENCY_GUARD,
+    /** Encoding the term of an outgoing message */
+    LATENCY_ENCODE,
+    /** Writing an outgoing message to a socket */
+    LATENCY_SEND,
+    LATENCY_STAGES
+};
+
+/**
+ * A latency histogram for each stage. Nodes, connections and mailboxes
+ * keep one, each recording the stages that happen there.
+ */
+class LatencyStats {
+public:
+    LatencyStats();
+
+    /**
+     * Get the histogram of a stage
+     */
+    inline LatencyHistogram &stage(LatencyStage stage) {
+        return mStages[stage];
+    }
+
+    inline const LatencyHistogram &stage(LatencyStage stage) const {
+        return mStages[stage];
+    }
+
+    /**
+     * Add the values of other stats to these
+     */
+    void add(const LatencyStats &other);
+
+    /**
+     * Remove all the values
+     */
+    void reset();
+
+    /**
+     * Get the name of a stage, like "queue_wait"
+     */
+    static std::string stageName(LatencyStage stage);
+
+private:
+    LatencyHistogram mStages[LATENCY_STAGES];
+
+    LatencyStats(const LatencyStats &);
+    LatencyStats &operator=(const LatencyStats &);
+};
+
+} // namespace util
+} // namespace epi
+
+#endif // __LATENCYHISTOGRAM_HPP
@@ -0,0 +1,314 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp" // Main config file
+
+#include <memory>
+#include <exception>
+
+#ifdef USE_OPEN_THREADS
+#include <OpenThreads/Thread>
+#include <OpenThreads/ScopedLock>
+#elif USE_BOOST
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#endif
+
+#include "MailBoxExecutor.hpp"
+#include "EpiAtomic.hpp"
+
+using namespace epi::node;
+using namespace epi::util;
+using namespace epi::error;
+
+// Executor and mailbox of the current worker thread
+static EPI_THREAD_LOCAL MailBoxExecutor *tExecutor;
+static EPI_THREAD_LOCAL unsigned tWorker;
+static EPI_THREAD_LOCAL MailBox *tRunning;
+
+namespace epi {
+namespace node {
+
+/**
+ * Worker thread of a MailBoxExecutor
+ */
+class MailBoxExecutorWorker
+    #ifdef USE_OPEN_THREADS
+    : public OpenThreads::Thread
+    #endif
+{
+public:
+    /**
+     * The thread will start with creation of the object.
+     */
+    MailBoxExecutorWorker(MailBoxExecutor *executor, unsigned index):
+            mExecutor(executor), mIndex(index)
+    {
+        #ifdef USE_OPEN_THREADS
+        start();
+        #elif USE_BOOST
+        m_thread = boost::shared_ptr<boost::thread>(
+            new boost::thread(boost::bind(&MailBoxExecutorWorker::run, this))
+        );
+        #endif
+    }
+
+    /**
+     * Wait for the thread
+     */
+    ~MailBoxExecutorWorker() {
+        #ifdef USE_OPEN_THREADS
+        if (this->isRunning()) {
+            this->join();
+        }
+        #elif USE_BOOST
+        m_thread->join();
+        #endif
+    }
+
+    void run() {
+        #ifdef CWDEBUG
+        epi::debug::setThreadDebugMargin();
+        #endif
+        mExecutor->run(mIndex);
+    }
+
+private:
+    MailBoxExecutor *mExecutor;
+    unsigned mIndex;
+    #ifdef USE_BOOST
+    boost::shared_ptr<boost::thread> m_thread;
+    #endif
+};
+
+} // node
+} // epi
+
+MailBoxExecutor::MailBoxExecutor(int threads, int budget):
+        mQueues(), mWorkers(), mBudget(budget > 0? budget: DEFAULT_BUDGET),
+        mPending(0), mIdle(0), mNextQueue(0), mStop(false)
+{
+    if (threads < 1) {
+        threads = 1;
+    }
+    for (int i = 0; i < threads; i++) {
+        mQueues.push_back(new WorkQueue());
+    }
+    for (int i = 0; i < threads; i++) {
+        mWorkers.push_back(new MailBoxExecutorWorker(this, i));
+    }
+}
+
+MailBoxExecutor::~MailBoxExecutor() {
+    Dout(dc::connect, "["<<this<<"]"<< "MailBoxExecutor::~MailBoxExecutor()");
+    shutdown();
+    for (unsigned i = 0; i < mQueues.size(); i++) {
+        delete mQueues[i];
+    }
+}
+
+void MailBoxExecutor::shutdown() {
+    if (mWorkers.empty()) {
+        return;
+    }
+    _idleMutex.lock();
+    mStop = true;
+    #ifdef USE_OPEN_THREADS
+    _idleCondition.broadcast();
+    #elif USE_BOOST
+    _idleCondition.notify_all();
+    #endif
+    _idleMutex.unlock();
+
+    for (unsigned i = 0; i < mWorkers.size(); i++) {
+        delete mWorkers[i];
+    }
+    mWorkers.clear();
+
+    // Mailboxes still queued are not scheduled anymore
+    for (unsigned i = 0; i < mQueues.size(); i++) {
+        std::deque<MailBox *> &mailboxes = mQueues[i]->mailboxes;
+        for (unsigned j = 0; j < mailboxes.size(); j++) {
+            unschedule(mailboxes[j]);
+        }
+        mailboxes.clear();
+    }
+}
+
+void MailBoxExecutor::attach(MailBox *mailbox, MailBoxGuard *handler) {
+    mailbox->mHandler = handler;
+    atomicStore(&mailbox->mExecutor, this);
+    if (mailbox->mQueue.count() > 0) {
+        schedule(mailbox);
+    }
+}
+
+void MailBoxExecutor::detach(MailBox *mailbox) {
+    atomicStore(&mailbox->mExecutor, (MailBoxExecutor *) 0);
+    if (tRunning == mailbox) {
+        // Called from the handler, the worker will leave it
+        return;
+    }
+    while (atomicLoad(&mailbox->mScheduled) != 0) {
+        #ifdef USE_OPEN_THREADS
+        OpenThreads::Thread::YieldCurrentThread();
+        #elif USE_BOOST
+        boost::thread::yield();
+        #endif
+    }
+    mailbox->mHandler = 0;
+}
+
+void MailBoxExecutor::unschedule(MailBox *mailbox) {
+    atomicStore(&mailbox->mScheduled, 0L);
+}
+
+void MailBoxExecutor::release(MailBox *mailbox) {
+    atomicStore(&mailbox->mExecutor, (MailBoxExecutor *) 0);
+    mailbox->mHandler = 0;
+}
+
+void MailBoxExecutor::schedule(MailBox *mailbox) {
+    if (atomicCompareAndSwap(&mailbox->mScheduled, 0L, 1L)) {
+        push(mailbox);
+    }
+}
+
+void MailBoxExecutor::push(MailBox *mailbox) {
+    unsigned index;
+    if (tExecutor == this) {
+        index = tWorker;
+    } else {
+        index = (unsigned long) atomicFetchAdd(&mNextQueue, 1) % mQueues.size();
+    }
+
+    WorkQueue *queue = mQueues[index];
+    queue->mutex.lock();
+    queue->mailboxes.push_back(mailbox);
+    queue->mutex.unlock();
+
+    // A worker going idle checks mPending after incrementing mIdle
+    atomicFetchAdd(&mPending, 1);
+    if (atomicLoad(&mIdle) > 0) {
+        #ifdef USE_OPEN_THREADS
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_idleMutex);
+        _idleCondition.signal();
+        #elif USE_BOOST
+        boost::mutex::scoped_lock lock(_idleMutex);
+        _idleCondition.notify_one();
+        #endif
+    }
+}
+
+MailBox *MailBoxExecutor::take(unsigned worker) {
+    unsigned count = mQueues.size();
+    for (unsigned i = 0; i < count; i++) {
+        WorkQueue *queue = mQueues[(worker + i) % count];
+        queue->mutex.lock();
+        if (!queue->mailboxes.empty()) {
+            MailBox *mailbox;
+            // In order from the own queue, steal the newest from others
+            if (i == 0) {
+                mailbox = queue->mailboxes.front();
+                queue->mailboxes.pop_front();
+            } else {
+                mailbox = queue->mailboxes.back();
+                queue->mailboxes.pop_back();
+            }
+            queue->mutex.unlock();
+            atomicFetchAdd(&mPending, -1);
+            return mailbox;
+        }
+        queue->mutex.unlock();
+    }
+    return 0;
+}
+
+void MailBoxExecutor::execute(MailBox *mailbox) {
+    int handled = 0;
+    tRunning = mailbox;
+    while (handled < mBudget && atomicLoad(&mailbox->mExecutor) == this) {
+        std::auto_ptr<EpiMessage> msg(mailbox->taken(mailbox->mQueue.get((long) 0)));
+        if (msg.get() == 0) {
+            break;
+        }
+        handled++;
+        // A handler that throws loses its message, not the worker
+        try {
+            if (!mailbox->mHandler->check(msg.get())) {
+                Dout(dc::connect, "["<<this<<"]"<< "MailBoxExecutor: message for " <<
+                     mailbox->self()->toString() << " not handled, discarded");
+            }
+        } catch (EpiException &e) {
+            Dout(dc::connect, "["<<this<<"]"<< "MailBoxExecutor: handler of " <<
+                 mailbox->self()->toString() << " failed: " << e.getMessage());
+        } catch (std::exception &e) {
+            Dout(dc::connect, "["<<this<<"]"<< "MailBoxExecutor: handler of " <<
+                 mailbox->self()->toString() << " failed: " << e.what());
+        }
+    }
+    tRunning = 0;
+
+    if (handled == mBudget) {
+        // Let the other mailboxes run, it is still scheduled
+        push(mailbox);
+        return;
+    }
+
+    // Messages delivered before this point could have seen the mailbox
+    // scheduled, so check again
+    unschedule(mailbox);
+    if (atomicLoad(&mailbox->mExecutor) == this && mailbox->mQueue.count() > 0) {
+        schedule(mailbox);
+    }
+}
+
+void MailBoxExecutor::run(unsigned worker) {
+    tExecutor = this;
+    tWorker = worker;
+    while (!mStop) {
+        MailBox *mailbox = take(worker);
+        if (mailbox != 0) {
+            execute(mailbox);
+            continue;
+        }
+
+        #ifdef USE_OPEN_THREADS
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_idleMutex);
+        #elif USE_BOOST
+        boost::mutex::scoped_lock lock(_idleMutex);
+        #endif
+        atomicFetchAdd(&mIdle, 1);
+        if (atomicLoad(&mPending) == 0 && !mStop) {
+            #ifdef USE_OPEN_THREADS
+            _idleCondition.wait(&_idleMutex);
+            #elif USE_BOOST
+            _idleCondition.wait(_idleMutex);
+            #endif
+        }
+        atomicFetchAdd(&mIdle, -1);
+    }
+    tExecutor = 0;
+}
@@ -0,0 +1,199 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#ifndef __MAILBOXEXECUTOR_HPP
+#define __MAILBOXEXECUTOR_HPP
+
+#include <deque>
+#include <vector>
+
+#ifdef USE_OPEN_THREADS
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+#elif USE_BOOST
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+#endif
+
+#include "EpiMailBox.hpp"
+
+namespace epi {
+namespace node {
+
+class MailBoxExecutorWorker;
+
+/**
+ * Pool of threads that run the handlers of mailboxes, so mailboxes
+ * don't need a thread blocked in receive().
+ *
+ * A mailbox attached to the executor is scheduled when it gets messages.
+ * A worker takes the messages in order of arrival and checks them with
+ * the handler of the mailbox, usually a MatchingCommandGuard or a
+ * ComposedGuard of them, so the command of the matching pattern is
+ * executed. Messages not matched by the handler are discarded.
+ *
+ * A mailbox is never run by two workers at once. After a number of
+ * messages (the budget) it goes back to the queue, so busy mailboxes
+ * don't starve the others.
+ *
+ * Each worker has its own queue. Mailboxes scheduled from a worker go
+ * to its queue, the others are distributed among all the queues.
+ * Idle workers steal mailboxes from the queues of the others.
+ *
+ * Mailboxes must be detached (or deleted) before the executor is
+ * destroyed.
+ */
+class MailBoxExecutor {
+    friend class MailBoxExecutorWorker;
+    friend class MailBox;
+public:
+    /** Default number of messages handled before yielding a worker */
+    static const int DEFAULT_BUDGET = 64;
+
+    /**
+     * Create the executor and start the workers
+     * @param threads number of worker threads
+     * @param budget number of messages of a mailbox handled in a row
+     */
+    MailBoxExecutor(int threads, int budget = DEFAULT_BUDGET);
+
+    /**
+     * Stop and wait for the workers
+     */
+    virtual ~MailBoxExecutor();
+
+    /**
+     * Run the handler for the messages of a mailbox. Pending messages
+     * are handled too.
+     * @param mailbox mailbox to attach. It can not be attached to other
+     *  executor or be used with receive()
+     * @param handler guard to check the messages. Owership is not
+     *  transfered
+     */
+    void attach(MailBox *mailbox, MailBoxGuard *handler);
+
+    /**
+     * Stop running the handler for a mailbox. It waits until no worker
+     * is running the mailbox, unless it is called from its handler.
+     * The handler can detach its mailbox but not delete it.
+     */
+    void detach(MailBox *mailbox);
+
+protected:
+    /*
+     * Run a scheduled mailbox. The default implementation handles its
+     * messages, up to the budget. Implementations must leave the
+     * mailbox in a queue (push), unscheduled or detached.
+     */
+    virtual void execute(MailBox *mailbox);
+
+    /*
+     * Queue the mailbox, unless it is already queued or running
+     */
+    void schedule(MailBox *mailbox);
+
+    /*
+     * Add a scheduled mailbox to a queue and wake up a worker
+     */
+    void push(MailBox *mailbox);
+
+    /*
+     * Mark a mailbox as not queued nor running. New messages will
+     * schedule it.
+     */
+    static void unschedule(MailBox *mailbox);
+
+    /*
+     * Detach a mailbox from execute(). It stays marked as scheduled,
+     * so it is not queued again.
+     */
+    static void release(MailBox *mailbox);
+
+    /*
+     * Get the handler of an attached mailbox
+     */
+    static inline MailBoxGuard *handler(MailBox *mailbox) {
+        return mailbox->mHandler;
+    }
+
+    /*
+     * Get the number of messages in the queue of a mailbox
+     */
+    static inline int queued(MailBox *mailbox) {
+        return mailbox->mQueue.count();
+    }
+
+    /*
+     * Stop and wait for the workers. Subclasses must call it in
+     * their destructor, so the workers don't run its execute()
+     * while it is destroyed.
+     */
+    void shutdown();
+
+private:
+    struct WorkQueue {
+        #ifdef USE_OPEN_THREADS
+        OpenThreads::Mutex mutex;
+        #elif USE_BOOST
+        boost::mutex mutex;
+        #endif
+        std::deque<MailBox *> mailboxes;
+    };
+
+    /*
+     * Get a mailbox from the queue of the worker, or steal one
+     * from other queue
+     */
+    MailBox *take(unsigned worker);
+
+    /*
+     * Main loop of a worker
+     */
+    void run(unsigned worker);
+
+    std::vector<WorkQueue *> mQueues;
+    std::vector<MailBoxExecutorWorker *> mWorkers;
+    int mBudget;
+
+    long volatile mPending;   // Mailboxes in the queues
+    long volatile mIdle;      // Workers waiting for mailboxes
+    long volatile mNextQueue; // Queue for the next external schedule
+    volatile bool mStop;
+
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::Mutex _idleMutex;
+    OpenThreads::Condition _idleCondition;
+    #elif USE_BOOST
+    boost::mutex _idleMutex;
+    boost::condition _idleCondition;
+    #endif
+
+    MailBoxExecutor(const MailBoxExecutor &);
+    MailBoxExecutor &operator=(const MailBoxExecutor &);
+};
+
+} // namespace node
+} // namespace epi
+
+#endif // __MAILBOXEXECUTOR_HPP
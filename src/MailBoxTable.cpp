@@ -0,0 +1,167 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp"
+
+#include "MailBoxTable.hpp"
+#include "EpiAtomic.hpp"
+
+using namespace epi::node;
+using namespace epi::type;
+using namespace epi::util;
+
+/** Bits of the pid number */
+static const unsigned PID_NUMBER_BITS = 15;
+/** Bits of the pid serial */
+static const unsigned PID_SERIAL_BITS = 13;
+/** Bit of the pid value (number and serial) set in the pids of the table */
+static const unsigned TABLE_BIT = 1 << 27;
+/** Bits of the slot index in the pid value */
+static const unsigned INDEX_BITS = 20;
+/** Bits of the slot generation in the pid value */
+static const unsigned GENERATION_BITS = 7;
+/** Bits of the slot index that select the slot in a chunk */
+static const unsigned CHUNK_BITS = 10;
+
+static const unsigned SLOT_COUNT = 1 << INDEX_BITS;
+static const unsigned CHUNK_SIZE = 1 << CHUNK_BITS;
+static const unsigned CHUNK_COUNT = SLOT_COUNT / CHUNK_SIZE;
+static const long GENERATION_MASK = (1 << GENERATION_BITS) - 1;
+
+/** Free slots kept before one is reused */
+static const unsigned MIN_FREE_SLOTS = 1024;
+
+MailBoxTable::MailBoxTable(int creation):
+        mCreation(creation & 0x03), mChunks(new Slot * volatile[CHUNK_COUNT]),
+        mSize(0), mFree()
+{
+    for (unsigned i = 0; i < CHUNK_COUNT; i++) {
+        mChunks[i] = 0;
+    }
+}
+
+MailBoxTable::~MailBoxTable() {
+    for (unsigned i = 0; i < CHUNK_COUNT; i++) {
+        delete [] mChunks[i];
+    }
+    delete [] mChunks;
+}
+
+/*
+ * Get the number and serial of a pid as one value, 0 if they are
+ * out of range
+ */
+static inline unsigned pidValue(ErlPid *pid) {
+    unsigned number = (unsigned) pid->id();
+    unsigned serial = (unsigned) pid->serial();
+    if (number >> PID_NUMBER_BITS != 0 || serial >> PID_SERIAL_BITS != 0) {
+        return 0;
+    }
+    return number | (serial << PID_NUMBER_BITS);
+}
+
+MailBoxTable::Slot *MailBoxTable::slot(ErlPid *pid, long &generation) const {
+    if (pid->creation() != mCreation) {
+        return 0;
+    }
+    unsigned value = pidValue(pid);
+    if ((value & TABLE_BIT) == 0) {
+        return 0;
+    }
+    unsigned index = value & (SLOT_COUNT - 1);
+    generation = (long) ((value >> INDEX_BITS) & GENERATION_MASK);
+    Slot *chunk = atomicLoad(&mChunks[index >> CHUNK_BITS]);
+    if (chunk == 0) {
+        return 0;
+    }
+    return &chunk[index & (CHUNK_SIZE - 1)];
+}
+
+bool MailBoxTable::reserve(unsigned &number, unsigned &serial) {
+    unsigned index;
+    if (mFree.size() >= MIN_FREE_SLOTS || (mSize == SLOT_COUNT && !mFree.empty())) {
+        index = mFree.front();
+        mFree.pop_front();
+    } else if (mSize < SLOT_COUNT) {
+        index = mSize++;
+        if ((index & (CHUNK_SIZE - 1)) == 0) {
+            Slot *chunk = new Slot[CHUNK_SIZE];
+            for (unsigned i = 0; i < CHUNK_SIZE; i++) {
+                chunk[i].mailbox = 0;
+                chunk[i].generation = 0;
+                chunk[i].used = false;
+            }
+            atomicStore(&mChunks[index >> CHUNK_BITS], chunk);
+        }
+    } else {
+        return false;
+    }
+    Slot *s = &mChunks[index >> CHUNK_BITS][index & (CHUNK_SIZE - 1)];
+    s->used = true;
+    unsigned value = TABLE_BIT | ((unsigned) s->generation << INDEX_BITS) | index;
+    number = value & ((1 << PID_NUMBER_BITS) - 1);
+    serial = value >> PID_NUMBER_BITS;
+    return true;
+}
+
+bool MailBoxTable::insert(ErlPid *pid, MailBox *mailbox) {
+    long generation;
+    Slot *s = slot(pid, generation);
+    if (s == 0 || !s->used || s->mailbox != 0 || s->generation != generation) {
+        return false;
+    }
+    atomicStore(&s->mailbox, mailbox);
+    return true;
+}
+
+void MailBoxTable::remove(ErlPid *pid, MailBox *mailbox) {
+    long generation;
+    Slot *s = slot(pid, generation);
+    if (s == 0 || s->mailbox != mailbox || s->generation != generation) {
+        return;
+    }
+    // Readers check the generation before and after reading the mailbox
+    atomicStore(&s->generation, (generation + 1) & GENERATION_MASK);
+    atomicStore(&s->mailbox, (MailBox *) 0);
+    s->used = false;
+    mFree.push_back(pidValue(pid) & (SLOT_COUNT - 1));
+}
+
+MailBox *MailBoxTable::find(ErlPid *pid) const {
+    long generation;
+    Slot *s = slot(pid, generation);
+    if (s == 0) {
+        return 0;
+    }
+    // If the generation changed while the mailbox was read, the mailbox
+    // can be the one of other pid
+    if (atomicLoad(&s->generation) != generation) {
+        return 0;
+    }
+    MailBox *mailbox = atomicLoad(&s->mailbox);
+    if (atomicLoad(&s->generation) != generation) {
+        return 0;
+    }
+    return mailbox;
+}
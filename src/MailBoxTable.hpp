@@ -0,0 +1,130 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#ifndef _MAILBOXTABLE_HPP
+#define _MAILBOXTABLE_HPP
+
+#include <deque>
+
+#include "ErlPid.hpp"
+
+namespace epi {
+namespace node {
+
+using namespace epi::type;
+
+class MailBox;
+
+/**
+ * Table of the mailboxes of a node indexed by pid, to find the
+ * destination of a message without locks.
+ *
+ * The table gives the pids of the mailboxes: reserve() takes a free
+ * slot and makes the pid number and serial from its index and a
+ * generation, which changes each time the slot is freed. A pid of a
+ * removed mailbox is not found, also once its slot is used by other
+ * mailbox, until the generation wraps. Freed slots are reused in the
+ * order they were freed, once there are enough of them, so the same
+ * pid is given again only after many mailboxes. Creating, finding and
+ * removing a mailbox take the same time whatever the number of
+ * mailboxes alive.
+ *
+ * The pids of the table have the highest serial bit set, and the ones
+ * created by LocalNode::createPid() have it clear, so they never meet.
+ * The memory of the table grows in chunks with the highest number of
+ * mailboxes alive at once, and is freed with the table.
+ *
+ * find() only reads the slots, and it can be called while other threads
+ * insert or remove mailboxes. reserve(), insert() and remove() must be
+ * serialized by the caller. As with a locked map, the caller must ensure
+ * that a removed mailbox is not deleted while other thread can be
+ * delivering to it.
+ */
+class MailBoxTable {
+public:
+    /**
+     * Create an empty table for the pids with the given creation
+     * (only the 2 bits used in pids are checked)
+     */
+    MailBoxTable(int creation);
+
+    ~MailBoxTable();
+
+    /**
+     * Reserve a slot for a new mailbox
+     * @param number set to the pid number of the slot
+     * @param serial set to the pid serial of the slot
+     * @return false if the table is full
+     */
+    bool reserve(unsigned &number, unsigned &serial);
+
+    /**
+     * Insert a mailbox in the slot reserved for its pid
+     * @return false if the pid has not a reserved slot
+     */
+    bool insert(ErlPid *pid, MailBox *mailbox);
+
+    /**
+     * Remove the mailbox of the pid, if it is the given mailbox,
+     * and free its slot
+     */
+    void remove(ErlPid *pid, MailBox *mailbox);
+
+    /**
+     * Find the mailbox for a pid.
+     * @return the mailbox or 0 if there is no mailbox for this pid
+     */
+    MailBox *find(ErlPid *pid) const;
+
+private:
+    struct Slot {
+        MailBox * volatile mailbox;
+        /** Generation of the pid of the slot */
+        long volatile generation;
+        /** The slot is reserved or holds a mailbox */
+        bool used;
+    };
+
+    /*
+     * Get the slot for the pid and its generation
+     * @return the slot or 0 if the pid is not of this table
+     */
+    Slot *slot(ErlPid *pid, long &generation) const;
+
+    int mCreation;
+    /** Chunks of slots, allocated as the table grows */
+    Slot * volatile *mChunks;
+    /** Number of slots allocated */
+    unsigned mSize;
+    /** Indexes of the free slots, in the order they were freed */
+    std::deque<unsigned> mFree;
+
+    MailBoxTable(const MailBoxTable &);
+    MailBoxTable &operator=(const MailBoxTable &);
+};
+
+} // node
+} // epi
+
+#endif // _MAILBOXTABLE_HPP
@@ -0,0 +1,159 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp" // Main config file
+
+#include <deque>
+
+#ifdef USE_OPEN_THREADS
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+#elif USE_BOOST
+#include <boost/thread/mutex.hpp>
+#endif
+
+#include "NodeNames.hpp"
+#include "EpiAtomic.hpp"
+
+using namespace epi::error;
+using namespace epi::type;
+using namespace epi::util;
+
+namespace {
+
+struct NodeEntry {
+    NodeEntry(const std::string &aName, unsigned aIndex, NodeEntry *aNext):
+            name(aName), index(aIndex), refs(1), next(aNext) {}
+    const std::string name;
+    const unsigned index;
+    unsigned refs;
+    NodeEntry *next;
+};
+
+}
+
+static const unsigned BUCKET_COUNT = 256;
+static const unsigned CHUNK_BITS = 10;
+static const unsigned CHUNK_SIZE = 1 << CHUNK_BITS;
+static const unsigned CHUNK_COUNT = 4096;
+
+// The buckets and the free indexes are guarded by namesMutex. The
+// chunks are also read by name() without the lock.
+static NodeEntry *sBuckets[BUCKET_COUNT];
+static NodeEntry * volatile *volatile sChunks[CHUNK_COUNT];
+static unsigned sCount;
+// Released indexes, reused oldest first
+static std::deque<unsigned> sFree;
+#ifdef USE_OPEN_THREADS
+static OpenThreads::Mutex namesMutex;
+#elif USE_BOOST
+static boost::mutex namesMutex;
+#endif
+
+static unsigned hash(const std::string &name) {
+    // FNV-1a
+    unsigned h = 2166136261u;
+    for (std::string::const_iterator p = name.begin(); p != name.end(); ++p) {
+        h = (h ^ (unsigned char) *p) * 16777619u;
+    }
+    return h;
+}
+
+static NodeEntry * volatile *entrySlot(unsigned index) {
+    return &atomicLoad(&sChunks[index >> CHUNK_BITS])[index & (CHUNK_SIZE - 1)];
+}
+
+unsigned NodeNames::intern(const std::string &node)
+        throw(EpiBadArgument)
+{
+    NodeEntry **bucket = &sBuckets[hash(node) % BUCKET_COUNT];
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(namesMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(namesMutex);
+    #endif
+    for (NodeEntry *entry = *bucket; entry != 0; entry = entry->next) {
+        if (entry->name == node) {
+            entry->refs++;
+            return entry->index;
+        }
+    }
+
+    unsigned index;
+    if (!sFree.empty()) {
+        index = sFree.front();
+        sFree.pop_front();
+    } else if (sCount < CHUNK_COUNT * CHUNK_SIZE) {
+        index = sCount++;
+        if (sChunks[index >> CHUNK_BITS] == 0) {
+            NodeEntry * volatile *chunk = new NodeEntry *[CHUNK_SIZE];
+            for (unsigned i = 0; i < CHUNK_SIZE; i++) {
+                chunk[i] = 0;
+            }
+            atomicStore(&sChunks[index >> CHUNK_BITS], chunk);
+        }
+    } else {
+        throw EpiBadArgument("Too many node names");
+    }
+    NodeEntry *entry = new NodeEntry(node, index, *bucket);
+    atomicStore(entrySlot(index), entry);
+    *bucket = entry;
+    return index;
+}
+
+void NodeNames::release(unsigned index) {
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(namesMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(namesMutex);
+    #endif
+    NodeEntry *entry = *entrySlot(index);
+    if (--entry->refs > 0) {
+        return;
+    }
+    NodeEntry **link = &sBuckets[hash(entry->name) % BUCKET_COUNT];
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+    atomicStore(entrySlot(index), (NodeEntry *) 0);
+    sFree.push_back(index);
+    delete entry;
+}
+
+const std::string &NodeNames::name(unsigned index) {
+    return atomicLoad(entrySlot(index))->name;
+}
+
+std::string NodeNames::lookup(unsigned index) {
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(namesMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(namesMutex);
+    #endif
+    if (index >= sCount || *entrySlot(index) == 0) {
+        return std::string();
+    }
+    return (*entrySlot(index))->name;
+}
@@ -0,0 +1,79 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#ifndef _NODENAMES_HPP
+#define _NODENAMES_HPP
+
+#include <string>
+
+#include "EpiException.hpp"
+
+namespace epi {
+namespace type {
+
+using namespace epi::error;
+
+/**
+ * Table of interned node names. Pids, refs and ports store the index of
+ * their node name, so they can be compared and hashed as integers.
+ *
+ * Each index returned by intern() holds a reference to the name, which
+ * is dropped with release(). A name is removed when its last reference
+ * is released, and its index is reused by later names, so the names of
+ * remote terms do not fill the table. All methods can be called from any
+ * thread, and name() does not take locks.
+ */
+class NodeNames {
+public:
+    /**
+     * Get the index of a node name, adding it to the table if needed,
+     * and take a reference to it
+     * @throws EpiBadArgument if the table is full
+     */
+    static unsigned intern(const std::string &node)
+            throw(EpiBadArgument);
+
+    /**
+     * Drop a reference taken by intern()
+     */
+    static void release(unsigned index);
+
+    /**
+     * Get the node name for an index returned by intern(). The caller
+     * must hold a reference to the index.
+     */
+    static const std::string &name(unsigned index);
+
+    /**
+     * Get a copy of the node name for an index the caller does not hold
+     * a reference to.
+     * @return the name, or an empty string if the index is free
+     */
+    static std::string lookup(unsigned index);
+};
+
+} //namespace type
+} //namespace epi
+
+#endif // _NODENAMES_HPP
@@ -24,17 +24,25 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include "Config.hpp"
 
+#include <memory>
+
 #include "PlainBuffer.hpp"
 
 using namespace epi::error;
 using namespace epi::type;
 using namespace epi::node;
 
-PlainBuffer::PlainBuffer(): mDecodeIndex(0), mTermList()
+PlainBuffer::PlainBuffer(): mDecodeIndex(0), mTermList(), mDeferSubst(false)
 {
 }
 
-PlainBuffer::PlainBuffer(const PlainBuffer &from): mDecodeIndex(0), mTermList(from.mTermList)
+PlainBuffer::PlainBuffer(const bool deferSubst):
+        mDecodeIndex(0), mTermList(), mDeferSubst(deferSubst)
+{
+}
+
+PlainBuffer::PlainBuffer(const PlainBuffer &from):
+        mDecodeIndex(0), mTermList(from.mTermList), mDeferSubst(from.mDeferSubst)
 {
 }
 
@@ -65,11 +73,42 @@ void PlainBuffer::writeTerm(ErlTerm *t, const VariableBinding *binding)
     if (t == 0) {
         throw EpiInvalidTerm("Null pointer");
     }
-    // We "encode" a term without variables, using subst
-    mTermList.push_back(t->subst(binding));
+    if (mDeferSubst && binding == 0) {
+        // The substitution would fail later, in other thread
+        if (t->hasVariables()) {
+            throw EpiInvalidTerm("Term with unbound variables");
+        }
+        if (!t->isValid()) {
+            throw EpiInvalidTerm("Element is not initialized");
+        }
+        mTermList.push_back(t);
+    } else {
+        // We "encode" a term without variables, using subst
+        mTermList.push_back(t->subst(binding));
+    }
+}
+
+size_t PlainBuffer::memoryFootprint(std::set<const ErlTerm*> &visited) const {
+    size_t size = mTermList.capacity() * sizeof(ErlTermPtr<ErlTerm>);
+    for (erlterm_list::const_iterator p = mTermList.begin();
+         p != mTermList.end(); ++p)
+    {
+        size += p->get()->memoryFootprint(visited);
+    }
+    return size;
 }
 
 InputBuffer *PlainBuffer::getInputBuffer() {
+    if (mDeferSubst) {
+        // return a copy with the substituted terms
+        std::auto_ptr<PlainBuffer> buffer(new PlainBuffer());
+        for (erlterm_list::const_iterator p = mTermList.begin();
+             p != mTermList.end(); ++p)
+        {
+            buffer->writeTerm(p->get());
+        }
+        return buffer.release();
+    }
     // return  a copy of this buffer
     return new PlainBuffer(*this);
 }
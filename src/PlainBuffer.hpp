@@ -47,6 +47,16 @@ class PlainBuffer: public InputBuffer, public OutputBuffer  {
 
 public:
     PlainBuffer();
+
+    /**
+     * Create a buffer that does not substitute the terms written
+     * without binding: they are stored as is, so the term is walked
+     * only once when it is encoded for a connection. The terms are
+     * substituted in getInputBuffer(). A term with variables written
+     * without binding is refused with EpiInvalidTerm.
+     * @param deferSubst defer or not the substitution.
+     */
+    PlainBuffer(const bool deferSubst);
     PlainBuffer(const PlainBuffer &from);
     virtual ~PlainBuffer();
 
@@ -58,9 +68,19 @@ public:
             throw(EpiInvalidTerm, EpiEncodeException, EpiVariableUnbound);
     virtual InputBuffer *getInputBuffer();
 
+    size_t memoryFootprint(std::set<const ErlTerm*> &visited) const;
+
+    /**
+     * Get the number of terms in the buffer
+     */
+    inline unsigned int size() const {
+        return mTermList.size();
+    }
+
 protected:
     unsigned int mDecodeIndex;
     erlterm_list mTermList;
+    bool mDeferSubst;
 
 };
 
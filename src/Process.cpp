@@ -0,0 +1,140 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp"
+
+#include "Process.hpp"
+#include "ProcessScheduler.hpp"
+#include "EpiAtomic.hpp"
+
+using namespace epi::node;
+using namespace epi::type;
+using namespace epi::util;
+
+Process::Process(ProcessScheduler *scheduler, MailBox *mailbox,
+                 ProcessFunction *function, std::size_t stackSize):
+        mScheduler(scheduler), mMailBox(mailbox), mFunction(function),
+        mFiber(&Process::start, this, stackSize), mState(RUNNING), mSeen(0),
+        mTimedOut(0)
+{
+}
+
+Process::~Process() {
+}
+
+void Process::start(void *arg) {
+    Process *process = (Process *) arg;
+    try {
+        process->mFunction->run(process);
+    } catch (EpiException &e) {
+        Dout(dc::connect, "["<<process<<"]"<< "Process " <<
+             process->self()->toString() << " ended with exception: " <<
+             e.getMessage());
+    } catch (...) {
+        // An exception must not leave the fiber
+        Dout(dc::connect, "["<<process<<"]"<< "Process " <<
+             process->self()->toString() << " ended with an unknown exception");
+    }
+    process->mState = FINISHED;
+}
+
+bool Process::match(ErlangMessage *msg) throw (EpiException) {
+    return false;
+}
+
+void Process::expired() {
+    atomicStore(&mTimedOut, 1L);
+    mScheduler->schedule(mMailBox);
+}
+
+ErlTerm* Process::receive()
+        throw (EpiDecodeException, EpiConnectionException)
+{
+    return doReceive(0, -1, 0);
+}
+
+ErlTerm* Process::receive( long timeout )
+        throw (EpiDecodeException, EpiConnectionException)
+{
+    return doReceive(0, timeout, 0);
+}
+
+ErlTerm* Process::receive( ErlTerm *pattern, VariableBinding *binding )
+        throw (EpiConnectionException)
+{
+    return doReceive(pattern, -1, binding);
+}
+
+ErlTerm* Process::receive( ErlTerm *pattern, long timeout, VariableBinding *binding )
+        throw (EpiConnectionException)
+{
+    return doReceive(pattern, timeout, binding);
+}
+
+ErlTerm* Process::doReceive( ErlTerm *pattern, long timeout, VariableBinding *binding )
+        throw (EpiDecodeException, EpiConnectionException)
+{
+    long long deadline = -1;
+    if (timeout >= 0) {
+        deadline = TimerService::currentTime() + timeout;
+    }
+
+    bool timedOut = false;
+    for (;;) {
+        // Messages arriving from now on will wake up the process
+        mSeen = ProcessScheduler::queued(mMailBox);
+        ErlTerm *term = pattern?
+                mMailBox->receive(pattern, (long) 0, binding):
+                mMailBox->receive((long) 0);
+        if (term != 0 || timedOut) {
+            return term;
+        }
+        timedOut = !park(deadline);
+    }
+}
+
+bool Process::park(long long deadline) {
+    atomicStore(&mTimedOut, 0L);
+    if (deadline >= 0) {
+        if (deadline <= TimerService::currentTime()) {
+            return false;
+        }
+        mScheduler->mTimers->add(this, deadline);
+    }
+
+    mState = WAITING;
+    Fiber::yield();
+    mState = RUNNING;
+
+    if (deadline >= 0) {
+        mScheduler->mTimers->cancel(this);
+    }
+    return atomicLoad(&mTimedOut) == 0;
+}
+
+void Process::yield() {
+    mState = READY;
+    Fiber::yield();
+    mState = RUNNING;
+}
@@ -0,0 +1,178 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#ifndef __PROCESS_HPP
+#define __PROCESS_HPP
+
+#include <memory>
+
+#include "EpiMailBox.hpp"
+#include "Fiber.hpp"
+#include "TimerService.hpp"
+
+namespace epi {
+namespace node {
+
+using namespace epi::type;
+using namespace epi::util;
+
+class Process;
+class ProcessScheduler;
+
+/**
+ * Interface to implement the code of a Process.
+ * The destructor must be virtual.
+ */
+class ProcessFunction {
+public:
+    /**
+     * Run the process. The process ends when this method returns.
+     * @param self the process running the function
+     */
+    virtual void run(Process *self) throw (EpiException) = 0;
+    virtual inline ~ProcessFunction() {}
+};
+
+/**
+ * Erlang-style process run by a ProcessScheduler. A process has its own
+ * pid and mailbox, and runs in a fiber: a blocking receive suspends the
+ * process instead of the thread, so many processes share a few threads.
+ *
+ * The receive methods and yield() must be called from the process
+ * function. Use the mailbox to send messages.
+ */
+class Process: public MailBoxGuard, public TimerTask {
+    friend class ProcessScheduler;
+public:
+    inline ErlPid *self() const {
+        return mMailBox->self();
+    }
+
+    /**
+     * Get the mailbox of the process, to send messages
+     */
+    inline MailBox *mailbox() const {
+        return mMailBox;
+    }
+
+    /**
+     * Get the next message, suspending the process until it arrives.
+     * @return the received term
+     * @exception EpiConnectionException if there was an connection error
+     */
+    ErlTerm* receive()
+            throw (EpiDecodeException, EpiConnectionException);
+
+    /**
+     * Get the next message, suspending the process until it arrives
+     * or the timeout expires.
+     * @param timeout the time, in milliseconds, to wait for a message
+     * @return the received term, or 0 if timeout is reached
+     * @exception EpiConnectionException if there was an connection error
+     */
+    ErlTerm* receive( long timeout )
+            throw (EpiDecodeException, EpiConnectionException);
+
+    /**
+     * Get a message that matches the given pattern, suspending the
+     * process until it arrives.
+     * @param pattern ErlTerm with pattern to check
+     * @param binding VariableBinding to use. It can be 0. Default = 0
+     * @return the received term
+     * @exception EpiConnectionException if there was an connection error
+     */
+    ErlTerm* receive( ErlTerm *pattern, VariableBinding *binding = 0 )
+            throw (EpiConnectionException);
+
+    /**
+     * Get a message that matches the given pattern, suspending the
+     * process until it arrives or the timeout expires.
+     * @param pattern ErlTerm with pattern to check
+     * @param timeout the time, in milliseconds, to wait for a message
+     * @param binding VariableBinding to use. It can be 0. Default = 0
+     * @return the received term, or 0 if timeout is reached
+     * @exception EpiConnectionException if there was an connection error
+     */
+    ErlTerm* receive( ErlTerm *pattern, long timeout, VariableBinding *binding = 0 )
+            throw (EpiConnectionException);
+
+    /**
+     * Let other processes run
+     */
+    void yield();
+
+    /**
+     * Not used, processes are not checked as guards
+     */
+    bool match(ErlangMessage *msg) throw (EpiException);
+
+    /**
+     * Wake up the process when the receive timeout expires
+     */
+    void expired();
+
+private:
+    enum State {
+        RUNNING,    // Running or waiting for the first run
+        READY,      // Yielded, to be run again
+        WAITING,    // Waiting for messages or the timeout
+        FINISHED
+    };
+
+    Process(ProcessScheduler *scheduler, MailBox *mailbox,
+            ProcessFunction *function, std::size_t stackSize);
+
+    ~Process();
+
+    /*
+     * Receive with an optional pattern and timeout (-1 to wait forever)
+     */
+    ErlTerm* doReceive( ErlTerm *pattern, long timeout, VariableBinding *binding )
+            throw (EpiDecodeException, EpiConnectionException);
+
+    /*
+     * Suspend until a new message arrives or the deadline (ms from
+     * the epoch, -1 for none) passes.
+     * @return false if the deadline passed
+     */
+    bool park(long long deadline);
+
+    static void start(void *process);
+
+    ProcessScheduler *mScheduler;
+    MailBox *mMailBox;
+    std::auto_ptr<ProcessFunction> mFunction;
+    Fiber mFiber;
+
+    State mState;
+    // Messages in the mailbox when the process was suspended
+    int mSeen;
+    // Set by the timer when the deadline of park() passes
+    long volatile mTimedOut;
+};
+
+} // namespace node
+} // namespace epi
+
+#endif // __PROCESS_HPP
@@ -0,0 +1,124 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp"
+
+#ifdef USE_OPEN_THREADS
+#include <OpenThreads/ScopedLock>
+#endif
+
+#include "ProcessScheduler.hpp"
+#include "EpiAtomic.hpp"
+
+using namespace epi::node;
+using namespace epi::type;
+using namespace epi::util;
+
+ProcessScheduler::ProcessScheduler(AutoNode *node, int threads,
+                                   std::size_t stackSize):
+        MailBoxExecutor(threads), mNode(node),
+        mTimers(node->getTimerService()), mStackSize(stackSize), mProcesses()
+{
+}
+
+ProcessScheduler::~ProcessScheduler() {
+    Dout(dc::connect, "["<<this<<"]"<< "ProcessScheduler::~ProcessScheduler()");
+    shutdown();
+
+    process_set processes;
+    _processesMutex.lock();
+    processes.swap(mProcesses);
+    _processesMutex.unlock();
+    for (process_set::iterator it = processes.begin(); it != processes.end(); ++it) {
+        MailBox *mailbox = (*it)->mailbox();
+        mTimers->cancel(*it);
+        release(mailbox);
+        mNode->deattachMailBox(mailbox);
+        delete *it;
+        delete mailbox;
+    }
+}
+
+ErlPid *ProcessScheduler::spawn(ProcessFunction *function) {
+    MailBox *mailbox = mNode->createMailBox();
+    Process *process = new Process(this, mailbox, function, mStackSize);
+    ErlPid *pid = mailbox->self();
+    // The process can end before returning
+    ErlPid *result = new ErlPid(pid->node(), pid->id(), pid->serial(),
+                                pid->creation());
+
+    _processesMutex.lock();
+    mProcesses.insert(process);
+    _processesMutex.unlock();
+
+    attach(mailbox, process);
+    schedule(mailbox);
+    return result;
+}
+
+int ProcessScheduler::count() {
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_processesMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(_processesMutex);
+    #endif
+    return mProcesses.size();
+}
+
+void ProcessScheduler::execute(MailBox *mailbox) {
+    Process *process = static_cast<Process *>(handler(mailbox));
+    process->mFiber.resume();
+
+    switch (process->mState) {
+    case Process::FINISHED:
+        destroy(process);
+        break;
+    case Process::WAITING:
+        // New messages or the timer could have found it running
+        unschedule(mailbox);
+        if (queued(mailbox) > process->mSeen ||
+            atomicLoad(&process->mTimedOut) != 0)
+        {
+            schedule(mailbox);
+        }
+        break;
+    default:
+        push(mailbox);
+        break;
+    }
+}
+
+void ProcessScheduler::destroy(Process *process) {
+    MailBox *mailbox = process->mailbox();
+    // It stays scheduled, so deliveries don't queue it again
+    release(mailbox);
+    mNode->deattachMailBox(mailbox);
+
+    _processesMutex.lock();
+    mProcesses.erase(process);
+    _processesMutex.unlock();
+
+    delete process;
+    delete mailbox;
+}
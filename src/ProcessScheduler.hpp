@@ -0,0 +1,103 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#ifndef __PROCESSSCHEDULER_HPP
+#define __PROCESSSCHEDULER_HPP
+
+#include <set>
+
+#include "MailBoxExecutor.hpp"
+#include "Process.hpp"
+#include "EpiAutoNode.hpp"
+
+namespace epi {
+namespace node {
+
+/**
+ * Runs Processes on a pool of threads (M:N scheduling).
+ *
+ * Each process is a mailbox of an AutoNode attached to this executor,
+ * with a fiber that runs the process function. A process is run by one
+ * worker at a time, until it yields, waits for a message that is not in
+ * its mailbox or finishes. New messages and expired receive timeouts
+ * schedule it again, in any of the workers. The timeouts use the
+ * TimerService of the node.
+ *
+ * Processes still alive when the scheduler is destroyed are deleted
+ * without unwinding their stacks.
+ */
+class ProcessScheduler: public MailBoxExecutor {
+    friend class Process;
+public:
+    /**
+     * Create the scheduler and start the workers
+     * @param node node for the mailboxes of the processes
+     * @param threads number of worker threads
+     * @param stackSize size of the stack of each process
+     */
+    ProcessScheduler(AutoNode *node, int threads,
+                     std::size_t stackSize = Fiber::DEFAULT_STACK_SIZE);
+
+    ~ProcessScheduler();
+
+    /**
+     * Start a new process
+     * @param function code of the process. Owership is transfered
+     * @return a new pid with the pid of the process
+     */
+    ErlPid *spawn(ProcessFunction *function);
+
+    /**
+     * Get the number of processes alive
+     */
+    int count();
+
+protected:
+    void execute(MailBox *mailbox);
+
+private:
+    typedef std::set<Process *> process_set;
+
+    /*
+     * Remove the process and its mailbox
+     */
+    void destroy(Process *process);
+
+    AutoNode *mNode;
+    TimerService *mTimers;
+    std::size_t mStackSize;
+
+    process_set mProcesses;
+
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::Mutex _processesMutex;
+    #elif USE_BOOST
+    boost::mutex _processesMutex;
+    #endif
+};
+
+} // namespace node
+} // namespace epi
+
+#endif // __PROCESSSCHEDULER_HPP
@@ -0,0 +1,226 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp"
+
+#ifdef USE_OPEN_THREADS
+#include <OpenThreads/Thread>
+#elif USE_BOOST
+#include <boost/thread/thread.hpp>
+#endif
+
+#include "RegisteredNameTable.hpp"
+#include "EpiAtomic.hpp"
+
+using namespace epi::node;
+using namespace epi::util;
+
+/** Initial number of buckets, a power of 2 */
+static const unsigned INITIAL_BUCKETS = 64;
+
+RegisteredNameTable::Buckets::Buckets(unsigned size):
+        mask(size - 1), heads(new Entry *[size])
+{
+    for (unsigned i = 0; i < size; i++) {
+        heads[i] = 0;
+    }
+}
+
+RegisteredNameTable::Buckets::~Buckets() {
+    delete [] heads;
+}
+
+RegisteredNameTable::RegisteredNameTable():
+        mBuckets(new Buckets(INITIAL_BUCKETS)), mCount(0), mNames(),
+        mEpoch(0)
+{
+    mReaders[0] = 0;
+    mReaders[1] = 0;
+}
+
+RegisteredNameTable::~RegisteredNameTable() {
+    for (unsigned i = 0; i <= mBuckets->mask; i++) {
+        Entry *entry = mBuckets->heads[i];
+        while (entry != 0) {
+            Entry *next = entry->next;
+            delete entry;
+            entry = next;
+        }
+    }
+    delete mBuckets;
+}
+
+unsigned RegisteredNameTable::hash(const std::string &name) {
+    // FNV-1a
+    unsigned h = 2166136261u;
+    for (std::string::const_iterator p = name.begin(); p != name.end(); ++p) {
+        h = (h ^ (unsigned char) *p) * 16777619u;
+    }
+    return h;
+}
+
+void RegisteredNameTable::insert(const std::string &name, MailBox *mailbox) {
+    entry_list retired;
+    Buckets *retiredBuckets = 0;
+
+    if (!unlink(name, retired)) {
+        mCount++;
+    }
+    Entry * volatile *head = &mBuckets->heads[hash(name) & mBuckets->mask];
+    atomicStore(head, new Entry(name, mailbox, *head));
+    mNames.insert(reverse_index::value_type(mailbox, name));
+
+    if (mCount > 2 * (mBuckets->mask + 1)) {
+        grow(retired, retiredBuckets);
+    }
+    reclaim(retired, retiredBuckets);
+}
+
+void RegisteredNameTable::remove(const std::string &name) {
+    entry_list retired;
+    if (unlink(name, retired)) {
+        mCount--;
+    }
+    reclaim(retired, 0);
+}
+
+void RegisteredNameTable::remove(MailBox *mailbox) {
+    std::pair<reverse_index::iterator, reverse_index::iterator> range =
+            mNames.equal_range(mailbox);
+    std::vector<std::string> names;
+    for (reverse_index::iterator it = range.first; it != range.second; ++it) {
+        names.push_back(it->second);
+    }
+
+    entry_list retired;
+    for (std::vector<std::string>::iterator it = names.begin(); it != names.end(); ++it) {
+        if (unlink(*it, retired)) {
+            mCount--;
+        }
+    }
+    reclaim(retired, 0);
+}
+
+MailBox *RegisteredNameTable::find(const std::string &name) const {
+    MailBox *mailbox = 0;
+    long epoch = enterRead();
+    Buckets *buckets = atomicLoad(&mBuckets);
+    Entry *entry = atomicLoad(&buckets->heads[hash(name) & buckets->mask]);
+    for (; entry != 0; entry = entry->next) {
+        if (entry->name == name) {
+            mailbox = entry->mailbox;
+            break;
+        }
+    }
+    exitRead(epoch);
+    return mailbox;
+}
+
+bool RegisteredNameTable::unlink(const std::string &name, entry_list &retired) {
+    Entry * volatile *head = &mBuckets->heads[hash(name) & mBuckets->mask];
+    Entry *target = *head;
+    while (target != 0 && target->name != name) {
+        target = target->next;
+    }
+    if (target == 0) {
+        return false;
+    }
+
+    // Readers can be traversing the entries before the target, so they
+    // are copied instead of relinked
+    entry_list prefix;
+    for (Entry *entry = *head; entry != target; entry = entry->next) {
+        prefix.push_back(entry);
+    }
+    Entry *chain = target->next;
+    for (entry_list::reverse_iterator it = prefix.rbegin(); it != prefix.rend(); ++it) {
+        chain = new Entry((*it)->name, (*it)->mailbox, chain);
+        retired.push_back(*it);
+    }
+    atomicStore(head, chain);
+    retired.push_back(target);
+
+    std::pair<reverse_index::iterator, reverse_index::iterator> range =
+            mNames.equal_range(target->mailbox);
+    for (reverse_index::iterator it = range.first; it != range.second; ++it) {
+        if (it->second == name) {
+            mNames.erase(it);
+            break;
+        }
+    }
+    return true;
+}
+
+void RegisteredNameTable::grow(entry_list &retired, Buckets *&retiredBuckets) {
+    Buckets *old = mBuckets;
+    Buckets *buckets = new Buckets(2 * (old->mask + 1));
+    for (unsigned i = 0; i <= old->mask; i++) {
+        for (Entry *entry = old->heads[i]; entry != 0; entry = entry->next) {
+            Entry * volatile *head = &buckets->heads[hash(entry->name) & buckets->mask];
+            *head = new Entry(entry->name, entry->mailbox, *head);
+            retired.push_back(entry);
+        }
+    }
+    atomicStore(&mBuckets, buckets);
+    retiredBuckets = old;
+}
+
+void RegisteredNameTable::reclaim(entry_list &retired, Buckets *retiredBuckets) {
+    if (retired.empty() && retiredBuckets == 0) {
+        return;
+    }
+
+    // New readers use the next epoch and can't reach the retired
+    // entries. Wait for the readers of the current one.
+    long epoch = atomicFetchAdd(&mEpoch, 1);
+    while (atomicLoad(&mReaders[epoch & 1]) != 0) {
+        #ifdef USE_OPEN_THREADS
+        OpenThreads::Thread::YieldCurrentThread();
+        #elif USE_BOOST
+        boost::thread::yield();
+        #endif
+    }
+
+    for (entry_list::iterator it = retired.begin(); it != retired.end(); ++it) {
+        delete *it;
+    }
+    delete retiredBuckets;
+}
+
+long RegisteredNameTable::enterRead() const {
+    for (;;) {
+        long epoch = atomicLoad(&mEpoch);
+        atomicFetchAdd(&mReaders[epoch & 1], 1);
+        // A writer could have started a new epoch and be waiting only
+        // for the readers of the previous one
+        if (atomicLoad(&mEpoch) == epoch) {
+            return epoch;
+        }
+        atomicFetchAdd(&mReaders[epoch & 1], -1);
+    }
+}
+
+void RegisteredNameTable::exitRead(long epoch) const {
+    atomicFetchAdd(&mReaders[epoch & 1], -1);
+}
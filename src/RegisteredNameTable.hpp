@@ -0,0 +1,139 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#ifndef _REGISTEREDNAMETABLE_HPP
+#define _REGISTEREDNAMETABLE_HPP
+
+#include <string>
+#include <map>
+#include <vector>
+
+namespace epi {
+namespace node {
+
+class MailBox;
+
+/**
+ * Table of the registered names of a node, to find the destination of
+ * a message without locks.
+ *
+ * Readers traverse a hash table whose entries are never modified once
+ * published. Writers publish new versions of the chains they change,
+ * and delete the old entries when all the readers that could be using
+ * them have finished (epoch-based reclamation).
+ *
+ * find() can be called while other threads insert or remove names.
+ * insert() and remove() must be serialized by the caller, and they wait
+ * for the readers of the previous version. As with a locked map, the
+ * caller must ensure that an unregistered mailbox is not deleted while
+ * other thread can be delivering to it.
+ *
+ * A reverse index by mailbox allows to remove all the names of a
+ * mailbox without scanning the table.
+ */
+class RegisteredNameTable {
+public:
+    RegisteredNameTable();
+
+    ~RegisteredNameTable();
+
+    /**
+     * Register a name for a mailbox, replacing the previous mailbox
+     * with this name, if any
+     */
+    void insert(const std::string &name, MailBox *mailbox);
+
+    /**
+     * Remove a name
+     */
+    void remove(const std::string &name);
+
+    /**
+     * Remove all the names of a mailbox
+     */
+    void remove(MailBox *mailbox);
+
+    /**
+     * Find the mailbox registered with a name
+     * @return the mailbox or 0 if the name is not registered
+     */
+    MailBox *find(const std::string &name) const;
+
+private:
+    struct Entry {
+        Entry(const std::string &aName, MailBox *aMailBox, Entry *aNext):
+                name(aName), mailbox(aMailBox), next(aNext) {}
+        const std::string name;
+        MailBox * const mailbox;
+        Entry * const next;
+    };
+
+    struct Buckets {
+        Buckets(unsigned size);
+        ~Buckets();
+        unsigned mask;
+        Entry * volatile *heads;
+    };
+
+    typedef std::multimap<MailBox *, std::string> reverse_index;
+    typedef std::vector<Entry *> entry_list;
+
+    /*
+     * Publish a version of the chain of the name without it.
+     * The replaced entries are added to retired.
+     * @return true if the name was in the table
+     */
+    bool unlink(const std::string &name, entry_list &retired);
+
+    /*
+     * Publish a bigger copy of the table
+     */
+    void grow(entry_list &retired, Buckets *&retiredBuckets);
+
+    /*
+     * Wait for the readers that could use retired entries, and delete
+     * them
+     */
+    void reclaim(entry_list &retired, Buckets *retiredBuckets);
+
+    long enterRead() const;
+    void exitRead(long epoch) const;
+
+    static unsigned hash(const std::string &name);
+
+    Buckets * volatile mBuckets;
+    unsigned mCount;
+    reverse_index mNames;
+
+    long volatile mEpoch;
+    mutable long volatile mReaders[2];
+
+    RegisteredNameTable(const RegisteredNameTable &);
+    RegisteredNameTable &operator=(const RegisteredNameTable &);
+};
+
+} // node
+} // epi
+
+#endif // _REGISTEREDNAMETABLE_HPP
@@ -0,0 +1,282 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp"
+
+#ifdef USE_OPEN_THREADS
+#include <OpenThreads/Thread>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+#include <OpenThreads/ScopedLock>
+#elif USE_BOOST
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/shared_ptr.hpp>
+#endif
+
+#include "ReplayConnection.hpp"
+#include "EIOutputBuffer.hpp"
+#include "EIInputBuffer.hpp"
+#include "EpiUtil.hpp"
+#include "FrameCapture.hpp"
+#include "LatencyHistogram.hpp"
+
+using namespace epi::type;
+using namespace epi::error;
+using namespace epi::node;
+using namespace epi::util;
+using namespace epi::ei;
+
+///////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+
+namespace epi {
+namespace ei {
+/**
+ * This class reads the frames of a capture, delivering them to the
+ * receiver of the connection at the pace they were captured
+ */
+class ReplayAcceptor
+    #ifdef USE_OPEN_THREADS
+    : public OpenThreads::Thread
+    #endif
+{
+public:
+    /**
+     * The acceptor thread will start with creation of
+     * the object.
+     */
+    ReplayAcceptor(ReplayConnection *connection);
+
+    ~ReplayAcceptor();
+
+    /**
+     * This method will stop and destroy the acceptor
+     */
+    void stop();
+
+    void run();
+
+private:
+    /*
+     * Wait until the given LatencyHistogram::now() time
+     * @return false if the acceptor was stopped meanwhile
+     */
+    bool waitUntil(long long time);
+
+    ReplayConnection *mConnection;
+    bool mThreadExit;
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::Mutex _exitMutex;
+    OpenThreads::Condition _exitCondition;
+    #elif USE_BOOST
+    boost::mutex _exitMutex;
+    boost::condition _exitCondition;
+    boost::shared_ptr<boost::thread> m_thread;
+    #endif
+};
+}// ei
+}// epi
+
+ReplayAcceptor::ReplayAcceptor(ReplayConnection *connection):
+        mConnection(connection), mThreadExit(false)
+{
+    #ifdef USE_OPEN_THREADS
+    start();
+    #elif USE_BOOST
+    m_thread = boost::shared_ptr<boost::thread>(
+        new boost::thread(boost::bind(&ReplayAcceptor::run, this))
+    );
+    #endif
+}
+
+ReplayAcceptor::~ReplayAcceptor()
+{
+    this->stop();
+}
+
+void ReplayAcceptor::stop() {
+    _exitMutex.lock();
+    mThreadExit = true;
+    #ifdef USE_OPEN_THREADS
+    _exitCondition.signal();
+    #elif USE_BOOST
+    _exitCondition.notify_one();
+    #endif
+    _exitMutex.unlock();
+    #ifdef USE_OPEN_THREADS
+    if (this->isRunning()) {
+        this->join();
+    }
+    #elif USE_BOOST
+    if (m_thread.get()) {
+        m_thread->join();
+        m_thread.reset();
+    }
+    #endif
+}
+
+bool ReplayAcceptor::waitUntil(long long time) {
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_exitMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(_exitMutex);
+    #endif
+    while (!mThreadExit) {
+        long long remaining = time - LatencyHistogram::now();
+        if (remaining <= 0) {
+            return true;
+        }
+        // In ms, rounded up
+        long wait = (long) ((remaining + 999999) / 1000000);
+        #ifdef USE_OPEN_THREADS
+        _exitCondition.wait(&_exitMutex, (unsigned long) wait);
+        #elif USE_BOOST
+        _exitCondition.timed_wait(lock, boost::posix_time::milliseconds(wait));
+        #endif
+    }
+    return false;
+}
+
+void ReplayAcceptor::run() {
+    #ifdef CWDEBUG
+    epi::debug::setThreadDebugMargin();
+    #endif
+    Dout(dc::connect, "["<<this<<"]"<< "ReplayAcceptor::run(): Thread started (" << gettid() << ")");
+
+    CaptureReader reader;
+    if (!reader.open(mConnection->mFile)) {
+        Dout(dc::connect, "["<<this<<"]"<< "ReplayAcceptor: can not read " << mConnection->mFile);
+        atomicStore(&mConnection->mFinished, 1L);
+        return;
+    }
+
+    const std::string &peer = mConnection->getPeer()->getNodeName();
+    long long begin = LatencyHistogram::now();
+    long long first = -1;
+    CapturedFrame frame;
+    while (!mThreadExit && reader.next(frame)) {
+        if (frame.peer != peer) {
+            continue;
+        }
+        if (first < 0) {
+            first = frame.time;
+        }
+        if (mConnection->mSpeed > 0 &&
+            !waitUntil(begin + (long long) ((frame.time - first) / mConnection->mSpeed)))
+        {
+            break;
+        }
+
+        long long start = LatencyHistogram::now();
+        // The buffer has the version, copy the message after it
+        EIInputBuffer *buffer = new EIInputBuffer();
+        unsigned index = 0;
+        if (!frame.payload.empty() && (unsigned char) frame.payload[0] == 131) {
+            index++;
+        }
+        if (index < frame.payload.size()) {
+            ei_x_append_buf(buffer->getBuffer(), &frame.payload[index],
+                            frame.payload.size() - index);
+        }
+        EpiMessage *msgResult;
+        try {
+            msgResult = epi::util::ToMessage(&frame.msg, buffer, false);
+        } catch (EpiConnectionException &e) {
+            // An error would close the connection, skip the frame
+            atomicFetchAdd(&mConnection->mSkipped, 1);
+            continue;
+        }
+        mConnection->countIn(frame.payload.size());
+        mConnection->deliver(mConnection, msgResult);
+        mConnection->getLatencyStats().stage(LATENCY_RECEIVE)
+                .record(LatencyHistogram::now() - start);
+    }
+    reader.close();
+    atomicStore(&mConnection->mFinished, 1L);
+    Dout(dc::connect, "["<<this<<"]"<< "ReplayAcceptor:: Thread exit");
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+ReplayConnection::ReplayConnection(PeerNode *peer,
+                                   const std::string &file,
+                                   double speed):
+        Connection(peer, ""),
+        mFile(file), mSpeed(speed), mAcceptor(0), mFinished(0), mSkipped(0)
+{
+}
+
+ReplayConnection::~ReplayConnection() {
+    Dout(dc::connect, "["<<this<<"]"<< "ReplayConnection::~ReplayConnection()");
+    this->close();
+}
+
+OutputBuffer* ReplayConnection::newOutputBuffer() {
+    return new EIOutputBuffer();
+}
+
+void ReplayConnection::sendBuf( ErlPid * from, ErlPid * to,
+                                OutputBuffer * buffer )
+        throw( EpiConnectionException)
+{
+    countOut(*(((EIOutputBuffer *) buffer)->getInternalIndex()));
+}
+
+void ReplayConnection::sendBuf( ErlPid * from, const std::string &to,
+                                OutputBuffer * buffer )
+        throw( EpiConnectionException)
+{
+    countOut(*(((EIOutputBuffer *) buffer)->getInternalIndex()));
+}
+
+void ReplayConnection::sendBuf( ErlPid* from,
+                                const std::string &node,
+                                const std::string &to,
+                                OutputBuffer* buffer )
+        throw (EpiConnectionException)
+{
+    sendBuf(from, to, buffer);
+}
+
+void ReplayConnection::start() {
+    if (mAcceptor == 0) {
+        atomicStore(&mFinished, 0L);
+        mAcceptor = new ReplayAcceptor(this);
+    }
+}
+
+void ReplayConnection::stop() {
+    if (mAcceptor) {
+        mAcceptor->stop();
+        delete mAcceptor;
+        mAcceptor = 0;
+    }
+}
+
+void ReplayConnection::close() {
+    this->stop();
+}
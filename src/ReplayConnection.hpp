@@ -0,0 +1,137 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#ifndef _REPLAYCONNECTION_H
+#define _REPLAYCONNECTION_H
+
+#include <string>
+
+#include "EpiConnection.hpp"
+#include "EpiAtomic.hpp"
+
+namespace epi {
+namespace ei {
+
+using namespace epi::type;
+using namespace epi::error;
+using namespace epi::node;
+
+class ReplayAcceptor;
+
+/**
+ * A connection that stands in for a peer node, delivering the frames
+ * captured from it by epi::util::FrameCapture. The frames are decoded
+ * and delivered as if they were read from a socket, so a node can be
+ * run against a capture of real traffic without the peer, or Erlang.
+ *
+ * The frames are delivered at the pace they were captured, or faster
+ * with a speed greater than 1. With a speed of 0 they are delivered
+ * as fast as the node takes them. Frames captured from other nodes
+ * are skipped. The messages sent to the peer are encoded and dropped.
+ *
+ * Attach it to a node with AutoNode::attachConnection().
+ */
+class ReplayConnection: public Connection
+{
+    friend class ReplayAcceptor;
+public:
+    /**
+     * Create a connection replaying a capture. It is stopped, the
+     * replay begins with start().
+     * @param peer node the frames were captured from
+     * @param file capture file
+     * @param speed speedup of the replay, 0 for no pauses
+     */
+    ReplayConnection(PeerNode *peer, const std::string &file,
+                     double speed = 1);
+
+    virtual ~ReplayConnection();
+
+    /**
+     * Create a new OutputBuffer to be used with this sender
+     */
+    virtual OutputBuffer* newOutputBuffer();
+
+    inline OutputBufferType outputBufferType() const {
+        return EI_OUTPUT_BUFFER;
+    }
+
+    /**
+     * Drop the buffer, counting it as sent
+     */
+    virtual void sendBuf( epi::type::ErlPid* from,
+                          epi::type::ErlPid* to,
+                          epi::node::OutputBuffer* buffer )
+            throw (EpiConnectionException);
+
+    /**
+     * Drop the buffer, counting it as sent
+     */
+    virtual void sendBuf( epi::type::ErlPid* from,
+                          const std::string &to,
+                          epi::node::OutputBuffer* buffer )
+            throw (EpiConnectionException);
+
+    /**
+     * Drop the buffer, counting it as sent
+     */
+    virtual void sendBuf( ErlPid* from,
+                          const std::string &node,
+                          const std::string &to,
+                          OutputBuffer* buffer )
+            throw (EpiConnectionException);
+
+    virtual void start();
+
+    virtual void stop();
+
+    virtual void close();
+
+    /**
+     * Check if all the frames of the capture were delivered, or the
+     * capture could not be read
+     */
+    inline bool finished() const {
+        return epi::util::atomicLoad(&mFinished) != 0;
+    }
+
+    /**
+     * Get the frames skipped because they could not be delivered
+     */
+    inline long skipped() const {
+        return epi::util::atomicLoad(&mSkipped);
+    }
+
+protected:
+    std::string mFile;
+    double mSpeed;
+    ReplayAcceptor *mAcceptor;
+    long volatile mFinished;
+    long volatile mSkipped;
+};
+
+} // ei
+} // epi
+
+#endif
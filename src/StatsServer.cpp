@@ -0,0 +1,294 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp" // Main config file
+
+#include <vector>
+
+#ifdef USE_OPEN_THREADS
+#include <OpenThreads/Thread>
+#elif USE_BOOST
+#include <boost/thread/thread.hpp>
+#endif
+
+#include "StatsServer.hpp"
+#include "EpiAutoNode.hpp"
+#include "EpiAtomic.hpp"
+#include "LatencyHistogram.hpp"
+
+using namespace epi::node;
+using namespace epi::type;
+using namespace epi::util;
+
+/*
+ * A proper list with the given elements, whose ownership is transfered
+ */
+static ErlTerm *makeList(std::vector<ErlTerm *> &elems) {
+    if (elems.empty()) {
+        return new ErlEmptyList();
+    }
+    return new ErlConsList(&elems[0], elems.size());
+}
+
+/*
+ * A {Key, Value} tuple
+ */
+static ErlTerm *property(const char *key, ErlTerm *value) {
+    return new ErlTuple(new ErlAtom(key), value);
+}
+
+static ErlTerm *property(const char *key, long long value) {
+    return property(key, new ErlLong(value));
+}
+
+StatsServer::StatsServer(AutoNode *node, MailBox *mailbox,
+                         const std::string &name):
+        mNode(node), mMailBox(mailbox), mName(name), mStopped(0), mServing(0)
+{
+    LatencyStats stats;
+    mNode->getLatencyStats(stats);
+    mStartTime = LatencyHistogram::now();
+    mStartDecoded = stats.stage(LATENCY_DECODE).count();
+    mStartEncoded = stats.stage(LATENCY_ENCODE).count();
+}
+
+StatsServer::~StatsServer() {
+}
+
+void StatsServer::start() {
+    atomicStore(&mStopped, 0L);
+    mMailBox->asyncReceive(this, this);
+}
+
+void StatsServer::stop() {
+    atomicStore(&mStopped, 1L);
+    mMailBox->cancelReceive(this);
+    // received() checks mStopped after counting itself
+    while (atomicLoad(&mServing) > 0) {
+        #ifdef USE_OPEN_THREADS
+        OpenThreads::Thread::YieldCurrentThread();
+        #elif USE_BOOST
+        boost::thread::yield();
+        #endif
+    }
+}
+
+void StatsServer::received(ErlangMessage *msg) {
+    std::auto_ptr<ErlangMessage> message(msg);
+    atomicFetchAdd(&mServing, 1);
+    // Serve the requests queued meanwhile before waiting again, so
+    // a burst of requests does not nest the callbacks
+    while (message.get() != 0 && !atomicLoad(&mStopped)) {
+        try {
+            serve(message.get());
+        } catch (EpiException &e) {
+            Dout(dc::connect, "["<<this<<"]"<< "StatsServer: request failed: " <<
+                 e.getMessage());
+        }
+        try {
+            message.reset(mMailBox->receiveMsg(0));
+        } catch (EpiConnectionException &) {
+            message.reset();
+        }
+    }
+    if (!atomicLoad(&mStopped)) {
+        mMailBox->asyncReceive(this, this);
+    }
+    atomicFetchAdd(&mServing, -1);
+}
+
+void StatsServer::failed(EpiConnectionException &error) {
+    if (!atomicLoad(&mStopped)) {
+        mMailBox->asyncReceive(this, this);
+    }
+}
+
+void StatsServer::serve(ErlangMessage *msg) {
+    ErlTerm *term = msg->getMsg();
+    if (term == 0 || !term->instanceOf(ERL_TUPLE)) {
+        return;
+    }
+    ErlTuple *tuple = (ErlTuple *) term;
+    ErlTermPtr<ErlPid> to;
+    ErlTermPtr<> answer;
+    if (tuple->arity() == 3 && tuple->elementAt(0)->instanceOf(ERL_ATOM) &&
+        ((ErlAtom *) tuple->elementAt(0))->atomValue() == "$gen_call")
+    {
+        // {'$gen_call', {Pid, Tag}, Request} -> {Tag, Reply}
+        ErlTerm *from = tuple->elementAt(1);
+        if (!from->instanceOf(ERL_TUPLE) || ((ErlTuple *) from)->arity() != 2 ||
+            !((ErlTuple *) from)->elementAt(0)->instanceOf(ERL_PID))
+        {
+            return;
+        }
+        to = (ErlPid *) ((ErlTuple *) from)->elementAt(0);
+        answer = new ErlTuple(((ErlTuple *) from)->elementAt(1),
+                              reply(tuple->elementAt(2)));
+    } else if (tuple->arity() == 2 && tuple->elementAt(0)->instanceOf(ERL_PID)) {
+        // {Pid, Request} -> {Name, Reply}
+        to = (ErlPid *) tuple->elementAt(0);
+        answer = new ErlTuple(new ErlAtom(mName.c_str()),
+                              reply(tuple->elementAt(1)));
+    } else {
+        return;
+    }
+    mMailBox->send(to.get(), answer.get());
+}
+
+ErlTerm *StatsServer::reply(ErlTerm *request) {
+    std::string name;
+    if (request->instanceOf(ERL_ATOM)) {
+        name = ((ErlAtom *) request)->atomValue();
+    }
+    if (name == "stats") {
+        std::vector<ErlTerm *> stats;
+        stats.push_back(property("node", new ErlAtom(mNode->getNodeName().c_str())));
+        stats.push_back(property("connections", connections()));
+        stats.push_back(property("mailboxes", mailboxes()));
+        stats.push_back(property("rates", rates()));
+        stats.push_back(property("latency", latency()));
+        stats.push_back(property("memory", memory()));
+        return makeList(stats);
+    } else if (name == "connections") {
+        return connections();
+    } else if (name == "mailboxes") {
+        return mailboxes();
+    } else if (name == "rates") {
+        return rates();
+    } else if (name == "latency") {
+        return latency();
+    } else if (name == "memory") {
+        return memory();
+    }
+    return new ErlTuple(new ErlAtom("error"), new ErlAtom("unknown_request"));
+}
+
+ErlTerm *StatsServer::connections() {
+    std::vector<ConnectionStats> connections;
+    mNode->getConnectionStats(connections);
+
+    std::vector<ErlTerm *> peers;
+    for (unsigned i = 0; i < connections.size(); i++) {
+        std::vector<ErlTerm *> traffic;
+        traffic.push_back(property("messages_in", connections[i].messagesIn));
+        traffic.push_back(property("bytes_in", connections[i].bytesIn));
+        traffic.push_back(property("messages_out", connections[i].messagesOut));
+        traffic.push_back(property("bytes_out", connections[i].bytesOut));
+        peers.push_back(new ErlTuple(new ErlAtom(connections[i].node.c_str()),
+                                     makeList(traffic)));
+    }
+
+    std::vector<ErlTerm *> stats;
+    stats.push_back(property("count", (long long) connections.size()));
+    stats.push_back(property("peers", makeList(peers)));
+    return makeList(stats);
+}
+
+ErlTerm *StatsServer::mailboxes() {
+    std::vector<MailBoxMemory> mailboxes;
+    mNode->getMailBoxMemory(mailboxes);
+
+    long long messages = 0;
+    long long bytes = 0;
+    std::vector<ErlTerm *> queues;
+    for (unsigned i = 0; i < mailboxes.size(); i++) {
+        messages += mailboxes[i].messages;
+        bytes += mailboxes[i].bytes;
+        if (mailboxes[i].messages > 0) {
+            queues.push_back(new ErlTuple(mailboxes[i].pid.get(),
+                                          new ErlLong(mailboxes[i].messages),
+                                          new ErlLong(mailboxes[i].bytes)));
+        }
+    }
+
+    std::vector<ErlTerm *> stats;
+    stats.push_back(property("count", (long long) mailboxes.size()));
+    stats.push_back(property("queued_messages", messages));
+    stats.push_back(property("queued_bytes", bytes));
+    stats.push_back(property("queues", makeList(queues)));
+    return makeList(stats);
+}
+
+ErlTerm *StatsServer::rates() {
+    LatencyStats latency;
+    mNode->getLatencyStats(latency);
+    long decoded = latency.stage(LATENCY_DECODE).count();
+    long encoded = latency.stage(LATENCY_ENCODE).count();
+    long long now = LatencyHistogram::now();
+
+    // Nothing is kept between requests, so the requesters do not
+    // change the rates of each other
+    long long decodeRate = 0;
+    long long encodeRate = 0;
+    if (now > mStartTime) {
+        double seconds = (now - mStartTime) / 1e9;
+        decodeRate = (long long) ((decoded - mStartDecoded) / seconds);
+        encodeRate = (long long) ((encoded - mStartEncoded) / seconds);
+    }
+
+    std::vector<ErlTerm *> stats;
+    stats.push_back(property("decode", decodeRate > 0? decodeRate: 0));
+    stats.push_back(property("encode", encodeRate > 0? encodeRate: 0));
+    stats.push_back(property("decoded", (long long) decoded));
+    stats.push_back(property("encoded", (long long) encoded));
+    stats.push_back(property("time", now));
+    return makeList(stats);
+}
+
+ErlTerm *StatsServer::latency() {
+    LatencyStats latency;
+    mNode->getLatencyStats(latency);
+
+    std::vector<ErlTerm *> stages;
+    for (int i = 0; i < LATENCY_STAGES; i++) {
+        const LatencyHistogram &histogram = latency.stage((LatencyStage) i);
+        std::vector<ErlTerm *> values;
+        values.push_back(property("count", (long long) histogram.count()));
+        values.push_back(property("p50", histogram.percentile(50)));
+        values.push_back(property("p90", histogram.percentile(90)));
+        values.push_back(property("p99", histogram.percentile(99)));
+        values.push_back(property("max", histogram.max()));
+        std::string name = LatencyStats::stageName((LatencyStage) i);
+        stages.push_back(property(name.c_str(), makeList(values)));
+    }
+    return makeList(stages);
+}
+
+ErlTerm *StatsServer::memory() {
+    std::vector<ErlTerm *> types;
+    for (int i = 0; i < TermStats::TYPES; i++) {
+        long live = TermStats::liveTerms((TermType) i);
+        if (live != 0) {
+            types.push_back(property(TermStats::typeName((TermType) i), live));
+        }
+    }
+
+    std::vector<ErlTerm *> stats;
+    stats.push_back(property("term_stats",
+            new ErlAtom(TermStats::available()? "true": "false")));
+    stats.push_back(property("live_terms", TermStats::liveTerms()));
+    stats.push_back(property("live_bytes", TermStats::liveBytes()));
+    stats.push_back(property("terms", makeList(types)));
+    return makeList(stats);
+}
@@ -0,0 +1,138 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#ifndef __STATSSERVER_HPP
+#define __STATSSERVER_HPP
+
+#include <string>
+
+#include "ErlTypes.hpp"
+#include "EpiMailBox.hpp"
+
+namespace epi {
+namespace node {
+
+class AutoNode;
+
+/**
+ * Serves the statistics of an AutoNode to Erlang processes, from a
+ * registered mailbox (see AutoNode::startStatsServer()). It does not
+ * use a thread: requests are served by the thread that delivers them.
+ *
+ * A request is a gen_server call, or a tuple with the pid to reply:
+ *   gen_server:call({epi_stats, 'cnode@host'}, Request)
+ *   {epi_stats, 'cnode@host'} ! {self(), Request}
+ * the second one is answered with {epi_stats, Reply}.
+ *
+ * Requests:
+ *  - stats: all the following, as [{node, Node}, {Request, Reply}]
+ *  - connections: [{count, N}, {peers, [{Node, [{messages_in, N},
+ *    {bytes_in, N}, {messages_out, N}, {bytes_out, N}]}]}]
+ *  - mailboxes: [{count, N}, {queued_messages, N}, {queued_bytes, N},
+ *    {queues, [{Pid, Messages, Bytes}]}] with the non-empty queues
+ *  - rates: [{decode, N}, {encode, N}, {decoded, N}, {encoded, N},
+ *    {time, Ns}] with the messages per second since the server started,
+ *    and the totals at a monotonic time in nanoseconds, to compute the
+ *    rates between two requests
+ *  - latency: [{Stage, [{count, N}, {p50, Ns}, {p90, Ns}, {p99, Ns},
+ *    {max, Ns}]}] for each LatencyStage
+ *  - memory: [{term_stats, Bool}, {live_terms, N}, {live_bytes, N},
+ *    {terms, [{Type, Live}]}] from epi::type::TermStats
+ * Other requests are answered with {error, unknown_request}.
+ */
+class StatsServer: public MailBoxGuard, public ReceiveCallback {
+public:
+    /**
+     * Create the server of the node, for requests to the mailbox.
+     * Call start() to serve them.
+     */
+    StatsServer(AutoNode *node, MailBox *mailbox, const std::string &name);
+
+    virtual ~StatsServer();
+
+    /**
+     * Start serving the requests
+     */
+    void start();
+
+    /**
+     * Stop serving the requests. If a request is being served, wait
+     * for it, so the mailbox can be deattached once this returns.
+     */
+    void stop();
+
+    /** Get the mailbox of the server */
+    inline MailBox *getMailBox() const {
+        return mMailBox;
+    }
+
+    /** Get the name of the mailbox */
+    inline const std::string &getName() const {
+        return mName;
+    }
+
+    /** Accept every message */
+    bool match(ErlangMessage *msg) throw (EpiException) {
+        return true;
+    }
+
+    void received(ErlangMessage *msg);
+
+    void failed(EpiConnectionException &error);
+
+private:
+    AutoNode *mNode;
+    MailBox *mMailBox;
+    std::string mName;
+    long volatile mStopped;
+    // Threads in received()
+    long volatile mServing;
+    // Counts when the server was created
+    long long mStartTime;
+    long mStartDecoded;
+    long mStartEncoded;
+
+    /*
+     * Answer a request message
+     */
+    void serve(ErlangMessage *msg);
+
+    /*
+     * Get the reply to a request, see the class description.
+     * Requests are served one at a time.
+     * @return a zero referenced term
+     */
+    ErlTerm *reply(ErlTerm *request);
+
+    ErlTerm *connections();
+    ErlTerm *mailboxes();
+    ErlTerm *rates();
+    ErlTerm *latency();
+    ErlTerm *memory();
+};
+
+} // node
+} // epi
+
+#endif // __STATSSERVER_HPP
@@ -0,0 +1,349 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#ifdef USE_OPEN_THREADS
+#include <OpenThreads/Thread>
+#include <OpenThreads/ScopedLock>
+#elif USE_BOOST
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#endif
+
+#include "TimerService.hpp"
+#include "Debug.hpp"
+#include "EpiAtomic.hpp"
+
+using namespace epi::util;
+
+// Service whose thread is this one
+static EPI_THREAD_LOCAL TimerService *tService;
+
+namespace epi {
+namespace util {
+
+/**
+ * Thread that runs the tasks of a TimerService
+ */
+class TimerServiceThread
+    #ifdef USE_OPEN_THREADS
+    : public OpenThreads::Thread
+    #endif
+{
+public:
+    /**
+     * The thread will start with creation of the object.
+     */
+    TimerServiceThread(TimerService *service):
+            mService(service)
+    {
+        #ifdef USE_OPEN_THREADS
+        start();
+        #elif USE_BOOST
+        m_thread = boost::shared_ptr<boost::thread>(
+            new boost::thread(boost::bind(&TimerServiceThread::run, this))
+        );
+        #endif
+    }
+
+    /**
+     * Wait for the thread
+     */
+    ~TimerServiceThread() {
+        #ifdef USE_OPEN_THREADS
+        if (this->isRunning()) {
+            this->join();
+        }
+        #elif USE_BOOST
+        m_thread->join();
+        #endif
+    }
+
+    void run() {
+        #ifdef CWDEBUG
+        epi::debug::setThreadDebugMargin();
+        #endif
+        mService->run();
+    }
+
+private:
+    TimerService *mService;
+    #ifdef USE_BOOST
+    boost::shared_ptr<boost::thread> m_thread;
+    #endif
+};
+
+} // util
+} // epi
+
+TimerService::TimerService():
+        mExpired(0), mExpiredTail(0), mCurrent(currentTime()), mCount(0),
+        mWakeUp(-1), mRunning(0), mStop(false), mThread(0)
+{
+    for (int level = 0; level < LEVELS; level++) {
+        for (int index = 0; index < SLOTS; index++) {
+            mSlots[level][index] = 0;
+        }
+    }
+}
+
+TimerService::~TimerService() {
+    _timerMutex.lock();
+    mStop = true;
+    #ifdef USE_OPEN_THREADS
+    _timerCondition.signal();
+    #elif USE_BOOST
+    _timerCondition.notify_one();
+    #endif
+    _timerMutex.unlock();
+    delete mThread;
+}
+
+long long TimerService::currentTime() {
+    #ifdef _WIN32
+    return GetTickCount64();
+    #else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    #endif
+}
+
+void TimerService::insert(TimerTask *task) {
+    long long expiry = task->mExpiry;
+    if (expiry < mCurrent) {
+        expiry = mCurrent;
+    }
+    long long delta = expiry - mCurrent;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1LL << (SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    long long limit = (1LL << (SLOT_BITS * LEVELS)) - 1;
+    if (delta > limit) {
+        // Cascaded again when its slot comes
+        expiry = mCurrent + limit;
+    }
+    int index = (int) ((expiry >> (SLOT_BITS * level)) & (SLOTS - 1));
+
+    TimerTask **list = &mSlots[level][index];
+    task->mList = list;
+    task->mPrev = 0;
+    task->mNext = *list;
+    if (*list) {
+        (*list)->mPrev = task;
+    }
+    *list = task;
+}
+
+void TimerService::unlink(TimerTask *task) {
+    if (task == mExpiredTail) {
+        mExpiredTail = task->mPrev;
+    }
+    if (task->mPrev) {
+        task->mPrev->mNext = task->mNext;
+    } else {
+        *task->mList = task->mNext;
+    }
+    if (task->mNext) {
+        task->mNext->mPrev = task->mPrev;
+    }
+    task->mList = 0;
+    task->mNext = 0;
+    task->mPrev = 0;
+}
+
+void TimerService::cascade(int level, int index) {
+    TimerTask *task = mSlots[level][index];
+    mSlots[level][index] = 0;
+    while (task) {
+        TimerTask *next = task->mNext;
+        insert(task);
+        task = next;
+    }
+}
+
+void TimerService::advance() {
+    int index = (int) (mCurrent & (SLOTS - 1));
+    for (int level = 1; level < LEVELS && index == 0; level++) {
+        index = (int) ((mCurrent >> (SLOT_BITS * level)) & (SLOTS - 1));
+        cascade(level, index);
+    }
+
+    TimerTask **slot = &mSlots[0][mCurrent & (SLOTS - 1)];
+    while (*slot) {
+        TimerTask *task = *slot;
+        unlink(task);
+        task->mList = &mExpired;
+        task->mPrev = mExpiredTail;
+        if (mExpiredTail) {
+            mExpiredTail->mNext = task;
+        } else {
+            mExpired = task;
+        }
+        mExpiredTail = task;
+    }
+    mCurrent++;
+}
+
+long long TimerService::nextExpiry() {
+    if (mCount == 0) {
+        return -1;
+    }
+    // Up to the next cascade, which can bring tasks to level 0
+    long long tick = mCurrent;
+    while ((tick & (SLOTS - 1)) != 0 && mSlots[0][tick & (SLOTS - 1)] == 0) {
+        tick++;
+    }
+    return tick;
+}
+
+void TimerService::add(TimerTask *task, long long deadline) {
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_timerMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(_timerMutex);
+    #endif
+    if (mThread == 0) {
+        mThread = new TimerServiceThread(this);
+    }
+    if (task->mList) {
+        unlink(task);
+    } else {
+        if (mCount == 0) {
+            // The wheel is empty, skip the ticks of the idle period
+            long long now = currentTime();
+            if (now > mCurrent) {
+                mCurrent = now;
+            }
+        }
+        mCount++;
+    }
+    task->mExpiry = deadline;
+    insert(task);
+
+    if (mWakeUp < 0 || deadline < mWakeUp) {
+        #ifdef USE_OPEN_THREADS
+        _timerCondition.signal();
+        #elif USE_BOOST
+        _timerCondition.notify_one();
+        #endif
+    }
+}
+
+bool TimerService::cancel(TimerTask *task) {
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_timerMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(_timerMutex);
+    #endif
+    if (task->mList) {
+        unlink(task);
+        mCount--;
+        return true;
+    }
+
+    // The task can be deleted when this returns
+    if (tService != this) {
+        while (mRunning == task) {
+            #ifdef USE_OPEN_THREADS
+            _runningCondition.wait(&_timerMutex);
+            #elif USE_BOOST
+            _runningCondition.wait(_timerMutex);
+            #endif
+        }
+    }
+    return false;
+}
+
+int TimerService::count() {
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_timerMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(_timerMutex);
+    #endif
+    return mCount;
+}
+
+void TimerService::run() {
+    tService = this;
+    _timerMutex.lock();
+    while (!mStop) {
+        long long now = currentTime();
+        while (mCurrent <= now) {
+            // Empty ticks before the next cascade need no work
+            long long next = nextExpiry();
+            if (next < 0 || next > now) {
+                mCurrent = now + 1;
+                break;
+            }
+            mCurrent = next;
+            advance();
+        }
+
+        if (mExpired) {
+            TimerTask *task = mExpired;
+            unlink(task);
+            mCount--;
+
+            mRunning = task;
+            _timerMutex.unlock();
+            task->expired();
+            _timerMutex.lock();
+            mRunning = 0;
+            #ifdef USE_OPEN_THREADS
+            _runningCondition.broadcast();
+            #elif USE_BOOST
+            _runningCondition.notify_all();
+            #endif
+            continue;
+        }
+
+        mWakeUp = nextExpiry();
+        if (mWakeUp < 0) {
+            #ifdef USE_OPEN_THREADS
+            _timerCondition.wait(&_timerMutex);
+            #elif USE_BOOST
+            _timerCondition.wait(_timerMutex);
+            #endif
+        } else {
+            #ifdef USE_OPEN_THREADS
+            _timerCondition.wait(&_timerMutex, (unsigned long) (mWakeUp - now));
+            #elif USE_BOOST
+            _timerCondition.timed_wait(_timerMutex,
+                    boost::posix_time::milliseconds(mWakeUp - now));
+            #endif
+        }
+        mWakeUp = -1;
+    }
+    _timerMutex.unlock();
+}
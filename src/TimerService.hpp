@@ -0,0 +1,181 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#ifndef __TIMERSERVICE_HPP
+#define __TIMERSERVICE_HPP
+
+#include "Config.hpp"
+
+#ifdef USE_OPEN_THREADS
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+#elif USE_BOOST
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+#endif
+
+namespace epi {
+namespace util {
+
+class TimerService;
+class TimerServiceThread;
+
+/**
+ * Task run by a TimerService when its deadline expires
+ */
+class TimerTask {
+    friend class TimerService;
+public:
+    inline TimerTask(): mNext(0), mPrev(0), mList(0), mExpiry(0) {}
+
+    virtual ~TimerTask() {}
+
+    /**
+     * Called from the timer thread. Other timers wait while it runs,
+     * so keep it short.
+     */
+    virtual void expired() = 0;
+
+private:
+    // Links in a slot of the wheel or in the expired list
+    TimerTask *mNext;
+    TimerTask *mPrev;
+    // Head of the list with the task, 0 if it is not pending
+    TimerTask **mList;
+    long long mExpiry;
+};
+
+/**
+ * Runs TimerTasks at their deadlines from a single thread.
+ * The thread is started with the first timer.
+ *
+ * Timers are kept in a hierarchical timing wheel with a tick of one
+ * millisecond, so adding and cancelling them is O(1). Deadlines use
+ * a monotonic clock, they are not affected by changes of the system
+ * time.
+ */
+class TimerService {
+    friend class TimerServiceThread;
+public:
+    TimerService();
+
+    /**
+     * Stop the thread. Pending timers are dropped.
+     */
+    ~TimerService();
+
+    /**
+     * Run the task at the deadline. If the task is pending, it is
+     * moved to the new deadline.
+     * @param task task to run. Ownership is not transfered
+     * @param deadline time in milliseconds, as returned by currentTime()
+     */
+    void add(TimerTask *task, long long deadline);
+
+    /**
+     * Cancel a task. If the task is running, wait for it
+     * (unless it is called from the task itself).
+     * @return true if the task was cancelled before running
+     */
+    bool cancel(TimerTask *task);
+
+    /**
+     * Get the number of pending tasks
+     */
+    int count();
+
+    /**
+     * Milliseconds from a monotonic clock
+     */
+    static long long currentTime();
+
+private:
+    enum {
+        LEVELS = 4,
+        SLOT_BITS = 8,
+        SLOTS = 1 << SLOT_BITS
+    };
+
+    /*
+     * Put the task in the slot for its expiry
+     */
+    void insert(TimerTask *task);
+
+    /*
+     * Remove the task from its list
+     */
+    void unlink(TimerTask *task);
+
+    /*
+     * Move the tasks of a slot to their slots in the lower levels
+     */
+    void cascade(int level, int index);
+
+    /*
+     * Move the tasks of the current tick to the expired list,
+     * and go to the next tick
+     */
+    void advance();
+
+    /*
+     * Tick when the next task could expire, -1 if there are no tasks.
+     * It is at most the next cascade.
+     */
+    long long nextExpiry();
+
+    /*
+     * Main loop of the timer thread
+     */
+    void run();
+
+    TimerTask *mSlots[LEVELS][SLOTS];
+    // Tasks of past ticks waiting to run, oldest first
+    TimerTask *mExpired;
+    TimerTask *mExpiredTail;
+    // Next tick to process
+    long long mCurrent;
+    // Pending tasks
+    int mCount;
+    // Tick the thread waits for, to wake it up for earlier tasks
+    long long mWakeUp;
+
+    TimerTask *mRunning;
+    bool mStop;
+    TimerServiceThread *mThread;
+
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::Mutex _timerMutex;
+    OpenThreads::Condition _timerCondition;
+    OpenThreads::Condition _runningCondition;
+    #elif USE_BOOST
+    boost::mutex _timerMutex;
+    boost::condition _timerCondition;
+    boost::condition _runningCondition;
+    #endif
+};
+
+} // namespace util
+} // namespace epi
+
+#endif // __TIMERSERVICE_HPP
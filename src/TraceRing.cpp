@@ -0,0 +1,357 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <set>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#ifdef USE_OPEN_THREADS
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+#elif USE_BOOST
+#include <boost/thread/mutex.hpp>
+#endif
+
+#include "TraceRing.hpp"
+#include "LatencyHistogram.hpp"
+#include "NodeNames.hpp"
+
+using namespace epi::util;
+using namespace epi::type;
+
+namespace epi {
+namespace util {
+
+/*
+ * Ring of events of a thread. Only its thread writes the events and
+ * next, other threads read them to dump.
+ */
+struct TraceBuffer {
+    TraceEvent *events;
+    // A power of two
+    unsigned size;
+    unsigned thread;
+    // Events written
+    long volatile next;
+    // Events dropped by Trace::clear()
+    long volatile start;
+    // 1 once the thread has exited, so the ring can be reused
+    long volatile free;
+};
+
+} // util
+} // epi
+
+/** Pids keep the index of the node name from this bit */
+static const int PID_NODE_SHIFT = 33;
+
+static std::vector<TraceBuffer *> buffers;
+static unsigned bufferSize = 4096;
+static unsigned nextThread = 0;
+#ifdef USE_OPEN_THREADS
+static OpenThreads::Mutex buffersMutex;
+#elif USE_BOOST
+static boost::mutex buffersMutex;
+#endif
+
+static EPI_THREAD_LOCAL TraceBuffer *threadBuffer = 0;
+
+#ifndef _WIN32
+static pthread_key_t exitKey;
+static bool exitKeyCreated = false;
+
+static void threadExit(void *buffer) {
+    atomicStore(&((TraceBuffer *) buffer)->free, 1L);
+}
+#endif
+
+/*
+ * Get a ring for the calling thread, reusing the ring of an
+ * exited thread if there is one
+ */
+static TraceBuffer *attach() {
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(buffersMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(buffersMutex);
+    #endif
+    TraceBuffer *buffer = 0;
+    for (std::vector<TraceBuffer *>::const_iterator p = buffers.begin();
+         p != buffers.end(); ++p)
+    {
+        if ((*p)->size == bufferSize && atomicLoad(&(*p)->free) == 1) {
+            buffer = *p;
+            atomicStore(&buffer->free, 0L);
+            break;
+        }
+    }
+    if (buffer == 0) {
+        buffer = new TraceBuffer();
+        buffer->events = new TraceEvent[bufferSize];
+        buffer->size = bufferSize;
+        buffer->next = 0;
+        buffer->start = 0;
+        buffer->free = 0;
+        buffers.push_back(buffer);
+    }
+    buffer->thread = nextThread++;
+    #ifndef _WIN32
+    if (!exitKeyCreated) {
+        exitKeyCreated = pthread_key_create(&exitKey, threadExit) == 0;
+    }
+    if (exitKeyCreated) {
+        pthread_setspecific(exitKey, buffer);
+    }
+    #endif
+    threadBuffer = buffer;
+    return buffer;
+}
+
+static bool earlier(const TraceEvent &a, const TraceEvent &b) {
+    return a.time < b.time;
+}
+
+/*
+ * Enable the categories of EPI_TRACE at startup
+ */
+static struct TraceInit {
+    TraceInit() {
+        const char *env = getenv("EPI_TRACE");
+        if (env) {
+            Trace::enable(Trace::parseCategories(env));
+        }
+    }
+} traceInit;
+
+long volatile Trace::sCategories = 0;
+
+void Trace::enable(unsigned categories) {
+    long old;
+    do {
+        old = atomicLoad(&sCategories);
+    } while (!atomicCompareAndSwap(&sCategories, old, old | (long) categories));
+}
+
+void Trace::disable(unsigned categories) {
+    long old;
+    do {
+        old = atomicLoad(&sCategories);
+    } while (!atomicCompareAndSwap(&sCategories, old, old & ~(long) categories));
+}
+
+unsigned Trace::categories() {
+    return (unsigned) atomicLoad(&sCategories);
+}
+
+unsigned Trace::parseCategories(const std::string &names) {
+    unsigned categories = 0;
+    std::string::size_type begin = 0;
+    while (begin <= names.size()) {
+        std::string::size_type end = names.find(',', begin);
+        if (end == std::string::npos) {
+            end = names.size();
+        }
+        std::string name = names.substr(begin, end - begin);
+        if (name == "in") {
+            categories |= TRACE_MESSAGE_IN;
+        } else if (name == "out") {
+            categories |= TRACE_MESSAGE_OUT;
+        } else if (name == "codec") {
+            categories |= TRACE_CODEC;
+        } else if (name == "mailbox") {
+            categories |= TRACE_MAILBOX;
+        } else if (name == "all") {
+            categories |= TRACE_ALL;
+        }
+        begin = end + 1;
+    }
+    return categories;
+}
+
+void Trace::setBufferSize(unsigned events) {
+    unsigned size = 16;
+    while (size < events && size < (1u << 30)) {
+        size <<= 1;
+    }
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(buffersMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(buffersMutex);
+    #endif
+    bufferSize = size;
+}
+
+void Trace::record(TraceEventType type, long long duration, unsigned size,
+                   unsigned long long from, unsigned long long to,
+                   unsigned arg)
+{
+    TraceBuffer *buffer = threadBuffer;
+    if (buffer == 0) {
+        buffer = attach();
+    }
+    long n = buffer->next;
+    TraceEvent &event = buffer->events[n & (buffer->size - 1)];
+    event.time = LatencyHistogram::now();
+    event.duration = duration;
+    event.from = from;
+    event.to = to;
+    event.size = size;
+    event.seq = (unsigned) n;
+    event.thread = buffer->thread;
+    event.type = (unsigned short) type;
+    event.arg = (unsigned short) arg;
+    // Publish it
+    atomicStore(&buffer->next, n + 1);
+}
+
+int Trace::dump(const std::string &file) {
+    std::vector<TraceEvent> events;
+    {
+        #ifdef USE_OPEN_THREADS
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(buffersMutex);
+        #elif USE_BOOST
+        boost::mutex::scoped_lock lock(buffersMutex);
+        #endif
+        for (std::vector<TraceBuffer *>::const_iterator p = buffers.begin();
+             p != buffers.end(); ++p)
+        {
+            TraceBuffer *buffer = *p;
+            long end = atomicLoad(&buffer->next);
+            long begin = std::max(end - (long) buffer->size,
+                                  atomicLoad(&buffer->start));
+            std::vector<TraceEvent> copy;
+            for (long i = begin; i < end; i++) {
+                copy.push_back(buffer->events[i & (buffer->size - 1)]);
+            }
+            // A full barrier, then drop the events overwritten while
+            // copying, and the one being written
+            long last = atomicFetchAdd(&buffer->next, 0);
+            long valid = last - (long) buffer->size + 1;
+            for (long i = begin; i < end; i++) {
+                if (i >= valid) {
+                    events.push_back(copy[i - begin]);
+                }
+            }
+        }
+    }
+    std::stable_sort(events.begin(), events.end(), earlier);
+
+    std::set<unsigned> nodes;
+    for (std::vector<TraceEvent>::const_iterator p = events.begin();
+         p != events.end(); ++p)
+    {
+        if (p->from) {
+            nodes.insert((unsigned) (p->from >> PID_NODE_SHIFT));
+        }
+        if (p->to) {
+            nodes.insert((unsigned) (p->to >> PID_NODE_SHIFT));
+        }
+    }
+
+    std::ofstream out(file.c_str(), std::ios::out | std::ios::binary);
+    if (!out) {
+        return -1;
+    }
+    TraceFileHeader header;
+    memcpy(header.magic, "EPITRACE", 8);
+    header.version = 1;
+    header.eventSize = sizeof(TraceEvent);
+    header.names = nodes.size();
+    header.events = events.size();
+    out.write((const char *) &header, sizeof(header));
+    for (std::set<unsigned>::const_iterator p = nodes.begin();
+         p != nodes.end(); ++p)
+    {
+        // The pids of the events can be gone, with their node name
+        std::string name = NodeNames::lookup(*p);
+        unsigned entry[2];
+        entry[0] = *p;
+        entry[1] = name.size();
+        out.write((const char *) entry, sizeof(entry));
+        out.write(name.data(), name.size());
+    }
+    if (!events.empty()) {
+        out.write((const char *) &events[0], events.size() * sizeof(TraceEvent));
+    }
+    out.close();
+    return out ? (int) events.size() : -1;
+}
+
+void Trace::clear() {
+    #ifdef USE_OPEN_THREADS
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(buffersMutex);
+    #elif USE_BOOST
+    boost::mutex::scoped_lock lock(buffersMutex);
+    #endif
+    for (std::vector<TraceBuffer *>::const_iterator p = buffers.begin();
+         p != buffers.end(); ++p)
+    {
+        atomicStore(&(*p)->start, atomicLoad(&(*p)->next));
+    }
+}
+
+const char *Trace::eventName(unsigned type) {
+    switch (type) {
+    case TRACE_FRAME_IN:
+        return "frame_in";
+    case TRACE_FRAME_OUT:
+        return "frame_out";
+    case TRACE_DECODE:
+        return "decode";
+    case TRACE_ENCODE:
+        return "encode";
+    case TRACE_DELIVER:
+        return "deliver";
+    case TRACE_RECEIVE:
+        return "receive";
+    default:
+        return "unknown";
+    }
+}
+
+unsigned Trace::category(unsigned type) {
+    switch (type) {
+    case TRACE_FRAME_IN:
+        return TRACE_MESSAGE_IN;
+    case TRACE_FRAME_OUT:
+        return TRACE_MESSAGE_OUT;
+    case TRACE_DECODE:
+    case TRACE_ENCODE:
+        return TRACE_CODEC;
+    case TRACE_DELIVER:
+    case TRACE_RECEIVE:
+        return TRACE_MAILBOX;
+    default:
+        return 0;
+    }
+}
@@ -0,0 +1,198 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#ifndef __TRACERING_HPP
+#define __TRACERING_HPP
+
+#include <string>
+
+#include "EpiAtomic.hpp"
+
+namespace epi {
+namespace util {
+
+/**
+ * Categories of trace events, to enable them separately
+ */
+enum TraceCategory {
+    /** Frames read from connections */
+    TRACE_MESSAGE_IN = 1,
+    /** Frames written to connections */
+    TRACE_MESSAGE_OUT = 2,
+    /** Decoding and encoding of terms */
+    TRACE_CODEC = 4,
+    /** Messages put in and taken from mailboxes */
+    TRACE_MAILBOX = 8,
+    TRACE_ALL = 15
+};
+
+/**
+ * Types of trace events
+ */
+enum TraceEventType {
+    /** A frame read from a connection, timed until it is handed over */
+    TRACE_FRAME_IN = 1,
+    /** A frame written to a connection */
+    TRACE_FRAME_OUT,
+    /** The term of an incoming message decoded */
+    TRACE_DECODE,
+    /** The terms of an outgoing message encoded for a connection */
+    TRACE_ENCODE,
+    /** A message put in a mailbox */
+    TRACE_DELIVER,
+    /** A message taken from a mailbox */
+    TRACE_RECEIVE
+};
+
+/**
+ * An event of the trace. All the events have the same size, and
+ * pids are stored as the keys of ErlPid, so nothing is formatted
+ * while tracing.
+ */
+struct TraceEvent {
+    /** Time in nanoseconds, as returned by LatencyHistogram::now() */
+    long long time;
+    /** Duration in nanoseconds, 0 if the event is not timed */
+    long long duration;
+    /** ErlPid::key() of the sender, 0 if unknown */
+    unsigned long long from;
+    /** ErlPid::key() of the recipient, 0 if unknown */
+    unsigned long long to;
+    /** Size in bytes, 0 if unknown */
+    unsigned size;
+    /** Position of the event in the trace of its thread */
+    unsigned seq;
+    /** Number of the thread, given in the order threads trace */
+    unsigned thread;
+    /** TraceEventType */
+    unsigned short type;
+    /** Data of the event type, like the type of the message */
+    unsigned short arg;
+};
+
+/**
+ * Header of a trace file written by Trace::dump(). It is followed by
+ * the node names used by the pids of the events, each one as its
+ * index and its length (two unsigned) and the characters, and then by
+ * the events ordered by time. Integers are in the byte order of the
+ * machine that wrote the file.
+ */
+struct TraceFileHeader {
+    /** "EPITRACE" */
+    char magic[8];
+    unsigned version;
+    /** sizeof(TraceEvent) */
+    unsigned eventSize;
+    unsigned names;
+    unsigned events;
+};
+
+/**
+ * Binary trace of the library, to follow the messages of a running
+ * node.
+ *
+ * Each thread writes its events in its own ring, without locks, and
+ * the oldest events are overwritten when it is full. Tracing can be
+ * enabled and disabled at any time, by category. While a category is
+ * disabled its events cost a load and a branch. The categories in the
+ * environment variable EPI_TRACE (names separated by commas, see
+ * parseCategories()) are enabled at startup.
+ */
+class Trace {
+public:
+    /**
+     * Check if any of the categories is enabled
+     */
+    static inline bool enabled(unsigned categories) {
+        return (atomicLoad(&sCategories) & (long) categories) != 0;
+    }
+
+    /**
+     * Enable the categories, in addition to those already enabled
+     */
+    static void enable(unsigned categories);
+
+    /**
+     * Disable the categories
+     */
+    static void disable(unsigned categories);
+
+    /**
+     * Get the enabled categories
+     */
+    static unsigned categories();
+
+    /**
+     * Get the categories in a list of names separated by commas:
+     * "in", "out", "codec", "mailbox" or "all".
+     * Unknown names are ignored.
+     */
+    static unsigned parseCategories(const std::string &names);
+
+    /**
+     * Set the number of events kept per thread, rounded up to a power
+     * of two. It applies to the threads that start tracing after the
+     * call. The default is 4096.
+     */
+    static void setBufferSize(unsigned events);
+
+    /**
+     * Add an event to the ring of the calling thread. The caller
+     * checks the category with enabled() first.
+     */
+    static void record(TraceEventType type, long long duration,
+                       unsigned size, unsigned long long from,
+                       unsigned long long to, unsigned arg = 0);
+
+    /**
+     * Write the events of all threads to a file. Events written while
+     * the dump runs may be missing.
+     * @return the number of events written, -1 if the file could not
+     *  be written
+     */
+    static int dump(const std::string &file);
+
+    /**
+     * Drop the events of all threads
+     */
+    static void clear();
+
+    /**
+     * Get the name of an event type, like "frame_in"
+     */
+    static const char *eventName(unsigned type);
+
+    /**
+     * Get the category of an event type
+     */
+    static unsigned category(unsigned type);
+
+private:
+    static long volatile sCategories;
+};
+
+} // namespace util
+} // namespace epi
+
+#endif // __TRACERING_HPP
@@ -172,6 +172,15 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "MatchingCommandGuard.hpp"
 #include "MatchingCommand.hpp"
 #include "ComposedGuard.hpp"
+#include "TimerService.hpp"
+#include "MailBoxExecutor.hpp"
+#include "ProcessScheduler.hpp"
+#include "DecodePool.hpp"
+#include "LatencyHistogram.hpp"
+#include "TraceRing.hpp"
+#include "StatsServer.hpp"
+#include "FrameCapture.hpp"
+#include "ReplayConnection.hpp"
 
 #endif // _EPI_HPP
 
@@ -0,0 +1,63 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+/*
+ * Replacement of the global operator new and delete that counts the
+ * allocations, for ei_performance. It is kept in its own file so the
+ * compiler does not see malloc and free behind new and delete.
+ */
+
+#include "Config.hpp" // Main config file
+
+#include <new>
+#include <cstdlib>
+
+// Number of calls to operator new
+unsigned long long gAllocations = 0;
+
+void *operator new(size_t size) throw (std::bad_alloc) {
+    gAllocations++;
+    void *p = malloc(size? size: 1);
+    if (p == 0) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size) throw (std::bad_alloc) {
+    gAllocations++;
+    void *p = malloc(size? size: 1);
+    if (p == 0) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) throw () {
+    free(p);
+}
+
+void operator delete[](void *p) throw () {
+    free(p);
+}
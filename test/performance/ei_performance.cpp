@@ -0,0 +1,412 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp" // Main config file
+
+#include <epi.hpp>
+#include "EIOutputBuffer.hpp"
+#include "EIInputBuffer.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+using namespace epi::error;
+using namespace epi::type;
+using namespace epi::node;
+using namespace epi::ei;
+
+/*
+ * Codec and term benchmarks. For each benchmark it prints a line with:
+ *   name iterations ns/op bytes/s allocs/op
+ * separated by tabs, after a header line starting with '#'.
+ * allocs/op counts the calls to operator new, not the malloc calls
+ * of the ei library.
+ *
+ * Usage: ei_performance [-t milliseconds] [filter...]
+ * Only the benchmarks whose name contains one of the filters are run.
+ */
+
+// Number of calls to operator new, counted in alloc_count.cpp
+extern unsigned long long gAllocations;
+
+// Monotonic time in nanoseconds
+static long long now() {
+    #ifdef _WIN32
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (long long) ((double) count.QuadPart * 1e9 / frequency.QuadPart);
+    #else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    #endif
+}
+
+/**
+ * A benchmark runs an operation many times. bytes() is the amount
+ * of data handled by each run, 0 if it does not apply.
+ */
+class Benchmark {
+public:
+    Benchmark(const std::string &name): mName(name) {}
+    virtual ~Benchmark() {}
+    virtual void run() = 0;
+    virtual long bytes() { return 0; }
+    const std::string &name() const { return mName; }
+private:
+    std::string mName;
+};
+
+// Output buffer that tells the size of the encoded data
+class SizedOutputBuffer: public EIOutputBuffer {
+public:
+    long size() { return getBuffer()->index; }
+};
+
+// Encode a term in a reused buffer
+class EncodeBenchmark: public Benchmark {
+public:
+    EncodeBenchmark(const std::string &name, ErlTerm *term):
+            Benchmark("encode_" + name), mTerm(term)
+    {
+        mBuffer.writeTerm(mTerm.get());
+        mBytes = mBuffer.size();
+    }
+    void run() {
+        mBuffer.reset();
+        mBuffer.writeTerm(mTerm.get());
+    }
+    long bytes() { return mBytes; }
+private:
+    ErlTermPtr<ErlTerm> mTerm;
+    SizedOutputBuffer mBuffer;
+    long mBytes;
+};
+
+// Encode an rpc request, with the arguments inside, each run
+class RequestBenchmark: public Benchmark {
+public:
+    RequestBenchmark(const std::string &name, ErlTerm *args):
+            Benchmark("encode_request_" + name), mArgs(args)
+    {
+        run();
+        mBytes = mBuffer.size();
+    }
+    void run() {
+        ErlTerm* inner_terms[] = {
+            new ErlAtom("call"),
+            new ErlAtom("module"),
+            new ErlAtom("function"),
+            mArgs.get(),
+            new ErlAtom("user")
+        };
+        ErlTermPtr<ErlTerm> request(new ErlTuple(inner_terms, 5));
+        mBuffer.reset();
+        mBuffer.writeTerm(request.get());
+    }
+    long bytes() { return mBytes; }
+private:
+    ErlTermPtr<ErlTerm> mArgs;
+    SizedOutputBuffer mBuffer;
+    long mBytes;
+};
+
+// Decode a term from an encoded buffer
+class DecodeBenchmark: public Benchmark {
+public:
+    DecodeBenchmark(const std::string &name, ErlTerm *term):
+            Benchmark("decode_" + name)
+    {
+        ErlTermPtr<ErlTerm> t(term);
+        SizedOutputBuffer buffer;
+        buffer.writeTerm(t.get());
+        mBytes = buffer.size();
+        mInput.reset(buffer.getInputBuffer());
+    }
+    void run() {
+        ErlTermPtr<ErlTerm> t(mInput->readTerm());
+        mInput->resetIndex();
+    }
+    long bytes() { return mBytes; }
+private:
+    std::auto_ptr<InputBuffer> mInput;
+    long mBytes;
+};
+
+// Match a term with a pattern with variables
+class MatchBenchmark: public Benchmark {
+public:
+    MatchBenchmark(const std::string &name, ErlTerm *term, ErlTerm *pattern):
+            Benchmark("match_" + name), mTerm(term), mPattern(pattern) {}
+    void run() {
+        VariableBinding binding;
+        if (!mTerm->match(mPattern.get(), &binding)) {
+            throw EpiException("Benchmark term does not match");
+        }
+    }
+private:
+    ErlTermPtr<ErlTerm> mTerm;
+    ErlTermPtr<ErlTerm> mPattern;
+};
+
+// Substitute the variables of a pattern
+class SubstBenchmark: public Benchmark {
+public:
+    SubstBenchmark(const std::string &name, ErlTerm *term, ErlTerm *pattern,
+                   ErlTerm *result):
+            Benchmark("subst_" + name), mResult(result)
+    {
+        ErlTermPtr<ErlTerm> t(term);
+        if (!t->match(pattern, &mBinding)) {
+            throw EpiException("Benchmark term does not match");
+        }
+    }
+    void run() {
+        ErlTermPtr<ErlTerm> t(mResult->subst(&mBinding));
+    }
+private:
+    VariableBinding mBinding;
+    ErlTermPtr<ErlTerm> mResult;
+};
+
+// Get the string representation of a term
+class ToStringBenchmark: public Benchmark {
+public:
+    ToStringBenchmark(const std::string &name, ErlTerm *term):
+            Benchmark("tostring_" + name), mTerm(term)
+    {
+        mBytes = mTerm->toString().size();
+    }
+    void run() {
+        std::string s = mTerm->toString();
+    }
+    long bytes() { return mBytes; }
+private:
+    ErlTermPtr<ErlTerm> mTerm;
+    long mBytes;
+};
+
+// Parse a term with ErlTerm::format
+class FormatBenchmark: public Benchmark {
+public:
+    FormatBenchmark(const std::string &name, const char *format):
+            Benchmark("format_" + name), mFormat(format) {}
+    void run() {
+        ErlTermPtr<ErlTerm> t(ErlTerm::format(mFormat));
+    }
+    long bytes() { return strlen(mFormat); }
+private:
+    const char *mFormat;
+};
+
+// Format with arguments, like a typical request
+class FormatArgsBenchmark: public Benchmark {
+public:
+    FormatArgsBenchmark(): Benchmark("format_args") {}
+    void run() {
+        ErlTermPtr<ErlTerm> t(ErlTerm::format("{request, ~i, ~a, [{name, ~s}]}",
+                                              42, "get", "value"));
+    }
+};
+
+/*
+ * Term shapes
+ */
+static ErlTerm *smallTuple() {
+    return ErlTerm::format("{request, 1234, get, \"key\"}");
+}
+
+static ErlTerm *deepTuple() {
+    ErlTerm *term = new ErlAtom("leaf");
+    for (int i = 0; i < 64; i++) {
+        term = new ErlTuple(new ErlAtom("node"), new ErlLong(i), term);
+    }
+    return term;
+}
+
+static ErlTerm *longList() {
+    ErlConsList *list = new ErlConsList(1000);
+    for (int i = 0; i < 1000; i++) {
+        list->addElement(new ErlLong(i * 1000));
+    }
+    list->close();
+    return list;
+}
+
+static ErlTerm *largeBinary() {
+    std::vector<char> data(1024 * 1024);
+    for (unsigned i = 0; i < data.size(); i++) {
+        data[i] = (char) i;
+    }
+    return new ErlBinary(&data[0], data.size());
+}
+
+static ErlTerm *longString() {
+    return new ErlString(std::string(200, 'x'));
+}
+
+static ErlTerm *pidsAndRefs() {
+    unsigned int ids[] = {1, 2, 3};
+    ErlTuple *tuple = new ErlTuple(4);
+    tuple->initElement(new ErlPid("perf@localhost", 1, 2, 3));
+    tuple->initElement(new ErlRef("perf@localhost", ids, 1));
+    tuple->initElement(new ErlPid("other@localhost", 40, 0, 1));
+    tuple->initElement(new ErlRef("other@localhost", ids, 2));
+    return tuple;
+}
+
+static ErlTerm *record() {
+    return ErlTerm::format("[{name, \"Mary\"}, {age, 33}, {pets, [cat, dog]}, "
+                           "{address, {\"E-street\", 42, 3.5}}]");
+}
+
+static const char *RECORD_FORMAT = "[{name, \"Mary\"}, {age, 33}, "
+        "{pets, [cat, dog]}, {address, {\"E-street\", 42, 3.5}}]";
+
+static std::vector<Benchmark *> createBenchmarks() {
+    std::vector<Benchmark *> benchmarks;
+
+    const char *names[] = {"small_tuple", "deep_tuple", "long_list",
+                           "large_binary", "string", "pids_refs", "record"};
+    ErlTerm *(*shapes[])() = {smallTuple, deepTuple, longList,
+                              largeBinary, longString, pidsAndRefs, record};
+    for (unsigned i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+        benchmarks.push_back(new EncodeBenchmark(names[i], shapes[i]()));
+        benchmarks.push_back(new EncodeBenchmark(std::string("frozen_") + names[i],
+                                                 FreezeTerm(shapes[i]())));
+        benchmarks.push_back(new DecodeBenchmark(names[i], shapes[i]()));
+    }
+    benchmarks.push_back(new RequestBenchmark("record", record()));
+    benchmarks.push_back(new RequestBenchmark("frozen_record",
+                                              FreezeTerm(record())));
+
+    benchmarks.push_back(new MatchBenchmark("small_tuple", smallTuple(),
+            ErlTerm::format("{request, Id, Op, Key}")));
+    benchmarks.push_back(new MatchBenchmark("record", record(),
+            ErlTerm::format("[{name, Name}, {age, Age}, {pets, [First, _]}, "
+                            "{address, {Street, _, _}}]")));
+    benchmarks.push_back(new SubstBenchmark("small_tuple", smallTuple(),
+            ErlTerm::format("{request, Id, Op, Key}"),
+            ErlTerm::format("{reply, Id, {Op, Key}, ok}")));
+    benchmarks.push_back(new SubstBenchmark("record", record(),
+            ErlTerm::format("[{name, Name}, {age, Age}, {pets, Pets}, "
+                            "{address, Address}]"),
+            ErlTerm::format("{person, Name, Age, Pets, Address}")));
+    benchmarks.push_back(new ToStringBenchmark("small_tuple", smallTuple()));
+    benchmarks.push_back(new ToStringBenchmark("record", record()));
+    benchmarks.push_back(new ToStringBenchmark("long_list", longList()));
+    benchmarks.push_back(new FormatBenchmark("small_tuple",
+            "{request, 1234, get, \"key\"}"));
+    benchmarks.push_back(new FormatBenchmark("record", RECORD_FORMAT));
+    benchmarks.push_back(new FormatArgsBenchmark());
+
+    return benchmarks;
+}
+
+static bool selected(const std::string &name,
+                     const std::vector<std::string> &filters)
+{
+    if (filters.empty()) {
+        return true;
+    }
+    for (unsigned i = 0; i < filters.size(); i++) {
+        if (name.find(filters[i]) != std::string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char **argv) {
+    long long duration = 200 * 1000000LL;
+    std::vector<std::string> filters;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            duration = atol(argv[++i]) * 1000000LL;
+        } else {
+            filters.push_back(argv[i]);
+        }
+    }
+
+    try {
+        std::vector<Benchmark *> benchmarks = createBenchmarks();
+
+        printf("# name\titerations\tns/op\tbytes/s\tallocs/op\n");
+        for (unsigned i = 0; i < benchmarks.size(); i++) {
+            Benchmark *benchmark = benchmarks[i];
+            if (!selected(benchmark->name(), filters)) {
+                continue;
+            }
+
+            // Warm up and find the iterations for a tenth of the time
+            long iterations = 1;
+            while (true) {
+                long long start = now();
+                for (long n = 0; n < iterations; n++) {
+                    benchmark->run();
+                }
+                if (now() - start > duration / 10 || iterations > (1L << 28)) {
+                    break;
+                }
+                iterations *= 2;
+            }
+            iterations *= 10;
+
+            unsigned long long allocations = gAllocations;
+            long long start = now();
+            for (long n = 0; n < iterations; n++) {
+                benchmark->run();
+            }
+            long long elapsed = now() - start;
+            allocations = gAllocations - allocations;
+
+            double nsPerOp = (double) elapsed / iterations;
+            double bytesPerSecond = benchmark->bytes() * 1e9 / nsPerOp;
+            printf("%s\t%ld\t%.1f\t%.0f\t%.2f\n", benchmark->name().c_str(),
+                   iterations, nsPerOp, bytesPerSecond,
+                   (double) allocations / iterations);
+            fflush(stdout);
+        }
+
+        for (unsigned i = 0; i < benchmarks.size(); i++) {
+            delete benchmarks[i];
+        }
+    } catch (EpiException &e) {
+        std::cerr << "Catched exception: " << e.getMessage() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,508 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp" // Main config file
+
+#include <epi.hpp>
+#include "EIConnection.hpp"
+#include "Socket.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <netinet/tcp.h>
+#endif
+
+using namespace epi::error;
+using namespace epi::type;
+using namespace epi::node;
+using namespace epi::ei;
+
+/*
+ * End to end benchmark of two nodes in the same process. The client
+ * node drives the workloads against mailboxes of the server node, run
+ * by a MailBoxExecutor:
+ *   pingpong   round trips to an echo server
+ *   stream     one way messages to a sink, without waiting
+ *   fanout     each message to a number of sinks
+ *   selective  round trips received with a pattern, from a mailbox
+ *              with other messages queued
+ *   rpc        MailBox::RPC to a rex server
+ *
+ * For each workload it prints a line with:
+ *   name messages msgs/s p50_us p99_us p999_us
+ * separated by tabs, after a header line starting with '#'. The
+ * latency is the round trip time, or the time to the sink for one
+ * way messages.
+ *
+ * Usage: node_performance [options] [workload...]
+ *   -a node       client node (default inproc:bench_a@localhost)
+ *   -b node       server node (default inproc:bench_b@localhost)
+ *   -w wire       how the nodes are connected (default loopback):
+ *                 loopback  a pair of EIConnections on a TCP socket of
+ *                           the loopback interface. Messages go through
+ *                           the ei codec and the socket, but there is
+ *                           no epmd lookup nor handshake
+ *                 node      the transport of the nodes. inproc: nodes
+ *                           pass the terms in a PlainBuffer, without
+ *                           codec nor socket. ei: nodes connect through
+ *                           epmd, which must be running
+ *   -n messages   messages per workload (default 10000)
+ *   -s bytes      payload of stream and fanout messages (default 64)
+ *   -f sinks      sinks of fanout (default 16)
+ *   -d depth      messages queued for selective (default 1000)
+ *   -t threads    executor threads of the server node (default 2)
+ * The defaults need nothing external.
+ */
+
+// Monotonic time in nanoseconds
+static long long now() {
+    #ifdef _WIN32
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (long long) ((double) count.QuadPart * 1e9 / frequency.QuadPart);
+    #else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    #endif
+}
+
+static const long TIMEOUT = 10000;
+
+typedef std::vector<long long> sample_list;
+
+// Reply {pong, T} to {ping, From, T}
+class EchoCommand: public MatchingCommand {
+public:
+    EchoCommand(MailBox *mailbox): mMailBox(mailbox) {}
+
+    void execute(ErlTerm* term, VariableBinding *binding)
+            throw (EpiException)
+    {
+        ErlTermPtr<> reply(new ErlTuple(new ErlAtom("pong"),
+                                        binding->search("T")));
+        mMailBox->send((ErlPid *) binding->search("From"), reply.get());
+    }
+
+private:
+    MailBox *mMailBox;
+};
+
+// Reply {rex, Node} to the requests of MailBox::RPC
+class RexCommand: public MatchingCommand {
+public:
+    RexCommand(MailBox *mailbox, const std::string &node):
+            mMailBox(mailbox), mReply(new ErlTuple(new ErlAtom("rex"),
+                                                   new ErlAtom(node.c_str()))) {}
+
+    void execute(ErlTerm* term, VariableBinding *binding)
+            throw (EpiException)
+    {
+        mMailBox->send((ErlPid *) binding->search("From"), mReply.get());
+    }
+
+private:
+    MailBox *mMailBox;
+    ErlTermPtr<> mReply;
+};
+
+// Record the latency of {data, T, Payload}, and send done to the
+// client after the expected messages
+class SinkCommand: public MatchingCommand {
+public:
+    SinkCommand(MailBox *mailbox, ErlPid *client, long expected):
+            mMailBox(mailbox), mClient(client), mExpected(expected)
+    {
+        mSamples.reserve(expected);
+    }
+
+    void execute(ErlTerm* term, VariableBinding *binding)
+            throw (EpiException)
+    {
+        long long sent = ((ErlLong *) binding->search("T"))->longValue();
+        mSamples.push_back(now() - sent);
+        if ((long) mSamples.size() == mExpected) {
+            ErlTermPtr<> done(new ErlAtom("done"));
+            mMailBox->send(mClient, done.get());
+        }
+    }
+
+    sample_list mSamples;
+
+private:
+    MailBox *mMailBox;
+    ErlPid *mClient;
+    long mExpected;
+};
+
+struct Options {
+    std::string clientNode;
+    std::string serverNode;
+    std::string wire;
+    long messages;
+    int payload;
+    int sinks;
+    int depth;
+    int threads;
+};
+
+/**
+ * Mailboxes of the server node run by an executor. They are detached
+ * and deleted with the object.
+ */
+class Servers {
+public:
+    Servers(AutoNode &node, int threads): mNode(node), mExecutor(threads) {}
+
+    ~Servers() {
+        for (unsigned i = 0; i < mMailBoxes.size(); i++) {
+            mExecutor.detach(mMailBoxes[i]);
+            mNode.unRegisterMailBox(mMailBoxes[i]);
+            mNode.deattachMailBox(mMailBoxes[i]);
+            delete mMailBoxes[i];
+            delete mHandlers[i];
+        }
+    }
+
+    MailBox *create() {
+        MailBox *mailbox = mNode.createMailBox();
+        mMailBoxes.push_back(mailbox);
+        mHandlers.push_back(0);
+        return mailbox;
+    }
+
+    /*
+     * Run the command for the messages of the mailbox that match
+     * the pattern
+     */
+    void attach(MailBox *mailbox, const char *pattern,
+                MatchingCommand *command)
+    {
+        MailBoxGuard *handler = new MatchingCommandGuard(
+                ErlTerm::format(pattern), command);
+        mHandlers[mHandlers.size() - 1] = handler;
+        mExecutor.attach(mailbox, handler);
+    }
+
+private:
+    AutoNode &mNode;
+    MailBoxExecutor mExecutor;
+    std::vector<MailBox *> mMailBoxes;
+    std::vector<MailBoxGuard *> mHandlers;
+};
+
+static void report(const char *name, long messages, long long elapsed,
+                   sample_list &samples)
+{
+    std::sort(samples.begin(), samples.end());
+    double p[3] = {0.5, 0.99, 0.999};
+    double us[3] = {0, 0, 0};
+    for (int i = 0; i < 3 && !samples.empty(); i++) {
+        unsigned index = (unsigned) (p[i] * samples.size());
+        if (index >= samples.size()) {
+            index = samples.size() - 1;
+        }
+        us[i] = samples[index] / 1000.0;
+    }
+    printf("%s\t%ld\t%.0f\t%.1f\t%.1f\t%.1f\n", name, messages,
+           messages * 1e9 / elapsed, us[0], us[1], us[2]);
+    fflush(stdout);
+}
+
+/*
+ * Send pings to the echo server and wait for each pong, with the
+ * pattern if given
+ */
+static bool roundTrips(const char *name, MailBox *client, ErlPid *echo,
+                       long messages, ErlTerm *pattern)
+{
+    sample_list samples;
+    samples.reserve(messages);
+    long long start = now();
+    for (long n = 0; n < messages; n++) {
+        long long sent = now();
+        ErlTermPtr<> ping(new ErlTuple(new ErlAtom("ping"),
+                                       client->self(), new ErlLong(sent)));
+        client->send(echo, ping.get());
+        ErlTermPtr<> pong(pattern? client->receive(pattern, TIMEOUT):
+                                   client->receive(TIMEOUT));
+        if (pong.get() == 0) {
+            std::cerr << name << ": reply " << n << " lost\n";
+            return false;
+        }
+        samples.push_back(now() - sent);
+    }
+    report(name, messages, now() - start, samples);
+    return true;
+}
+
+/*
+ * Send the messages to the sinks without waiting, then wait for the
+ * done of every sink
+ */
+static bool oneWay(const char *name, AutoNode &serverNode, MailBox *client,
+                   const Options &options, int sinks)
+{
+    Servers servers(serverNode, options.threads);
+    std::vector<SinkCommand *> commands;
+    std::vector<MailBox *> mailboxes;
+    for (int i = 0; i < sinks; i++) {
+        MailBox *sink = servers.create();
+        SinkCommand *command = new SinkCommand(sink, client->self(),
+                                               options.messages);
+        servers.attach(sink, "{data, T, _}", command);
+        commands.push_back(command);
+        mailboxes.push_back(sink);
+    }
+
+    std::vector<char> data(options.payload, 'x');
+    ErlTermPtr<> payload(new ErlBinary(data.empty()? "": &data[0],
+                                       data.size()));
+    long long start = now();
+    for (long n = 0; n < options.messages; n++) {
+        ErlTermPtr<> message(new ErlTuple(new ErlAtom("data"),
+                                          new ErlLong(now()), payload.get()));
+        for (int i = 0; i < sinks; i++) {
+            client->send(mailboxes[i]->self(), message.get());
+        }
+    }
+    for (int i = 0; i < sinks; i++) {
+        ErlTermPtr<> done(client->receive(TIMEOUT));
+        if (done.get() == 0) {
+            std::cerr << name << ": sink did not get all the messages\n";
+            return false;
+        }
+    }
+    long long elapsed = now() - start;
+
+    sample_list samples;
+    for (int i = 0; i < sinks; i++) {
+        samples.insert(samples.end(), commands[i]->mSamples.begin(),
+                       commands[i]->mSamples.end());
+    }
+    report(name, options.messages * sinks, elapsed, samples);
+    return true;
+}
+
+static bool pingpong(AutoNode &clientNode, AutoNode &serverNode,
+                     MailBox *client, const Options &options)
+{
+    Servers servers(serverNode, options.threads);
+    MailBox *echo = servers.create();
+    servers.attach(echo, "{ping, From, T}", new EchoCommand(echo));
+    return roundTrips("pingpong", client, echo->self(),
+                      options.messages, 0);
+}
+
+static bool stream(AutoNode &clientNode, AutoNode &serverNode,
+                   MailBox *client, const Options &options)
+{
+    return oneWay("stream", serverNode, client, options, 1);
+}
+
+static bool fanout(AutoNode &clientNode, AutoNode &serverNode,
+                   MailBox *client, const Options &options)
+{
+    return oneWay("fanout", serverNode, client, options, options.sinks);
+}
+
+static bool selective(AutoNode &clientNode, AutoNode &serverNode,
+                      MailBox *client, const Options &options)
+{
+    Servers servers(serverNode, options.threads);
+    MailBox *echo = servers.create();
+    servers.attach(echo, "{ping, From, T}", new EchoCommand(echo));
+
+    // Messages the pattern skips, left in the mailbox of the client
+    MailBox *queued = clientNode.createMailBox();
+    for (int i = 0; i < options.depth; i++) {
+        ErlTermPtr<> noise(new ErlTuple(new ErlAtom("noise"), new ErlLong(i)));
+        client->send(queued->self(), noise.get());
+    }
+    ErlTermPtr<> pattern(ErlTerm::format("{pong, _}"));
+    // The echo server replies to the mailbox with the queue
+    bool ok = roundTrips("selective", queued, echo->self(),
+                         options.messages, pattern.get());
+    clientNode.deattachMailBox(queued);
+    delete queued;
+    return ok;
+}
+
+static bool rpc(AutoNode &clientNode, AutoNode &serverNode,
+                MailBox *client, const Options &options)
+{
+    Servers servers(serverNode, options.threads);
+    MailBox *rex = servers.create();
+    serverNode.registerMailBox("rex", rex);
+    servers.attach(rex, "{From, _}", new RexCommand(rex, serverNode.getNodeName()));
+
+    ErlTermPtr<ErlList> args(new ErlEmptyList());
+    sample_list samples;
+    samples.reserve(options.messages);
+    long long start = now();
+    for (long n = 0; n < options.messages; n++) {
+        long long sent = now();
+        ErlTermPtr<> reply(client->RPC(serverNode.getNodeName(), "erlang",
+                                       "node", args.get(), TIMEOUT));
+        if (reply.get() == 0) {
+            std::cerr << "rpc: reply " << n << " lost\n";
+            return false;
+        }
+        samples.push_back(now() - sent);
+    }
+    report("rpc", options.messages, now() - start, samples);
+    return true;
+}
+
+/*
+ * Connect the nodes with a pair of EIConnections over a TCP socket on
+ * loopback. The connections only carry the messages, there is no epmd
+ * lookup nor handshake.
+ */
+static bool connectLoopback(AutoNode &clientNode, AutoNode &serverNode) {
+    Socket listener;
+    if (!listener.create() || !listener.bind(0) || !listener.listen()) {
+        std::cerr << "Could not listen on loopback\n";
+        return false;
+    }
+    Socket *client = new Socket();
+    Socket *server = new Socket();
+    if (!client->create() ||
+        !client->connect("127.0.0.1", listener.getLocalPort()) ||
+        !listener.accept(*server))
+    {
+        std::cerr << "Could not connect on loopback\n";
+        delete client;
+        delete server;
+        return false;
+    }
+    // As the sockets of ei_connect
+    int on = 1;
+    setsockopt(client->getSystemSocket(), IPPROTO_TCP, TCP_NODELAY,
+               (const char *) &on, sizeof(on));
+    setsockopt(server->getSystemSocket(), IPPROTO_TCP, TCP_NODELAY,
+               (const char *) &on, sizeof(on));
+
+    clientNode.attachConnection(new EIConnection(
+            new PeerNode(serverNode.getNodeName()), "", client));
+    serverNode.attachConnection(new EIConnection(
+            new PeerNode(clientNode.getNodeName()), "", server));
+    return true;
+}
+
+typedef bool (*workload_function)(AutoNode &, AutoNode &, MailBox *,
+                                  const Options &);
+
+struct Workload {
+    const char *name;
+    workload_function run;
+};
+
+static const Workload WORKLOADS[] = {
+    {"pingpong", pingpong},
+    {"stream", stream},
+    {"fanout", fanout},
+    {"selective", selective},
+    {"rpc", rpc},
+    {0, 0}
+};
+
+int main(int argc, char **argv) {
+    Options options;
+    options.clientNode = "inproc:bench_a@localhost";
+    options.serverNode = "inproc:bench_b@localhost";
+    options.wire = "loopback";
+    options.messages = 10000;
+    options.payload = 64;
+    options.sinks = 16;
+    options.depth = 1000;
+    options.threads = 2;
+
+    std::vector<std::string> selected;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.size() == 2 && arg[0] == '-' && i + 1 < argc) {
+            const char *value = argv[++i];
+            switch (arg[1]) {
+            case 'a': options.clientNode = value; break;
+            case 'b': options.serverNode = value; break;
+            case 'w': options.wire = value; break;
+            case 'n': options.messages = atol(value); break;
+            case 's': options.payload = atoi(value); break;
+            case 'f': options.sinks = atoi(value); break;
+            case 'd': options.depth = atoi(value); break;
+            case 't': options.threads = atoi(value); break;
+            default:
+                std::cerr << "Unknown option " << arg << "\n";
+                return 1;
+            }
+        } else {
+            selected.push_back(arg);
+        }
+    }
+
+    try {
+        AutoNode clientNode(options.clientNode);
+        AutoNode serverNode(options.serverNode);
+        clientNode.startAcceptor();
+        serverNode.startAcceptor();
+        if (options.wire == "loopback") {
+            if (!connectLoopback(clientNode, serverNode)) {
+                return 1;
+            }
+        } else if (options.wire != "node") {
+            std::cerr << "Unknown wire " << options.wire << "\n";
+            return 1;
+        }
+        MailBox *client = clientNode.createMailBox();
+
+        printf("# name\tmessages\tmsgs/s\tp50_us\tp99_us\tp999_us\n");
+        for (const Workload *w = WORKLOADS; w->name; w++) {
+            if (!selected.empty() &&
+                std::find(selected.begin(), selected.end(), w->name) ==
+                selected.end())
+            {
+                continue;
+            }
+            if (!w->run(clientNode, serverNode, client, options)) {
+                return 1;
+            }
+        }
+    } catch (EpiException &e) {
+        std::cerr << "Catched exception: " << e.getMessage() << "\n";
+        return 1;
+    }
+    return 0;
+}
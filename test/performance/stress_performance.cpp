@@ -0,0 +1,397 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp" // Main config file
+
+#include <epi.hpp>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
+
+using namespace epi::error;
+using namespace epi::type;
+using namespace epi::node;
+
+/*
+ * Scalability stress of a node. It builds up the load in phases:
+ *   create_mailboxes   mailboxes created with AutoNode::createMailBox
+ *   register_names     names registered for some of them
+ *   connect_nodes      peer nodes that connect and send a message
+ *   pending_receives   asyncReceive with a timeout, left pending
+ * then measures the round trip from a peer to an echo mailbox under
+ * that load (deliver_under_load), and tears everything down.
+ *
+ * For each phase it prints a line with:
+ *   name count ops/s bytes/object threads p50_us p99_us p999_us
+ * separated by tabs, after a header line starting with '#'. The
+ * memory is the growth of the resident set, and it is 0 where it can
+ * not be read. The latency columns are only set for deliver_under_load.
+ *
+ * Usage: stress_performance [options]
+ *   -a node        stressed node (default inproc:stress@localhost).
+ *                  Peers use the same transport and host.
+ *   -m mailboxes   (default 100000)
+ *   -r names       (default 5000)
+ *   -c peers       (default 200)
+ *   -p receives    pending timed receives (default 20000)
+ *   -n messages    round trips under load (default 5000)
+ */
+
+// Monotonic time in nanoseconds
+static long long now() {
+    #ifdef _WIN32
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (long long) ((double) count.QuadPart * 1e9 / frequency.QuadPart);
+    #else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    #endif
+}
+
+// Resident memory in bytes, 0 if unknown
+static long long residentMemory() {
+    #ifdef __linux__
+    long long size = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%lld %lld", &size, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+    #else
+    return 0;
+    #endif
+}
+
+// Threads of the process, 0 if unknown
+static int threadCount() {
+    int threads = 0;
+    #ifdef __linux__
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f) {
+        char line[256];
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "Threads: %d", &threads) == 1) {
+                break;
+            }
+        }
+        fclose(f);
+    }
+    #endif
+    return threads;
+}
+
+static const long TIMEOUT = 10000;
+
+// Long enough to stay pending during the test
+static const long PENDING_TIMEOUT = 3600 * 1000;
+
+/**
+ * Measures a phase: rate, memory growth and threads
+ */
+class Phase {
+public:
+    Phase(const char *name, long count):
+            mName(name), mCount(count),
+            mMemory(residentMemory()), mStart(now()) {}
+
+    void report() {
+        long long elapsed = now() - mStart;
+        long long memory = residentMemory() - mMemory;
+        printf("%s\t%ld\t%.0f\t%lld\t%d\t0\t0\t0\n", mName, mCount,
+               mCount * 1e9 / (elapsed > 0? elapsed: 1),
+               memory > 0 && mCount > 0? memory / mCount: 0,
+               threadCount());
+        fflush(stdout);
+    }
+
+private:
+    const char *mName;
+    long mCount;
+    long long mMemory;
+    long long mStart;
+};
+
+// Reply {pong, T} to {ping, From, T}
+class EchoCommand: public MatchingCommand {
+public:
+    EchoCommand(MailBox *mailbox): mMailBox(mailbox) {}
+
+    void execute(ErlTerm* term, VariableBinding *binding)
+            throw (EpiException)
+    {
+        ErlTermPtr<> reply(new ErlTuple(new ErlAtom("pong"),
+                                        binding->search("T")));
+        mMailBox->send((ErlPid *) binding->search("From"), reply.get());
+    }
+
+private:
+    MailBox *mMailBox;
+};
+
+// Count the receives that end, none should before the teardown
+class CountCallback: public ReceiveCallback {
+public:
+    CountCallback(): mCalls(0) {}
+
+    void received(ErlangMessage *msg) {
+        delete msg;
+        epi::util::atomicFetchAdd(&mCalls, 1);
+    }
+
+    void failed(EpiConnectionException &error) {
+        epi::util::atomicFetchAdd(&mCalls, 1);
+    }
+
+    long volatile mCalls;
+};
+
+struct Options {
+    std::string node;
+    long mailboxes;
+    long names;
+    long peers;
+    long pending;
+    long messages;
+};
+
+// Name of the peer, with the transport and host of the node
+static std::string peerName(const std::string &node, long index) {
+    std::string::size_type colon = node.find(':');
+    std::string::size_type at = node.find('@');
+    std::ostringstream name;
+    if (colon != std::string::npos) {
+        name << node.substr(0, colon + 1);
+    }
+    name << "stress_peer" << index;
+    if (at != std::string::npos) {
+        name << node.substr(at);
+    }
+    return name.str();
+}
+
+static bool deliverUnderLoad(AutoNode &node, AutoNode &peer,
+                             const Options &options)
+{
+    MailBoxExecutor executor(2);
+    MailBox *echo = node.createMailBox();
+    MatchingCommandGuard handler(ErlTerm::format("{ping, From, T}"),
+                                 new EchoCommand(echo));
+    executor.attach(echo, &handler);
+    MailBox *client = peer.createMailBox();
+
+    std::vector<long long> samples;
+    samples.reserve(options.messages);
+    bool ok = true;
+    long long start = now();
+    for (long n = 0; n < options.messages; n++) {
+        long long sent = now();
+        ErlTermPtr<> ping(new ErlTuple(new ErlAtom("ping"),
+                                       client->self(), new ErlLong(sent)));
+        client->send(echo->self(), ping.get());
+        ErlTermPtr<> pong(client->receive(TIMEOUT));
+        if (pong.get() == 0) {
+            std::cerr << "deliver_under_load: reply " << n << " lost\n";
+            ok = false;
+            break;
+        }
+        samples.push_back(now() - sent);
+    }
+    long long elapsed = now() - start;
+
+    executor.detach(echo);
+    node.deattachMailBox(echo);
+    delete echo;
+    peer.deattachMailBox(client);
+    delete client;
+
+    if (ok) {
+        std::sort(samples.begin(), samples.end());
+        double p[3] = {0.5, 0.99, 0.999};
+        double us[3] = {0, 0, 0};
+        for (int i = 0; i < 3 && !samples.empty(); i++) {
+            unsigned index = (unsigned) (p[i] * samples.size());
+            if (index >= samples.size()) {
+                index = samples.size() - 1;
+            }
+            us[i] = samples[index] / 1000.0;
+        }
+        printf("deliver_under_load\t%ld\t%.0f\t0\t%d\t%.1f\t%.1f\t%.1f\n",
+               options.messages, options.messages * 1e9 / elapsed,
+               threadCount(), us[0], us[1], us[2]);
+        fflush(stdout);
+    }
+    return ok;
+}
+
+static bool stress(const Options &options) {
+    AutoNode node(options.node);
+    node.startAcceptor();
+
+    printf("# name\tcount\tops/s\tbytes/object\tthreads\tp50_us\tp99_us\tp999_us\n");
+
+    std::vector<MailBox *> mailboxes;
+    mailboxes.reserve(options.mailboxes);
+    Phase createMailboxes("create_mailboxes", options.mailboxes);
+    for (long i = 0; i < options.mailboxes; i++) {
+        mailboxes.push_back(node.createMailBox());
+    }
+    createMailboxes.report();
+
+    long names = std::min(options.names, options.mailboxes);
+    Phase registerNames("register_names", names);
+    for (long i = 0; i < names; i++) {
+        std::ostringstream name;
+        name << "stress_name" << i;
+        node.registerMailBox(name.str(), mailboxes[i]);
+    }
+    registerNames.report();
+
+    // Each peer connects by sending a message to a registered sink
+    MailBox *sink = node.createMailBox();
+    node.registerMailBox("stress_sink", sink);
+    std::vector<AutoNode *> peers;
+    Phase connectNodes("connect_nodes", options.peers);
+    for (long i = 0; i < options.peers; i++) {
+        AutoNode *peer = new AutoNode(peerName(options.node, i));
+        peers.push_back(peer);
+        MailBox *mailbox = peer->createMailBox();
+        ErlTermPtr<> hello(new ErlTuple(new ErlAtom("hello"), new ErlLong(i)));
+        mailbox->send(node.getNodeName(), "stress_sink", hello.get());
+    }
+    for (long i = 0; i < options.peers; i++) {
+        ErlTermPtr<> hello(sink->receive(TIMEOUT));
+        if (hello.get() == 0) {
+            std::cerr << "connect_nodes: only " << i << " peers connected\n";
+            return false;
+        }
+    }
+    connectNodes.report();
+
+    CountCallback callback;
+    ErlTermPtr<> pattern(ErlTerm::format("{never, _}"));
+    long pending = std::min(options.pending, options.mailboxes);
+    Phase pendingReceives("pending_receives", pending);
+    for (long i = 0; i < pending; i++) {
+        mailboxes[i]->asyncReceive(pattern.get(), &callback, PENDING_TIMEOUT);
+    }
+    pendingReceives.report();
+
+    if (options.peers > 0 && !deliverUnderLoad(node, *peers[0], options)) {
+        return false;
+    }
+    if (callback.mCalls != 0) {
+        std::cerr << "pending_receives: " << callback.mCalls << " ended\n";
+        return false;
+    }
+
+    // Teardown
+    Phase cancelReceives("cancel_receives", pending);
+    for (long i = 0; i < pending; i++) {
+        mailboxes[i]->cancelReceive(&callback);
+    }
+    cancelReceives.report();
+
+    Phase disconnectNodes("disconnect_nodes", options.peers);
+    for (long i = 0; i < options.peers; i++) {
+        delete peers[i];
+    }
+    disconnectNodes.report();
+
+    Phase unregisterNames("unregister_names", names);
+    for (long i = 0; i < names; i++) {
+        node.unRegisterMailBox(mailboxes[i]);
+    }
+    unregisterNames.report();
+
+    Phase deleteMailboxes("delete_mailboxes", options.mailboxes);
+    for (long i = 0; i < options.mailboxes; i++) {
+        node.deattachMailBox(mailboxes[i]);
+        delete mailboxes[i];
+    }
+    deleteMailboxes.report();
+
+    node.unRegisterMailBox(sink);
+    node.deattachMailBox(sink);
+    delete sink;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    options.node = "inproc:stress@localhost";
+    options.mailboxes = 100000;
+    options.names = 5000;
+    options.peers = 200;
+    options.pending = 20000;
+    options.messages = 5000;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.size() != 2 || arg[0] != '-' || i + 1 >= argc) {
+            std::cerr << "Unknown argument " << arg << "\n";
+            return 1;
+        }
+        const char *value = argv[++i];
+        switch (arg[1]) {
+        case 'a': options.node = value; break;
+        case 'm': options.mailboxes = atol(value); break;
+        case 'r': options.names = atol(value); break;
+        case 'c': options.peers = atol(value); break;
+        case 'p': options.pending = atol(value); break;
+        case 'n': options.messages = atol(value); break;
+        default:
+            std::cerr << "Unknown option " << arg << "\n";
+            return 1;
+        }
+    }
+
+    try {
+        if (!stress(options)) {
+            return 1;
+        }
+    } catch (EpiException &e) {
+        std::cerr << "Catched exception: " << e.getMessage() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include <epi.hpp>
+#include "EIOutputBuffer.hpp"
+
+#include <iostream>
+#include <memory>
+
+using namespace epi::error;
+using namespace epi::type;
+using namespace epi::node;
+using namespace epi::util;
+
+// Output buffer that gives the encoded data
+class EncodedBuffer: public epi::ei::EIOutputBuffer {
+public:
+    std::string data() {
+        return std::string(getInternalBuffer(), *getInternalIndex());
+    }
+};
+
+static std::string encode(ErlTerm *term) {
+    EncodedBuffer buffer;
+    buffer.writeTerm(term);
+    return buffer.data();
+}
+
+// Frozen terms encode as the terms they were, alone and inside others
+bool test_freeze()
+        throw (EpiException)
+{
+    const char *format = "[{name, \"Mary\"}, {age, 33}, {pets, [cat, dog]}]";
+    ErlTermPtr<> frozen(ErlTerm::format(format));
+    ErlTermPtr<> plain(ErlTerm::format(format));
+    size_t footprint = frozen->memoryFootprint();
+    FreezeTerm(frozen.get());
+    if (!frozen->isFrozen() || plain->isFrozen() ||
+        frozen->memoryFootprint() <= footprint)
+    {
+        std::cout << "Term not frozen\n";
+        return false;
+    }
+    if (encode(frozen.get()) != encode(plain.get())) {
+        std::cout << "Wrong frozen encoding\n";
+        return false;
+    }
+    ErlTermPtr<> outer(ErlTerm::format("{request, ~w, [~w]}",
+                                       frozen.get(), frozen.get()));
+    ErlTermPtr<> expected(ErlTerm::format("{request, ~w, [~w]}",
+                                          plain.get(), plain.get()));
+    if (encode(outer.get()) != encode(expected.get())) {
+        std::cout << "Wrong spliced encoding\n";
+        return false;
+    }
+    EncodedBuffer buffer;
+    buffer.writeTerm(outer.get());
+    std::auto_ptr<InputBuffer> input(buffer.getInputBuffer());
+    ErlTermPtr<> decoded(input->readTerm());
+    if (!decoded->equals(*expected.get())) {
+        std::cout << "Wrong decoded term " << decoded->toString() << "\n";
+        return false;
+    }
+    ErlTermPtr<> pattern(ErlTerm::format("{request, Args}"));
+    try {
+        pattern->freeze(encode(plain.get()));
+        std::cout << "Frozen pattern\n";
+        return false;
+    } catch (EpiInvalidTerm &e) {
+    }
+    std::cout << "Freeze ok\n";
+    return true;
+}
+
+// Test code
+int main(int argc, char **argv) {
+
+    if (argc > 1 && argv[1][0] == '1') {
+	    Debug( dc::notice.on() );
+	    Debug( libcw_do.on() );
+    }
+
+    try {
+        std::cout << "Testing frozen terms" << std::endl;
+        if (!test_freeze()) exit(1);
+
+    } catch (EpiException &e) {
+        std::cout << "Catched exception: " << e.getMessage() << "\n";
+        exit(1);
+    }
+
+    return 0;
+}
@@ -28,6 +28,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include <sstream>
 #include <ostream>
 #include <memory>
+#include <algorithm>
 
 #include "ErlTypes.hpp"
 
@@ -48,6 +49,8 @@ public:
          TEST_CASE( tupleTest );
          TEST_CASE( listTest );
          TEST_CASE( variableTest );
+         TEST_CASE( pidTest );
+         TEST_CASE( memoryTest );
      }
 
      void basicTypesTest() {
@@ -94,6 +97,71 @@ public:
 
      }
 
+     void pidTest() {
+         ErlTermPtr<ErlPid> pid1(new ErlPid("a@node", 0x7fff, 0x1fff, 3));
+         ErlTermPtr<ErlPid> pid2(new ErlPid("a@node", 0x7fff, 0x1fff, 1));
+         ErlTermPtr<ErlPid> pid3(new ErlPid("b@node", 0x7fff, 0x1fff, 3));
+
+         // Fields are kept when packed
+         ASSERT_EQUALS( std::string("a@node"), pid1->node() );
+         ASSERT_EQUALS( 0x7fff, pid1->id() );
+         ASSERT_EQUALS( 0x1fff, pid1->serial() );
+         ASSERT_EQUALS( 3, pid1->creation() );
+
+         // Node names are interned
+         ASSERT( pid1->nodeIndex() == pid2->nodeIndex() );
+         ASSERT( pid1->nodeIndex() != pid3->nodeIndex() );
+
+         // The creation is not compared
+         ASSERT( pid1->equals(*pid2.get()) );
+         ASSERT( pid1->hash() == pid2->hash() );
+         ASSERT( !pid1->equals(*pid3.get()) );
+         ASSERT( (*pid1.get() < *pid3.get()) != (*pid3.get() < *pid1.get()) );
+
+         // Names are removed with their last term, and the index reused
+         unsigned index = pid3->nodeIndex();
+         pid3 = 0;
+         ASSERT( NodeNames::lookup(index).empty() );
+         unsigned last = 0;
+         for (int i = 0; i < 10000; i++) {
+             std::ostringstream node;
+             node << "remote" << i << "@node";
+             ErlTermPtr<ErlPid> remote(new ErlPid(node.str(), 1, 1, 1));
+             ASSERT_EQUALS( node.str(), remote->node() );
+             last = std::max(last, remote->nodeIndex());
+         }
+         ASSERT( last < 100 );
+         pid3 = new ErlPid("b@node", 0x7fff, 0x1fff, 3);
+         ASSERT_EQUALS( std::string("b@node"), NodeNames::lookup(pid3->nodeIndex()) );
+         ASSERT_EQUALS( std::string("a@node"), pid1->node() );
+     }
+
+     void memoryTest() {
+         ErlTermPtr<> text(new ErlString("a string longer than a short one"));
+         ErlTermPtr<> single(new ErlTuple(text.get()));
+         ErlTermPtr<> twice(new ErlTuple(text.get(), text.get()));
+
+         // The characters are counted, and a shared subterm once
+         ASSERT( text->memoryFootprint() > 32 );
+         ASSERT( single->memoryFootprint() > text->memoryFootprint() );
+         ASSERT( twice->memoryFootprint() <
+                 single->memoryFootprint() + text->memoryFootprint() );
+
+         // The terms alive are counted, if enabled
+         if (TermStats::available()) {
+             long live = TermStats::liveTerms(ERL_LONG);
+             long allocs = TermStats::allocs(ERL_LONG);
+             {
+                 ErlTermPtr<> number(new ErlLong(1));
+                 ErlTermPtr<> copy;
+                 copy = number;
+                 ASSERT_EQUALS( live + 1, TermStats::liveTerms(ERL_LONG) );
+             }
+             ASSERT_EQUALS( live, TermStats::liveTerms(ERL_LONG) );
+             ASSERT_EQUALS( allocs + 1, TermStats::allocs(ERL_LONG) );
+         }
+     }
+
      void tupleTest() {
 
          ErlTermPtr<ErlTuple> empty_tuple(new ErlTuple((unsigned int) 0));
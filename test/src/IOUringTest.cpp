@@ -0,0 +1,291 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+/*
+ * Tests of the io_uring data path, on a socketpair. The peer end
+ * echoes all the data, so the frames sent by the connection are
+ * received again by its acceptor.
+ */
+
+#include "Config.hpp" // Main config file
+
+#include <epi.hpp>
+
+#include <iostream>
+
+#ifdef USE_IO_URING
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "IOUring.hpp"
+#include "EIUringConnection.hpp"
+#include "EIOutputBuffer.hpp"
+
+using namespace epi::error;
+using namespace epi::type;
+using namespace epi::node;
+using namespace epi::ei;
+
+const int SENDERS = 4;
+const int MESSAGES = 200;
+
+// Linked sends go out in order, and a pending recv can be canceled
+bool test_ring(int fd, int peer)
+{
+    IOUring ring;
+    if (!ring.create(8)) {
+        std::cout << "io_uring not available, skipped\n";
+        return true;
+    }
+    const char *parts[] = {"abc", "defg", "h"};
+    for (int i=0; i<3; i++) {
+        ring.prepareSend(fd, parts[i], strlen(parts[i]), i, i < 2);
+    }
+    if (ring.submitAndWait(3) < 0) {
+        std::cout << "Submit failed\n";
+        return false;
+    }
+    unsigned long long userData;
+    int result;
+    for (int done=0; done<3; ) {
+        if (ring.peekCompletion(&userData, &result)) {
+            if (result != (int) strlen(parts[userData])) {
+                std::cout << "Send " << userData << " failed: " << result << "\n";
+                return false;
+            }
+            done++;
+        } else {
+            ring.wait(1);
+        }
+    }
+    char data[9] = "";
+    for (int got=0; got<8; ) {
+        int res = read(peer, data + got, 8 - got);
+        if (res <= 0) {
+            std::cout << "Read failed\n";
+            return false;
+        }
+        got += res;
+    }
+    if (strcmp(data, "abcdefgh") != 0) {
+        std::cout << "Wrong data " << data << "\n";
+        return false;
+    }
+
+    ring.prepareRecv(fd, data, sizeof(data), 10);
+    ring.submitAndWait(0);
+    ring.prepareCancel(10, 11);
+    ring.submitAndWait(2);
+    int recvResult = 0;
+    for (int done=0; done<2; ) {
+        if (ring.peekCompletion(&userData, &result)) {
+            if (userData == 10) {
+                recvResult = result;
+            }
+            done++;
+        } else {
+            ring.wait(1);
+        }
+    }
+    if (recvResult != -ECANCELED) {
+        std::cout << "Recv not canceled: " << recvResult << "\n";
+        return false;
+    }
+    std::cout << "Ring ok\n";
+    return true;
+}
+
+// Check the messages of each sender arrive in order and complete
+class CheckReceiver: public EpiReceiver {
+public:
+    CheckReceiver(): mReceived(0), mErrors(0) {
+        for (int i=0; i<SENDERS; i++) {
+            mNext[i] = 0;
+        }
+    }
+    void deliver(void *origin, EpiMessage *msg) {
+        if (msg->messageType() == ERL_MSG_SEND) {
+            check(((ErlangMessage *) msg)->getMsg());
+        } else if (msg->messageType() == ERL_MSG_ERROR) {
+            // The acceptor is stopped by closing the socket
+        } else {
+            mErrors++;
+        }
+        delete msg;
+    }
+    void check(ErlTerm *term) {
+        VariableBinding binding;
+        ErlTermPtr<> pattern(ErlTerm::format("{Sender, Seq, Data}"));
+        if (!term->match(pattern.get(), &binding)) {
+            mErrors++;
+            return;
+        }
+        long sender = ((ErlLong *) binding.search("Sender"))->longValue();
+        long seq = ((ErlLong *) binding.search("Seq"))->longValue();
+        ErlBinary *data = (ErlBinary *) binding.search("Data");
+        if (sender < 0 || sender >= SENDERS || seq != mNext[sender] ||
+            !data->instanceOf(ERL_BINARY) || data->size() != size(seq))
+        {
+            mErrors++;
+            return;
+        }
+        const char *bytes = (const char *) data->binaryData();
+        for (unsigned i=0; i<data->size(); i++) {
+            if (bytes[i] != (char) (seq + i)) {
+                mErrors++;
+                return;
+            }
+        }
+        mNext[sender]++;
+        epi::util::atomicFetchAdd(&mReceived, 1);
+    }
+    static unsigned size(long seq) {
+        // Big and small payloads, some of them bigger than the
+        // socket buffer and the registered receive buffer
+        return (seq * 7919) % 150000 + 1;
+    }
+    long received() { return epi::util::atomicLoad(&mReceived); }
+    long errors() { return mErrors; }
+private:
+    long mNext[SENDERS];
+    long volatile mReceived;
+    long mErrors;
+};
+
+// Send all the data received back
+void *echo(void *arg) {
+    int fd = *(int *) arg;
+    char buffer[4096];
+    int res;
+    while ((res = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (int sent=0; sent<res; ) {
+            int n = write(fd, buffer + sent, res - sent);
+            if (n <= 0) {
+                return 0;
+            }
+            sent += n;
+        }
+    }
+    return 0;
+}
+
+struct SenderArgs {
+    EIUringConnection *connection;
+    long id;
+    bool failed;
+};
+
+void *sender(void *arg) {
+    SenderArgs *args = (SenderArgs *) arg;
+    try {
+        ErlTermPtr<ErlPid> pid(new ErlPid("peer@localhost", args->id, 0, 0));
+        for (long seq=0; seq<MESSAGES; seq++) {
+            std::vector<char> data(CheckReceiver::size(seq));
+            for (unsigned i=0; i<data.size(); i++) {
+                data[i] = (char) (seq + i);
+            }
+            ErlTermPtr<> term(new ErlTuple(new ErlLong(args->id),
+                                           new ErlLong(seq),
+                                           new ErlBinary(&data[0], data.size())));
+            std::auto_ptr<OutputBuffer> buffer(args->connection->newOutputBuffer());
+            buffer->writeTerm(term.get());
+            args->connection->sendBuf(pid.get(), pid.get(), buffer.get());
+        }
+    } catch (EpiException &e) {
+        std::cout << "Send failed: " << e.getMessage() << "\n";
+        args->failed = true;
+    }
+    return 0;
+}
+
+// Frames of concurrent senders are flushed whole and in order
+bool test_flush(int fd, int peer)
+{
+    CheckReceiver receiver;
+    EIUringConnection *connection = new EIUringConnection(
+            new PeerNode("peer@localhost"), "cookie", new Socket(fd));
+    connection->setReceiver(&receiver);
+    connection->start();
+
+    pthread_t echoThread;
+    pthread_create(&echoThread, 0, echo, &peer);
+    pthread_t senders[SENDERS];
+    SenderArgs args[SENDERS];
+    for (int i=0; i<SENDERS; i++) {
+        args[i].connection = connection;
+        args[i].id = i;
+        args[i].failed = false;
+        pthread_create(&senders[i], 0, sender, &args[i]);
+    }
+    bool failed = false;
+    for (int i=0; i<SENDERS; i++) {
+        pthread_join(senders[i], 0);
+        failed = failed || args[i].failed;
+    }
+    for (int i=0; i<3000 && receiver.received() < SENDERS * MESSAGES &&
+         receiver.errors() == 0; i++)
+    {
+        usleep(10000);
+    }
+    // Stop the acceptor while it waits for data
+    connection->stop();
+    shutdown(peer, SHUT_RDWR);
+    pthread_join(echoThread, 0);
+    delete connection;
+
+    if (failed || receiver.errors() > 0 ||
+        receiver.received() != SENDERS * MESSAGES)
+    {
+        std::cout << "Received " << receiver.received() << " messages, " <<
+                receiver.errors() << " errors\n";
+        return false;
+    }
+    std::cout << "Flushed " << receiver.received() << " messages\n";
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        std::cout << "socketpair failed\n";
+        exit(1);
+    }
+    std::cout << "Testing ring" << std::endl;
+    if (!test_ring(fds[0], fds[1])) exit(1);
+    std::cout << "Testing frame flush" << std::endl;
+    if (!test_flush(fds[0], fds[1])) exit(1);
+    close(fds[1]);
+    return 0;
+}
+
+#else
+
+int main(int argc, char **argv) {
+    std::cout << "Built without io_uring, skipped" << std::endl;
+    return 0;
+}
+
+#endif // USE_IO_URING
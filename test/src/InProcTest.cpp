@@ -0,0 +1,1277 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include <epi.hpp>
+#include "EIOutputBuffer.hpp"
+#include "InProcTransport.hpp"
+
+#include <iostream>
+#include <cstdio>
+#include <sstream>
+#include <ostream>
+#include <memory>
+#include <vector>
+#include <set>
+#include <stdexcept>
+
+using namespace epi::error;
+using namespace epi::type;
+using namespace epi::node;
+using namespace epi::util;
+
+std::string LOCALNODE = "inproc:local@localhost";
+std::string REMOTENODE = "inproc:remote@localhost";
+std::string BURSTNODE = "inproc:burst@localhost";
+std::string POOLEDNODE = "inproc:pooled@localhost";
+std::string CROSSEDNODE = "inproc:crossed@localhost";
+std::string UNBOUNDNODE = "inproc:unbound@localhost";
+
+// Create the set of term to test
+ErlTermPtr<ErlTerm> * create_test_set()
+        throw (EpiException)
+{
+    // Create an array of ErlTerm
+    const int count = 30;
+    ErlTermPtr<ErlTerm> *term_array = new ErlTermPtr<ErlTerm>[count];
+    for (int i=0; i<count; i++) {
+        term_array[i] = 0;
+    }
+    int index = 0;
+
+    term_array[index++] = ErlTerm::format("an_atom");
+    term_array[index++] = ErlTerm::format("3.141617");
+    term_array[index++] = ErlTerm::format("123456789");
+    unsigned int ids[] = {1,2,3};
+    term_array[index++] = new ErlRef("local@localhost", ids, 4);
+    term_array[index++] = new ErlPid("local@localhost", 1, 2, 3);
+    char *data="Mary has a little cat";
+    term_array[index++] = new ErlBinary(data, strlen(data), true);
+    term_array[index++] = new ErlPort("local@localhost", 1, 2);
+    term_array[index++] = ErlTerm::format("{an_atom_in_a_tuple, 123}");
+    term_array[index++] = new ErlEmptyList();
+    term_array[index++] = ErlTerm::format("[{an_atom_in_tuple_in_a_list, 123},"
+            "[an_atom_in_a_list_in_a_list, 456]]");
+
+    return term_array;
+}
+
+// Receiver that replies on the same connection the messages it gets
+class EchoReceiver: public EpiReceiver {
+public:
+    EchoReceiver(Connection *connection, ErlPid *pid):
+            mConnection(connection), mPid(pid), mCount(0) {}
+    void deliver(void *origin, EpiMessage *msg) {
+        delete msg;
+        mCount++;
+        if (mConnection) {
+            std::auto_ptr<OutputBuffer> buffer(mConnection->newOutputBuffer());
+            ErlTermPtr<> reply(new ErlLong(mCount));
+            buffer->writeTerm(reply.get());
+            mConnection->sendBuf(mPid.get(), mPid.get(), buffer.get());
+        }
+    }
+    int count() { return mCount; }
+private:
+    Connection *mConnection;
+    ErlTermPtr<ErlPid> mPid;
+    int mCount;
+};
+
+// The messages queued in a stopped end are delivered on start, and
+// their receiver can reply on the same link
+bool test_flush_reply()
+        throw (EpiException)
+{
+    const int count = 5;
+    InProcTransport server("flush_server@localhost", "cookie");
+    InProcTransport client("flush_client@localhost", "cookie");
+    server.publishPort();
+    std::auto_ptr<Connection> clientEnd(client.connect("flush_server@localhost"));
+    std::auto_ptr<Connection> serverEnd(server.accept(1000));
+    if (serverEnd.get() == 0) {
+        std::cout << "Connection not accepted\n";
+        return false;
+    }
+    ErlTermPtr<ErlPid> pid(new ErlPid("flush_client@localhost", 1, 0, 0));
+    EchoReceiver echo(serverEnd.get(), pid.get());
+    EchoReceiver replies(0, pid.get());
+    serverEnd->setReceiver(&echo);
+    clientEnd->setReceiver(&replies);
+    clientEnd->start();
+    for (int i=0; i<count; i++) {
+        std::auto_ptr<OutputBuffer> buffer(clientEnd->newOutputBuffer());
+        ErlTermPtr<> request(new ErlLong(i));
+        buffer->writeTerm(request.get());
+        clientEnd->sendBuf(pid.get(), pid.get(), buffer.get());
+    }
+    serverEnd->start();
+    server.unPublishPort();
+    if (echo.count() != count || replies.count() != count) {
+        std::cout << "Flushed " << echo.count() << " messages, " <<
+                replies.count() << " replies\n";
+        return false;
+    }
+    std::cout << "Flushed " << count << " messages\n";
+    return true;
+}
+
+// Receiver that throws on the first message it gets
+class ThrowingReceiver: public EpiReceiver {
+public:
+    ThrowingReceiver(): mCount(0) {}
+    void deliver(void *origin, EpiMessage *msg) {
+        delete msg;
+        if (mCount++ == 0) {
+            throw EpiConnectionException("Receiver failed");
+        }
+    }
+    int count() { return mCount; }
+private:
+    int mCount;
+};
+
+// A receiver that throws leaves the link usable and closable
+bool test_throwing_receiver()
+        throw (EpiException)
+{
+    InProcTransport server("throw_server@localhost", "cookie");
+    InProcTransport client("throw_client@localhost", "cookie");
+    server.publishPort();
+    std::auto_ptr<Connection> clientEnd(client.connect("throw_server@localhost"));
+    std::auto_ptr<Connection> serverEnd(server.accept(1000));
+    server.unPublishPort();
+    if (serverEnd.get() == 0) {
+        std::cout << "Connection not accepted\n";
+        return false;
+    }
+    ErlTermPtr<ErlPid> pid(new ErlPid("throw_server@localhost", 1, 0, 0));
+    ThrowingReceiver receiver;
+    serverEnd->setReceiver(&receiver);
+    // Queued while stopped, the first one throws in start
+    const int count = 3;
+    for (int i=0; i<count; i++) {
+        std::auto_ptr<OutputBuffer> buffer(clientEnd->newOutputBuffer());
+        ErlTermPtr<> request(new ErlLong(i));
+        buffer->writeTerm(request.get());
+        clientEnd->sendBuf(pid.get(), pid.get(), buffer.get());
+    }
+    try {
+        serverEnd->start();
+        std::cout << "The receiver did not throw\n";
+        return false;
+    } catch (EpiConnectionException &e) {
+    }
+    // The others are kept for the next start
+    serverEnd->start();
+    if (receiver.count() != count) {
+        std::cout << "Delivered " << receiver.count() << " messages\n";
+        return false;
+    }
+    // A throw in the sender thread reaches the sender, and close
+    // does not wait for that delivery
+    ThrowingReceiver started;
+    serverEnd->setReceiver(&started);
+    try {
+        std::auto_ptr<OutputBuffer> buffer(clientEnd->newOutputBuffer());
+        ErlTermPtr<> request(new ErlLong(count));
+        buffer->writeTerm(request.get());
+        clientEnd->sendBuf(pid.get(), pid.get(), buffer.get());
+        std::cout << "The receiver did not throw\n";
+        return false;
+    } catch (EpiConnectionException &e) {
+    }
+    serverEnd->close();
+    std::cout << "Throwing receiver ok\n";
+    return true;
+}
+
+// Test send and receive with a reply server in the other node
+bool test_reply_server(AutoNode &local, AutoNode &remote)
+        throw (EpiException)
+{
+    MailBox* server = remote.createMailBox();
+    remote.registerMailBox("reply_server", server);
+    MailBox* client = local.createMailBox();
+
+    bool ret = true;
+    ErlTermPtr<ErlTerm> *test_set = create_test_set();
+    ErlTermPtr<ErlTerm> *p = test_set;
+
+    while(p->get()) {
+        std::cout << "Sending term: " << p->get()->toString() << "\n";
+        ErlTermPtr<ErlTuple> tuple(new ErlTuple(client->self(), p->get()));
+        client->send(remote.getNodeName(), "reply_server", tuple.get());
+
+        std::auto_ptr<ErlangMessage> msg(server->receiveMsg(5000));
+        if (msg.get() == 0 || msg->messageType() != ERL_MSG_REG_SEND) {
+            std::cout << "Server did not get a REG_SEND message\n";
+            ret = false;
+            break;
+        }
+        ErlTuple *request = (ErlTuple *) msg->getMsg();
+        server->send((ErlPid *) request->elementAt(0), request->elementAt(1));
+
+        ErlTermPtr<> reply(client->receive(5000));
+        if (reply.get() == 0 || !p->get()->equals(*reply.get())) {
+            std::cout << "Not equals, error!\n";
+            ret = false;
+            break;
+        }
+        std::cout << "Got term: " << reply->toString() << "\n";
+        p++;
+    }
+
+    delete [] test_set;
+    return ret;
+}
+
+// Messages sent while the connection is set up arrive in order
+bool test_burst(AutoNode &local)
+        throw (EpiException)
+{
+    AutoNode burst(BURSTNODE);
+    burst.startAcceptor();
+    MailBox* server = burst.createMailBox();
+    burst.registerMailBox("burst_server", server);
+    MailBox* client = local.createMailBox();
+
+    const int count = 100;
+    for (int i=0; i<count; i++) {
+        ErlTermPtr<> term(new ErlLong(i));
+        client->send(burst.getNodeName(), "burst_server", term.get());
+    }
+    for (int i=0; i<count; i++) {
+        ErlTermPtr<> term(server->receive(5000));
+        if (term.get() == 0 || ((ErlLong *) term.get())->longValue() != i) {
+            std::cout << "Message " << i << " lost or out of order\n";
+            return false;
+        }
+    }
+    std::cout << "Got " << count << " messages in order\n";
+    return true;
+}
+
+// Two new nodes send to each other at once, so each one accepts a
+// connection while its own connector sends the queued messages
+bool test_crossed_burst(AutoNode &local)
+        throw (EpiException)
+{
+    AutoNode crossed(CROSSEDNODE);
+    crossed.startAcceptor();
+    MailBox* localServer = local.createMailBox();
+    MailBox* crossedServer = crossed.createMailBox();
+    local.registerMailBox("crossed_server", localServer);
+    crossed.registerMailBox("crossed_server", crossedServer);
+    MailBox* localClient = local.createMailBox();
+    MailBox* crossedClient = crossed.createMailBox();
+
+    // Some of the messages are multicast, they must not overtake
+    // the queued ones
+    std::vector<ErlPid*> targets;
+    targets.push_back(crossedServer->self());
+    const int count = 200;
+    for (int i=0; i<count; i++) {
+        ErlTermPtr<> term(new ErlLong(i));
+        if (i % 10 == 5) {
+            localClient->multicast(targets, term.get());
+        } else {
+            localClient->send(crossed.getNodeName(), "crossed_server", term.get());
+        }
+        crossedClient->send(local.getNodeName(), "crossed_server", term.get());
+    }
+    MailBox* servers[] = {localServer, crossedServer};
+    for (int s=0; s<2; s++) {
+        for (int i=0; i<count; i++) {
+            ErlTermPtr<> term(servers[s]->receive(5000));
+            if (term.get() == 0 || ((ErlLong *) term.get())->longValue() != i) {
+                std::cout << "Message " << i << " lost or out of order\n";
+                return false;
+            }
+        }
+    }
+    local.unRegisterMailBox(localServer);
+    std::cout << "Got " << count << " crossed messages in order\n";
+    return true;
+}
+
+// Messages decoded by a pool keep the order of each sender, even when
+// a later message is shorter to decode
+bool test_decode_pool(AutoNode &local)
+        throw (EpiException)
+{
+    AutoNode pooled(POOLEDNODE);
+    pooled.setDecodeThreads(4);
+    pooled.startAcceptor();
+
+    const int senders = 8;
+    const int servers = 8;
+    const int count = 200;
+    MailBox *clients[senders];
+    MailBox *server[servers];
+    for (int i=0; i<senders; i++) {
+        clients[i] = local.createMailBox();
+    }
+    for (int i=0; i<servers; i++) {
+        server[i] = pooled.createMailBox();
+        std::ostringstream name;
+        name << "pooled_server" << i;
+        pooled.registerMailBox(name.str(), server[i]);
+    }
+
+    // Even servers by pid, odd servers by name
+    std::string padding(8192, 'x');
+    for (int n=0; n<count; n++) {
+        for (int i=0; i<senders; i++) {
+            for (int j=0; j<servers; j++) {
+                ErlTermPtr<> term;
+                if (n % 5 == 0) {
+                    term.reset(new ErlTuple(new ErlLong(i), new ErlLong(n),
+                                            new ErlString(padding)));
+                } else {
+                    term.reset(new ErlTuple(new ErlLong(i), new ErlLong(n)));
+                }
+                if (j % 2 == 0) {
+                    clients[i]->send(server[j]->self(), term.get());
+                } else {
+                    std::ostringstream name;
+                    name << "pooled_server" << j;
+                    clients[i]->send(pooled.getNodeName(), name.str(), term.get());
+                }
+            }
+        }
+    }
+
+    for (int j=0; j<servers; j++) {
+        int next[senders];
+        for (int i=0; i<senders; i++) {
+            next[i] = 0;
+        }
+        for (int n=0; n<count*senders; n++) {
+            ErlTermPtr<> term(server[j]->receive(5000));
+            if (term.get() == 0 || !term->instanceOf(ERL_TUPLE)) {
+                std::cout << "Server " << j << " lost message " << n << "\n";
+                return false;
+            }
+            ErlTuple *tuple = (ErlTuple *) term.get();
+            int i = ((ErlLong *) tuple->elementAt(0))->longValue();
+            int seq = ((ErlLong *) tuple->elementAt(1))->longValue();
+            if (seq != next[i]++) {
+                std::cout << "Server " << j << " got " << seq << " from " <<
+                        i << ", expected " << next[i]-1 << "\n";
+                return false;
+            }
+        }
+    }
+    std::cout << "Got " << count*senders*servers << " messages in order\n";
+
+    // A hot peer sending to one name, decoded from the wire format
+    const char *file = "pooled_capture.bin";
+    const int frames = 2000;
+    erlang_msg msg;
+    memset(&msg, 0, sizeof(msg));
+    strcpy(msg.from.node, "hot@localhost");
+    msg.from.num = 1;
+    msg.from.creation = 1;
+    msg.msgtype = ERL_REG_SEND;
+    strcpy(msg.toname, "pooled_server1");
+    if (!FrameCapture::start(file)) {
+        std::cout << "Could not start the capture\n";
+        return false;
+    }
+    for (int n=0; n<frames; n++) {
+        ei_x_buff payload;
+        ei_x_new_with_version(&payload);
+        ei_x_encode_tuple_header(&payload, 2);
+        ei_x_encode_long(&payload, n);
+        if (n % 5 == 0) {
+            ei_x_encode_string(&payload, padding.c_str());
+        } else {
+            ei_x_encode_atom(&payload, "short");
+        }
+        FrameCapture::record("hot@localhost", &msg, payload.buff, payload.index);
+        ei_x_free(&payload);
+    }
+    FrameCapture::stop();
+
+    epi::ei::ReplayConnection *connection = new epi::ei::ReplayConnection(
+            new PeerNode("hot@localhost"), file, 0);
+    pooled.attachConnection(connection);
+    for (int n=0; n<frames; n++) {
+        ErlTermPtr<> term(server[1]->receive(5000));
+        if (term.get() == 0 || !term->instanceOf(ERL_TUPLE)) {
+            std::cout << "Hot peer message " << n << " lost\n";
+            return false;
+        }
+        ErlTuple *tuple = (ErlTuple *) term.get();
+        if (((ErlLong *) tuple->elementAt(0))->longValue() != n) {
+            std::cout << "Hot peer message " << n << " out of order\n";
+            return false;
+        }
+    }
+    for (int i=0; i<500 && !connection->finished(); i++) {
+        server[1]->receive(10);
+    }
+    remove(file);
+    std::cout << "Got " << frames << " messages of a hot peer in order\n";
+    return true;
+}
+
+// Mailboxes of the same node share the sent term
+bool test_local(AutoNode &local)
+        throw (EpiException)
+{
+    MailBox* sender = local.createMailBox();
+    MailBox* receiver = local.createMailBox();
+
+    ErlTermPtr<> term(ErlTerm::format("{local, [1, 2, 3], \"text\"}"));
+    sender->send(receiver->self(), term.get());
+    ErlTermPtr<> received(receiver->receive(5000));
+    if (received.get() != term.get()) {
+        std::cout << "The term was copied\n";
+        return false;
+    }
+
+    // A term with variables is substituted
+    VariableBinding binding;
+    binding.bind("X", new ErlLong(1));
+    ErlTermPtr<> pattern(ErlTerm::format("{local, X}"));
+    std::auto_ptr<OutputBuffer> buffer(sender->newOutputBuffer());
+    buffer->writeTerm(pattern.get(), &binding);
+    sender->sendBuf(receiver->self(), buffer.get());
+    received = receiver->receive(5000);
+    ErlTermPtr<> expected(ErlTerm::format("{local, 1}"));
+    if (received.get() == 0 || !expected->equals(*received.get())) {
+        std::cout << "The term was not substituted\n";
+        return false;
+    }
+    std::cout << "Local delivery ok\n";
+    return true;
+}
+
+// Output buffer that gives the encoded data
+class EncodedBuffer: public epi::ei::EIOutputBuffer {
+public:
+    std::string data() {
+        return std::string(getInternalBuffer(), *getInternalIndex());
+    }
+};
+
+static std::string encode(ErlTerm *term) {
+    EncodedBuffer buffer;
+    buffer.writeTerm(term);
+    return buffer.data();
+}
+
+// Captured frames are replayed into a node
+bool test_replay(AutoNode &local, AutoNode &remote)
+        throw (EpiException)
+{
+    const char *file = "inproc_capture.bin";
+    const int count = 10;
+    MailBox* server = local.createMailBox();
+    MailBox* receiver = local.createMailBox();
+    local.registerMailBox("replay_server", server);
+
+    erlang_msg msg;
+    memset(&msg, 0, sizeof(msg));
+    strcpy(msg.from.node, "peer@localhost");
+    msg.from.num = 1;
+    msg.from.creation = 1;
+    strcpy(msg.toname, "replay_server");
+    if (!FrameCapture::start(file)) {
+        std::cout << "Could not start the capture\n";
+        return false;
+    }
+    for (int i=0; i<=count; i++) {
+        ei_x_buff payload;
+        ei_x_new_with_version(&payload);
+        ei_x_encode_tuple_header(&payload, 2);
+        ei_x_encode_atom(&payload, "replayed");
+        ei_x_encode_long(&payload, i);
+        if (i < count) {
+            msg.msgtype = ERL_REG_SEND;
+        } else {
+            // The last one to a pid
+            std::auto_ptr<erlang_pid> to(ErlPid2EI(receiver->self()));
+            msg.msgtype = ERL_SEND;
+            msg.to = *to;
+        }
+        FrameCapture::record("peer@localhost", &msg, payload.buff, payload.index);
+        ei_x_free(&payload);
+    }
+    FrameCapture::stop();
+    if (FrameCapture::frames() != count + 1) {
+        std::cout << "Captured " << FrameCapture::frames() << " frames\n";
+        return false;
+    }
+
+    epi::ei::ReplayConnection *connection = new epi::ei::ReplayConnection(
+            new PeerNode("peer@localhost"), file, 0);
+    local.attachConnection(connection);
+    for (int i=0; i<=count; i++) {
+        MailBox *mailbox = i < count? server: receiver;
+        ErlTermPtr<> received(mailbox->receive(5000));
+        ErlTermPtr<> expected(ErlTerm::format("{replayed, ~i}", i));
+        if (received.get() == 0 || !expected->equals(*received.get())) {
+            std::cout << "Frame " << i << " not replayed\n";
+            return false;
+        }
+    }
+    // Replies to the peer are dropped, also when they are multicast
+    // together with an in process node
+    ErlTermPtr<ErlPid> peer(epi::util::EI2ErlPid(&msg.from));
+    MailBox *other = remote.createMailBox();
+    std::vector<ErlPid*> pids;
+    pids.push_back(peer.get());
+    pids.push_back(other->self());
+    ErlTermPtr<> reply(new ErlAtom("reply"));
+    server->multicast(pids, reply.get());
+    ErlTermPtr<> received(other->receive(5000));
+    if (received.get() == 0 || !reply->equals(*received.get())) {
+        std::cout << "Multicast reply not received\n";
+        return false;
+    }
+    for (int i=0; i<500 && !connection->finished(); i++) {
+        receiver->receive(10);
+    }
+    local.unRegisterMailBox(server);
+    remove(file);
+    if (!connection->finished() || connection->skipped() != 0 ||
+        connection->messagesIn() != count + 1 || connection->messagesOut() != 1 ||
+        connection->bytesOut() != (long) encode(reply.get()).size())
+    {
+        std::cout << "Replayed " << connection->messagesIn() << " frames, " <<
+                connection->messagesOut() << " replies\n";
+        return false;
+    }
+    std::cout << "Replayed " << count + 1 << " frames\n";
+    return true;
+}
+
+// Refs stay unique across the reserved ranges and nodes
+bool test_refs(AutoNode &local, AutoNode &remote)
+        throw (EpiException)
+{
+    std::set<std::string> refs;
+    for (int i = 0; i < 3000; i++) {
+        AutoNode &node = (i % 3)? local: remote;
+        ErlTermPtr<ErlRef> ref(node.createRef());
+        if (!refs.insert(ref->toString()).second) {
+            std::cout << "Duplicated ref " << ref->toString() << "\n";
+            return false;
+        }
+    }
+    std::cout << "Refs ok\n";
+    return true;
+}
+
+// Messages reach the mailboxes by pid until they are deattached
+bool test_lookup(AutoNode &local)
+        throw (EpiException)
+{
+    const int count = 100;
+    MailBox* sender = local.createMailBox();
+    std::vector<MailBox*> mailboxes;
+    std::vector<ErlPid*> deattached;
+    for (int i = 0; i < count; i++) {
+        MailBox* mailbox = local.createMailBox();
+        if (i % 2) {
+            deattached.push_back(mailbox->self());
+            deattached.back()->addRef();
+            local.deattachMailBox(mailbox);
+            delete mailbox;
+        } else {
+            mailboxes.push_back(mailbox);
+        }
+    }
+
+    ErlTermPtr<> term(new ErlAtom("lookup"));
+    for (unsigned i = 0; i < deattached.size(); i++) {
+        // Ignored by the node
+        sender->send(deattached[i], term.get());
+        deattached[i]->release();
+    }
+    // A pid with the number of a live mailbox and other serial
+    // is not found
+    ErlPid* pid = mailboxes[0]->self();
+    ErlTermPtr<ErlPid> stale(new ErlPid(pid->node(), pid->id(),
+                                        (pid->serial() + 1) & 0x1fff, pid->creation()));
+    ErlTermPtr<> staleTerm(new ErlAtom("stale"));
+    sender->send(stale.get(), staleTerm.get());
+    for (unsigned i = 0; i < mailboxes.size(); i++) {
+        sender->send(mailboxes[i]->self(), term.get());
+        ErlTermPtr<> received(mailboxes[i]->receive(5000));
+        if (received.get() == 0) {
+            std::cout << "Message not received\n";
+            return false;
+        }
+        if (!received->equals(*term)) {
+            std::cout << "Wrong message " << received->toString() << "\n";
+            return false;
+        }
+    }
+
+    // The slots of removed mailboxes are reused, but not their pids
+    const int reused = 3000;
+    std::vector<ErlTermPtr<ErlPid> > old;
+    for (int i = 0; i < reused; i++) {
+        MailBox* mailbox = local.createMailBox();
+        old.push_back(mailbox->self());
+        local.deattachMailBox(mailbox);
+        delete mailbox;
+    }
+    std::vector<MailBox*> fresh;
+    std::set<std::string> pids;
+    for (int i = 0; i < reused; i++) {
+        fresh.push_back(local.createMailBox());
+        pids.insert(fresh.back()->self()->toString());
+    }
+    for (int i = 0; i < reused; i++) {
+        pids.insert(old[i]->toString());
+        sender->send(old[i].get(), staleTerm.get());
+    }
+    if (pids.size() != 2 * reused) {
+        std::cout << "Pids given twice\n";
+        return false;
+    }
+    for (int i = 0; i < reused; i++) {
+        sender->send(fresh[i]->self(), term.get());
+        ErlTermPtr<> received(fresh[i]->receive(5000));
+        if (received.get() == 0 || !received->equals(*term)) {
+            std::cout << "Old pid reached a new mailbox\n";
+            return false;
+        }
+        local.deattachMailBox(fresh[i]);
+        delete fresh[i];
+    }
+    std::cout << "Lookup ok\n";
+    return true;
+}
+
+// Messages reach the registered names until the mailbox is unregistered
+bool test_names(AutoNode &local)
+        throw (EpiException)
+{
+    const int count = 200;
+    MailBox* sender = local.createMailBox();
+    MailBox* mailboxes[2] = { local.createMailBox(), local.createMailBox() };
+    std::vector<std::string> names;
+    for (int i = 0; i < count; i++) {
+        std::ostringstream name;
+        name << "name" << i;
+        names.push_back(name.str());
+        local.registerMailBox(name.str(), mailboxes[i % 2]);
+    }
+
+    ErlTermPtr<> term(new ErlAtom("names"));
+    for (int i = 0; i < count; i++) {
+        sender->send(names[i], term.get());
+        ErlTermPtr<> received(mailboxes[i % 2]->receive(5000));
+        if (received.get() == 0) {
+            std::cout << "Message to " << names[i] << " not received\n";
+            return false;
+        }
+    }
+
+    local.unRegisterMailBox(mailboxes[0]);
+    for (int i = 0; i < count; i++) {
+        sender->send(names[i], term.get());
+    }
+    for (int i = 1; i < count; i += 2) {
+        ErlTermPtr<> received(mailboxes[1]->receive(5000));
+        if (received.get() == 0) {
+            std::cout << "Message to " << names[i] << " not received\n";
+            return false;
+        }
+    }
+    ErlTermPtr<> received(mailboxes[0]->receive(100));
+    if (received.get() != 0) {
+        std::cout << "Message received by an unregistered mailbox\n";
+        return false;
+    }
+    local.unRegisterMailBox(mailboxes[1]);
+    std::cout << "Registered names ok\n";
+    return true;
+}
+
+// Forward {seq, N} messages to a collector as {Index, N}
+class ForwardCommand: public MatchingCommand {
+public:
+    ForwardCommand(MailBox *mailbox, ErlPid *collector, int index):
+            mMailBox(mailbox), mCollector(collector), mIndex(index) {}
+
+    void execute(ErlTerm* term, VariableBinding *binding)
+            throw (EpiException)
+    {
+        ErlTermPtr<> reply(new ErlTuple(new ErlLong(mIndex),
+                                        binding->search("N")));
+        mMailBox->send(mCollector, reply.get());
+    }
+
+private:
+    MailBox *mMailBox;
+    ErlPid *mCollector;
+    int mIndex;
+};
+
+// Handler that throws on {seq, fail}, and gives the other messages
+// to another handler
+class FailingGuard: public MailBoxGuard {
+public:
+    FailingGuard(MailBoxGuard *guard):
+            mGuard(guard), mFail(ErlTerm::format("{seq, fail}")) {}
+    ~FailingGuard() {
+        delete mGuard;
+    }
+    bool check(void *elem) {
+        EpiMessage *msg = (EpiMessage *) elem;
+        if (msg->instanceOf(ERL_MSG_ERLANG) &&
+            ((ErlangMessage *) msg)->getMsg()->equals(*mFail.get()))
+        {
+            throw std::runtime_error("Handler failed");
+        }
+        return mGuard->check(elem);
+    }
+    bool match(ErlangMessage *msg) throw (EpiException) {
+        return mGuard->match(msg);
+    }
+private:
+    MailBoxGuard *mGuard;
+    ErlTermPtr<> mFail;
+};
+
+// Mailboxes attached to an executor handle their messages in order,
+// also after a handler throws
+bool test_executor(AutoNode &local)
+        throw (EpiException)
+{
+    const int count = 50;
+    const int messages = 20;
+    MailBoxExecutor executor(4, 3);
+    MailBox* sender = local.createMailBox();
+    MailBox* collector = local.createMailBox();
+
+    std::vector<MailBox*> mailboxes;
+    std::vector<MailBoxGuard*> handlers;
+    for (int i = 0; i < count; i++) {
+        MailBox* mailbox = local.createMailBox();
+        MailBoxGuard* handler = new FailingGuard(new MatchingCommandGuard(
+                ErlTerm::format("{seq, N}"),
+                new ForwardCommand(mailbox, collector->self(), i)));
+        executor.attach(mailbox, handler);
+        mailboxes.push_back(mailbox);
+        handlers.push_back(handler);
+    }
+
+    ErlTermPtr<> failing(ErlTerm::format("{seq, fail}"));
+    for (int i = 0; i < count; i++) {
+        sender->send(mailboxes[i]->self(), failing.get());
+    }
+    for (int n = 0; n < messages; n++) {
+        for (int i = 0; i < count; i++) {
+            ErlTermPtr<> term(new ErlTuple(new ErlAtom("seq"), new ErlLong(n)));
+            sender->send(mailboxes[i]->self(), term.get());
+        }
+    }
+
+    std::vector<int> next(count, 0);
+    for (int received = 0; received < count * messages; received++) {
+        ErlTermPtr<> reply(collector->receive(5000));
+        VariableBinding binding;
+        ErlTermPtr<> pattern(ErlTerm::format("{I, N}"));
+        if (reply.get() == 0 || !reply->match(pattern.get(), &binding)) {
+            std::cout << "Missing reply " << received << "\n";
+            return false;
+        }
+        int i = ((ErlLong *) binding.search("I"))->longValue();
+        int n = ((ErlLong *) binding.search("N"))->longValue();
+        if (n != next[i]++) {
+            std::cout << "Reply out of order from " << i << "\n";
+            return false;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        executor.detach(mailboxes[i]);
+        local.deattachMailBox(mailboxes[i]);
+        delete mailboxes[i];
+        delete handlers[i];
+    }
+    std::cout << "Executor ok\n";
+    return true;
+}
+
+// Tell ready after a receive timeout, then reply {pong, N} to
+// {ping, From, N} until stop
+class EchoProcess: public ProcessFunction {
+public:
+    EchoProcess(ErlPid *collector): mCollector(collector) {}
+
+    void run(Process *self) throw (EpiException) {
+        ErlTermPtr<> nothing(self->receive(10));
+        if (nothing.get() != 0) {
+            return;
+        }
+        ErlTermPtr<> ready(new ErlAtom("ready"));
+        self->mailbox()->send(mCollector.get(), ready.get());
+
+        ErlTermPtr<> pattern(ErlTerm::format("{ping, From, N}"));
+        for (;;) {
+            VariableBinding binding;
+            ErlTermPtr<> term(self->receive());
+            if (!term->match(pattern.get(), &binding)) {
+                return;
+            }
+            ErlTermPtr<> reply(new ErlTuple(new ErlAtom("pong"),
+                                            binding.search("N")));
+            self->mailbox()->send((ErlPid *) binding.search("From"),
+                                  reply.get());
+            self->yield();
+        }
+    }
+
+private:
+    ErlTermPtr<ErlPid> mCollector;
+};
+
+// Many processes share a few threads, blocking in receive
+bool test_processes(AutoNode &local)
+        throw (EpiException)
+{
+    const int count = 1000;
+    const int messages = 5;
+    ProcessScheduler scheduler(&local, 4, 32 * 1024);
+    MailBox* collector = local.createMailBox();
+
+    std::vector<ErlTermPtr<ErlPid> > pids;
+    for (int i = 0; i < count; i++) {
+        pids.push_back(ErlTermPtr<ErlPid>(scheduler.spawn(new EchoProcess(collector->self()))));
+    }
+    if (scheduler.count() != count) {
+        std::cout << "Processes ended too early\n";
+        return false;
+    }
+
+    for (int ready = 0; ready < count; ready++) {
+        ErlTermPtr<> reply(collector->receive(5000));
+        if (reply.get() == 0) {
+            std::cout << "Missing ready " << ready << "\n";
+            return false;
+        }
+    }
+
+    for (int n = 0; n < messages; n++) {
+        for (int i = 0; i < count; i++) {
+            ErlTermPtr<> term(new ErlTuple(new ErlAtom("ping"),
+                                           collector->self(), new ErlLong(n)));
+            collector->send(pids[i].get(), term.get());
+        }
+    }
+
+    for (int received = 0; received < count * messages; received++) {
+        ErlTermPtr<> reply(collector->receive(5000));
+        if (reply.get() == 0) {
+            std::cout << "Missing pong " << received << "\n";
+            return false;
+        }
+    }
+
+    ErlTermPtr<> stop(new ErlAtom("stop"));
+    for (int i = 0; i < count; i++) {
+        collector->send(pids[i].get(), stop.get());
+    }
+    for (int wait = 0; scheduler.count() > 0 && wait < 500; wait++) {
+        collector->receive(10);
+    }
+    if (scheduler.count() != 0) {
+        std::cout << scheduler.count() << " processes did not end\n";
+        return false;
+    }
+
+    local.deattachMailBox(collector);
+    delete collector;
+    std::cout << "Processes ok\n";
+    return true;
+}
+
+// Keep the result of an asyncReceive or an asyncRPC
+class AsyncResult: public ReceiveCallback, public RPCCallback {
+public:
+    AsyncResult(): mCalls(0), mFailed(false) {}
+
+    void received(ErlangMessage *msg) {
+        std::auto_ptr<ErlangMessage> message(msg);
+        mTerm.reset(msg? msg->getMsg(): 0);
+        epi::util::atomicFetchAdd(&mCalls, 1);
+    }
+
+    void replied(ErlTerm *response) {
+        mTerm.reset(response);
+        epi::util::atomicFetchAdd(&mCalls, 1);
+    }
+
+    void failed(EpiConnectionException &error) {
+        mFailed = true;
+        epi::util::atomicFetchAdd(&mCalls, 1);
+    }
+
+    void failed(EpiException &error) {
+        mFailed = true;
+        epi::util::atomicFetchAdd(&mCalls, 1);
+    }
+
+    // Wait up to 5 seconds for the callback
+    long wait(MailBox *idle) {
+        for (int i = 0; epi::util::atomicLoad(&mCalls) == 0 && i < 500; i++) {
+            idle->receive(10);
+        }
+        return epi::util::atomicLoad(&mCalls);
+    }
+
+    long volatile mCalls;
+    bool mFailed;
+    ErlTermPtr<> mTerm;
+};
+
+// Receives and RPCs that don't block the caller
+bool test_async(AutoNode &local, AutoNode &remote)
+        throw (EpiException)
+{
+    MailBox* client = local.createMailBox();
+    MailBox* idle = local.createMailBox();
+    ErlTermPtr<> pattern(ErlTerm::format("{async, X}"));
+
+    // The message is already in the mailbox
+    AsyncResult now;
+    ErlTermPtr<> first(ErlTerm::format("{async, 1}"));
+    client->send(client->self(), first.get());
+    client->asyncReceive(pattern.get(), &now);
+    if (now.mCalls != 1 || !first->equals(*now.mTerm.get())) {
+        std::cout << "Queued message not received\n";
+        return false;
+    }
+
+    // Other messages stay in the mailbox
+    AsyncResult later;
+    client->asyncReceive(pattern.get(), &later, 5000);
+    ErlTermPtr<> other(new ErlAtom("other"));
+    ErlTermPtr<> second(ErlTerm::format("{async, 2}"));
+    client->send(client->self(), other.get());
+    client->send(client->self(), second.get());
+    if (later.wait(idle) != 1 || !second->equals(*later.mTerm.get())) {
+        std::cout << "Delivered message not received\n";
+        return false;
+    }
+    ErlTermPtr<> left(client->receive(1000));
+    if (left.get() == 0 || !other->equals(*left.get())) {
+        std::cout << "Unmatched message lost\n";
+        return false;
+    }
+
+    AsyncResult timeout;
+    client->asyncReceive(pattern.get(), &timeout, 20);
+    if (timeout.wait(idle) != 1 || timeout.mTerm.get() != 0) {
+        std::cout << "Receive did not time out\n";
+        return false;
+    }
+
+    AsyncResult cancelled;
+    client->asyncReceive(pattern.get(), &cancelled);
+    if (!client->cancelReceive(&cancelled)) {
+        std::cout << "Receive not cancelled\n";
+        return false;
+    }
+    client->send(client->self(), first.get());
+    ErlTermPtr<> kept(client->receive(pattern.get(), 1000));
+    if (kept.get() == 0 || cancelled.mCalls != 0) {
+        std::cout << "Cancelled receive got the message\n";
+        return false;
+    }
+
+    // A fake rex server in the remote node
+    MailBox* rex = remote.createMailBox();
+    remote.registerMailBox("rex", rex);
+    ErlTermPtr<ErlList> args(new ErlEmptyList());
+    const char *replies[] = {"{rex, remote}", "{rex, {badrpc, nofun}}"};
+    for (int i = 0; i < 2; i++) {
+        AsyncResult rpc;
+        client->asyncRPC(remote.getNodeName(), "erlang", "node",
+                         args.get(), &rpc, 5000);
+        ErlTermPtr<ErlTuple> request((ErlTuple *) rex->receive(5000));
+        if (request.get() == 0) {
+            std::cout << "RPC request not received\n";
+            return false;
+        }
+        ErlTermPtr<> reply(ErlTerm::format(replies[i]));
+        rex->send((ErlPid *) request->elementAt(0), reply.get());
+        if (rpc.wait(idle) != 1 || rpc.mFailed != (i == 1)) {
+            std::cout << "Wrong RPC result " << i << "\n";
+            return false;
+        }
+    }
+
+    remote.unRegisterMailBox("rex");
+    remote.deattachMailBox(rex);
+    delete rex;
+    local.deattachMailBox(client);
+    delete client;
+    local.deattachMailBox(idle);
+    delete idle;
+    std::cout << "Async receive ok\n";
+    return true;
+}
+
+// Timers of sendAfter, in order and never early
+bool test_timers(AutoNode &local)
+        throw (EpiException)
+{
+    MailBox* mailbox = local.createMailBox();
+    ErlPid* self = mailbox->self();
+
+    const long delays[] = {300, 20, 100, 50};
+    for (int i = 0; i < 4; i++) {
+        ErlTermPtr<> term(new ErlLong(delays[i]));
+        unsigned long timer = mailbox->sendAfter(self, term.get(), delays[i]);
+        if (delays[i] == 50 && !mailbox->cancelTimer(timer)) {
+            std::cout << "Timer not cancelled\n";
+            return false;
+        }
+    }
+    const long expected[] = {20, 100, 300};
+    for (int i = 0; i < 3; i++) {
+        ErlTermPtr<ErlLong> term((ErlLong *) mailbox->receive(5000));
+        if (term.get() == 0 || term->longValue() != expected[i]) {
+            std::cout << "Timer " << expected[i] << " out of order\n";
+            return false;
+        }
+    }
+
+    // Many timers, some in the upper levels of the wheel
+    const int count = 20000;
+    for (int i = 0; i < count; i++) {
+        long delay = (i * 7919) % 1000;
+        long long deadline = TimerService::currentTime() + delay;
+        ErlTermPtr<> term(new ErlLong(deadline));
+        mailbox->sendAfter(self, term.get(), delay);
+    }
+    for (int i = 0; i < count; i++) {
+        ErlTermPtr<ErlLong> term((ErlLong *) mailbox->receive(5000));
+        if (term.get() == 0) {
+            std::cout << "Missing timer " << i << "\n";
+            return false;
+        }
+        if (term->longValue() > TimerService::currentTime()) {
+            std::cout << "Timer expired early\n";
+            return false;
+        }
+    }
+    if (local.getTimerService()->count() != 0) {
+        std::cout << "Timers left\n";
+        return false;
+    }
+
+    // A timer after an idle period, and one past the next cascade
+    if (mailbox->receive(600) != 0) {
+        std::cout << "Unexpected message\n";
+        return false;
+    }
+    long long start = TimerService::currentTime();
+    ErlTermPtr<> idle(new ErlAtom("idle"));
+    mailbox->sendAfter(self, idle.get(), 10);
+    mailbox->sendAfter(self, idle.get(), 300);
+    for (int i = 0; i < 2; i++) {
+        ErlTermPtr<> term(mailbox->receive(5000));
+        if (term.get() == 0) {
+            std::cout << "Missing timer after idle\n";
+            return false;
+        }
+    }
+    if (TimerService::currentTime() - start > 400) {
+        std::cout << "Timer after idle late\n";
+        return false;
+    }
+
+    // Mailboxes deleted while their timers expire wait for them
+    ErlTermPtr<> dropped(new ErlAtom("dropped"));
+    for (int i = 0; i < 200; i++) {
+        MailBox* sender = local.createMailBox();
+        for (int j = 0; j < 20; j++) {
+            sender->sendAfter(sender->self(), dropped.get(), j % 2);
+        }
+        local.deattachMailBox(sender);
+        delete sender;
+    }
+    if (local.getTimerService()->count() != 0) {
+        std::cout << "Timers of deleted mailboxes left\n";
+        return false;
+    }
+
+    local.deattachMailBox(mailbox);
+    delete mailbox;
+    std::cout << "Timers ok\n";
+    return true;
+}
+
+// A multicast reaches the mailboxes in both nodes
+bool test_multicast(AutoNode &local, AutoNode &remote)
+        throw (EpiException)
+{
+    MailBox* client = local.createMailBox();
+    std::vector<MailBox*> mailboxes;
+    std::vector<ErlPid*> pids;
+    for (int i=0; i<6; i++) {
+        MailBox *mailbox = (i % 2 ? remote : local).createMailBox();
+        mailboxes.push_back(mailbox);
+        pids.push_back(mailbox->self());
+    }
+
+    ErlTermPtr<> term(ErlTerm::format("{multicast, [1, 2, 3]}"));
+    client->multicast(pids, term.get());
+
+    for (unsigned i=0; i<mailboxes.size(); i++) {
+        ErlTermPtr<> received(mailboxes[i]->receive(5000));
+        if (received.get() == 0 || !term->equals(*received.get())) {
+            std::cout << "Mailbox " << i << " did not get the message\n";
+            return false;
+        }
+    }
+    std::cout << "Got multicast in " << mailboxes.size() << " mailboxes\n";
+    return true;
+}
+
+// A term with an unbound variable is refused by send, also when the
+// node is not connected yet and the message would be queued
+bool test_unbound(AutoNode &local)
+        throw (EpiException)
+{
+    AutoNode other(UNBOUNDNODE);
+    other.startAcceptor();
+    MailBox* sender = local.createMailBox();
+    MailBox* receiver = other.createMailBox();
+    ErlTermPtr<> term(ErlTerm::format("{x, Unbound}"));
+    try {
+        sender->send(receiver->self(), term.get());
+        std::cout << "A term with an unbound variable was sent\n";
+        return false;
+    } catch (EpiInvalidTerm &e) {
+    }
+    // The node can still be reached
+    ErlTermPtr<> bound(ErlTerm::format("{x, 1}"));
+    sender->send(receiver->self(), bound.get());
+    ErlTermPtr<> received(receiver->receive(5000));
+    if (received.get() == 0 || !bound->equals(*received.get())) {
+        std::cout << "The bound term was not received\n";
+        return false;
+    }
+    std::cout << "Unbound variable refused\n";
+    return true;
+}
+
+// A node that does not exist can not be reached. The send does not
+// fail (the connection is set up in background), but the next receive
+// of the sender and ping do.
+bool test_refused(AutoNode &local)
+        throw (EpiException)
+{
+    MailBox* mailbox = local.createMailBox();
+    ErlTermPtr<> term(new ErlAtom("hello"));
+    try {
+        mailbox->send("nobody@localhost", "reply_server", term.get());
+    } catch (EpiConnectionException &e) {
+        std::cout << "Send to an unknown node failed: " << e.getMessage() << "\n";
+        return false;
+    }
+    try {
+        ErlTermPtr<> received(mailbox->receive(5000));
+        std::cout << "The failed send was not reported\n";
+        return false;
+    } catch (EpiConnectionException &e) {
+    }
+    if (local.ping("nobody@localhost", 500)) {
+        std::cout << "Ping to an unknown node did not fail\n";
+        return false;
+    }
+    std::cout << "Refused\n";
+    return true;
+}
+
+// Test code
+int main(int argc, char **argv) {
+
+    if (argc > 1 && argv[1][0] == '1') {
+	    Debug( dc::notice.on() );
+	    Debug( dc::connect.on() );
+	    Debug( libcw_do.on() );
+    }
+
+    try {
+        AutoNode local(LOCALNODE);
+        AutoNode remote(REMOTENODE);
+        local.startAcceptor();
+        remote.startAcceptor();
+
+        std::cout << "Testing reply server" << std::endl;
+        if (!test_reply_server(local, remote)) exit(1);
+        std::cout << "Testing flush with replies" << std::endl;
+        if (!test_flush_reply()) exit(1);
+        std::cout << "Testing throwing receiver" << std::endl;
+        if (!test_throwing_receiver()) exit(1);
+        std::cout << "Testing capture replay" << std::endl;
+        if (!test_replay(local, remote)) exit(1);
+        std::cout << "Testing local delivery" << std::endl;
+        if (!test_local(local)) exit(1);
+        std::cout << "Testing refs" << std::endl;
+        if (!test_refs(local, remote)) exit(1);
+        std::cout << "Testing mailbox lookup" << std::endl;
+        if (!test_lookup(local)) exit(1);
+        std::cout << "Testing registered names" << std::endl;
+        if (!test_names(local)) exit(1);
+        std::cout << "Testing executor" << std::endl;
+        if (!test_executor(local)) exit(1);
+        std::cout << "Testing processes" << std::endl;
+        if (!test_processes(local)) exit(1);
+        std::cout << "Testing async receive" << std::endl;
+        if (!test_async(local, remote)) exit(1);
+        std::cout << "Testing timers" << std::endl;
+        if (!test_timers(local)) exit(1);
+        std::cout << "Testing multicast" << std::endl;
+        if (!test_multicast(local, remote)) exit(1);
+        std::cout << "Testing decode pool" << std::endl;
+        if (!test_decode_pool(local)) exit(1);
+        std::cout << "Testing burst to a new node" << std::endl;
+        if (!test_burst(local)) exit(1);
+        std::cout << "Testing crossed bursts" << std::endl;
+        if (!test_crossed_burst(local)) exit(1);
+        std::cout << "Testing unbound variables" << std::endl;
+        if (!test_unbound(local)) exit(1);
+        std::cout << "Testing connection refused" << std::endl;
+        if (!test_refused(local)) exit(1);
+
+    } catch (EpiException &e) {
+        std::cout << "Catched exception: " << e.getMessage() << "\n";
+        exit(1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,381 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include <epi.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <vector>
+
+using namespace epi::error;
+using namespace epi::type;
+using namespace epi::node;
+using namespace epi::util;
+
+std::string LOCALNODE = "inproc:local@localhost";
+std::string REMOTENODE = "inproc:remote@localhost";
+
+// Recorded values fall in buckets of their order of magnitude
+bool test_histogram()
+{
+    LatencyHistogram histogram;
+    if (histogram.count() != 0 || histogram.percentile(50) != 0) {
+        std::cout << "Histogram not empty\n";
+        return false;
+    }
+    const int count = 1000;
+    for (int i=1; i<=count; i++) {
+        histogram.record(i * 1000);
+    }
+    histogram.record(-1);
+    if (histogram.count() != count + 1) {
+        std::cout << "Recorded " << histogram.count() << " values\n";
+        return false;
+    }
+    // A value is known with an error below 12.5%
+    long long p50 = histogram.percentile(50);
+    if (p50 < 500000 || p50 > 500000 * 9 / 8 ||
+        histogram.max() < count * 1000 || histogram.max() > count * 1000 * 9 / 8)
+    {
+        std::cout << "Wrong p50 " << p50 << " or max " << histogram.max() << "\n";
+        return false;
+    }
+    long long values[] = { 0, 1, 7, 8, 9, 1000, 123456789, 1LL << 39 };
+    for (unsigned i=0; i<sizeof(values)/sizeof(values[0]); i++) {
+        int bucket = LatencyHistogram::bucketOf(values[i]);
+        if (values[i] < LatencyHistogram::lowerBound(bucket) ||
+            values[i] > LatencyHistogram::upperBound(bucket))
+        {
+            std::cout << "Value " << values[i] << " out of its bucket\n";
+            return false;
+        }
+    }
+    LatencyHistogram total;
+    total.add(histogram);
+    total.add(histogram);
+    if (total.count() != 2 * histogram.count() ||
+        total.percentile(50) != histogram.percentile(50))
+    {
+        std::cout << "Wrong added histogram\n";
+        return false;
+    }
+    total.reset();
+    if (total.count() != 0 || total.max() != 0) {
+        std::cout << "Histogram not reset\n";
+        return false;
+    }
+    std::cout << "Histogram p50 " << p50 << " ns\n";
+    return true;
+}
+
+// The stages of the messages are timed in the connections and mailboxes
+bool test_latency(AutoNode &local, AutoNode &remote)
+        throw (EpiException)
+{
+    MailBox* server = remote.createMailBox();
+    server->useOwnLatencyStats();
+    remote.registerMailBox("latency_server", server);
+    MailBox* client = local.createMailBox();
+    MailBox* other = local.createMailBox();
+    // Other mailboxes share the histograms of their node
+    if (client->getLatencyStats() == 0 ||
+        client->getLatencyStats() != other->getLatencyStats())
+    {
+        std::cout << "Mailboxes do not share the histograms\n";
+        return false;
+    }
+    local.deattachMailBox(other);
+    delete other;
+
+    const int count = 50;
+    for (int i=0; i<count; i++) {
+        ErlTermPtr<> term(new ErlTuple(new ErlAtom("ping"), new ErlLong(i)));
+        client->send(remote.getNodeName(), "latency_server", term.get());
+    }
+    ErlTermPtr<> pattern(ErlTerm::format("{ping, _}"));
+    for (int i=0; i<count; i++) {
+        ErlTermPtr<> term(server->receive(pattern.get(), 5000));
+        if (term.get() == 0) {
+            std::cout << "Message " << i << " lost\n";
+            return false;
+        }
+    }
+
+    LatencyStats sent, received, node;
+    if (!local.getLatencyStats(remote.getNodeName(), sent) ||
+        !remote.getLatencyStats(local.getNodeName(), received))
+    {
+        std::cout << "No stats for the connection\n";
+        return false;
+    }
+    remote.getLatencyStats(node);
+    LatencyStats &mailbox = *server->getLatencyStats();
+    if (sent.stage(LATENCY_ENCODE).count() < count ||
+        received.stage(LATENCY_DECODE).count() < count ||
+        mailbox.stage(LATENCY_QUEUE_WAIT).count() != count ||
+        mailbox.stage(LATENCY_GUARD).count() < count ||
+        node.stage(LATENCY_QUEUE_WAIT).count() < count)
+    {
+        std::cout << "Missing latencies\n";
+        return false;
+    }
+    const LatencyHistogram &wait = mailbox.stage(LATENCY_QUEUE_WAIT);
+    if (wait.percentile(50) > wait.percentile(99) ||
+        wait.percentile(99) > wait.max())
+    {
+        std::cout << "Wrong percentiles\n";
+        return false;
+    }
+    std::cout << "Queue wait p50 " << wait.percentile(50) << " ns, p99 " <<
+            wait.percentile(99) << " ns\n";
+    return true;
+}
+
+// Traced events are dumped to a file
+bool test_trace(AutoNode &local, AutoNode &remote)
+        throw (EpiException)
+{
+    MailBox* server = remote.createMailBox();
+    MailBox* client = local.createMailBox();
+
+    const int count = 20;
+    Trace::clear();
+    Trace::enable(TRACE_MAILBOX | TRACE_CODEC);
+    for (int i=0; i<=count; i++) {
+        if (i == count) {
+            // Not traced
+            Trace::disable(TRACE_ALL);
+        }
+        ErlTermPtr<> term(new ErlLong(i));
+        client->send(server->self(), term.get());
+        ErlTermPtr<> received(server->receive(5000));
+        if (received.get() == 0) {
+            std::cout << "Message " << i << " lost\n";
+            return false;
+        }
+    }
+
+    const char *file = "inproc_trace.bin";
+    if (Trace::dump(file) < 0) {
+        std::cout << "Could not dump the trace\n";
+        return false;
+    }
+    std::ifstream in(file, std::ios::in | std::ios::binary);
+    TraceFileHeader header;
+    in.read((char *) &header, sizeof(header));
+    for (unsigned i=0; in && i<header.names; i++) {
+        unsigned entry[2];
+        in.read((char *) entry, sizeof(entry));
+        in.ignore(entry[1]);
+    }
+    int delivered = 0, received = 0, decoded = 0;
+    TraceEvent event;
+    for (unsigned i=0; i<header.events && in.read((char *) &event, sizeof(event)); i++) {
+        if (event.to != server->self()->key()) {
+            continue;
+        }
+        switch (event.type) {
+        case TRACE_DELIVER: delivered++; break;
+        case TRACE_RECEIVE: received++; break;
+        case TRACE_DECODE: decoded++; break;
+        }
+    }
+    in.close();
+    remove(file);
+    if (delivered != count || received != count || decoded != count) {
+        std::cout << "Traced " << delivered << " delivered, " << received <<
+                " received and " << decoded << " decoded messages\n";
+        return false;
+    }
+    std::cout << "Traced " << header.events << " events\n";
+    return true;
+}
+
+// The queued bytes of a mailbox are counted while byte accounting is on
+bool test_memory(AutoNode &local, AutoNode &remote)
+        throw (EpiException)
+{
+    MailBox* sender = remote.createMailBox();
+    MailBox* receiver = local.createMailBox();
+    MailBox* idle = local.createMailBox();
+
+    const int count = 10;
+    MailBox::setByteAccounting(true);
+    for (int i=0; i<count; i++) {
+        ErlTermPtr<> term(ErlTerm::format("{memory, ~i, \"some text\"}", i));
+        sender->send(receiver->self(), term.get());
+    }
+    // Wait for the messages from the remote node
+    for (int i=0; i<500 && receiver->queuedMessages() < count; i++) {
+        idle->receive(10);
+    }
+    MailBox::setByteAccounting(false);
+
+    std::vector<MailBoxMemory> stats;
+    local.getMailBoxMemory(stats);
+    long bytes = -1;
+    for (unsigned i=0; i<stats.size(); i++) {
+        if (stats[i].pid->equals(*receiver->self())) {
+            if (stats[i].messages != count) {
+                std::cout << "Wrong queued messages " << stats[i].messages << "\n";
+                return false;
+            }
+            bytes = stats[i].bytes;
+        }
+    }
+    if (bytes <= 0 || bytes != receiver->queuedBytes()) {
+        std::cout << "Wrong queued bytes " << bytes << "\n";
+        return false;
+    }
+    for (int i=0; i<count; i++) {
+        ErlTermPtr<> received(receiver->receive(5000));
+        if (received.get() == 0) {
+            std::cout << "Message " << i << " lost\n";
+            return false;
+        }
+    }
+    if (receiver->queuedBytes() != 0) {
+        std::cout << "Bytes left " << receiver->queuedBytes() << "\n";
+        return false;
+    }
+    std::cout << "Queued " << bytes << " bytes in " << count << " messages\n";
+    return true;
+}
+
+// The statistics server answers both request forms
+bool test_stats(AutoNode &local, AutoNode &remote)
+        throw (EpiException)
+{
+    remote.startStatsServer();
+    MailBox* client = local.createMailBox();
+
+    ErlTermPtr<> request(ErlTerm::format("{~w, stats}", client->self()));
+    client->send(remote.getNodeName(), "epi_stats", request.get());
+    ErlTermPtr<> received(client->receive(5000));
+    if (received.get() == 0) {
+        std::cout << "No stats reply\n";
+        return false;
+    }
+    VariableBinding binding;
+    ErlTermPtr<> pattern(ErlTerm::format(
+            "{epi_stats, [{node, _}, {connections, [{count, Count}, {peers, Peers}]},"
+            " {mailboxes, _}, {rates, _}, {latency, _}, {memory, _}]}"));
+    if (!received->match(pattern.get(), &binding)) {
+        std::cout << "Wrong stats reply " << received->toString() << "\n";
+        return false;
+    }
+    ErlLong *count = (ErlLong *) binding.search("Count");
+    if (!count->instanceOf(ERL_LONG) || count->longValue() < 1 ||
+        binding.search("Peers")->instanceOf(ERL_EMPTY_LIST))
+    {
+        std::cout << "No connections " << received->toString() << "\n";
+        return false;
+    }
+
+    ErlTermPtr<ErlRef> tag(local.createRef());
+    request.reset(ErlTerm::format("{'$gen_call', {~w, ~w}, connections}",
+                                  client->self(), tag.get()));
+    client->send(remote.getNodeName(), "epi_stats", request.get());
+    received.reset(client->receive(5000));
+    ErlTermPtr<> reply(ErlTerm::format("{~w, [{count, _}, {peers, _}]}", tag.get()));
+    if (received.get() == 0 || !received->match(reply.get())) {
+        std::cout << "Wrong call reply\n";
+        return false;
+    }
+
+    request.reset(ErlTerm::format("{~w, unknown}", client->self()));
+    client->send(remote.getNodeName(), "epi_stats", request.get());
+    received.reset(client->receive(5000));
+    reply.reset(ErlTerm::format("{epi_stats, {error, unknown_request}}"));
+    if (received.get() == 0 || !received->match(reply.get())) {
+        std::cout << "Unknown request not refused\n";
+        return false;
+    }
+
+    // The totals of the rates do not go back between requests
+    long decoded = 0;
+    for (int i = 0; i < 2; i++) {
+        request.reset(ErlTerm::format("{~w, rates}", client->self()));
+        client->send(remote.getNodeName(), "epi_stats", request.get());
+        received.reset(client->receive(5000));
+        reply.reset(ErlTerm::format("{epi_stats, [{decode, _}, {encode, _},"
+                                    " {decoded, Decoded}, {encoded, _}, {time, _}]}"));
+        VariableBinding rates;
+        if (received.get() == 0 || !received->match(reply.get(), &rates) ||
+            ((ErlLong *) rates.search("Decoded"))->longValue() < decoded)
+        {
+            std::cout << "Wrong rates reply\n";
+            return false;
+        }
+        decoded = ((ErlLong *) rates.search("Decoded"))->longValue();
+    }
+
+    // Stopping waits for the requests being served
+    request.reset(ErlTerm::format("{~w, stats}", client->self()));
+    for (int i = 0; i < 20; i++) {
+        client->send(remote.getNodeName(), "epi_stats", request.get());
+    }
+    remote.stopStatsServer();
+    // Drop the replies sent before
+    do {
+        received.reset(client->receive(100));
+    } while (received.get() != 0);
+    std::cout << "Stats ok\n";
+    return true;
+}
+
+// Test code
+int main(int argc, char **argv) {
+
+    if (argc > 1 && argv[1][0] == '1') {
+	    Debug( dc::notice.on() );
+	    Debug( dc::connect.on() );
+	    Debug( libcw_do.on() );
+    }
+
+    try {
+        AutoNode local(LOCALNODE);
+        AutoNode remote(REMOTENODE);
+        local.startAcceptor();
+        remote.startAcceptor();
+
+        std::cout << "Testing histograms" << std::endl;
+        if (!test_histogram()) exit(1);
+        std::cout << "Testing latencies" << std::endl;
+        if (!test_latency(local, remote)) exit(1);
+        std::cout << "Testing trace" << std::endl;
+        if (!test_trace(local, remote)) exit(1);
+        std::cout << "Testing memory accounting" << std::endl;
+        if (!test_memory(local, remote)) exit(1);
+        std::cout << "Testing stats server" << std::endl;
+        if (!test_stats(local, remote)) exit(1);
+
+    } catch (EpiException &e) {
+        std::cout << "Catched exception: " << e.getMessage() << "\n";
+        exit(1);
+    }
+
+    return 0;
+}
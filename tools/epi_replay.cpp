@@ -0,0 +1,244 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp" // Main config file
+
+#include <epi.hpp>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+#include <cstdlib>
+#include <cstdio>
+
+using namespace epi::node;
+using namespace epi::ei;
+using namespace epi::util;
+
+/*
+ * Replay a capture written by epi::util::FrameCapture into a node,
+ * and print how the node took it: the frames delivered, their rate,
+ * the replies and the latencies of each stage.
+ *
+ * Usage: epi_replay [-s speed] [-d threads] [-n node] file
+ * speed is the speedup of the replay, 0 to replay as fast as the node
+ * takes the frames (default 1). threads are the decoding threads of
+ * the node (default 0). node is the name of the node, by default
+ * inproc:epi_replay@localhost, so no epmd or Erlang are needed.
+ *
+ * The frames of each captured peer are replayed by a connection of
+ * its own. Mailboxes with the names of the registered sends drop the
+ * messages, the messages sent to pids are decoded and dropped by the
+ * node.
+ */
+
+/*
+ * Take and drop the messages of a mailbox
+ */
+class Sink: public MailBoxGuard, public ReceiveCallback {
+public:
+    Sink(MailBox *mailbox): mMailBox(mailbox), mStopped(false) {
+        mMailBox->asyncReceive(this, this);
+    }
+
+    void stop() {
+        mStopped = true;
+        mMailBox->cancelReceive(this);
+    }
+
+    bool match(ErlangMessage *msg) throw (EpiException) {
+        return true;
+    }
+
+    void received(ErlangMessage *msg) {
+        // Drop the queued messages too, without nesting the callbacks
+        while (msg != 0) {
+            delete msg;
+            try {
+                msg = mMailBox->receiveMsg(0);
+            } catch (EpiConnectionException &) {
+                msg = 0;
+            }
+        }
+        if (!mStopped) {
+            mMailBox->asyncReceive(this, this);
+        }
+    }
+
+    void failed(EpiConnectionException &error) {
+        if (!mStopped) {
+            mMailBox->asyncReceive(this, this);
+        }
+    }
+
+private:
+    MailBox *mMailBox;
+    volatile bool mStopped;
+};
+
+int main(int argc, char **argv) {
+    double speed = 1;
+    int threads = 0;
+    std::string nodeName = "inproc:epi_replay@localhost";
+    std::string file;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-s" && i + 1 < argc) {
+            speed = atof(argv[++i]);
+        } else if (arg == "-d" && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (arg == "-n" && i + 1 < argc) {
+            nodeName = argv[++i];
+        } else if (file.empty() && arg[0] != '-') {
+            file = arg;
+        } else {
+            std::cerr << "Unknown argument " << arg << "\n";
+            return 1;
+        }
+    }
+    if (file.empty() || speed < 0) {
+        std::cerr << "Usage: epi_replay [-s speed] [-d threads] [-n node] file\n";
+        return 1;
+    }
+
+    // Find the peers and the registered names
+    std::set<std::string> peers;
+    std::set<std::string> names;
+    long frames = 0;
+    long messages = 0;
+    {
+        CaptureReader reader;
+        if (!reader.open(file)) {
+            std::cerr << file << " is not a capture file\n";
+            return 1;
+        }
+        CapturedFrame frame;
+        while (reader.next(frame)) {
+            peers.insert(frame.peer);
+            if (frame.msg.msgtype == ERL_REG_SEND) {
+                names.insert(frame.msg.toname);
+            }
+            if (frame.msg.msgtype == ERL_SEND ||
+                frame.msg.msgtype == ERL_REG_SEND)
+            {
+                messages++;
+            }
+            frames++;
+        }
+    }
+    std::cout << "# " << frames << " frames from " << peers.size() <<
+            " nodes to " << names.size() << " registered names\n";
+
+    std::vector<Sink *> sinks;
+    try {
+        std::auto_ptr<AutoNode> node(new AutoNode(nodeName));
+        node->setDecodeThreads(threads);
+
+        for (std::set<std::string>::const_iterator p = names.begin();
+             p != names.end(); ++p)
+        {
+            MailBox *mailbox = node->createMailBox();
+            node->registerMailBox(*p, mailbox);
+            sinks.push_back(new Sink(mailbox));
+        }
+
+        long long start = LatencyHistogram::now();
+        std::vector<ReplayConnection *> connections;
+        for (std::set<std::string>::const_iterator p = peers.begin();
+             p != peers.end(); ++p)
+        {
+            ReplayConnection *connection =
+                    new ReplayConnection(new PeerNode(*p), file, speed);
+            connections.push_back(connection);
+            node->attachConnection(connection);
+        }
+
+        // Wait for the replays
+        MailBox *idle = node->createMailBox();
+        for (unsigned i = 0; i < connections.size(); i++) {
+            while (!connections[i]->finished()) {
+                idle->receive(10);
+            }
+        }
+        // The decoding threads may still be delivering
+        for (long last = -1; ; ) {
+            LatencyStats stats;
+            node->getLatencyStats(stats);
+            long decoded = stats.stage(LATENCY_DECODE).count();
+            if (decoded >= messages || decoded == last) {
+                break;
+            }
+            last = decoded;
+            idle->receive(10);
+        }
+        long long elapsed = LatencyHistogram::now() - start;
+
+        long delivered = 0;
+        long skipped = 0;
+        long bytes = 0;
+        long replies = 0;
+        for (unsigned i = 0; i < connections.size(); i++) {
+            delivered += connections[i]->messagesIn();
+            skipped += connections[i]->skipped();
+            bytes += connections[i]->bytesIn();
+            replies += connections[i]->messagesOut();
+        }
+        for (unsigned i = 0; i < sinks.size(); i++) {
+            sinks[i]->stop();
+        }
+
+        char line[256];
+        sprintf(line, "frames %ld skipped %ld bytes %ld replies %ld in %.3f s, %.0f frames/s\n",
+                delivered, skipped, bytes, replies, elapsed / 1e9,
+                elapsed > 0 ? delivered / (elapsed / 1e9) : 0.0);
+        std::cout << line;
+
+        LatencyStats stats;
+        node->getLatencyStats(stats);
+        std::cout << "# stage\tcount\tp50_us\tp99_us\tmax_us\n";
+        for (int i = 0; i < LATENCY_STAGES; i++) {
+            const LatencyHistogram &histogram = stats.stage((LatencyStage) i);
+            sprintf(line, "%s\t%ld\t%.3f\t%.3f\t%.3f\n",
+                    LatencyStats::stageName((LatencyStage) i).c_str(),
+                    histogram.count(),
+                    histogram.percentile(50) / 1000.0,
+                    histogram.percentile(99) / 1000.0,
+                    histogram.max() / 1000.0);
+            std::cout << line;
+        }
+
+        // The node deletes the mailboxes and connections, the sinks
+        // can be deleted once it is gone
+        node.reset();
+    } catch (EpiException &e) {
+        std::cerr << "Error: " << e.getMessage() << "\n";
+        return 1;
+    }
+    for (unsigned i = 0; i < sinks.size(); i++) {
+        delete sinks[i];
+    }
+    return 0;
+}
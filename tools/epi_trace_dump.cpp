@@ -0,0 +1,158 @@
+/*
+***** BEGIN LICENSE BLOCK *****
+
+This file is part of the EPI (Erlang Plus Interface) Library.
+
+Copyright (C) 2005 Hector Rivas Gandara <keymon@gmail.com>
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+***** END LICENSE BLOCK *****
+*/
+
+#include "Config.hpp" // Main config file
+
+#include <epi.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <cstring>
+
+using namespace epi::util;
+
+/*
+ * Print a trace file written by epi::util::Trace::dump(), one event
+ * per line:
+ *   time_us thread seq event size duration_us from to message_type
+ * separated by tabs, after a header line starting with '#'. Times
+ * are relative to the first event, and pids are printed as
+ * <node.id.serial>, "-" if the event has no pid or message type.
+ *
+ * Usage: epi_trace_dump [-c categories] file
+ * categories are names separated by commas, as in EPI_TRACE.
+ */
+
+/** Layout of ErlPid::key(): node index:31 id:18 serial:13 creation:2 */
+static const int NODE_SHIFT = 33;
+static const int ID_SHIFT = 15;
+static const unsigned ID_MASK = 0x3ffff;
+static const int SERIAL_SHIFT = 2;
+static const unsigned SERIAL_MASK = 0x1fff;
+
+/** Names of epi::node::EpiMessageType */
+static const char *MESSAGE_TYPES[] = {
+    "error", "erlang", "send", "reg_send", "control", "unlink", "link", "exit"
+};
+
+static std::string pidName(unsigned long long key,
+                           std::map<unsigned, std::string> &names)
+{
+    if (key == 0) {
+        return "-";
+    }
+    std::ostringstream oss;
+    unsigned node = (unsigned) (key >> NODE_SHIFT);
+    std::map<unsigned, std::string>::const_iterator it = names.find(node);
+    oss << "<";
+    if (it != names.end()) {
+        oss << it->second;
+    } else {
+        oss << "#" << node;
+    }
+    oss << "." << ((key >> ID_SHIFT) & ID_MASK) << "." <<
+            ((key >> SERIAL_SHIFT) & SERIAL_MASK) << ">";
+    return oss.str();
+}
+
+int main(int argc, char **argv) {
+    unsigned categories = TRACE_ALL;
+    std::string file;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-c" && i + 1 < argc) {
+            categories = Trace::parseCategories(argv[++i]);
+        } else if (file.empty() && arg[0] != '-') {
+            file = arg;
+        } else {
+            std::cerr << "Unknown argument " << arg << "\n";
+            return 1;
+        }
+    }
+    if (file.empty()) {
+        std::cerr << "Usage: epi_trace_dump [-c categories] file\n";
+        return 1;
+    }
+
+    std::ifstream in(file.c_str(), std::ios::in | std::ios::binary);
+    TraceFileHeader header;
+    if (!in.read((char *) &header, sizeof(header)) ||
+        memcmp(header.magic, "EPITRACE", 8) != 0)
+    {
+        std::cerr << file << " is not a trace file\n";
+        return 1;
+    }
+    if (header.version != 1 || header.eventSize != sizeof(TraceEvent)) {
+        std::cerr << file << " has an unknown format\n";
+        return 1;
+    }
+
+    std::map<unsigned, std::string> names;
+    for (unsigned i = 0; i < header.names; i++) {
+        unsigned entry[2];
+        if (!in.read((char *) entry, sizeof(entry))) {
+            std::cerr << file << " is truncated\n";
+            return 1;
+        }
+        std::vector<char> name(entry[1]);
+        if (entry[1] > 0 && !in.read(&name[0], entry[1])) {
+            std::cerr << file << " is truncated\n";
+            return 1;
+        }
+        names[entry[0]] = std::string(name.begin(), name.end());
+    }
+
+    std::cout << "# time_us\tthread\tseq\tevent\tsize\tduration_us\tfrom\tto\tmessage_type\n";
+    long long first = 0;
+    TraceEvent event;
+    for (unsigned i = 0; i < header.events; i++) {
+        if (!in.read((char *) &event, sizeof(event))) {
+            std::cerr << file << " is truncated\n";
+            return 1;
+        }
+        if (i == 0) {
+            first = event.time;
+        }
+        if ((Trace::category(event.type) & categories) == 0) {
+            continue;
+        }
+        char times[64];
+        sprintf(times, "%.3f", (event.time - first) / 1000.0);
+        char duration[64];
+        sprintf(duration, "%.3f", event.duration / 1000.0);
+        std::cout << times << "\t" << event.thread << "\t" << event.seq <<
+                "\t" << Trace::eventName(event.type) << "\t" <<
+                event.size << "\t" << duration << "\t" <<
+                pidName(event.from, names) << "\t" <<
+                pidName(event.to, names) << "\t" <<
+                (event.type == TRACE_ENCODE || event.arg > ERL_MSG_EXIT ?
+                        "-" : MESSAGE_TYPES[event.arg]) << "\n";
+    }
+    return 0;
+}